@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 layout (location = 0) out vec4 gPosition; // RGB=WorldPos, A=Depth
 layout (location = 1) out vec4 gNormal;   // RGB=Normal, A=Emissive
 layout (location = 2) out vec4 gAlbedo;   // RGB=Albedo, A=Alpha
@@ -7,51 +7,130 @@ layout (location = 3) out vec4 gPBR;      // R=Metal, G=Rough, B=AO
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+in vec3 Tangent;
+in vec3 Bitangent;
+in float Deviation;
+in float Occlusion;
+
+// Feature bits, mirror GeometryFeature in src/geometryprograms.h. A bit is
+// set when the material has the texture and its UI toggle is on.
+#define FEATURE_BASE_COLOR_MAP 1
+#define FEATURE_METALLIC_MAP   2
+#define FEATURE_ROUGHNESS_MAP  4
+#define FEATURE_NORMAL_MAP     8
+#define FEATURE_DERIVATIVE_TBN 16 // Comparison path, not a material feature
+#define FEATURE_HEATMAP        32 // Compare mode, replaces the albedo
+#define FEATURE_OCCLUSION      64 // Baked per-vertex AO
+#define FEATURE_ALPHA_MASK     128 // alphaMode MASK
+
+// Variants get "#define FEATURES <mask>" injected after #version, so every
+// HAS_FEATURE() below is a constant and unused paths are compiled out. The
+// uber-shader (UBER_SHADER) keeps the runtime branches for comparison.
+#ifdef UBER_SHADER
+uniform int uFeatures;
+#define HAS_FEATURE(bit) ((uFeatures & (bit)) != 0)
+#else
+#ifndef FEATURES
+#define FEATURES 0
+#endif
+#define HAS_FEATURE(bit) ((FEATURES & (bit)) != 0)
+
+// Hidden fragments report no texture levels. Alpha-tested ones have to
+// run first, they may still be discarded.
+#if (FEATURES & FEATURE_ALPHA_MASK) == 0
+layout (early_fragment_tests) in;
+#endif
+#endif
 
 // Material Factors
 uniform vec4 uBaseColorFactor;
 uniform float uMetallicFactor;
 uniform float uRoughnessFactor;
+uniform float uAlphaCutoff;
 
-// Toggles (From UI)
-uniform bool uUseBaseColorMap;
-uniform bool uUseMetallicMap;
-uniform bool uUseRoughnessMap;
-uniform bool uUseNormalMap;
-
-// Texture Availability (From Model)
-uniform bool uHasBaseColorMap;
-uniform bool uHasMetallicRoughnessMap;
-uniform bool uHasNormalMap;
+// Deviation at which the heatmap saturates
+uniform float uHeatmapRange;
 
 // Samplers
 uniform sampler2D texture_baseColor;
 uniform sampler2D texture_metallicRoughness; // G=Roughness, B=Metal
 uniform sampler2D texture_normal;
 
-vec3 getNormalFromMap()
+// Texture streaming feedback, read back by Model::updateStreaming: the
+// finest source level each streamed texture is sampled at. Per draw, the
+// texture index of the base color, metallic-roughness and normal map (-1 =
+// not streamed) and log2 of their level 0 size. The binding mirrors
+// kStreamingFeedbackBinding in src/geometryprograms.h.
+layout (std430, binding = 5) buffer StreamingFeedback
 {
-    // If map disabled or missing, return geometry normal
-    if (!uUseNormalMap || !uHasNormalMap)
-        return normalize(Normal);
+    uint requiredLevel[];
+};
+uniform ivec3 uFeedbackTextures;
+uniform vec3 uFeedbackLog2Size;
 
-    vec3 tangentNormal = texture(texture_normal, TexCoords).xyz * 2.0 - 1.0;
+void writeFeedback()
+{
+    // log2 of the UV footprint of a pixel, as the hardware picks its level
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-20));
+    for (int i = 0; i < 3; i++) {
+        int index = uFeedbackTextures[i];
+        if (index < 0)
+            continue;
+        uint level = uint(max(lod + uFeedbackLog2Size[i], 0.0));
+        // Most fragments agree with what is there already: skip the atomic
+        if (level < requiredLevel[index])
+            atomicMin(requiredLevel[index], level);
+    }
+}
 
-    vec3 Q1  = dFdx(FragPos);
-    vec3 Q2  = dFdy(FragPos);
-    vec2 st1 = dFdx(TexCoords);
-    vec2 st2 = dFdy(TexCoords);
+// Blue below the reference surface, white on it, red above
+vec3 heatmapColor(float deviation)
+{
+    float t = clamp(deviation / max(uHeatmapRange, 1e-20), -1.0, 1.0);
+    return t < 0.0 ? mix(vec3(1.0), vec3(0.05, 0.2, 1.0), -t)
+                   : mix(vec3(1.0), vec3(1.0, 0.1, 0.05), t);
+}
+
+vec3 getNormalFromMap()
+{
+    if (!HAS_FEATURE(FEATURE_NORMAL_MAP))
+        return normalize(Normal);
 
-    vec3 N   = normalize(Normal);
-    vec3 T  = normalize(Q1*st2.t - Q2*st1.t);
-    vec3 B  = -normalize(cross(N, T));
-    mat3 TBN = mat3(T, B, N);
+    // Only XY is read: BC5 normal maps carry two channels, Z is rebuilt
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(texture_normal, TexCoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
+
+    mat3 TBN = mat3(Tangent, Bitangent, Normal);
+    if (HAS_FEATURE(FEATURE_DERIVATIVE_TBN)) {
+        vec3 Q1  = dFdx(FragPos);
+        vec3 Q2  = dFdy(FragPos);
+        vec2 st1 = dFdx(TexCoords);
+        vec2 st2 = dFdy(TexCoords);
+
+        vec3 N   = normalize(Normal);
+        vec3 T  = normalize(Q1*st2.t - Q2*st1.t);
+        vec3 B  = -normalize(cross(N, T));
+        TBN = mat3(T, B, N);
+    }
 
     return normalize(TBN * tangentNormal);
 }
 
 void main()
 {
+    // Before the alpha test, derivatives are undefined after a discard
+    writeFeedback();
+
+    // 0. Alpha test, before anything is written
+    vec4 albedo = uBaseColorFactor;
+    if (HAS_FEATURE(FEATURE_BASE_COLOR_MAP))
+        albedo *= texture(texture_baseColor, TexCoords);
+    if (HAS_FEATURE(FEATURE_ALPHA_MASK) && albedo.a < uAlphaCutoff)
+        discard;
+
     // 1. Position + Depth
     gPosition.rgb = FragPos;
     gPosition.a = gl_FragCoord.z;
@@ -60,27 +139,22 @@ void main()
     gNormal.rgb = getNormalFromMap();
     gNormal.a = 0.0; // Emissive placeholder
 
-    // 3. Albedo
-    vec4 albedo = uBaseColorFactor;
-    if (uUseBaseColorMap && uHasBaseColorMap) {
-        // Sample texture and multiply by factor
-        vec4 texColor = texture(texture_baseColor, TexCoords);
-        // Assuming texture is sRGB, convert to Linear if needed,
-        // but for now we treat as linear in deferred pass or handle in resolve.
-        // GLTF defines baseColor as sRGB.
-        // Simple approx gamma correction: pow(texColor.rgb, vec3(2.2))
-        albedo *= texColor;
-    }
+    // 3. Albedo, sampled above. GLTF defines baseColor as sRGB; for now
+    // it is treated as linear, as the lighting pass expects.
+    if (HAS_FEATURE(FEATURE_HEATMAP))
+        albedo = vec4(heatmapColor(Deviation), 1.0);
     gAlbedo = albedo;
 
     // 4. PBR
     float metallic = uMetallicFactor;
     float roughness = uRoughnessFactor;
 
-    if (uHasMetallicRoughnessMap) {
+    // GLTF Metallic-Roughness packing: G = Roughness, B = Metallic.
+    // Sampled once for both channels.
+    if (HAS_FEATURE(FEATURE_METALLIC_MAP | FEATURE_ROUGHNESS_MAP)) {
         vec4 mrSample = texture(texture_metallicRoughness, TexCoords);
-        if (uUseRoughnessMap) roughness *= mrSample.g;
-        if (uUseMetallicMap) metallic *= mrSample.b;
+        if (HAS_FEATURE(FEATURE_ROUGHNESS_MAP)) roughness *= mrSample.g;
+        if (HAS_FEATURE(FEATURE_METALLIC_MAP)) metallic *= mrSample.b;
     }
 
     // Safety: Clamp roughness to avoid perfect mathematical singularities
@@ -88,21 +162,6 @@ void main()
 
     gPBR.r = metallic;
     gPBR.g = roughness;
-
-    // GLTF Metallic-Roughness packing: G = Roughness, B = Metallic
-    if (uHasMetallicRoughnessMap) {
-        vec4 mrSample = texture(texture_metallicRoughness, TexCoords);
-
-        if (uUseRoughnessMap) {
-            roughness *= mrSample.g;
-        }
-        if (uUseMetallicMap) {
-            metallic *= mrSample.b;
-        }
-    }
-
-    gPBR.r = metallic;
-    gPBR.g = roughness;
-    gPBR.b = 1.0; // AO placeholder
+    gPBR.b = HAS_FEATURE(FEATURE_OCCLUSION) ? Occlusion : 1.0;
     gPBR.a = 0.0;
 }
@@ -2,21 +2,42 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aTangent; // XYZ + bitangent sign, MikkTSpace
+layout (location = 4) in float aDeviation; // Compare mode, signed distance
+layout (location = 5) in float aOcclusion; // Baked AO, 1 = unoccluded
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Mirrors struct FrameConstants in src/frameconstants.h
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 cameraPos;
+};
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out vec3 Tangent;
+out vec3 Bitangent;
+out float Deviation;
+out float Occlusion;
 
 void main()
 {
     vec4 worldPos = model * vec4(aPos, 1.0);
     FragPos = worldPos.xyz;
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = mat3(normalMatrix) * aNormal;
     TexCoords = aTexCoords;
 
-    gl_Position = projection * view * worldPos;
+    // Bitangent per vertex and no renormalization anywhere, as MikkTSpace
+    // expects; unused (and zero) without a normal map
+    Tangent = mat3(model) * aTangent.xyz;
+    Bitangent = aTangent.w * cross(Normal, Tangent);
+    Deviation = aDeviation;
+    Occlusion = aOcclusion;
+
+    gl_Position = viewProjection * worldPos;
 }
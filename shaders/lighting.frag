@@ -9,7 +9,16 @@ uniform sampler2D gAlbedo;
 uniform sampler2D gPBR;
 uniform sampler2D environmentMap;
 
-uniform vec3 viewPos;
+// Mirrors struct FrameConstants in src/frameconstants.h
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 cameraPos;
+};
 
 const float PI = 3.14159265359;
 const vec2 invAtan = vec2(0.1591, 0.3183);
@@ -61,7 +70,7 @@ void main()
     float Roughness = PBR.g;
     float AO = PBR.b;
 
-    vec3 V = normalize(viewPos - WorldPos);
+    vec3 V = normalize(cameraPos.xyz - WorldPos);
     vec3 R = reflect(-V, N);
 
     vec3 F0 = vec3(0.04);
@@ -0,0 +1,24 @@
+#version 330 core
+// Resolves the weighted blended OIT targets over the lit image in one
+// full-screen pass, blended with (ONE_MINUS_SRC_ALPHA, SRC_ALPHA): the
+// average transparent color covers 1 - revealage of the background.
+out vec4 FragColor;
+
+uniform sampler2D accumTexture;
+uniform sampler2D revealageTexture;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float revealage = texelFetch(revealageTexture, texel, 0).r;
+    if (revealage >= 1.0)
+        discard; // No transparent surface here
+
+    vec4 accum = texelFetch(accumTexture, texel, 0);
+    // Keeps the average finite where the weights overflow half floats
+    if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b))))
+        accum.rgb = vec3(accum.a);
+
+    vec3 average = accum.rgb / max(accum.a, 1e-5);
+    FragColor = vec4(average, revealage);
+}
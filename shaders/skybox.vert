@@ -3,8 +3,16 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 WorldPos;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Mirrors struct FrameConstants in src/frameconstants.h
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 cameraPos;
+};
 
 void main()
 {
@@ -0,0 +1,192 @@
+#version 430 core
+// alphaMode BLEND surfaces, weighted blended order-independent
+// transparency (McGuire and Bavoil 2013). Every fragment is shaded with the
+// same image-based lighting as lighting.frag and added to the accumulation
+// target with a depth and coverage weight; the revealage target multiplies
+// up (1 - alpha). oitcomposite.frag resolves both over the lit image.
+layout (location = 0) out vec4 accum;      // RGB=Weighted color, A=Weighted alpha
+layout (location = 1) out float revealage; // Product of (1 - alpha)
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in vec3 Tangent;
+in vec3 Bitangent;
+in float Deviation;
+in float Occlusion;
+
+// Mirror GeometryFeature in src/geometryprograms.h and geometry.frag.
+// Always specialized: "#define FEATURES <mask>" is injected after #version.
+#define FEATURE_BASE_COLOR_MAP 1
+#define FEATURE_METALLIC_MAP   2
+#define FEATURE_ROUGHNESS_MAP  4
+#define FEATURE_NORMAL_MAP     8
+#define FEATURE_DERIVATIVE_TBN 16
+#define FEATURE_HEATMAP        32
+#define FEATURE_OCCLUSION      64
+
+#ifndef FEATURES
+#define FEATURES 0
+#endif
+#define HAS_FEATURE(bit) ((FEATURES & (bit)) != 0)
+
+// Fragments behind the opaque depth report no texture levels
+layout (early_fragment_tests) in;
+
+// Mirrors struct FrameConstants in src/frameconstants.h
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 cameraPos;
+};
+
+// Material Factors
+uniform vec4 uBaseColorFactor;
+uniform float uMetallicFactor;
+uniform float uRoughnessFactor;
+
+uniform float uHeatmapRange;
+
+uniform sampler2D texture_baseColor;
+uniform sampler2D texture_metallicRoughness; // G=Roughness, B=Metal
+uniform sampler2D texture_normal;
+uniform sampler2D environmentMap;
+
+// Texture streaming feedback, as geometry.frag
+layout (std430, binding = 5) buffer StreamingFeedback
+{
+    uint requiredLevel[];
+};
+uniform ivec3 uFeedbackTextures;
+uniform vec3 uFeedbackLog2Size;
+
+void writeFeedback()
+{
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-20));
+    for (int i = 0; i < 3; i++) {
+        int index = uFeedbackTextures[i];
+        if (index < 0)
+            continue;
+        uint level = uint(max(lod + uFeedbackLog2Size[i], 0.0));
+        if (level < requiredLevel[index])
+            atomicMin(requiredLevel[index], level);
+    }
+}
+
+const vec2 invAtan = vec2(0.1591, 0.3183);
+
+// --- ACES Tone Mapping, as lighting.frag ---
+vec3 aces(vec3 x) {
+  const float a = 2.51;
+  const float b = 0.03;
+  const float c = 2.43;
+  const float d = 0.59;
+  const float e = 0.14;
+  return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+}
+
+vec2 SampleSphericalMap(vec3 v)
+{
+    vec2 uv = vec2(atan(v.z, v.x), asin(v.y));
+    uv *= invAtan;
+    uv += 0.5;
+    return uv;
+}
+
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+vec3 heatmapColor(float deviation)
+{
+    float t = clamp(deviation / max(uHeatmapRange, 1e-20), -1.0, 1.0);
+    return t < 0.0 ? mix(vec3(1.0), vec3(0.05, 0.2, 1.0), -t)
+                   : mix(vec3(1.0), vec3(1.0, 0.1, 0.05), t);
+}
+
+vec3 getNormalFromMap()
+{
+    if (!HAS_FEATURE(FEATURE_NORMAL_MAP))
+        return normalize(Normal);
+
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(texture_normal, TexCoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
+
+    mat3 TBN = mat3(Tangent, Bitangent, Normal);
+    if (HAS_FEATURE(FEATURE_DERIVATIVE_TBN)) {
+        vec3 Q1  = dFdx(FragPos);
+        vec3 Q2  = dFdy(FragPos);
+        vec2 st1 = dFdx(TexCoords);
+        vec2 st2 = dFdy(TexCoords);
+
+        vec3 N   = normalize(Normal);
+        vec3 T  = normalize(Q1*st2.t - Q2*st1.t);
+        vec3 B  = -normalize(cross(N, T));
+        TBN = mat3(T, B, N);
+    }
+
+    return normalize(TBN * tangentNormal);
+}
+
+void main()
+{
+    writeFeedback();
+
+    // 1. Material, as geometry.frag
+    vec4 albedo = uBaseColorFactor;
+    if (HAS_FEATURE(FEATURE_BASE_COLOR_MAP))
+        albedo *= texture(texture_baseColor, TexCoords);
+    if (HAS_FEATURE(FEATURE_HEATMAP))
+        albedo.rgb = heatmapColor(Deviation);
+
+    float metallic = uMetallicFactor;
+    float roughness = uRoughnessFactor;
+    if (HAS_FEATURE(FEATURE_METALLIC_MAP | FEATURE_ROUGHNESS_MAP)) {
+        vec4 mrSample = texture(texture_metallicRoughness, TexCoords);
+        if (HAS_FEATURE(FEATURE_ROUGHNESS_MAP)) roughness *= mrSample.g;
+        if (HAS_FEATURE(FEATURE_METALLIC_MAP)) metallic *= mrSample.b;
+    }
+    roughness = max(roughness, 0.04);
+    float ao = HAS_FEATURE(FEATURE_OCCLUSION) ? Occlusion : 1.0;
+
+    // 2. Image-based lighting, as lighting.frag; back faces see the side
+    // facing the camera
+    vec3 N = getNormalFromMap();
+    vec3 V = normalize(cameraPos.xyz - FragPos);
+    if (dot(N, V) < 0.0)
+        N = -N;
+    vec3 R = reflect(-V, N);
+
+    vec3 F0 = mix(vec3(0.04), albedo.rgb, metallic);
+    vec3 kS = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
+    vec3 kD = (1.0 - kS) * (1.0 - metallic);
+
+    vec3 irradiance = textureLod(environmentMap, SampleSphericalMap(N), 6.0).rgb;
+    vec3 diffuse = irradiance * albedo.rgb;
+
+    const float MAX_REFLECTION_LOD = 8.0;
+    vec3 prefilteredColor = textureLod(environmentMap, SampleSphericalMap(R), roughness * MAX_REFLECTION_LOD).rgb;
+    vec2 brdf = vec2(0.9, 0.1); // Placeholder for LUT lookup, as lighting.frag
+    vec3 specular = prefilteredColor * (F0 * brdf.x + brdf.y);
+
+    // Tone mapped here: the lit image it is composited over already is
+    vec3 color = aces((kD * diffuse + specular) * ao);
+    color = pow(color, vec3(1.0/2.2));
+
+    // 3. Weight falls off with depth so nearer layers dominate, and with
+    // coverage so faint layers do not (McGuire and Bavoil, eq. 10)
+    float alpha = clamp(albedo.a, 0.0, 1.0);
+    float w = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8
+                    * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+
+    accum = vec4(color * alpha, alpha) * w;
+    revealage = alpha;
+}
@@ -0,0 +1,123 @@
+// Analysis benchmark: MeshAnalyzer::analyze over a synthetic model on the
+// whole thread pool, as the Analysis panel runs it after a load. The
+// default size is the 50M-triangle target.
+//
+//   mesh-spy-analysisbench [--vertices N] [--primitives N]
+//                          [--iterations N] [--work-dir DIR]
+//                          [--out results.json]
+
+#include "gltfloader.h"
+#include "meshanalyzer.h"
+#include "syntheticglb.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static double
+median (std::vector<double> values)
+{
+  if (values.empty ())
+    return 0.0;
+  std::sort (values.begin (), values.end ());
+  return values[values.size () / 2];
+}
+
+int
+main (int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy analysis benchmark");
+  parser.addHelpOption ();
+  QCommandLineOption vertexOpt ("vertices",
+                                "Vertices, about half the triangles.",
+                                "count", "25000000");
+  QCommandLineOption primitiveOpt ("primitives",
+                                   "Submeshes the vertices are split into.",
+                                   "count", "16");
+  QCommandLineOption iterOpt ("iterations", "Runs per measurement.", "count",
+                              "3");
+  QCommandLineOption dirOpt ("work-dir", "Where generated GLBs are cached.",
+                             "dir", QDir::tempPath () + "/mesh-spy-bench");
+  QCommandLineOption outOpt ("out", "Results file.", "file",
+                             "analysisbench.json");
+  parser.addOptions ({ vertexOpt, primitiveOpt, iterOpt, dirOpt, outOpt });
+  parser.process (app);
+
+  const int runs = std::max (1, parser.value (iterOpt).toInt ());
+
+  // 1. A wavy grid model, split so that every submesh is over the
+  // sharding threshold like a large scan
+  SyntheticSceneSpec spec;
+  spec.vertexCount = std::max (1000ll, parser.value (vertexOpt).toLongLong ());
+  spec.primitiveCount = std::max (1, parser.value (primitiveOpt).toInt ());
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+  const QString path = workDir.filePath (spec.name () + ".glb");
+  if (!QFileInfo::exists (path))
+    {
+      QString error;
+      if (!writeSyntheticGlb (spec, path, nullptr, &error))
+        {
+          std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                        qPrintable (error));
+          return 1;
+        }
+    }
+
+  LoaderOptions options;
+  options.processTextures = false;
+  QString error;
+  std::unique_ptr<SceneData> scene (GLTFLoader::load (path, &error, options));
+  if (!scene)
+    {
+      std::fprintf (stderr, "Load failed: %s\n", qPrintable (error));
+      return 1;
+    }
+
+  // 2. What the analysis job does once the scene is loaded
+  std::vector<double> analysisMs;
+  SceneAnalysis analysis;
+  for (int run = 0; run < runs; run++)
+    {
+      analysis = MeshAnalyzer::analyze (*scene);
+      analysisMs.push_back (analysis.analysisMs);
+    }
+
+  const MeshMetrics &total = analysis.total;
+  const double ms = median (analysisMs);
+  const int threads = QThreadPool::globalInstance ()->maxThreadCount ();
+  std::printf ("%zu triangles, %zu vertices, %zu submeshes, %d threads\n",
+               total.triangles, total.vertices, total.submeshes, threads);
+  std::printf ("%-24s %10.1f ms %8.2f Mtriangles/s\n", "analyze", ms,
+               total.triangles / ms / 1.0e3);
+  std::printf ("%-24s %10.3f\n", "ACMR", total.acmr ());
+  std::printf ("%-24s %10zu\n", "non-manifold edges", total.nonManifoldEdges);
+
+  QJsonObject results{ { "file", spec.name () },
+                       { "triangles", (double)total.triangles },
+                       { "vertices", (double)total.vertices },
+                       { "submeshes", (double)total.submeshes },
+                       { "threads", threads },
+                       { "runs", runs },
+                       { "analysisMs", ms },
+                       { "acmr", total.acmr () } };
+
+  QFile out (parser.value (outOpt));
+  if (out.open (QIODevice::WriteOnly))
+    out.write (QJsonDocument (results).toJson ());
+  std::printf ("\nResults written to %s\n",
+               qPrintable (parser.value (outOpt)));
+  return 0;
+}
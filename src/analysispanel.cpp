@@ -0,0 +1,111 @@
+#include "analysispanel.h"
+#include "meshanalyzer.h"
+
+#include <QHeaderView>
+#include <QLocale>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+AnalysisPanel::AnalysisPanel (QWidget *parent)
+    : QGroupBox ("Analysis", parent)
+{
+  QVBoxLayout *layout = new QVBoxLayout (this);
+
+  m_tree = new QTreeWidget (this);
+  m_tree->setHeaderLabels ({ "Item", "Value" });
+  m_tree->setUniformRowHeights (true);
+  m_tree->header ()->setStretchLastSection (false);
+  m_tree->header ()->setSectionResizeMode (0, QHeaderView::Stretch);
+  m_tree->header ()->setSectionResizeMode (1,
+                                           QHeaderView::ResizeToContents);
+  layout->addWidget (m_tree);
+
+  new QTreeWidgetItem (m_tree, { "No model loaded" });
+}
+
+void
+AnalysisPanel::setPending ()
+{
+  m_tree->clear ();
+  new QTreeWidgetItem (m_tree, { "Analyzing..." });
+}
+
+QTreeWidgetItem *
+AnalysisPanel::addNode (QTreeWidgetItem *parent, const QString &name,
+                        const MeshMetrics &metrics)
+{
+  QTreeWidgetItem *node = parent ? new QTreeWidgetItem (parent)
+                                 : new QTreeWidgetItem (m_tree);
+  const QLocale locale;
+  auto count = [&locale] (size_t value) {
+    return locale.toString ((qulonglong)value);
+  };
+  auto row = [node] (const QString &label, const QString &value) {
+    new QTreeWidgetItem (node, { label, value });
+  };
+
+  node->setText (0, name);
+  node->setText (1, count (metrics.triangles));
+
+  row ("Triangles", count (metrics.triangles));
+  row ("Vertices", count (metrics.vertices));
+  row ("Degenerate triangles", count (metrics.degenerateTriangles));
+  row ("Duplicate triangles", count (metrics.duplicateTriangles));
+  row ("Non-manifold edges", count (metrics.nonManifoldEdges));
+  row ("Unreferenced vertices", count (metrics.unusedVertices));
+  if (metrics.submeshes > 1)
+    {
+      row ("Submeshes", count (metrics.submeshes));
+      row ("Submeshes without UVs", count (metrics.withoutTexCoords));
+    }
+  else
+    {
+      row ("UVs", metrics.withoutTexCoords ? "Missing" : "Present");
+    }
+  if (metrics.weldedVertices)
+    row ("Welded vertices",
+         QString ("%1 (%2 MB)")
+             .arg (count (metrics.weldedVertices))
+             .arg (metrics.weldedBytes / 1048576.0, 0, 'f', 2));
+  row ("ACMR", QString::number (metrics.acmr (), 'f', 3));
+  row ("ATVR", QString::number (metrics.atvr (), 'f', 3));
+  return node;
+}
+
+void
+AnalysisPanel::setAnalysis (const SceneAnalysis &analysis)
+{
+  m_tree->clear ();
+
+  QTreeWidgetItem *scene = addNode (
+      nullptr, QString ("Scene (%1 ms)").arg (analysis.analysisMs, 0, 'f', 0),
+      analysis.total);
+  scene->setExpanded (true);
+
+  std::vector<std::vector<size_t>> byMaterial (analysis.materials.size ());
+  for (size_t m = 0; m < analysis.meshes.size (); m++)
+    {
+      const int material = analysis.meshes[m].materialIndex;
+      if (material >= 0 && material < (int)byMaterial.size ())
+        byMaterial[material].push_back (m);
+    }
+
+  for (size_t i = 0; i < byMaterial.size (); i++)
+    {
+      if (byMaterial[i].empty ())
+        continue;
+
+      QTreeWidgetItem *material
+          = addNode (nullptr,
+                     QString::fromStdString (analysis.materialNames[i]),
+                     analysis.materials[i]);
+      for (size_t m : byMaterial[i])
+        {
+          const SubMeshReport &mesh = analysis.meshes[m];
+          QString name = QString::fromStdString (mesh.name);
+          if (mesh.sharedGeometry >= 0)
+            name += " (shared)";
+          addNode (material, name, mesh.metrics);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef ANALYSISPANEL_H
+#define ANALYSISPANEL_H
+
+#include <QGroupBox>
+
+struct MeshMetrics;
+struct SceneAnalysis;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+// Side-panel tree of MeshAnalyzer results: scene totals, then one node per
+// material with its submeshes underneath. Expanding a node shows its
+// metrics.
+class AnalysisPanel : public QGroupBox
+{
+  Q_OBJECT
+
+public:
+  explicit AnalysisPanel (QWidget *parent = nullptr);
+
+  // Clears the tree while a new model is analyzed
+  void setPending ();
+  void setAnalysis (const SceneAnalysis &analysis);
+
+private:
+  QTreeWidgetItem *addNode (QTreeWidgetItem *parent, const QString &name,
+                            const MeshMetrics &metrics);
+
+  QTreeWidget *m_tree;
+};
+
+#endif // ANALYSISPANEL_H
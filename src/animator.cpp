@@ -0,0 +1,450 @@
+#include "animator.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#define ANIMATOR_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+constexpr size_t kInstanceGrain = 4; // Instances per pool task
+constexpr float kGridGap = 1.25f;    // Instance spacing, of the diagonal
+constexpr float kPhaseStep = 0.618034f; // Golden ratio phase per instance
+
+glm::mat4
+localMatrix (const NodeData &node, const glm::vec3 &t, const glm::vec4 &r,
+             const glm::vec3 &s)
+{
+  return node.hasMatrix ? node.matrix : composeTRS (t, r, s);
+}
+
+// Index of the last key at or before t (0 before the first key). Playback
+// mostly moves forward by a key or less, so the scan starts at the cursor
+// and compares four key times at once; the FLT_MAX padding stops it at
+// the last key.
+template <typename Track>
+size_t
+findKey (const Track &track, float t, uint32_t &cursor)
+{
+  const float *times = track.times.data ();
+  size_t k = cursor < track.keys && times[cursor] <= t ? cursor : 0;
+#ifdef ANIMATOR_SSE
+  const __m128 time = _mm_set1_ps (t);
+  for (;;)
+    {
+      // Times are sorted, so the mask is a run of low bits
+      const __m128 next = _mm_loadu_ps (times + k + 1);
+      const int mask = _mm_movemask_ps (_mm_cmple_ps (next, time));
+      if (mask != 0xF)
+        {
+          k += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1);
+          break;
+        }
+      k += 4;
+    }
+#else
+  while (k + 1 < track.keys && times[k + 1] <= t)
+    k++;
+#endif
+  cursor = (uint32_t)k;
+  return k;
+}
+
+// Writes min(components, count) interpolated components to out
+template <typename Track>
+void
+sampleTrack (const Track &track, float t, uint32_t &cursor, float *out,
+             int count)
+{
+  const size_t k = findKey (track, t, cursor);
+  const int n = std::min (track.components, count);
+  const bool cubic = track.interpolation == InterpolationCubicSpline;
+  const int valueBlock = cubic ? 1 : 0;
+
+  if (k + 1 >= track.keys || t <= track.times[k]
+      || track.interpolation == InterpolationStep)
+    {
+      for (int c = 0; c < n; c++)
+        out[c] = track.lane (valueBlock, c)[k];
+      return;
+    }
+
+  const float dt = track.times[k + 1] - track.times[k];
+  const float f = (t - track.times[k]) / dt;
+  if (cubic)
+    {
+      // Hermite basis, tangents scaled by the key interval
+      const float f2 = f * f;
+      const float f3 = f2 * f;
+      const float h00 = 2.0f * f3 - 3.0f * f2 + 1.0f;
+      const float h10 = (f3 - 2.0f * f2 + f) * dt;
+      const float h01 = -2.0f * f3 + 3.0f * f2;
+      const float h11 = (f3 - f2) * dt;
+      for (int c = 0; c < n; c++)
+        out[c] = h00 * track.lane (1, c)[k] + h10 * track.lane (2, c)[k]
+                 + h01 * track.lane (1, c)[k + 1]
+                 + h11 * track.lane (0, c)[k + 1];
+    }
+  else if (track.path == PathRotation && n == 4)
+    {
+      // Shortest-arc slerp, nlerp when the keys are nearly parallel
+      float a[4], b[4];
+      float dot = 0.0f;
+      for (int c = 0; c < 4; c++)
+        {
+          a[c] = track.lane (0, c)[k];
+          b[c] = track.lane (0, c)[k + 1];
+          dot += a[c] * b[c];
+        }
+      const float sign = dot < 0.0f ? -1.0f : 1.0f;
+      dot *= sign;
+      float wa = 1.0f - f;
+      float wb = f * sign;
+      if (dot < 0.9995f)
+        {
+          const float theta = std::acos (dot);
+          const float sinTheta = std::sin (theta);
+          wa = std::sin (wa * theta) / sinTheta;
+          wb = std::sin (f * theta) / sinTheta * sign;
+        }
+      for (int c = 0; c < 4; c++)
+        out[c] = wa * a[c] + wb * b[c];
+    }
+  else
+    {
+      for (int c = 0; c < n; c++)
+        {
+          const float *v = track.lane (0, c);
+          out[c] = v[k] + (v[k + 1] - v[k]) * f;
+        }
+    }
+
+  if (track.path == PathRotation && n == 4)
+    {
+      const float length = std::sqrt (out[0] * out[0] + out[1] * out[1]
+                                      + out[2] * out[2] + out[3] * out[3]);
+      if (length > 0.0f)
+        for (int c = 0; c < 4; c++)
+          out[c] /= length;
+    }
+}
+} // namespace
+
+Animator::Animator (const SceneData &scene)
+    : m_nodes (scene.nodes), m_skins (scene.skins)
+{
+  const size_t nodeCount = m_nodes.size ();
+
+  // 1. Parent-first order (cycles in broken files are cut)
+  std::vector<std::vector<int>> children (nodeCount);
+  for (size_t n = 0; n < nodeCount; n++)
+    {
+      const int parent = m_nodes[n].parent;
+      if (parent >= 0 && parent < (int)nodeCount)
+        children[parent].push_back ((int)n);
+      else
+        m_nodes[n].parent = -1;
+    }
+  std::vector<bool> visited (nodeCount, false);
+  for (size_t root = 0; root < nodeCount; root++)
+    {
+      if (m_nodes[root].parent >= 0)
+        continue;
+      std::vector<int> stack{ (int)root };
+      while (!stack.empty ())
+        {
+          const int n = stack.back ();
+          stack.pop_back ();
+          if (visited[n])
+            continue;
+          visited[n] = true;
+          m_order.push_back (n);
+          stack.insert (stack.end (), children[n].begin (),
+                        children[n].end ());
+        }
+    }
+  for (size_t n = 0; n < nodeCount; n++)
+    if (!visited[n])
+      m_nodes[n].parent = -1; // Unreachable from a root: part of a cycle
+
+  // 2. Rest world matrices
+  std::vector<glm::mat4> rest (nodeCount, glm::mat4 (1.0f));
+  for (int n : m_order)
+    {
+      const NodeData &node = m_nodes[n];
+      const glm::mat4 local = node.localMatrix ();
+      rest[n] = node.parent >= 0 ? rest[node.parent] * local : local;
+    }
+  m_restInverse.resize (nodeCount);
+  for (size_t n = 0; n < nodeCount; n++)
+    m_restInverse[n] = bakesRestWorld (rest[n]) ? glm::inverse (rest[n])
+                                                : glm::mat4 (1.0f);
+
+  // 3. Morph weight slots per node, sized for its largest primitive
+  m_nodeWeightOffset.assign (nodeCount, -1);
+  m_nodeWeightCount.assign (nodeCount, 0);
+  for (const SubMesh &mesh : scene.meshes)
+    if (mesh.node >= 0 && mesh.node < (int)nodeCount)
+      m_nodeWeightCount[mesh.node] = std::max (
+          m_nodeWeightCount[mesh.node], (int)mesh.morphWeights.size ());
+  for (size_t n = 0; n < nodeCount; n++)
+    if (m_nodeWeightCount[n] > 0)
+      {
+        m_nodeWeightOffset[n] = (int)m_restWeights.size ();
+        m_restWeights.resize (m_restWeights.size () + m_nodeWeightCount[n],
+                              0.0f);
+      }
+  for (const SubMesh &mesh : scene.meshes)
+    if (mesh.node >= 0 && mesh.node < (int)nodeCount
+        && !mesh.morphWeights.empty ())
+      std::copy (mesh.morphWeights.begin (), mesh.morphWeights.end (),
+                 m_restWeights.begin () + m_nodeWeightOffset[mesh.node]);
+
+  // 4. One binding per submesh
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene.meshes[m];
+      DeformBinding binding;
+      binding.mesh = (int)m;
+      binding.skinned = mesh.skin >= 0 && mesh.skin < (int)m_skins.size ()
+                        && !m_skins[mesh.skin].joints.empty ();
+      binding.jointCount
+          = binding.skinned ? (int)m_skins[mesh.skin].joints.size () : 1;
+      binding.paletteOffset = m_paletteStride;
+      binding.targetCount = (int)scene.geometry (m).targets.size ();
+      binding.weightOffset = m_weightStride;
+      m_paletteStride += binding.jointCount;
+      m_weightStride += binding.targetCount;
+      m_bindings.push_back (binding);
+      m_bindingNode.push_back (
+          mesh.node >= 0 && mesh.node < (int)nodeCount ? mesh.node : -1);
+      m_bindingSkin.push_back (binding.skinned ? mesh.skin : -1);
+    }
+
+  // 5. Clips, transposed to component arrays
+  for (const AnimationData &animation : scene.animations)
+    {
+      Clip clip;
+      clip.name = animation.name;
+      clip.duration = animation.duration;
+      for (const AnimationChannelData &channel : animation.channels)
+        {
+          if (channel.node < 0 || channel.node >= (int)nodeCount
+              || (channel.path == PathWeights
+                  && m_nodeWeightOffset[channel.node] < 0))
+            continue;
+
+          Track track;
+          track.node = channel.node;
+          track.path = channel.path;
+          track.interpolation = channel.interpolation;
+          track.components = channel.components;
+          track.keys = channel.times.size ();
+          track.times = channel.times;
+          track.times.resize ((track.keys + 4 + 3) & ~(size_t)3, FLT_MAX);
+
+          const int blocks
+              = channel.interpolation == InterpolationCubicSpline ? 3 : 1;
+          const int n = channel.components;
+          track.values.resize (channel.values.size ());
+          for (size_t k = 0; k < track.keys; k++)
+            for (int b = 0; b < blocks; b++)
+              for (int c = 0; c < n; c++)
+                track.values[((size_t)b * n + c) * track.keys + k]
+                    = channel.values[(k * blocks + b) * n + c];
+          clip.tracks.push_back (std::move (track));
+        }
+      m_clips.push_back (std::move (clip));
+    }
+
+  // 6. Instances a little more than the model's size apart
+  m_spacing = std::max (
+      glm::length (scene.maxBounds - scene.minBounds) * kGridGap, 1.0e-3f);
+  if (!std::isfinite (m_spacing))
+    m_spacing = 1.0f;
+  resetState ();
+}
+
+const std::string &
+Animator::clipName (int clip) const
+{
+  return m_clips[clip].name;
+}
+
+float
+Animator::clipDuration (int clip) const
+{
+  return clip >= 0 && clip < clipCount () ? m_clips[clip].duration : 0.0f;
+}
+
+void
+Animator::setClip (int clip)
+{
+  m_clip = clip >= 0 && clip < clipCount () ? clip : -1;
+  resetState ();
+}
+
+void
+Animator::setInstanceCount (int count)
+{
+  m_instances = std::clamp (count, 1, kMaxInstances);
+  resetState ();
+}
+
+void
+Animator::resetState ()
+{
+  const size_t instances = (size_t)m_instances;
+  const size_t nodeCount = m_nodes.size ();
+  m_translations.resize (instances * nodeCount);
+  m_rotations.resize (instances * nodeCount);
+  m_scales.resize (instances * nodeCount);
+  m_nodeWeights.resize (instances * m_restWeights.size ());
+  m_world.resize (instances * nodeCount);
+  m_palettes.resize (instances * m_paletteStride);
+  m_weights.resize (instances * m_weightStride);
+  const size_t tracks = m_clip >= 0 ? m_clips[m_clip].tracks.size () : 0;
+  m_cursors.assign (instances * tracks, 0);
+}
+
+void
+Animator::sample (double seconds)
+{
+  const size_t nodeCount = m_nodes.size ();
+  const size_t weightCount = m_restWeights.size ();
+  const Clip *clip = m_clip >= 0 ? &m_clips[m_clip] : nullptr;
+
+  parallelFor (
+      (size_t)m_instances,
+      [&] (size_t i) {
+        // 1. Rest pose, for the nodes no channel drives
+        glm::vec3 *translations = &m_translations[i * nodeCount];
+        glm::vec4 *rotations = &m_rotations[i * nodeCount];
+        glm::vec3 *scales = &m_scales[i * nodeCount];
+        float *weights = m_nodeWeights.data () + i * weightCount;
+        for (size_t n = 0; n < nodeCount; n++)
+          {
+            translations[n] = m_nodes[n].translation;
+            rotations[n] = m_nodes[n].rotation;
+            scales[n] = m_nodes[n].scale;
+          }
+        std::copy (m_restWeights.begin (), m_restWeights.end (), weights);
+        if (!clip)
+          return;
+
+        // 2. Channels at this instance's phase
+        float t = 0.0f;
+        if (clip->duration > 0.0f)
+          {
+            const double phase
+                = (i * kPhaseStep - std::floor (i * kPhaseStep))
+                  * clip->duration;
+            t = (float)std::fmod (seconds + phase, (double)clip->duration);
+          }
+        uint32_t *cursors = &m_cursors[i * clip->tracks.size ()];
+        for (size_t k = 0; k < clip->tracks.size (); k++)
+          {
+            const Track &track = clip->tracks[k];
+            const int node = track.node;
+            switch (track.path)
+              {
+              case PathTranslation:
+                sampleTrack (track, t, cursors[k], &translations[node][0], 3);
+                break;
+              case PathRotation:
+                sampleTrack (track, t, cursors[k], &rotations[node][0], 4);
+                break;
+              case PathScale:
+                sampleTrack (track, t, cursors[k], &scales[node][0], 3);
+                break;
+              default:
+                {
+                  sampleTrack (track, t, cursors[k],
+                               weights + m_nodeWeightOffset[node],
+                               m_nodeWeightCount[node]);
+                }
+                break;
+              }
+          }
+      },
+      kInstanceGrain);
+}
+
+void
+Animator::pose ()
+{
+  const size_t nodeCount = m_nodes.size ();
+  const size_t weightCount = m_restWeights.size ();
+  const int columns = (int)std::ceil (std::sqrt ((double)m_instances));
+
+  parallelFor (
+      (size_t)m_instances,
+      [&] (size_t i) {
+        // 1. World matrices, parents first
+        glm::mat4 *world = &m_world[i * nodeCount];
+        for (int n : m_order)
+          {
+            const size_t at = i * nodeCount + n;
+            const glm::mat4 local
+                = localMatrix (m_nodes[n], m_translations[at],
+                               m_rotations[at], m_scales[at]);
+            const int parent = m_nodes[n].parent;
+            world[n] = parent >= 0 ? world[parent] * local : local;
+          }
+
+        // 2. Palettes with the grid offset folded in
+        glm::mat4 offset (1.0f);
+        offset[3] = glm::vec4 ((float)(i % columns) * m_spacing, 0.0f,
+                               (float)(i / columns) * m_spacing, 1.0f);
+        glm::mat4 *palette = &m_palettes[i * m_paletteStride];
+        float *weights = m_weights.data () + i * m_weightStride;
+        const float *nodeWeights = m_nodeWeights.data () + i * weightCount;
+        for (size_t b = 0; b < m_bindings.size (); b++)
+          {
+            const DeformBinding &binding = m_bindings[b];
+            const int node = m_bindingNode[b];
+            glm::mat4 *block = palette + binding.paletteOffset;
+            if (binding.skinned)
+              {
+                const SkinData &skin = m_skins[m_bindingSkin[b]];
+                for (int j = 0; j < binding.jointCount; j++)
+                  {
+                    const int joint = skin.joints[j];
+                    block[j] = joint >= 0 ? offset * world[joint]
+                                                * skin.inverseBindMatrices[j]
+                                          : offset;
+                  }
+              }
+            else
+              {
+                // The loader baked the rest world matrix into the
+                // vertices: take it out, then apply the posed one
+                block[0] = node >= 0
+                               ? offset * world[node] * m_restInverse[node]
+                               : offset;
+              }
+
+            // 3. Morph weights of the mesh's node
+            if (binding.targetCount > 0 && node >= 0
+                && m_nodeWeightOffset[node] >= 0)
+              {
+                const int count
+                    = std::min (binding.targetCount, m_nodeWeightCount[node]);
+                std::copy_n (nodeWeights + m_nodeWeightOffset[node], count,
+                             weights + binding.weightOffset);
+                std::fill_n (weights + binding.weightOffset + count,
+                             binding.targetCount - count, 0.0f);
+              }
+            else if (binding.targetCount > 0)
+              {
+                std::fill_n (weights + binding.weightOffset,
+                             binding.targetCount, 0.0f);
+              }
+          }
+      },
+      kInstanceGrain);
+}
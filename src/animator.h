@@ -0,0 +1,181 @@
+#ifndef ANIMATOR_H
+#define ANIMATOR_H
+
+#include "meshdata.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where one deformed submesh finds its matrices and morph weights in an
+// instance's block of the per-frame buffers.
+struct DeformBinding
+{
+  int mesh = -1;         // SceneData::meshes index
+  int paletteOffset = 0; // First matrix
+  int jointCount = 1;    // Matrices, 1 for meshes without a skin
+  int weightOffset = 0;  // First morph weight
+  int targetCount = 0;
+  bool skinned = false;
+};
+
+// CPU side of skeletal and morph target playback.
+//
+// Every channel is stored structure-of-arrays: key times padded to whole
+// groups of four, then one contiguous array per component (and per
+// in-tangent, value and out-tangent for cubic splines). Finding the key
+// pair is a 4-wide compare forward from the previous key, and
+// interpolation reads each component as a stream.
+//
+// Each instance plays the current clip at its own phase, laid out on a
+// grid in the XZ plane. sample() evaluates every channel of every instance
+// into local node poses on the pool; pose() walks the hierarchy parents
+// first and writes, per instance and deformed submesh, its joint palette
+// (joint world matrix times inverse bind matrix, or for meshes without a
+// skin the motion of their node away from the rest pose) with the
+// instance offset folded in, plus its morph weights. SkinningPass deforms
+// the vertices from these on the GPU.
+class Animator
+{
+public:
+  static constexpr int kMaxInstances = 1024;
+
+  // Every submesh of the scene gets a binding (see
+  // SceneData::animated()).
+  explicit Animator (const SceneData &scene);
+
+  int
+  clipCount () const
+  {
+    return (int)m_clips.size ();
+  }
+
+  const std::string &clipName (int clip) const;
+  float clipDuration (int clip) const;
+
+  // -1 holds the rest pose
+  void setClip (int clip);
+
+  int
+  clip () const
+  {
+    return m_clip;
+  }
+
+  void setInstanceCount (int count);
+
+  int
+  instanceCount () const
+  {
+    return m_instances;
+  }
+
+  // Local pose of every node of every instance, `seconds` into the clip
+  // (looped)
+  void sample (double seconds);
+
+  // World matrices, palettes and morph weights from the sampled poses
+  void pose ();
+
+  const std::vector<DeformBinding> &
+  bindings () const
+  {
+    return m_bindings;
+  }
+
+  // Per instance: paletteStride matrices and weightStride weights,
+  // instance after instance
+  int
+  paletteStride () const
+  {
+    return m_paletteStride;
+  }
+
+  int
+  weightStride () const
+  {
+    return m_weightStride;
+  }
+
+  const std::vector<glm::mat4> &
+  palettes () const
+  {
+    return m_palettes;
+  }
+
+  const std::vector<float> &
+  weights () const
+  {
+    return m_weights;
+  }
+
+private:
+  struct Track
+  {
+    int node = -1;
+    int path = PathTranslation;
+    int interpolation = InterpolationLinear;
+    int components = 0;
+    size_t keys = 0;
+    std::vector<float> times;  // Padded with FLT_MAX
+    std::vector<float> values; // Component arrays of `keys` floats
+
+    // block 0 = values, or for cubic splines 0/1/2 = in-tangents, values,
+    // out-tangents
+    const float *
+    lane (int block, int component) const
+    {
+      return values.data ()
+             + ((size_t)block * components + component) * keys;
+    }
+  };
+
+  struct Clip
+  {
+    std::string name;
+    float duration = 0.0f;
+    std::vector<Track> tracks;
+  };
+
+  void resetState ();
+
+  std::vector<Clip> m_clips;
+  int m_clip = -1;
+  int m_instances = 1;
+  float m_spacing = 1.0f;
+
+  // Rest pose, nodes in parent-first order and the inverse rest world
+  // matrices that rigid meshes are moved relative to (identity where the
+  // loader did not bake one in)
+  std::vector<NodeData> m_nodes;
+  std::vector<int> m_order;
+  std::vector<glm::mat4> m_restInverse;
+  std::vector<SkinData> m_skins;
+
+  // Morph weights by node: offset into an instance's node weights (-1 for
+  // nodes without a morphed mesh) and count
+  std::vector<int> m_nodeWeightOffset;
+  std::vector<int> m_nodeWeightCount;
+  std::vector<float> m_restWeights;
+
+  std::vector<DeformBinding> m_bindings;
+  std::vector<int> m_bindingNode;
+  std::vector<int> m_bindingSkin;
+  int m_paletteStride = 0;
+  int m_weightStride = 0;
+
+  // Per instance and node (weights: per instance and m_restWeights slot)
+  std::vector<glm::vec3> m_translations;
+  std::vector<glm::vec4> m_rotations;
+  std::vector<glm::vec3> m_scales;
+  std::vector<float> m_nodeWeights;
+  std::vector<glm::mat4> m_world;
+
+  // Last key found per instance and track of the current clip
+  std::vector<uint32_t> m_cursors;
+
+  std::vector<glm::mat4> m_palettes;
+  std::vector<float> m_weights;
+};
+
+#endif // ANIMATOR_H
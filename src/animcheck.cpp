@@ -0,0 +1,200 @@
+// Animation correctness check: a rigid mesh on a translated and rotated
+// node, spun in place by a rotation channel, must stay on its pivot.
+//
+//   mesh-spy-animcheck [--work-dir DIR]
+//
+// Exit code: 0 = pass, 1 = mismatch, 2 = error.
+
+#include "animator.h"
+#include "glbwriter.h"
+#include "gltfloader.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static constexpr float kTolerance = 1.0e-4f;
+
+// Rotation about +Y, as a glTF quaternion (XYZW)
+static glm::vec4
+yaw (float degrees)
+{
+  const float half = degrees * 3.14159265f / 360.0f;
+  return glm::vec4 (0.0f, std::sin (half), 0.0f, std::cos (half));
+}
+
+static QJsonArray
+toJson (const glm::vec3 &v)
+{
+  return QJsonArray{ v.x, v.y, v.z };
+}
+
+static QJsonArray
+toJson (const glm::vec4 &v)
+{
+  return QJsonArray{ v.x, v.y, v.z, v.w };
+}
+
+// Every point of `expected` has a vertex of `actual` within tolerance
+static bool
+sameSet (const std::vector<glm::vec3> &expected,
+         const std::vector<glm::vec3> &actual, const char *what)
+{
+  bool ok = expected.size () == actual.size ();
+  for (const glm::vec3 &e : expected)
+    {
+      bool found = false;
+      for (const glm::vec3 &a : actual)
+        found = found || glm::length (a - e) < kTolerance;
+      if (!found)
+        {
+          std::printf ("%-28s expected (%.4f %.4f %.4f) not found\n", what,
+                       e.x, e.y, e.z);
+          ok = false;
+        }
+    }
+  std::printf ("%-28s %s\n", what, ok ? "PASS" : "FAIL");
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy animation check");
+  parser.addHelpOption ();
+  QCommandLineOption dirOpt ("work-dir", "Where the test GLB is written.",
+                             "dir", QDir::tempPath () + "/mesh-spy-check");
+  parser.addOption (dirOpt);
+  parser.process (app);
+
+  // 1. One triangle around its node's origin; the node sits at
+  // (5, 0, 2) turned 90 degrees, and the clip turns it on to 180
+  const std::vector<glm::vec3> local = { glm::vec3 (1.0f, 0.0f, 0.0f),
+                                         glm::vec3 (0.0f, 1.0f, 0.0f),
+                                         glm::vec3 (0.0f, 0.0f, 1.0f) };
+  const glm::vec3 normal (0.0f, 0.0f, 1.0f);
+  const glm::vec3 translation (5.0f, 0.0f, 2.0f);
+  const float times[] = { 0.0f, 1.0f };
+  const glm::vec4 rotations[] = { yaw (90.0f), yaw (180.0f) };
+
+  GlbWriter writer;
+  const std::vector<glm::vec3> normals (local.size (), normal);
+  const int positionView = writer.addBufferView (
+      local.data (), local.size () * sizeof (glm::vec3), 0,
+      GlbWriter::ArrayBuffer);
+  const int normalView = writer.addBufferView (
+      normals.data (), normals.size () * sizeof (glm::vec3), 0,
+      GlbWriter::ArrayBuffer);
+  const int timeView = writer.addBufferView (times, sizeof (times));
+  const int rotationView
+      = writer.addBufferView (rotations, sizeof (rotations));
+  const int positionAccessor = writer.addAccessor (
+      positionView, 0, GlbWriter::Float, local.size (), "VEC3", false,
+      { 0.0, 0.0, 0.0 }, { 1.0, 1.0, 1.0 });
+  const int normalAccessor = writer.addAccessor (
+      normalView, 0, GlbWriter::Float, normals.size (), "VEC3");
+  const int timeAccessor = writer.addAccessor (
+      timeView, 0, GlbWriter::Float, 2, "SCALAR", false, { 0.0 }, { 1.0 });
+  const int rotationAccessor
+      = writer.addAccessor (rotationView, 0, GlbWriter::Float, 2, "VEC4");
+
+  QJsonObject attributes{ { "POSITION", positionAccessor },
+                          { "NORMAL", normalAccessor } };
+  const int mesh
+      = writer.addMesh (QJsonArray{ QJsonObject{ { "attributes",
+                                                   attributes } } });
+  const int node = writer.addNode (
+      QJsonObject{ { "mesh", mesh },
+                   { "translation", toJson (translation) },
+                   { "rotation", toJson (rotations[0]) } });
+  writer.addAnimation (QJsonObject{
+      { "channels",
+        QJsonArray{ QJsonObject{
+            { "sampler", 0 },
+            { "target", QJsonObject{ { "node", node },
+                                     { "path", "rotation" } } } } } },
+      { "samplers",
+        QJsonArray{ QJsonObject{ { "input", timeAccessor },
+                                 { "output", rotationAccessor } } } } });
+
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+  const QString path = workDir.filePath ("animated-node.glb");
+  QString error;
+  if (!writer.write (path, &error))
+    {
+      std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                    qPrintable (error));
+      return 2;
+    }
+
+  std::unique_ptr<SceneData> scene (
+      GLTFLoader::load (path, &error, LoaderOptions ()));
+  if (!scene || scene->meshes.size () != 1 || scene->animations.empty ())
+    {
+      std::fprintf (stderr, "Load failed: %s\n", qPrintable (error));
+      return 2;
+    }
+  const SubMesh &loaded = scene->geometry (0);
+
+  // 2. The rest pose is baked into the vertices
+  const glm::mat4 rest = composeTRS (translation, rotations[0],
+                                     glm::vec3 (1.0f));
+  std::vector<glm::vec3> expected, actual, actualNormals;
+  for (const glm::vec3 &p : local)
+    expected.push_back (glm::vec3 (rest * glm::vec4 (p, 1.0f)));
+  for (size_t i = 0; i < loaded.vertexCount; i++)
+    {
+      actual.push_back (loaded.position (i));
+      actualNormals.push_back (loaded.normal (i));
+    }
+  const std::vector<glm::vec3> expectedNormals (
+      local.size (), glm::vec3 (rest * glm::vec4 (normal, 0.0f)));
+  bool ok = sameSet (expected, actual, "rest positions");
+  ok = sameSet (expectedNormals, actualNormals, "rest normals") && ok;
+
+  // 3. At the start and halfway through the clip the node has turned 90
+  // and 135 degrees about its own origin, which has not moved
+  Animator animator (*scene);
+  animator.setClip (0);
+  animator.setInstanceCount (1);
+  const DeformBinding *binding = nullptr;
+  for (const DeformBinding &b : animator.bindings ())
+    if (b.mesh == 0)
+      binding = &b;
+  if (!binding)
+    {
+      std::fprintf (stderr, "No deform binding for the mesh\n");
+      return 2;
+    }
+
+  for (float seconds : { 0.0f, 0.5f })
+    {
+      animator.sample (seconds);
+      animator.pose ();
+      const glm::mat4 &palette = animator.palettes ()[binding->paletteOffset];
+      const glm::mat4 posed
+          = composeTRS (translation, yaw (90.0f + 90.0f * seconds),
+                        glm::vec3 (1.0f));
+      std::vector<glm::vec3> want, got;
+      for (const glm::vec3 &p : local)
+        want.push_back (glm::vec3 (posed * glm::vec4 (p, 1.0f)));
+      for (const glm::vec3 &p : actual)
+        got.push_back (glm::vec3 (palette * glm::vec4 (p, 1.0f)));
+      const QByteArray what
+          = "posed at " + QByteArray::number (seconds, 'f', 1) + " s";
+      ok = sameSet (want, got, what.constData ()) && ok;
+    }
+
+  std::printf ("\n%s\n", ok ? "All checks passed." : "Animation mismatch.");
+  return ok ? 0 : 1;
+}
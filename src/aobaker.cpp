@@ -0,0 +1,270 @@
+#include "aobaker.h"
+#include "meshbvh.h"
+#include "parallel.h"
+#include "tracer.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHashFunctions>
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/constants.hpp>
+
+namespace
+{
+constexpr size_t kVertexGrain = 64; // Vertices per pool task
+constexpr float kDistanceFraction = 0.1f; // Default range, of the diagonal
+constexpr float kBiasFraction = 1.0e-4f;  // Ray origin offset, likewise
+
+const char kMagic[4] = { 'M', 'S', 'A', 'O' };
+constexpr uint32_t kVersion = 1;
+constexpr qsizetype kHeaderSize = 24; // Magic, version, key, vertex count
+
+// Van der Corput radical inverse in base 2
+float
+radicalInverse (uint32_t bits)
+{
+  bits = (bits << 16) | (bits >> 16);
+  bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+  bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+  bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+  bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+  return bits * 2.3283064365386963e-10f;
+}
+
+// Integer hash for the per-vertex rotation (lowbias32)
+uint32_t
+hashVertex (uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Area-weighted normal of every BVH vertex, zero for unreferenced ones
+std::vector<glm::vec3>
+vertexNormals (const MeshBVH &bvh)
+{
+  const std::vector<glm::vec3> &positions = bvh.positions ();
+  std::vector<glm::vec3> normals (positions.size (), glm::vec3 (0.0f));
+  for (const glm::uvec3 &tri : bvh.triangles ())
+    {
+      const glm::vec3 n
+          = glm::cross (positions[tri.y] - positions[tri.x],
+                        positions[tri.z] - positions[tri.x]);
+      normals[tri.x] += n;
+      normals[tri.y] += n;
+      normals[tri.z] += n;
+    }
+  parallelFor (
+      normals.size (),
+      [&] (size_t v) {
+        const float length = glm::length (normals[v]);
+        normals[v] = length > 0.0f ? normals[v] / length : glm::vec3 (0.0f);
+      },
+      4096);
+  return normals;
+}
+
+uint64_t
+cacheKey (const MeshBVH &bvh, const AoBaker::Settings &settings)
+{
+  const std::vector<glm::vec3> &positions = bvh.positions ();
+  const size_t key = qHashBits (positions.data (),
+                                positions.size () * sizeof (glm::vec3));
+  return qHashMulti (key, (quint64)bvh.triangleCount (),
+                     (quint64)bvh.meshCount (), settings.raysPerVertex,
+                     settings.distance);
+}
+
+// One vector per inserted submesh, indexed by SceneData::meshes
+std::vector<std::vector<float>>
+splitPerMesh (const MeshBVH &bvh, const std::vector<float> &values)
+{
+  std::vector<std::vector<float>> perMesh;
+  for (size_t k = 0; k < bvh.meshCount (); k++)
+    {
+      const size_t mesh = (size_t)bvh.sceneMesh (k);
+      const size_t first = bvh.firstVertex (k);
+      const size_t end = k + 1 < bvh.meshCount () ? bvh.firstVertex (k + 1)
+                                                  : values.size ();
+      if (perMesh.size () <= mesh)
+        perMesh.resize (mesh + 1);
+      perMesh[mesh].assign (values.begin () + first, values.begin () + end);
+    }
+  return perMesh;
+}
+} // namespace
+
+AoBakeResult
+AoBaker::bake (const MeshBVH &bvh, const Settings &settings)
+{
+  TRACE_SCOPE_CAT ("analysis", "AoBaker::bake");
+  QElapsedTimer timer;
+  timer.start ();
+  AoBakeResult result;
+  const std::vector<glm::vec3> &positions = bvh.positions ();
+  if (positions.empty ())
+    return result;
+
+  // 1. Ray range and origin offset from the model's size
+  glm::vec3 min (FLT_MAX);
+  glm::vec3 max (-FLT_MAX);
+  for (const glm::vec3 &p : positions)
+    {
+      min = glm::min (min, p);
+      max = glm::max (max, p);
+    }
+  const float diagonal = glm::length (max - min);
+  const float distance = settings.distance > 0.0f
+                             ? settings.distance
+                             : diagonal * kDistanceFraction;
+  const float bias = diagonal * kBiasFraction;
+
+  // 2. Cosine-distributed directions around +Z (Malley's method on a
+  // Hammersley set), shared by every vertex
+  const int packets = std::max (1, (settings.raysPerVertex + 3) / 4);
+  const int rays = packets * 4;
+  std::vector<glm::vec3> samples (rays);
+  for (int i = 0; i < rays; i++)
+    {
+      const float u = (i + 0.5f) / rays;
+      const float phi = glm::two_pi<float> () * radicalInverse ((uint32_t)i);
+      const float r = std::sqrt (u);
+      samples[i] = glm::vec3 (r * std::cos (phi), r * std::sin (phi),
+                              std::sqrt (1.0f - u));
+    }
+
+  // 3. Trace, one vertex per packet loop
+  const std::vector<glm::vec3> normals = vertexNormals (bvh);
+  std::vector<float> visibility (positions.size (), 1.0f);
+  parallelFor (
+      positions.size (),
+      [&] (size_t v) {
+        const glm::vec3 &n = normals[v];
+        if (n == glm::vec3 (0.0f))
+          return;
+
+        // Orthonormal basis (Duff et al. 2017), turned by a per-vertex
+        // angle
+        const float sign = std::copysign (1.0f, n.z);
+        const float a = -1.0f / (sign + n.z);
+        const float b = n.x * n.y * a;
+        const glm::vec3 t1 (1.0f + sign * n.x * n.x * a, sign * b,
+                            -sign * n.x);
+        const glm::vec3 t2 (b, sign + n.y * n.y * a, -n.y);
+        const float angle
+            = hashVertex ((uint32_t)v) * (glm::two_pi<float> () / 4.2950e9f);
+        const glm::vec3 x = t1 * std::cos (angle) + t2 * std::sin (angle);
+        const glm::vec3 y = glm::cross (n, x);
+
+        const glm::vec3 origin = positions[v] + n * bias;
+        int blocked = 0;
+        for (int p = 0; p < packets; p++)
+          {
+            RayPacket packet;
+            for (int lane = 0; lane < 4; lane++)
+              {
+                const glm::vec3 &s = samples[p * 4 + lane];
+                packet.set (lane, origin, x * s.x + y * s.y + n * s.z,
+                            distance);
+              }
+            const int mask = bvh.occluded (packet);
+            blocked += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1)
+                       + ((mask >> 3) & 1);
+          }
+        visibility[v] = 1.0f - (float)blocked / rays;
+      },
+      kVertexGrain);
+
+  result.perMesh = splitPerMesh (bvh, visibility);
+  for (const glm::vec3 &n : normals)
+    if (n != glm::vec3 (0.0f))
+      result.rays += rays;
+  result.bakeMs = timer.nsecsElapsed () / 1.0e6;
+  return result;
+}
+
+QString
+AoBaker::cachePath (const QString &modelPath)
+{
+  return modelPath + ".ao";
+}
+
+bool
+AoBaker::loadCache (const QString &modelPath, const MeshBVH &bvh,
+                    const Settings &settings, AoBakeResult *result)
+{
+  QFile file (cachePath (modelPath));
+  if (!file.open (QIODevice::ReadOnly))
+    return false;
+  const QByteArray data = file.readAll ();
+  const size_t count = bvh.positions ().size ();
+  if (data.size () != kHeaderSize + (qsizetype)count
+      || std::memcmp (data.constData (), kMagic, 4) != 0)
+    return false;
+
+  uint32_t version;
+  uint64_t key;
+  std::memcpy (&version, data.constData () + 4, 4);
+  std::memcpy (&key, data.constData () + 8, 8);
+  if (version != kVersion || key != cacheKey (bvh, settings))
+    return false;
+
+  const unsigned char *bytes
+      = reinterpret_cast<const unsigned char *> (data.constData ())
+        + kHeaderSize;
+  std::vector<float> visibility (count);
+  for (size_t v = 0; v < count; v++)
+    visibility[v] = bytes[v] / 255.0f;
+
+  *result = AoBakeResult ();
+  result->perMesh = splitPerMesh (bvh, visibility);
+  return true;
+}
+
+bool
+AoBaker::saveCache (const QString &modelPath, const MeshBVH &bvh,
+                    const Settings &settings, const AoBakeResult &result,
+                    QString *errorMsg)
+{
+  const size_t count = bvh.positions ().size ();
+  QByteArray data (kHeaderSize + (qsizetype)count, '\0');
+  const uint64_t key = cacheKey (bvh, settings);
+  const uint64_t vertices = count;
+  std::memcpy (data.data (), kMagic, 4);
+  std::memcpy (data.data () + 4, &kVersion, 4);
+  std::memcpy (data.data () + 8, &key, 8);
+  std::memcpy (data.data () + 16, &vertices, 8);
+
+  // Vertices back in BVH order
+  unsigned char *bytes
+      = reinterpret_cast<unsigned char *> (data.data ()) + kHeaderSize;
+  for (size_t k = 0; k < bvh.meshCount (); k++)
+    {
+      const size_t mesh = (size_t)bvh.sceneMesh (k);
+      if (mesh >= result.perMesh.size ())
+        continue;
+      const std::vector<float> &values = result.perMesh[mesh];
+      const size_t first = bvh.firstVertex (k);
+      for (size_t v = 0; v < values.size () && first + v < count; v++)
+        bytes[first + v] = (unsigned char)std::lround (
+            std::clamp (values[v], 0.0f, 1.0f) * 255.0f);
+    }
+
+  // Written atomically so a crash never leaves a truncated entry behind
+  QSaveFile file (cachePath (modelPath));
+  if (!file.open (QIODevice::WriteOnly) || file.write (data) != data.size ()
+      || !file.commit ())
+    {
+      if (errorMsg)
+        *errorMsg = file.errorString ();
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef AOBAKER_H
+#define AOBAKER_H
+
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+class MeshBVH;
+
+struct AoBakeResult
+{
+  // Unoccluded fraction per vertex (1 = open sky) by SceneData::meshes
+  // index, written to the G-buffer AO channel. Empty for submeshes whose
+  // geometry lives in another one.
+  std::vector<std::vector<float>> perMesh;
+  uint64_t rays = 0;
+  double bakeMs = 0.0; // Tracing only; 0 when read from the cache
+
+  double
+  raysPerSecond () const
+  {
+    return bakeMs > 0.0 ? rays / (bakeMs / 1000.0) : 0.0;
+  }
+};
+
+// Baked per-vertex ambient occlusion.
+//
+// Every vertex of the picking BVH shoots cosine-distributed rays over the
+// hemisphere around its area-weighted normal (a Hammersley set, rotated
+// per vertex to trade banding for noise), four per packet through
+// MeshBVH::occluded, vertices spread over the pool. The fraction of rays
+// that escape within the occlusion distance is the vertex's AO.
+//
+// Results are cached next to the model as "<model>.ao", keyed by a hash of
+// the BVH positions and the settings, at 8 bits per vertex.
+class AoBaker
+{
+public:
+  struct Settings
+  {
+    int raysPerVertex = 64; // Rounded up to whole packets
+    float distance = 0.0f;  // Occluder range, 0 = a tenth of the diagonal
+  };
+
+  static AoBakeResult bake (const MeshBVH &bvh, const Settings &settings);
+
+  static QString cachePath (const QString &modelPath);
+
+  // False (and result untouched) without a cache entry that matches
+  static bool loadCache (const QString &modelPath, const MeshBVH &bvh,
+                         const Settings &settings, AoBakeResult *result);
+  static bool saveCache (const QString &modelPath, const MeshBVH &bvh,
+                         const Settings &settings,
+                         const AoBakeResult &result, QString *errorMsg);
+};
+
+#endif // AOBAKER_H
@@ -0,0 +1,452 @@
+#include "batchrenderer.h"
+#include "camera.h"
+#include "deferredrenderer.h"
+#include "gltfloader.h"
+#include "textureprocessor.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonDocument>
+#include <QMutex>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QSemaphore>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <glm/gtc/constants.hpp>
+#include <memory>
+#include <vector>
+
+namespace
+{
+// Readbacks in flight before the render thread waits for the oldest one.
+const int kReadbackRing = 3;
+
+// Encoded images queued before the render thread blocks, bounds memory when
+// encoding is slower than rendering.
+const int kMaxPendingImages = 32;
+
+struct LoadSlot
+{
+  std::unique_ptr<SceneData> data;
+  QString error;
+  double loadMs = 0.0;
+  bool done = false;
+};
+
+struct Readback
+{
+  unsigned int pbo = 0;
+  GLsync fence = nullptr;
+  QString path;
+};
+}
+
+int
+BatchRenderer::runFromCommandLine (const QStringList &arguments)
+{
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy batch thumbnail renderer");
+  parser.addHelpOption ();
+
+  QCommandLineOption batchOpt ("batch", "Batch rendering mode.");
+  QCommandLineOption outOpt ("out", "Output directory.", "dir");
+  QCommandLineOption sizeOpt ("size", "Image size.", "WxH", "512x512");
+  QCommandLineOption framesOpt ("frames", "Turntable frames per model.",
+                                "count", "1");
+  QCommandLineOption loadersOpt ("loaders", "Loader threads.", "count", "0");
+  QCommandLineOption lookaheadOpt ("lookahead",
+                                   "Models loaded ahead of the renderer.",
+                                   "count", "4");
+  parser.addOptions (
+      { batchOpt, outOpt, sizeOpt, framesOpt, loadersOpt, lookaheadOpt });
+  parser.addPositionalArgument ("inputs", "Models, directories or @lists.");
+  parser.process (arguments);
+
+  Options options;
+  options.inputs = parser.positionalArguments ();
+  options.outputDir = parser.value (outOpt);
+  options.frames = parser.value (framesOpt).toInt ();
+  options.loaderThreads = parser.value (loadersOpt).toInt ();
+  options.lookahead = std::max (1, parser.value (lookaheadOpt).toInt ());
+
+  const QStringList dims = parser.value (sizeOpt).split ('x');
+  if (dims.size () == 2)
+    options.size = QSize (dims[0].toInt (), dims[1].toInt ());
+
+  if (options.inputs.isEmpty () || options.outputDir.isEmpty ()
+      || options.frames <= 0 || options.size.isEmpty ())
+    {
+      std::fprintf (stderr,
+                    "Usage: mesh-spy --batch --out DIR [--size WxH] "
+                    "[--frames N] [--loaders N] [--lookahead N] inputs...\n");
+      return 2;
+    }
+
+  QString errorMsg;
+  QJsonObject report = run (options, &errorMsg);
+  if (report.isEmpty ())
+    {
+      std::fprintf (stderr, "Batch failed: %s\n", qPrintable (errorMsg));
+      return 1;
+    }
+
+  std::fputs (QJsonDocument (report).toJson (QJsonDocument::Indented)
+                  .constData (),
+              stdout);
+  return report["failed"].toInt () + report["imageFailures"].toInt () > 0
+             ? 1
+             : 0;
+}
+
+QStringList
+BatchRenderer::collectInputs (const QStringList &inputs)
+{
+  QStringList paths;
+  for (const QString &input : inputs)
+    {
+      if (input.startsWith ('@'))
+        {
+          QFile list (input.mid (1));
+          if (!list.open (QIODevice::ReadOnly | QIODevice::Text))
+            {
+              std::fprintf (stderr, "Cannot open list %s\n",
+                            qPrintable (list.fileName ()));
+              continue;
+            }
+          QTextStream stream (&list);
+          while (!stream.atEnd ())
+            {
+              const QString line = stream.readLine ().trimmed ();
+              if (!line.isEmpty () && !line.startsWith ('#'))
+                paths.append (line);
+            }
+        }
+      else if (QFileInfo (input).isDir ())
+        {
+          QStringList found;
+          QDirIterator it (input, { "*.glb", "*.gltf" }, QDir::Files,
+                           QDirIterator::Subdirectories);
+          while (it.hasNext ())
+            found.append (it.next ());
+          found.sort ();
+          paths.append (found);
+        }
+      else
+        {
+          paths.append (input);
+        }
+    }
+  return paths;
+}
+
+QJsonObject
+BatchRenderer::run (const Options &options, QString *errorMsg)
+{
+  const QStringList inputs = collectInputs (options.inputs);
+  if (inputs.isEmpty ())
+    {
+      *errorMsg = "No models found.";
+      return QJsonObject ();
+    }
+
+  QDir outDir (options.outputDir);
+  if (!outDir.mkpath ("."))
+    {
+      *errorMsg = "Cannot create " + options.outputDir;
+      return QJsonObject ();
+    }
+
+  QOpenGLContext context;
+  context.setFormat (QSurfaceFormat::defaultFormat ());
+  if (!context.create ())
+    {
+      *errorMsg = "Could not create an OpenGL context.";
+      return QJsonObject ();
+    }
+
+  QOffscreenSurface surface;
+  surface.setFormat (context.format ());
+  surface.create ();
+  if (!context.makeCurrent (&surface))
+    {
+      *errorMsg = "Could not make the offscreen context current.";
+      return QJsonObject ();
+    }
+
+  QOpenGLExtraFunctions *gl = context.extraFunctions ();
+  const int width = options.size.width ();
+  const int height = options.size.height ();
+  const size_t imageBytes = (size_t)width * height * 4;
+  const int modelCount = (int)inputs.size ();
+
+  // Loaders encode textures for whatever this context samples
+  LoaderOptions loaderOptions;
+  loaderOptions.textureCodecs = TextureProcessor::supportedCodecs (&context);
+
+  // 1. Shared state. Declared before the pools so the pools (which wait
+  // for their tasks on destruction) go away first.
+  QMutex mutex;
+  QWaitCondition loaded;
+  std::vector<LoadSlot> loadSlots (modelCount);
+  QSemaphore encodeSlots (kMaxPendingImages);
+  std::atomic<qint64> encodeNs{ 0 };
+  std::atomic<int> encodeFailures{ 0 };
+
+  QThreadPool loaderPool;
+  int loaderThreads = options.loaderThreads;
+  if (loaderThreads <= 0)
+    loaderThreads = std::max (1, QThread::idealThreadCount () - 1);
+  loaderPool.setMaxThreadCount (loaderThreads);
+
+  QThreadPool encodePool;
+  encodePool.setMaxThreadCount (std::max (1, QThread::idealThreadCount ()));
+
+  auto submitLoad = [&] (int index) {
+    if (index >= modelCount)
+      return;
+    loaderPool.start ([&, index] () {
+      QElapsedTimer timer;
+      timer.start ();
+      QString error;
+      std::unique_ptr<SceneData> data (
+          GLTFLoader::load (inputs[index], &error, loaderOptions));
+      double ms = timer.nsecsElapsed () / 1.0e6;
+
+      QMutexLocker locker (&mutex);
+      loadSlots[index].data = std::move (data);
+      loadSlots[index].error = error;
+      loadSlots[index].loadMs = ms;
+      loadSlots[index].done = true;
+      loaded.wakeAll ();
+    });
+  };
+
+  // Output names: base name, made unique across directories
+  QStringList names;
+  {
+    QSet<QString> used;
+    for (const QString &path : inputs)
+      {
+        const QString base = QFileInfo (path).completeBaseName ();
+        QString name = base;
+        for (int n = 2; used.contains (name); n++)
+          name = QString ("%1-%2").arg (base).arg (n);
+        used.insert (name);
+        names.append (name);
+      }
+  }
+
+  int rendered = 0;
+  int failed = 0;
+  double loadMsTotal = 0.0;
+  double uploadMsTotal = 0.0;
+  double renderMsTotal = 0.0;
+  double stallMs = 0.0;
+
+  QElapsedTimer wall;
+  wall.start ();
+
+  for (int i = 0; i < std::min (options.lookahead, modelCount); i++)
+    submitLoad (i);
+
+  {
+    QOpenGLFramebufferObject target (
+        options.size, QOpenGLFramebufferObject::CombinedDepthStencil);
+    if (!target.isValid ())
+      {
+        *errorMsg = "Could not create the offscreen framebuffer.";
+        loaderPool.waitForDone ();
+        context.doneCurrent ();
+        return QJsonObject ();
+      }
+
+    Camera camera;
+    camera.setViewportSize (width, height);
+
+    DeferredRenderer renderer;
+    renderer.init (width, height);
+    renderer.setTargetFramebuffer (target.handle ());
+
+    // 2. Readback ring
+    std::vector<Readback> ring (kReadbackRing);
+    for (Readback &rb : ring)
+      {
+        gl->glGenBuffers (1, &rb.pbo);
+        gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, rb.pbo);
+        gl->glBufferData (GL_PIXEL_PACK_BUFFER, (GLsizeiptr)imageBytes,
+                          nullptr, GL_STREAM_READ);
+      }
+    gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+    int ringIndex = 0;
+
+    // Waits for a readback, copies the pixels out and hands them to the
+    // encoder pool.
+    auto finishReadback = [&] (Readback &rb) {
+      if (!rb.fence)
+        return;
+      gl->glClientWaitSync (rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            GL_TIMEOUT_IGNORED);
+      gl->glDeleteSync (rb.fence);
+      rb.fence = nullptr;
+
+      QImage image (width, height, QImage::Format_RGBA8888);
+      gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, rb.pbo);
+      const void *pixels = gl->glMapBufferRange (
+          GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)imageBytes, GL_MAP_READ_BIT);
+      if (pixels)
+        std::memcpy (image.bits (), pixels, imageBytes);
+      gl->glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+      gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+      if (!pixels)
+        {
+          encodeFailures++;
+          return;
+        }
+
+      encodeSlots.acquire ();
+      const QString path = rb.path;
+      encodePool.start ([&, image, path] () {
+        QElapsedTimer timer;
+        timer.start ();
+        // GL rows start at the bottom
+        QImage out = image.mirrored (false, true).convertToFormat (
+            QImage::Format_RGB888);
+        if (!out.save (path, "PNG"))
+          encodeFailures++;
+        encodeNs += timer.nsecsElapsed ();
+        encodeSlots.release ();
+      });
+    };
+
+    auto issueReadback = [&] (const QString &path) {
+      Readback &rb = ring[ringIndex];
+      ringIndex = (ringIndex + 1) % kReadbackRing;
+      finishReadback (rb);
+
+      gl->glBindFramebuffer (GL_READ_FRAMEBUFFER, target.handle ());
+      gl->glReadBuffer (GL_COLOR_ATTACHMENT0);
+      gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, rb.pbo);
+      gl->glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                        nullptr);
+      gl->glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+      rb.fence = gl->glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      rb.path = path;
+    };
+
+    // 3. Render models in input order as they become available
+    for (int i = 0; i < modelCount; i++)
+      {
+        QElapsedTimer timer;
+        timer.start ();
+        std::unique_ptr<SceneData> data;
+        QString error;
+        {
+          QMutexLocker locker (&mutex);
+          while (!loadSlots[i].done)
+            loaded.wait (&mutex);
+          data = std::move (loadSlots[i].data);
+          error = loadSlots[i].error;
+          loadMsTotal += loadSlots[i].loadMs;
+        }
+        stallMs += timer.nsecsElapsed () / 1.0e6;
+        submitLoad (i + options.lookahead);
+
+        if (!data)
+          {
+            std::fprintf (stderr, "Skipping %s: %s\n", qPrintable (inputs[i]),
+                          qPrintable (error));
+            failed++;
+            continue;
+          }
+
+        timer.restart ();
+        renderer.loadModel (data.get ());
+        uploadMsTotal += timer.nsecsElapsed () / 1.0e6;
+
+        glm::vec3 center = (data->minBounds + data->maxBounds) * 0.5f;
+        float size = glm::length (data->maxBounds - data->minBounds);
+        data.reset ();
+        camera.setTarget (center);
+        camera.setDistance (size * 1.25f);
+
+        QString stem = outDir.filePath (names[i]);
+        if (options.frames > 1)
+          {
+            outDir.mkpath (names[i]);
+            stem = outDir.filePath (names[i] + "/" + names[i]);
+          }
+
+        timer.restart ();
+        for (int f = 0; f < options.frames; f++)
+          {
+            float theta = glm::quarter_pi<float> ()
+                          + glm::two_pi<float> () * f / options.frames;
+            camera.setAngles (theta, glm::radians (65.0f));
+            renderer.render (&camera, 0.0f);
+
+            issueReadback (options.frames > 1
+                               ? QString ("%1_%2.png")
+                                     .arg (stem)
+                                     .arg (f, 3, 10, QChar ('0'))
+                               : stem + ".png");
+          }
+        renderMsTotal += timer.nsecsElapsed () / 1.0e6;
+        rendered++;
+      }
+
+    // 4. Drain
+    for (int i = 0; i < kReadbackRing; i++)
+      {
+        finishReadback (ring[ringIndex]);
+        ringIndex = (ringIndex + 1) % kReadbackRing;
+      }
+    for (Readback &rb : ring)
+      gl->glDeleteBuffers (1, &rb.pbo);
+  }
+
+  encodePool.waitForDone ();
+  double wallMs = wall.nsecsElapsed () / 1.0e6;
+  context.doneCurrent ();
+
+  if (rendered == 0)
+    {
+      *errorMsg = "No model could be loaded.";
+      return QJsonObject ();
+    }
+
+  const double images = (double)rendered * options.frames;
+
+  QJsonObject report;
+  report["models"] = rendered;
+  report["failed"] = failed;
+  report["imageFailures"] = encodeFailures.load ();
+  report["frames"] = options.frames;
+  report["width"] = width;
+  report["height"] = height;
+  report["loaderThreads"] = loaderThreads;
+  report["encoderThreads"] = encodePool.maxThreadCount ();
+  report["wallMs"] = wallMs;
+  report["modelsPerMinute"] = rendered / (wallMs / 60000.0);
+  report["imagesPerSecond"] = images / (wallMs / 1000.0);
+  report["loadMsAvg"] = loadMsTotal / modelCount;
+  report["uploadMsAvg"] = uploadMsTotal / rendered;
+  report["renderMsAvg"] = renderMsTotal / rendered;
+  report["encodeMsAvg"] = encodeNs.load () / 1.0e6 / images;
+  report["loaderStallMs"] = stallMs;
+  return report;
+}
@@ -0,0 +1,43 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+// Headless thumbnail / turntable renderer for whole asset libraries.
+//
+// A pool of loader threads parses models ahead of the render thread (bounded
+// by the lookahead), the render thread uploads and draws each model with the
+// regular DeferredRenderer into an offscreen FBO, frames are read back
+// through a ring of pixel pack buffers and PNG encoding runs on a second
+// pool, so parsing, GPU work and encoding overlap.
+class BatchRenderer
+{
+public:
+  struct Options
+  {
+    QStringList inputs; // Files, directories (searched recursively) or
+                        // "@list.txt" files with one path per line
+    QString outputDir;
+    QSize size = QSize (512, 512);
+    int frames = 1;        // 1 = thumbnail, N = turntable of N frames
+    int loaderThreads = 0; // 0 = ideal thread count - 1
+    int lookahead = 4;     // Models loaded ahead of the renderer
+  };
+
+  // Parses "--batch --out DIR [--size WxH] [--frames N] [--loaders N]
+  // [--lookahead N] inputs...", runs the batch and prints the JSON report to
+  // stdout. Returns the process exit code.
+  static int runFromCommandLine (const QStringList &arguments);
+
+  // Returns an empty object and fills errorMsg when nothing could be
+  // rendered; individual model failures are counted in the report.
+  static QJsonObject run (const Options &options, QString *errorMsg);
+
+  // Expands directories and list files into model paths.
+  static QStringList collectInputs (const QStringList &inputs);
+};
+
+#endif // BATCHRENDERER_H
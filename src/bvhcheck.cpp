@@ -0,0 +1,334 @@
+// MeshBVH correctness check: picking rays (intersect, occluded) and
+// closest-point queries over a synthetic scene against a brute-force scan
+// of every triangle. The scene is large enough for the binned top levels
+// on the thread pool and the appended per-task subtrees.
+//
+//   mesh-spy-bvhcheck [--rays N] [--seed N]
+//
+// Exit code: 0 = pass, 1 = mismatch.
+
+#include "meshbvh.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+struct Triangle
+{
+  int mesh;
+  unsigned int triangle;
+  glm::vec3 a, b, c;
+};
+
+SubMesh
+floatMesh (const std::vector<glm::vec3> &positions,
+           std::vector<unsigned int> indices)
+{
+  SubMesh mesh;
+  mesh.layout.position.components = 3;
+  mesh.layout.position.type = ComponentFloat;
+  mesh.layout.stride = sizeof (glm::vec3);
+  mesh.vertexCount = positions.size ();
+  mesh.vertexData.resize (positions.size () * sizeof (glm::vec3));
+  std::copy_n (reinterpret_cast<const unsigned char *> (positions.data ()),
+               mesh.vertexData.size (), mesh.vertexData.data ());
+  mesh.indices = std::move (indices);
+  for (const glm::vec3 &p : positions)
+    {
+      mesh.minBounds = glm::min (mesh.minBounds, p);
+      mesh.maxBounds = glm::max (mesh.maxBounds, p);
+    }
+  return mesh;
+}
+
+// n x n quads of a wavy height field, `size` wide, starting at `origin`
+// and rising by `lean` per unit along X
+SubMesh
+wavyGrid (int n, float size, const glm::vec3 &origin, float phase,
+          float lean)
+{
+  std::vector<glm::vec3> positions;
+  for (int y = 0; y <= n; y++)
+    for (int x = 0; x <= n; x++)
+      {
+        const float u = x * size / n, v = y * size / n;
+        const float height
+            = std::sin (u * 0.3f + phase) * std::cos (v * 0.2f) + u * lean;
+        positions.push_back (origin + glm::vec3 (u, height, v));
+      }
+  std::vector<unsigned int> indices;
+  for (int y = 0; y < n; y++)
+    for (int x = 0; x < n; x++)
+      {
+        const unsigned int a = y * (n + 1) + x, b = a + 1, c = a + n + 1,
+                           d = c + 1;
+        indices.insert (indices.end (), { a, c, b, b, c, d });
+      }
+  return floatMesh (positions, std::move (indices));
+}
+
+// Small triangles scattered through `min`..`max`, overlapping the grids
+SubMesh
+soup (size_t count, const glm::vec3 &min, const glm::vec3 &max,
+      std::mt19937 &random)
+{
+  std::uniform_real_distribution<float> unit (0.0f, 1.0f);
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  for (size_t t = 0; t < count; t++)
+    {
+      const glm::vec3 center
+          = min + (max - min) * glm::vec3 (unit (random), unit (random),
+                                           unit (random));
+      for (int k = 0; k < 3; k++)
+        {
+          indices.push_back ((unsigned int)positions.size ());
+          positions.push_back (center
+                               + glm::vec3 (unit (random), unit (random),
+                                            unit (random))
+                                     - 0.5f);
+        }
+    }
+  return floatMesh (positions, std::move (indices));
+}
+
+// Möller-Trumbore, both faces; FLT_MAX on a miss
+float
+rayTriangle (const glm::vec3 &o, const glm::vec3 &d, const Triangle &tri)
+{
+  const glm::vec3 e1 = tri.b - tri.a, e2 = tri.c - tri.a;
+  const glm::vec3 p = glm::cross (d, e2);
+  const float det = glm::dot (e1, p);
+  if (det == 0.0f)
+    return FLT_MAX;
+  const float invDet = 1.0f / det;
+  const glm::vec3 s = o - tri.a;
+  const float u = glm::dot (s, p) * invDet;
+  if (u < 0.0f || u > 1.0f)
+    return FLT_MAX;
+  const glm::vec3 q = glm::cross (s, e1);
+  const float v = glm::dot (d, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f)
+    return FLT_MAX;
+  const float t = glm::dot (e2, q) * invDet;
+  return t >= 0.0f ? t : FLT_MAX;
+}
+
+// Ericson's region test
+glm::vec3
+closestOnTriangle (const glm::vec3 &p, const Triangle &tri)
+{
+  const glm::vec3 ab = tri.b - tri.a, ac = tri.c - tri.a, ap = p - tri.a;
+  const float d1 = glm::dot (ab, ap), d2 = glm::dot (ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f)
+    return tri.a;
+  const glm::vec3 bp = p - tri.b;
+  const float d3 = glm::dot (ab, bp), d4 = glm::dot (ac, bp);
+  if (d3 >= 0.0f && d4 <= d3)
+    return tri.b;
+  const float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    return tri.a + ab * (d1 / (d1 - d3));
+  const glm::vec3 cp = p - tri.c;
+  const float d5 = glm::dot (ab, cp), d6 = glm::dot (ac, cp);
+  if (d6 >= 0.0f && d5 <= d6)
+    return tri.c;
+  const float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    return tri.a + ac * (d2 / (d2 - d6));
+  const float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+    return tri.b + (tri.c - tri.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  const float denom = 1.0f / (va + vb + vc);
+  return tri.a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+const Triangle *
+find (const std::vector<Triangle> &triangles, const BvhHit &hit)
+{
+  for (const Triangle &tri : triangles)
+    if (tri.mesh == hit.mesh && tri.triangle == hit.triangle)
+      return &tri;
+  return nullptr;
+}
+
+bool
+report (const char *what, size_t failures, size_t queries)
+{
+  if (failures)
+    std::printf ("%-28s FAIL (%zu of %zu)\n", what, failures, queries);
+  else
+    std::printf ("%-28s PASS\n", what);
+  return failures == 0;
+}
+
+} // namespace
+
+int
+main (int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy BVH check");
+  parser.addHelpOption ();
+  QCommandLineOption raysOpt ("rays", "Rays and points queried.", "count",
+                              "256");
+  QCommandLineOption seedOpt ("seed", "Random scene and queries.", "n", "1");
+  parser.addOptions ({ raysOpt, seedOpt });
+  parser.process (app);
+
+  const size_t queries
+      = std::max (4, parser.value (raysOpt).toInt ()) / 4 * 4;
+  std::mt19937 random (parser.value (seedOpt).toUInt ());
+
+  // 1. Two grid tiles, one tilted through the other, and a triangle soup
+  // across both, inserted twice: once on its own and once sharing the
+  // first copy's geometry (skipped by the BVH). Over 64K triangles, so
+  // the top levels are binned on the pool and the rest appended.
+  SceneData scene;
+  scene.meshes.push_back (
+      wavyGrid (160, 40.0f, glm::vec3 (0.0f), 0.0f, 0.0f));
+  scene.meshes.push_back (
+      wavyGrid (120, 40.0f, glm::vec3 (10.0f, -1.0f, 5.0f), 1.0f, 0.1f));
+  scene.meshes.push_back (soup (20000, glm::vec3 (-5.0f, -3.0f, -5.0f),
+                                glm::vec3 (55.0f, 6.0f, 50.0f), random));
+  scene.meshes.push_back (scene.meshes[2]);
+  scene.meshes[3].sharedGeometry = 2;
+  scene.meshes[3].vertexData.clear ();
+  scene.meshes[3].indices.clear ();
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    scene.meshes[m].materialIndex = (int)m;
+
+  MeshBVH bvh;
+  bvh.build (scene);
+
+  std::vector<Triangle> triangles;
+  glm::vec3 min (FLT_MAX), max (-FLT_MAX);
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene.meshes[m];
+      if (mesh.sharedGeometry >= 0)
+        continue;
+      for (size_t t = 0; t < mesh.indices.size () / 3; t++)
+        triangles.push_back (
+            { (int)m, (unsigned int)t, mesh.position (mesh.indices[t * 3]),
+              mesh.position (mesh.indices[t * 3 + 1]),
+              mesh.position (mesh.indices[t * 3 + 2]) });
+      min = glm::min (min, mesh.minBounds);
+      max = glm::max (max, mesh.maxBounds);
+    }
+  const float tolerance = 1.0e-5f * glm::length (max - min);
+  std::printf ("%zu triangles, %zu nodes, built in %.1f ms\n",
+               bvh.triangleCount (), bvh.nodeCount (), bvh.buildMs ());
+  const bool counted = bvh.triangleCount () == triangles.size ();
+  bool ok = report ("triangle count", !counted, 1);
+
+  // 2. Rays from around the scene towards points inside it, four to a
+  // packet; the last lane of every other packet is left unset, and some
+  // rays are cut short by tMax
+  std::uniform_real_distribution<float> unit (0.0f, 1.0f);
+  auto inside = [&] (float margin) {
+    const glm::vec3 extent = (max - min) * (1.0f + 2.0f * margin);
+    return min - (max - min) * margin
+           + extent * glm::vec3 (unit (random), unit (random), unit (random));
+  };
+
+  size_t pickFailures = 0, occludedFailures = 0, misses = 0;
+  for (size_t first = 0; first < queries; first += 4)
+    {
+      RayPacket packet;
+      float expected[4];
+      const int lanes = (first / 4) % 2 ? 3 : 4;
+      for (int lane = 0; lane < lanes; lane++)
+        {
+          const glm::vec3 from = inside (0.5f);
+          const glm::vec3 dir = glm::normalize (inside (0.1f) - from);
+          const float tMax
+              = lane == 2 ? glm::length (max - min) * unit (random) : FLT_MAX;
+          packet.set (lane, from, dir, tMax);
+
+          expected[lane] = FLT_MAX;
+          for (const Triangle &tri : triangles)
+            expected[lane] = std::min (expected[lane],
+                                       rayTriangle (from, dir, tri));
+          if (expected[lane] >= tMax)
+            expected[lane] = FLT_MAX;
+        }
+
+      const std::array<BvhHit, 4> hits = bvh.intersect (packet);
+      const int blocked = bvh.occluded (packet);
+      for (int lane = 0; lane < 4; lane++)
+        {
+          const BvhHit &hit = hits[lane];
+          if (lane >= lanes || expected[lane] == FLT_MAX)
+            {
+              misses += lane < lanes;
+              pickFailures += hit.mesh >= 0;
+              occludedFailures += (blocked >> lane) & 1;
+              continue;
+            }
+
+          // Ties may pick either triangle, but the one reported must be
+          // hit at the reported distance
+          const glm::vec3 from (packet.origin[0][lane],
+                                packet.origin[1][lane],
+                                packet.origin[2][lane]);
+          const glm::vec3 dir (packet.direction[0][lane],
+                               packet.direction[1][lane],
+                               packet.direction[2][lane]);
+          const Triangle *tri = find (triangles, hit);
+          const bool same
+              = tri && std::abs (hit.distance - expected[lane]) <= tolerance
+                && std::abs (rayTriangle (from, dir, *tri) - hit.distance)
+                       <= tolerance
+                && hit.material == tri->mesh
+                && glm::length (hit.point - (from + dir * hit.distance))
+                       <= tolerance;
+          pickFailures += !same;
+          occludedFailures += !((blocked >> lane) & 1);
+        }
+    }
+  std::printf ("%zu rays, %zu misses\n", queries - queries / 8, misses);
+  ok = report ("intersect", pickFailures, queries) && ok;
+  ok = report ("occluded", occludedFailures, queries) && ok;
+
+  // 3. Points in and around the scene, each also asked with a maximum
+  // distance just short of its closest one, which must miss
+  size_t pointFailures = 0, limitFailures = 0;
+  for (size_t q = 0; q < queries; q++)
+    {
+      const glm::vec3 p = inside (0.2f);
+      float expected = FLT_MAX;
+      for (const Triangle &tri : triangles)
+        {
+          const glm::vec3 c = closestOnTriangle (p, tri);
+          expected = std::min (expected, glm::length (p - c));
+        }
+
+      const BvhHit hit = bvh.closestPoint (p);
+      const Triangle *tri = find (triangles, hit);
+      const bool same
+          = tri && std::abs (std::abs (hit.distance) - expected) <= tolerance
+            && glm::length (closestOnTriangle (p, *tri) - hit.point)
+                   <= tolerance
+            && std::abs (glm::length (p - hit.point) - expected)
+                   <= tolerance;
+      pointFailures += !same;
+
+      if (expected > 2.0f * tolerance)
+        limitFailures += bvh.closestPoint (p, expected - tolerance).mesh >= 0;
+    }
+  ok = report ("closestPoint", pointFailures, queries) && ok;
+  ok = report ("closestPoint maxDistance", limitFailures, queries) && ok;
+
+  std::printf ("\n%s\n", ok ? "All checks passed." : "BVH mismatch.");
+  return ok ? 0 : 1;
+}
@@ -30,6 +30,15 @@ Camera::setDistance (float distance)
   updateVectors ();
 }
 
+void
+Camera::setAngles (float theta, float phi)
+{
+  const float epsilon = 0.001f;
+  m_theta = theta;
+  m_phi = std::clamp (phi, epsilon, glm::pi<float> () - epsilon);
+  updateVectors ();
+}
+
 void
 Camera::rotate (float dTheta, float dPhi)
 {
@@ -43,6 +52,26 @@ Camera::rotate (float dTheta, float dPhi)
   updateVectors ();
 }
 
+void
+Camera::rotateAround (const glm::vec3 &pivot, float dTheta, float dPhi)
+{
+  const float epsilon = 0.001f;
+  const float phi
+      = std::clamp (m_phi - dPhi, epsilon, glm::pi<float> () - epsilon);
+
+  // Yaw about world Y and pitch about the right axis, the two rotations
+  // rotate() applies to the eye offset. Moving the target with them keeps
+  // the eye offset consistent with the new angles.
+  const glm::mat4 rotation
+      = glm::rotate (glm::mat4 (1.0f), dTheta, glm::vec3 (0.0f, 1.0f, 0.0f))
+        * glm::rotate (glm::mat4 (1.0f), phi - m_phi, m_right);
+  m_target = pivot + glm::vec3 (rotation * glm::vec4 (m_target - pivot, 0.0f));
+  m_theta += dTheta;
+  m_phi = phi;
+
+  updateVectors ();
+}
+
 void
 Camera::pan (float dx, float dy)
 {
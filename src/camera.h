@@ -13,9 +13,12 @@ public:
   void setViewportSize (int width, int height);
   void setTarget (const glm::vec3 &target);
   void setDistance (float distance);
+  void setAngles (float theta, float phi); // Absolute orbit position
 
   // Input Processing
   void rotate (float dTheta, float dPhi); // Orbit
+  // Same angles as rotate(), orbiting a world point instead of the target
+  void rotateAround (const glm::vec3 &pivot, float dTheta, float dPhi);
   void pan (float dx, float dy);
   void zoom (float dDistance);
 
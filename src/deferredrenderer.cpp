@@ -1,14 +1,19 @@
 #include "deferredrenderer.h"
+#include "animator.h"
 #include "camera.h"
 #include "deferredrenderer.h"
-#include "gbuffer.h"
+#include "frameconstants.h"
+#include "geometryprograms.h"
+#include "shadercache.h"
+#include "skinningpass.h"
+#include "stagingring.h"
 #include <QDebug>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 DeferredRenderer::DeferredRenderer ()
-    : m_geomShader (nullptr), m_lightShader (nullptr), m_width (800),
+    : m_lightShader (nullptr), m_width (800),
       m_height (600)
 {
 }
@@ -32,8 +37,11 @@ DeferredRenderer::init (int width, int height)
   m_width = width;
   m_height = height;
 
-  m_gBuffer = std::make_unique<GBuffer> ();
-  m_gBuffer->init (width, height);
+  m_graph = std::make_unique<RenderGraph> ();
+  m_graph->init ();
+
+  m_shaderCache = std::make_unique<ShaderCache> ();
+  m_shaderCache->init ();
 
   initShaders ();
   initQuad ();
@@ -41,7 +49,25 @@ DeferredRenderer::init (int width, int height)
 
   // Init Skybox
   m_skybox = std::make_unique<Skybox> ();
-  m_skybox->init ();
+  m_skybox->init (m_shaderCache.get ());
+
+  const ShaderCacheStats &cacheStats = m_shaderCache->stats ();
+  qDebug () << "Shaders ready in" << cacheStats.totalMs << "ms (cache hits"
+            << cacheStats.hits << "misses" << cacheStats.misses << "rejected"
+            << cacheStats.rejected << ")";
+
+  m_profiler = std::make_unique<Profiler> ();
+  m_profiler->init ();
+
+  m_frameConstants = std::make_unique<UniformRing> ();
+  m_frameConstants->init (sizeof (FrameConstants));
+
+  m_skinning = std::make_unique<SkinningPass> ();
+  if (!m_skinning->init ())
+    {
+      qWarning () << "No compute shaders: animated models stay in bind pose";
+      m_skinning.reset ();
+    }
 }
 
 void
@@ -49,32 +75,26 @@ DeferredRenderer::resize (int width, int height)
 {
   m_width = width;
   m_height = height;
-  if (m_gBuffer)
-    {
-      m_gBuffer->resize (width, height);
-    }
+  // The render graph reallocates its targets on the next frame
 }
 
 void
 DeferredRenderer::initShaders ()
 {
-  m_geomShader = new QOpenGLShaderProgram ();
-  if (!m_geomShader->addShaderFromSourceFile (QOpenGLShader::Vertex,
-                                              ":/shaders/geometry.vert"))
-    qDebug () << "Geom Vert Error:" << m_geomShader->log ();
-  if (!m_geomShader->addShaderFromSourceFile (QOpenGLShader::Fragment,
-                                              ":/shaders/geometry.frag"))
-    qDebug () << "Geom Frag Error:" << m_geomShader->log ();
-  m_geomShader->link ();
-
-  m_lightShader = new QOpenGLShaderProgram ();
-  if (!m_lightShader->addShaderFromSourceFile (QOpenGLShader::Vertex,
-                                               ":/shaders/lighting.vert"))
-    qDebug () << "Light Vert Error:" << m_lightShader->log ();
-  if (!m_lightShader->addShaderFromSourceFile (QOpenGLShader::Fragment,
-                                               ":/shaders/lighting.frag"))
-    qDebug () << "Light Frag Error:" << m_lightShader->log ();
-  m_lightShader->link ();
+  // Geometry programs are specialized per material feature set and built
+  // on demand.
+  m_geomPrograms = std::make_unique<GeometryPrograms> (m_shaderCache.get ());
+  m_geomPrograms->init ();
+
+  m_lightShader = m_shaderCache->program (":/shaders/lighting.vert",
+                                          ":/shaders/lighting.frag");
+
+  // Camera position comes from the FrameConstants uniform block
+  GLuint block = glGetUniformBlockIndex (m_lightShader->programId (),
+                                         "FrameConstants");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding (m_lightShader->programId (), block,
+                           kFrameConstantsBinding);
 
   m_lightShader->bind ();
   m_lightShader->setUniformValue ("gPosition", 0);
@@ -82,6 +102,13 @@ DeferredRenderer::initShaders ()
   m_lightShader->setUniformValue ("gAlbedo", 2);
   m_lightShader->setUniformValue ("gPBR", 3);
   m_lightShader->release ();
+
+  m_compositeShader = m_shaderCache->program (":/shaders/lighting.vert",
+                                              ":/shaders/oitcomposite.frag");
+  m_compositeShader->bind ();
+  m_compositeShader->setUniformValue ("accumTexture", 0);
+  m_compositeShader->setUniformValue ("revealageTexture", 1);
+  m_compositeShader->release ();
 }
 
 void
@@ -171,70 +198,180 @@ DeferredRenderer::initTestCube ()
 void
 DeferredRenderer::render (Camera *camera, float modelRotationY)
 {
-  // 1. Geometry Pass
-  m_gBuffer->bindWrite ();
-  glClearColor (0.0f, 0.0f, 0.0f, 0.0f); // Clear to black/empty
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glEnable (GL_DEPTH_TEST);
+  m_profiler->beginFrame ();
 
-  if (camera)
+  // Overlays painted with QPainter after the previous frame may leave
+  // blending and scissoring enabled.
+  glDisable (GL_BLEND);
+  glDisable (GL_SCISSOR_TEST);
+
+  if (m_model && m_model->uploadPending ())
     {
-      renderGeometryPass (camera, modelRotationY);
+      ProfileScope scope (m_profiler.get (), "Upload");
+      m_model->uploadStep (m_stagingRing.get (), m_uploadBudgetMs);
     }
 
-  // 2. Lighting Pass
-  // 2. Lighting Pass (Render to default framebuffer)
-  glBindFramebuffer (GL_FRAMEBUFFER, 0);
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glDisable (GL_DEPTH_TEST);
+  updateFrameConstants (camera, modelRotationY);
 
-  renderLightingPass (camera); // Pass camera for View Pos
+  // Poses on the CPU, then every animated vertex on the GPU, before the
+  // geometry pass reads them
+  if (m_animator && m_model)
+    {
+      {
+        ProfileScope scope (m_profiler.get (), "Anim Sample");
+        m_animator->sample (m_animationTime);
+      }
+      {
+        ProfileScope scope (m_profiler.get (), "Anim Pose");
+        m_animator->pose ();
+      }
+      ProfileScope scope (m_profiler.get (), "Skinning");
+      m_skinning->dispatch (*m_animator, m_model.get ());
+    }
 
-  // 3. Skybox Pass (Render last)
-  // We copy the depth buffer from G-Buffer to default framebuffer
+  if (camera && m_model && m_model->streaming ())
+    {
+      ProfileScope scope (m_profiler.get (), "Streaming");
+      m_model->updateStreaming (m_textureBudgetBytes);
+      m_model->streamStep (m_stagingRing.get (), m_uploadBudgetMs);
+    }
+
+  // The frame's passes in execution order. The render graph culls what
+  // nothing reads and allocates the intermediate targets, aliasing those
+  // whose lifetimes do not overlap (see RenderGraph).
+  m_graph->begin (m_width, m_height);
+  const RenderResource target
+      = m_graph->importFramebuffer ("Target", m_targetFBO);
+  const RenderResource gPosition // RGB=WorldPos, A=Depth
+      = m_graph->createTexture ("gPosition", GL_RGBA16F);
+  const RenderResource gNormal // RGB=Normal, A=Emissive
+      = m_graph->createTexture ("gNormal", GL_RGBA16F);
+  const RenderResource gAlbedo // RGB=Albedo, A=Alpha
+      = m_graph->createTexture ("gAlbedo", GL_RGBA8);
+  const RenderResource gPBR // R=Metal, G=Rough, B=AO
+      = m_graph->createTexture ("gPBR", GL_RGBA8);
+  const RenderResource gDepth
+      = m_graph->createTexture ("gDepth", GL_DEPTH24_STENCIL8);
+
+  // 1. Geometry Pass
+  RenderPassDesc geometry;
+  geometry.name = "Geometry";
+  geometry.colors = { gPosition, gNormal, gAlbedo, gPBR };
+  geometry.depth = gDepth;
+  geometry.execute = [this, camera] () {
+    glClearColor (0.0f, 0.0f, 0.0f, 0.0f); // Clear to black/empty
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable (GL_DEPTH_TEST);
+
+    if (camera)
+      {
+        renderGeometryPass (camera);
+      }
+  };
+  m_graph->addPass (std::move (geometry));
+
+  // 2. Lighting Pass (Render to the target framebuffer)
+  RenderPassDesc lighting;
+  lighting.name = "Lighting";
+  lighting.reads = { gPosition, gNormal, gAlbedo, gPBR };
+  lighting.colors = { target };
+  lighting.execute = [=, this] () {
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable (GL_DEPTH_TEST);
+
+    m_graph->bindTextures ({ gPosition, gNormal, gAlbedo, gPBR });
+    renderLightingPass (camera); // Pass camera for View Pos
+  };
+  m_graph->addPass (std::move (lighting));
+
+  // 3. Skybox Pass
+  // We copy the depth buffer from G-Buffer to the target framebuffer
   // so the skybox is occluded by geometry.
   // BUT since we are doing deferred lighting on a quad, the depth information
   // is in the G-Buffer texture, not the default framebuffer's depth buffer.
   // We have two options:
   // A) Draw skybox first, then blend lighting on top (complex).
   // B) Blit G-Buffer Depth to Default Framebuffer Depth.
-
-  glBindFramebuffer (GL_READ_FRAMEBUFFER, m_gBuffer->getFBO ());
-  glBindFramebuffer (GL_DRAW_FRAMEBUFFER, 0);
-  glBlitFramebuffer (0, 0, m_width, m_height, 0, 0, m_width, m_height,
-                     GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-  glBindFramebuffer (GL_FRAMEBUFFER, 0);
+  RenderPassDesc depthBlit;
+  depthBlit.name = "Depth Blit";
+  depthBlit.reads = { gDepth };
+  depthBlit.colors = { target };
+  depthBlit.execute = [=, this] () {
+    glBindFramebuffer (GL_READ_FRAMEBUFFER, m_graph->readFramebuffer (gDepth));
+    glBindFramebuffer (GL_DRAW_FRAMEBUFFER, m_targetFBO);
+    glBlitFramebuffer (0, 0, m_width, m_height, 0, 0, m_width, m_height,
+                       GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer (GL_FRAMEBUFFER, m_targetFBO);
+  };
+  m_graph->addPass (std::move (depthBlit));
 
   if (camera && m_skybox)
     {
-      glEnable (GL_DEPTH_TEST);
-      QMatrix4x4 view = QMatrix4x4 (glm::value_ptr (camera->getViewMatrix ()))
-                            .transposed ();
-      QMatrix4x4 proj
-          = QMatrix4x4 (glm::value_ptr (camera->getProjectionMatrix ()))
-                .transposed ();
-      m_skybox->render (view, proj);
+      RenderPassDesc skybox;
+      skybox.name = "Skybox";
+      skybox.colors = { target };
+      skybox.execute = [this] () {
+        glEnable (GL_DEPTH_TEST);
+        m_skybox->render ();
+        m_profiler->countDraw (12);
+      };
+      m_graph->addPass (std::move (skybox));
     }
+
+  // 4. Transparency: alphaMode BLEND surfaces accumulated in any order
+  // against the G-Buffer depth, then resolved over the lit image. Only
+  // declared for models that have some, so the targets cost nothing
+  // otherwise.
+  if (camera && m_model && m_model->transparentCount () > 0)
+    {
+      // RGB=Weighted premultiplied color, A=Weighted alpha
+      const RenderResource accum
+          = m_graph->createTexture ("OIT Accum", GL_RGBA16F);
+      // Product of (1 - alpha)
+      const RenderResource revealage
+          = m_graph->createTexture ("OIT Revealage", GL_R16F);
+
+      RenderPassDesc transparency;
+      transparency.name = "Transparency";
+      transparency.colors = { accum, revealage };
+      transparency.depth = gDepth;
+      transparency.depthWrite = false;
+      transparency.execute = [this] () { renderTransparentPass (); };
+      m_graph->addPass (std::move (transparency));
+
+      RenderPassDesc composite;
+      composite.name = "OIT Composite";
+      composite.reads = { accum, revealage };
+      composite.colors = { target };
+      composite.execute = [=, this] () {
+        m_graph->bindTextures ({ accum, revealage });
+        renderCompositePass ();
+      };
+      m_graph->addPass (std::move (composite));
+    }
+
+  m_graph->execute (m_profiler.get ());
+
+  m_frameConstants->endFrame ();
+  m_profiler->endFrame ();
 }
 
 void
-DeferredRenderer::renderGeometryPass (Camera *camera, float modelRotationY)
+DeferredRenderer::updateFrameConstants (Camera *camera, float modelRotationY)
 {
-  if (!m_geomShader || !camera)
-    return;
+  FrameConstants *constants
+      = static_cast<FrameConstants *> (m_frameConstants->beginFrame ());
 
-  // Wireframe Mode Handling
-  if (m_config.wireframe)
-    {
-      glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);
-    }
-  else
+  glm::mat4 view (1.0f);
+  glm::mat4 projection (1.0f);
+  glm::vec3 camPos (0.0f);
+  if (camera)
     {
-      glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
+      view = camera->getViewMatrix ();
+      projection = camera->getProjectionMatrix ();
+      camPos = camera->getPosition ();
     }
 
-  m_geomShader->bind ();
-
   // Model Matrix: Rotation from auto-rotate
   glm::mat4 model = glm::mat4 (1.0f);
 
@@ -265,34 +402,71 @@ DeferredRenderer::renderGeometryPass (Camera *camera, float modelRotationY)
   // store model center in DeferredRenderer).
 
   model = glm::rotate (model, modelRotationY, glm::vec3 (0.0f, 1.0f, 0.0f));
+  m_modelMatrix = model;
+
+  // glm matrices are column-major like std140, no transposes needed.
+  // The normal matrix is computed once here instead of per vertex.
+  constants->view = view;
+  constants->projection = projection;
+  constants->viewProjection = projection * view;
+  constants->model = model;
+  constants->normalMatrix
+      = glm::mat4 (glm::transpose (glm::inverse (glm::mat3 (model))));
+  constants->cameraPos = glm::vec4 (camPos, 1.0f);
+
+  m_frameConstants->bind (kFrameConstantsBinding);
+}
 
-  m_geomShader->setUniformValue (
-      "model", QMatrix4x4 (glm::value_ptr (model)).transposed ());
-  m_geomShader->setUniformValue (
-      "view",
-      QMatrix4x4 (glm::value_ptr (camera->getViewMatrix ())).transposed ());
-  m_geomShader->setUniformValue (
-      "projection",
-      QMatrix4x4 (glm::value_ptr (camera->getProjectionMatrix ()))
-          .transposed ());
+void
+DeferredRenderer::renderGeometryPass (Camera *camera)
+{
+  if (!m_geomPrograms || !camera)
+    return;
+
+  // Wireframe Mode Handling
+  if (m_config.wireframe)
+    {
+      glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);
+    }
+  else
+    {
+      glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
+    }
 
   if (m_model)
     {
-      m_model->draw (m_geomShader, m_config); // Pass config
+      m_model->draw (m_geomPrograms.get (), m_config,
+                     m_profiler.get ()); // Pass config
+
+      // Selection: lit wireframe pulled slightly towards the camera
+      if (m_selection >= 0)
+        {
+          glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);
+          glEnable (GL_POLYGON_OFFSET_LINE);
+          glPolygonOffset (-1.0f, -1.0f);
+          glDepthFunc (GL_LEQUAL);
+          m_model->drawHighlight (m_geomPrograms.get (), m_selection,
+                                  glm::vec4 (1.0f, 0.45f, 0.0f, 1.0f));
+          glDepthFunc (GL_LESS);
+          glDisable (GL_POLYGON_OFFSET_LINE);
+        }
     }
   else
     {
       // Fallback Cube
-      m_geomShader->setUniformValue ("uAlbedoColor", 0.8f, 0.2f, 0.2f);
-      m_geomShader->setUniformValue ("uMetallic", 0.0f);
-      m_geomShader->setUniformValue ("uRoughness", 0.5f);
+      const GeometryProgram &cube = m_geomPrograms->variant (0);
+      cube.program->bind ();
+      glUniform4f (cube.baseColorFactor, 0.8f, 0.2f, 0.2f, 1.0f);
+      glUniform1f (cube.metallicFactor, 0.0f);
+      glUniform1f (cube.roughnessFactor, 0.5f);
+      glUniform3i (cube.feedbackTextures, -1, -1, -1);
       glBindVertexArray (m_cubeVAO);
       glDrawArrays (GL_TRIANGLES, 0, 36);
       glBindVertexArray (0);
+      m_profiler->countDraw (12);
+      cube.program->release ();
     }
 
-  m_geomShader->release ();
-
   // Reset Polygon Mode just in case
   glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
 }
@@ -305,8 +479,7 @@ DeferredRenderer::renderLightingPass (Camera *camera)
 
   m_lightShader->bind ();
 
-  // Bind G-Buffer textures
-  m_gBuffer->bindRead ();
+  // G-Buffer textures are bound to units 0-3 by the render graph pass
 
   // Bind Environment Map (Slot 4)
   if (m_skybox)
@@ -316,17 +489,65 @@ DeferredRenderer::renderLightingPass (Camera *camera)
       m_lightShader->setUniformValue ("environmentMap", 4);
     }
 
-  if (camera)
+  glBindVertexArray (m_quadVAO);
+  glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+  glBindVertexArray (0);
+  m_profiler->countDraw (2);
+
+  m_lightShader->release ();
+}
+
+void
+DeferredRenderer::renderTransparentPass ()
+{
+  const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  const float one[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  glClearBufferfv (GL_COLOR, 0, zero);
+  glClearBufferfv (GL_COLOR, 1, one);
+
+  // Depth tested, not written; accumulation adds up, revealage multiplies
+  // by (1 - alpha)
+  glEnable (GL_DEPTH_TEST);
+  glDepthMask (GL_FALSE);
+  glEnable (GL_BLEND);
+  glBlendFunci (0, GL_ONE, GL_ONE);
+  glBlendFunci (1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+  glPolygonMode (GL_FRONT_AND_BACK, m_config.wireframe ? GL_LINE : GL_FILL);
+
+  // Same environment as the lighting pass
+  if (m_skybox)
     {
-      glm::vec3 camPos = camera->getPosition ();
-      m_lightShader->setUniformValue ("viewPos", camPos.x, camPos.y, camPos.z);
+      glActiveTexture (GL_TEXTURE4);
+      glBindTexture (GL_TEXTURE_2D, m_skybox->getTextureId ());
     }
 
+  m_model->drawTransparent (m_geomPrograms.get (), m_config,
+                            m_profiler.get ());
+
+  glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
+  glDisable (GL_BLEND);
+  glDepthMask (GL_TRUE);
+}
+
+void
+DeferredRenderer::renderCompositePass ()
+{
+  if (!m_compositeShader)
+    return;
+
+  // Average transparent color over 1 - revealage of the lit image
+  glDisable (GL_DEPTH_TEST);
+  glEnable (GL_BLEND);
+  glBlendFunc (GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+  m_compositeShader->bind ();
   glBindVertexArray (m_quadVAO);
   glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
   glBindVertexArray (0);
+  m_profiler->countDraw (2);
+  m_compositeShader->release ();
 
-  m_lightShader->release ();
+  glDisable (GL_BLEND);
 }
 
 void
@@ -337,4 +558,124 @@ DeferredRenderer::loadModel (SceneData *data)
       m_model = std::make_unique<Model> ();
     }
   m_model->create (data);
+  if (data)
+    setupAnimation (*data);
+}
+
+void
+DeferredRenderer::beginModelUpload (std::shared_ptr<SceneData> data)
+{
+  if (!m_stagingRing)
+    {
+      m_stagingRing = std::make_unique<StagingRing> ();
+      m_stagingRing->init ();
+    }
+  if (!m_model)
+    {
+      m_model = std::make_unique<Model> ();
+    }
+  const std::shared_ptr<SceneData> scene = data;
+  m_model->beginUpload (std::move (data));
+  m_selection = -1;
+  if (scene)
+    setupAnimation (*scene);
+}
+
+void
+DeferredRenderer::setupAnimation (const SceneData &data)
+{
+  m_animator.reset ();
+  if (m_skinning)
+    m_skinning->clear ();
+  if (!m_skinning || !data.animated ())
+    return;
+
+  m_animator = std::make_unique<Animator> (data);
+  m_animator->setClip (m_animationClip);
+  m_animator->setInstanceCount (m_animationInstances);
+  m_skinning->setScene (data, *m_animator, m_model.get ());
+}
+
+void
+DeferredRenderer::setAnimationClip (int clip)
+{
+  m_animationClip = clip;
+  if (m_animator)
+    m_animator->setClip (clip);
+}
+
+void
+DeferredRenderer::setAnimationInstances (int count)
+{
+  m_animationInstances = count;
+  if (m_animator)
+    m_animator->setInstanceCount (count);
+}
+
+void
+DeferredRenderer::setDeviation (const std::vector<std::vector<float>> &perMesh,
+                                float range)
+{
+  if (m_model)
+    m_model->setDeviation (perMesh, range);
+}
+
+void
+DeferredRenderer::clearDeviation ()
+{
+  if (m_model)
+    m_model->clearDeviation ();
+}
+
+void
+DeferredRenderer::setOcclusion (const std::vector<std::vector<float>> &perMesh)
+{
+  if (m_model)
+    m_model->setOcclusion (perMesh);
+}
+
+void
+DeferredRenderer::clearOcclusion ()
+{
+  if (m_model)
+    m_model->clearOcclusion ();
+}
+
+bool
+DeferredRenderer::uploadPending () const
+{
+  return m_model && m_model->uploadPending ();
+}
+
+size_t
+DeferredRenderer::gpuMemoryBytes () const
+{
+  size_t bytes = 0;
+  if (m_graph)
+    bytes += m_graph->memoryBytes ();
+  if (m_skybox)
+    bytes += m_skybox->memoryBytes ();
+  if (m_model)
+    bytes += m_model->gpuMemoryBytes ();
+  if (m_skinning)
+    bytes += m_skinning->gpuMemoryBytes ();
+  return bytes;
+}
+
+RenderGraphStats
+DeferredRenderer::renderGraphStats () const
+{
+  return m_graph ? m_graph->stats () : RenderGraphStats ();
+}
+
+TextureStreamingStats
+DeferredRenderer::textureStreamingStats () const
+{
+  return m_model ? m_model->streamingStats () : TextureStreamingStats ();
+}
+
+int
+DeferredRenderer::geometryVariantCount () const
+{
+  return m_geomPrograms ? m_geomPrograms->variantCount () : 0;
 }
@@ -6,11 +6,18 @@
 #include <memory>
 
 #include "model.h"
+#include "profiler.h"
 #include "renderconfig.h"
+#include "rendergraph.h"
 #include "skybox.h"
+#include "uniformring.h"
 
-class GBuffer;
+class Animator;
 class Camera;
+class GeometryPrograms;
+class ShaderCache;
+class SkinningPass;
+class StagingRing;
 
 class DeferredRenderer : protected QOpenGLExtraFunctions
 {
@@ -30,20 +37,125 @@ public:
 
   void loadModel (SceneData *data);
 
+  // Shares ownership of data and uploads it over the following frames,
+  // spending at most the upload budget per render() call.
+  void beginModelUpload (std::shared_ptr<SceneData> data);
+  bool uploadPending () const;
+
+  void
+  setUploadBudget (double ms)
+  {
+    m_uploadBudgetMs = ms;
+  }
+
+  // VRAM budget for streamed textures (0 = unlimited).
+  void
+  setTextureBudget (size_t bytes)
+  {
+    m_textureBudgetBytes = bytes;
+  }
+
+  TextureStreamingStats textureStreamingStats () const;
+
+  // Framebuffer the final image is composed into (0 = default framebuffer).
+  // Offscreen users pass an FBO with a DEPTH24_STENCIL8 attachment so the
+  // G-Buffer depth can be blitted into it.
+  void
+  setTargetFramebuffer (unsigned int fbo)
+  {
+    m_targetFBO = fbo;
+  }
+
+  // Estimated VRAM of everything the renderer owns.
+  size_t gpuMemoryBytes () const;
+
+  // Passes and transient target memory of the last frame.
+  RenderGraphStats renderGraphStats () const;
+
+  Profiler *
+  profiler () const
+  {
+    return m_profiler.get ();
+  }
+
+  ShaderCache *
+  shaderCache () const
+  {
+    return m_shaderCache.get ();
+  }
+
+  // Geometry program variants built so far.
+  int geometryVariantCount () const;
+
+  // Model matrix of the last rendered frame, for picking.
+  const glm::mat4 &
+  modelMatrix () const
+  {
+    return m_modelMatrix;
+  }
+
+  // Compare mode heatmap of the current model, see Model::setDeviation.
+  void setDeviation (const std::vector<std::vector<float>> &perMesh,
+                     float range);
+  void clearDeviation ();
+
+  // Baked AO of the current model, see Model::setOcclusion.
+  void setOcclusion (const std::vector<std::vector<float>> &perMesh);
+  void clearOcclusion ();
+
+  // Skeletal and morph target playback of animated models (Animator on
+  // the CPU, SkinningPass on the GPU). Settings persist across models.
+  // Clip -1 holds the rest pose; instances are laid out on a grid.
+  void setAnimationClip (int clip);
+  void setAnimationInstances (int count);
+
+  void
+  setAnimationTime (double seconds)
+  {
+    m_animationTime = seconds;
+  }
+
+  // False without compute shaders (GL 4.3): models stay in bind pose
+  bool
+  animationSupported () const
+  {
+    return m_skinning != nullptr;
+  }
+
+  // Submesh outlined in the geometry pass, -1 = none.
+  void
+  setSelection (int mesh)
+  {
+    m_selection = mesh;
+  }
+
 private:
   void initShaders ();
   void initQuad ();     // For lighting pass
   void initTestCube (); // Temporary for Phase 2
 
+  // Animator and skinning inputs for a model that was just created.
+  void setupAnimation (const SceneData &data);
+
+  // Fills this frame's FrameConstants slot and binds it for all passes.
+  void updateFrameConstants (Camera *camera, float modelRotationY);
+
   // Passes
-  void renderGeometryPass (Camera *camera, float modelRotationY);
+  void renderGeometryPass (Camera *camera);
   void renderLightingPass (Camera *camera);
+  void renderTransparentPass ();
+  void renderCompositePass ();
 
-  std::unique_ptr<GBuffer> m_gBuffer;
+  // Passes and their intermediate targets (G-Buffer, OIT), per frame
+  std::unique_ptr<RenderGraph> m_graph;
+  std::unique_ptr<ShaderCache> m_shaderCache;
 
-  QOpenGLShaderProgram *m_geomShader;
+  std::unique_ptr<GeometryPrograms> m_geomPrograms;
   QOpenGLShaderProgram *m_lightShader;
 
+  // Weighted blended OIT resolve for alphaMode BLEND materials
+  QOpenGLShaderProgram *m_compositeShader = nullptr;
+
   // Full Screen Quad Resources
   unsigned int m_quadVAO = 0;
   unsigned int m_quadVBO = 0;
@@ -55,11 +167,32 @@ private:
   int m_width;
   int m_height;
 
+  unsigned int m_targetFBO = 0;
+
   std::unique_ptr<Model> m_model;
 
   RenderConfig m_config; // Store settings
 
   std::unique_ptr<Skybox> m_skybox;
+
+  std::unique_ptr<Profiler> m_profiler;
+
+  std::unique_ptr<UniformRing> m_frameConstants;
+
+  // Streaming uploads, created on first use
+  std::unique_ptr<StagingRing> m_stagingRing;
+  double m_uploadBudgetMs = 4.0;
+
+  size_t m_textureBudgetBytes = 0;
+  glm::mat4 m_modelMatrix = glm::mat4 (1.0f); // Set per frame
+  int m_selection = -1;
+
+  // Animation, created for animated models only
+  std::unique_ptr<SkinningPass> m_skinning; // Null without compute
+  std::unique_ptr<Animator> m_animator;
+  int m_animationClip = 0;
+  int m_animationInstances = 1;
+  double m_animationTime = 0.0;
 };
 
 #endif // DEFERREDRENDERER_H
@@ -0,0 +1,164 @@
+// Comparison benchmark: the BVH build and MeshDiff::compare of two
+// revisions of a synthetic model on the whole thread pool, as File >
+// Compare With... runs them.
+//
+//   mesh-spy-diffbench [--vertices N] [--iterations N] [--work-dir DIR]
+//                      [--out results.json]
+
+#include "gltfloader.h"
+#include "meshbvh.h"
+#include "meshdiff.h"
+#include "syntheticglb.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static double
+median (std::vector<double> values)
+{
+  if (values.empty ())
+    return 0.0;
+  std::sort (values.begin (), values.end ());
+  return values[values.size () / 2];
+}
+
+// The next revision: every vertex raised by a wave a thousandth of the
+// model's size high, so no query lands exactly on a vertex
+static void
+perturb (SceneData &scene)
+{
+  glm::vec3 min (FLT_MAX), max (-FLT_MAX);
+  for (const SubMesh &mesh : scene.meshes)
+    {
+      min = glm::min (min, mesh.minBounds);
+      max = glm::max (max, mesh.maxBounds);
+    }
+  const float size = glm::length (max - min);
+  const float wavelength = std::max (size, 1e-6f) / 16.0f;
+
+  for (SubMesh &mesh : scene.meshes)
+    {
+      const VertexAttribute &position = mesh.layout.position;
+      if (mesh.sharedGeometry >= 0 || position.type != ComponentFloat)
+        continue;
+      for (size_t v = 0; v < mesh.vertexCount; v++)
+        {
+          float *p = reinterpret_cast<float *> (
+              mesh.vertexData.data () + v * mesh.layout.stride
+              + position.offset);
+          p[1] += 1.0e-3f * size * std::sin (p[0] / wavelength)
+                  * std::cos (p[2] / wavelength);
+        }
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy comparison benchmark");
+  parser.addHelpOption ();
+  QCommandLineOption vertexOpt ("vertices", "Vertices per revision.",
+                                "count", "2500000");
+  QCommandLineOption iterOpt ("iterations", "Runs per measurement.", "count",
+                              "3");
+  QCommandLineOption dirOpt ("work-dir", "Where generated GLBs are cached.",
+                             "dir", QDir::tempPath () + "/mesh-spy-bench");
+  QCommandLineOption outOpt ("out", "Results file.", "file",
+                             "diffbench.json");
+  parser.addOptions ({ vertexOpt, iterOpt, dirOpt, outOpt });
+  parser.process (app);
+
+  const int runs = std::max (1, parser.value (iterOpt).toInt ());
+
+  // 1. A wavy grid model and a slightly displaced revision of it
+  SyntheticSceneSpec spec;
+  spec.vertexCount = std::max (1000ll, parser.value (vertexOpt).toLongLong ());
+  spec.primitiveCount = 16;
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+  const QString path = workDir.filePath (spec.name () + ".glb");
+  if (!QFileInfo::exists (path))
+    {
+      QString error;
+      if (!writeSyntheticGlb (spec, path, nullptr, &error))
+        {
+          std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                        qPrintable (error));
+          return 1;
+        }
+    }
+
+  LoaderOptions options;
+  options.processTextures = false;
+  QString error;
+  std::unique_ptr<SceneData> scene (GLTFLoader::load (path, &error, options));
+  if (!scene)
+    {
+      std::fprintf (stderr, "Load failed: %s\n", qPrintable (error));
+      return 1;
+    }
+  MeshBVH reference;
+  reference.build (*scene);
+  perturb (*scene);
+
+  // 2. What the comparison job does after loading the other file
+  std::vector<double> buildMs, diffMs, totalMs;
+  MeshDiffResult diff;
+  size_t otherVertices = 0;
+  size_t otherTriangles = 0;
+  for (int run = 0; run < runs; run++)
+    {
+      QElapsedTimer timer;
+      timer.start ();
+      MeshBVH other;
+      other.build (*scene);
+      diff = MeshDiff::compare (reference, other);
+      totalMs.push_back (timer.nsecsElapsed () / 1.0e6);
+      buildMs.push_back (other.buildMs ());
+      diffMs.push_back (diff.diffMs);
+      otherVertices = other.positions ().size ();
+      otherTriangles = other.triangleCount ();
+    }
+
+  const size_t queries = reference.positions ().size () + otherVertices;
+  const int threads = QThreadPool::globalInstance ()->maxThreadCount ();
+  std::printf ("%zu + %zu triangles, %zu queries, %d threads\n",
+               reference.triangleCount (), otherTriangles, queries, threads);
+  std::printf ("%-24s %10.1f ms\n", "BVH build", median (buildMs));
+  std::printf ("%-24s %10.1f ms %8.2f Mqueries/s\n", "compare",
+               median (diffMs), queries / median (diffMs) / 1.0e3);
+  std::printf ("%-24s %10.1f ms\n", "build + compare", median (totalMs));
+  std::printf ("%-24s %10.6f\n", "Hausdorff", diff.hausdorff);
+
+  QJsonObject results{ { "file", spec.name () },
+                       { "triangles", (double)reference.triangleCount () },
+                       { "queries", (double)queries },
+                       { "threads", threads },
+                       { "runs", runs },
+                       { "buildMs", median (buildMs) },
+                       { "diffMs", median (diffMs) },
+                       { "totalMs", median (totalMs) },
+                       { "hausdorff", diff.hausdorff } };
+
+  QFile out (parser.value (outOpt));
+  if (out.open (QIODevice::WriteOnly))
+    out.write (QJsonDocument (results).toJson ());
+  std::printf ("\nResults written to %s\n",
+               qPrintable (parser.value (outOpt)));
+  return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef FRAMECONSTANTS_H
+#define FRAMECONSTANTS_H
+
+#include <glm/glm.hpp>
+
+// Uniform buffer binding point of the FrameConstants block.
+const unsigned int kFrameConstantsBinding = 0;
+
+// CPU mirror of the std140 "FrameConstants" block declared in
+// geometry.vert, lighting.frag and skybox.vert. Only mat4/vec4 members so
+// the C++ layout matches std140 without explicit padding; keep both sides in
+// the same order.
+struct FrameConstants
+{
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 viewProjection;
+  glm::mat4 model;
+  glm::mat4 normalMatrix; // transpose(inverse(mat3(model))), upper 3x3 used
+  glm::vec4 cameraPos;    // xyz = world position
+};
+
+#endif // FRAMECONSTANTS_H
@@ -1,29 +0,0 @@
-#ifndef GBUFFER_H
-#define GBUFFER_H
-
-#include <QOpenGLExtraFunctions>
-
-class GBuffer : protected QOpenGLExtraFunctions
-{
-public:
-  GBuffer ();
-  ~GBuffer ();
-
-  bool init (int width, int height);
-  void bindWrite ();
-  void bindRead (); // Binds textures to units 0-3
-  void resize (int width, int height);
-
-private:
-  unsigned int m_textures[4]; // Pos, Norm, Albedo, PBR
-  unsigned int m_rboDepth;    // Depth/Stencil
-  unsigned int m_fbo;
-
-  int m_width;
-  int m_height;
-
-public:
-  unsigned int getFBO () const;
-};
-
-#endif // GBUFFER_H
@@ -0,0 +1,114 @@
+#include "geometryprograms.h"
+#include "frameconstants.h"
+#include "shadercache.h"
+
+unsigned int
+featureMask (const RenderConfig &config)
+{
+  unsigned int mask = FeatureAlphaMask;
+  if (config.useBaseColorMap)
+    mask |= FeatureBaseColorMap;
+  if (config.useMetallicMap)
+    mask |= FeatureMetallicMap;
+  if (config.useRoughnessMap)
+    mask |= FeatureRoughnessMap;
+  if (config.useNormalMap)
+    mask |= FeatureNormalMap;
+  return mask;
+}
+
+GeometryPrograms::GeometryPrograms (ShaderCache *shaderCache)
+    : m_shaderCache (shaderCache)
+{
+}
+
+GeometryPrograms::~GeometryPrograms ()
+{
+  for (auto &entry : m_variants)
+    delete entry.second.program;
+  for (auto &entry : m_transparent)
+    delete entry.second.program;
+  delete m_uber.program;
+}
+
+void
+GeometryPrograms::init ()
+{
+  initializeOpenGLFunctions ();
+
+  // Untextured variant is used by the fallback cube, build it up front.
+  variant (0);
+}
+
+const GeometryProgram &
+GeometryPrograms::variant (unsigned int features)
+{
+  auto it = m_variants.find (features);
+  if (it != m_variants.end ())
+    return it->second;
+
+  GeometryProgram program
+      = build (QByteArray ("#define FEATURES ") + QByteArray::number (features)
+               + "\n");
+  return m_variants.emplace (features, program).first->second;
+}
+
+const GeometryProgram &
+GeometryPrograms::uber ()
+{
+  if (!m_uber.program)
+    m_uber = build ("#define UBER_SHADER\n");
+  return m_uber;
+}
+
+const GeometryProgram &
+GeometryPrograms::transparent (unsigned int features)
+{
+  auto it = m_transparent.find (features);
+  if (it != m_transparent.end ())
+    return it->second;
+
+  GeometryProgram program
+      = build (QByteArray ("#define FEATURES ") + QByteArray::number (features)
+                   + "\n",
+               ":/shaders/transparent.frag");
+  return m_transparent.emplace (features, program).first->second;
+}
+
+GeometryProgram
+GeometryPrograms::build (const QByteArray &defines,
+                         const QString &fragmentPath)
+{
+  GeometryProgram result;
+  result.program = m_shaderCache->program (":/shaders/geometry.vert",
+                                           fragmentPath, defines);
+
+  QOpenGLShaderProgram *program = result.program;
+  GLuint block
+      = glGetUniformBlockIndex (program->programId (), "FrameConstants");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding (program->programId (), block,
+                           kFrameConstantsBinding);
+
+  // Sampler units are fixed: 0 = BaseColor, 1 = MetalRough, 2 = Normal,
+  // 4 = environment (transparency only)
+  program->bind ();
+  program->setUniformValue ("texture_baseColor", 0);
+  program->setUniformValue ("texture_metallicRoughness", 1);
+  program->setUniformValue ("texture_normal", 2);
+  program->setUniformValue ("environmentMap", 4);
+
+  // No streaming feedback until a draw names its streamed textures
+  result.feedbackTextures = program->uniformLocation ("uFeedbackTextures");
+  glUniform3i (result.feedbackTextures, -1, -1, -1);
+  program->release ();
+
+  result.baseColorFactor = program->uniformLocation ("uBaseColorFactor");
+  result.metallicFactor = program->uniformLocation ("uMetallicFactor");
+  result.roughnessFactor = program->uniformLocation ("uRoughnessFactor");
+  result.features = program->uniformLocation ("uFeatures");
+  result.heatmapRange = program->uniformLocation ("uHeatmapRange");
+  result.alphaCutoff = program->uniformLocation ("uAlphaCutoff");
+  result.feedbackLog2Size = program->uniformLocation ("uFeedbackLog2Size");
+  return result;
+}
@@ -0,0 +1,101 @@
+#ifndef GEOMETRYPROGRAMS_H
+#define GEOMETRYPROGRAMS_H
+
+#include "renderconfig.h"
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <map>
+
+class ShaderCache;
+
+// Feature bits of geometry.frag variants (mirrored by the FEATURE_* defines
+// in the shader). A bit is set when the material has the texture *and* the
+// matching RenderConfig toggle is on.
+enum GeometryFeature : unsigned int
+{
+  FeatureBaseColorMap = 1u << 0,
+  FeatureMetallicMap = 1u << 1,
+  FeatureRoughnessMap = 1u << 2,
+  FeatureNormalMap = 1u << 3,
+
+  // Not a material feature: rebuilds the tangent frame from screen-space
+  // derivatives instead of the vertex tangents (RenderConfig, comparisons)
+  FeatureDerivativeTangents = 1u << 4,
+
+  // Not a material feature either: compare mode, albedo from the per-vertex
+  // deviation (Model::setDeviation)
+  FeatureHeatmap = 1u << 5,
+
+  // Baked per-vertex AO in the G-buffer instead of 1 (Model::setOcclusion)
+  FeatureOcclusion = 1u << 6,
+
+  // alphaMode MASK: fragments below the material's alphaCutoff are
+  // discarded. Always allowed, it is part of the material's shape.
+  FeatureAlphaMask = 1u << 7,
+};
+
+// Shader storage binding of the texture streaming feedback that
+// geometry.frag and transparent.frag write (Model::updateStreaming).
+const unsigned int kStreamingFeedbackBinding = 5;
+
+// Bits the current UI toggles allow.
+unsigned int featureMask (const RenderConfig &config);
+
+// A linked geometry program with its per-draw uniform locations resolved.
+struct GeometryProgram
+{
+  QOpenGLShaderProgram *program = nullptr;
+  int baseColorFactor = -1;
+  int metallicFactor = -1;
+  int roughnessFactor = -1;
+  int features = -1; // uFeatures, uber-shader only
+  int heatmapRange = -1;
+  int alphaCutoff = -1;
+
+  // Streaming feedback: texture index of each bound map (-1 = none to
+  // report) and log2 of its level 0 size
+  int feedbackTextures = -1;
+  int feedbackLog2Size = -1;
+};
+
+// Specialized geometry pass programs, one per feature combination, built
+// on first use through the ShaderCache. The transparency pass has its own
+// set over the same vertex shader (transparent.frag).
+class GeometryPrograms : protected QOpenGLExtraFunctions
+{
+public:
+  explicit GeometryPrograms (ShaderCache *shaderCache);
+  ~GeometryPrograms ();
+
+  void init ();
+
+  const GeometryProgram &variant (unsigned int features);
+
+  // Single program branching on uFeatures at runtime; kept to compare
+  // against the variants (RenderConfig::uberShader).
+  const GeometryProgram &uber ();
+
+  // alphaMode BLEND materials: lit with the environment map (texture unit
+  // 4) and written to the OIT accumulation targets. There is no uber
+  // variant of these.
+  const GeometryProgram &transparent (unsigned int features);
+
+  int
+  variantCount () const
+  {
+    return (int)(m_variants.size () + m_transparent.size ());
+  }
+
+private:
+  GeometryProgram build (const QByteArray &defines,
+                         const QString &fragmentPath
+                         = ":/shaders/geometry.frag");
+
+  ShaderCache *m_shaderCache;
+  std::map<unsigned int, GeometryProgram> m_variants;
+  std::map<unsigned int, GeometryProgram> m_transparent;
+  GeometryProgram m_uber;
+};
+
+#endif // GEOMETRYPROGRAMS_H
@@ -0,0 +1,1042 @@
+#include "glboptimizer.h"
+#include "glbwriter.h"
+#include "gltfloader.h"
+#include "parallel.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <meshoptimizer.h>
+#include <vector>
+
+namespace
+{
+// Vertices per task when a single submesh is rewritten
+constexpr size_t kVertexGrain = 4096;
+
+// Simulated post-transform cache for the ACMR figures
+constexpr unsigned int kCacheSize = 16;
+
+struct EncodedGeometry
+{
+  std::vector<unsigned char> indexData; // Tightly packed, indexSize each
+  int indexSize = 4;
+  GlbWriter::MeshoptStream vertexStream;
+  GlbWriter::MeshoptStream indexStream;
+  std::vector<double> min; // POSITION bounds in stored units
+  std::vector<double> max;
+};
+
+unsigned int
+componentSize (int type)
+{
+  switch (type)
+    {
+    case ComponentByte:
+    case ComponentUnsignedByte:
+      return 1;
+    case ComponentShort:
+    case ComponentUnsignedShort:
+      return 2;
+    default:
+      return 4;
+    }
+}
+
+// Component c of an attribute as stored, before normalization
+double
+rawComponent (const unsigned char *vertex, const VertexAttribute &attribute,
+              int c)
+{
+  const unsigned char *src
+      = vertex + attribute.offset + c * componentSize (attribute.type);
+  switch (attribute.type)
+    {
+    case ComponentByte:
+      return (double)*reinterpret_cast<const int8_t *> (src);
+    case ComponentUnsignedByte:
+      return (double)*src;
+    case ComponentShort:
+      {
+        int16_t value;
+        std::memcpy (&value, src, 2);
+        return value;
+      }
+    case ComponentUnsignedShort:
+      {
+        uint16_t value;
+        std::memcpy (&value, src, 2);
+        return value;
+      }
+    case ComponentUnsignedInt:
+      {
+        uint32_t value;
+        std::memcpy (&value, src, 4);
+        return value;
+      }
+    default:
+      {
+        float value;
+        std::memcpy (&value, src, 4);
+        return value;
+      }
+    }
+}
+
+// `value` in the attribute's format: floats as they are, bytes and shorts
+// as signed and unsigned shorts as unsigned normalized integers
+void
+writeComponents (unsigned char *vertex, const VertexAttribute &attribute,
+                 const glm::vec4 &value)
+{
+  unsigned char *dst = vertex + attribute.offset;
+  for (int c = 0; c < attribute.components; c++)
+    {
+      switch (attribute.type)
+        {
+        case ComponentFloat:
+          std::memcpy (dst + 4 * c, &value[c], 4);
+          break;
+        case ComponentByte:
+          {
+            const float x = std::clamp (value[c], -1.0f, 1.0f);
+            dst[c] = (unsigned char)(int8_t)std::lround (x * 127.0f);
+            break;
+          }
+        case ComponentShort:
+          {
+            const float x = std::clamp (value[c], -1.0f, 1.0f);
+            const int16_t q = (int16_t)std::lround (x * 32767.0f);
+            std::memcpy (dst + 2 * c, &q, 2);
+            break;
+          }
+        default:
+          {
+            const float x = std::clamp (value[c], 0.0f, 1.0f);
+            const uint16_t q = (uint16_t)std::lround (x * 65535.0f);
+            std::memcpy (dst + 2 * c, &q, 2);
+            break;
+          }
+        }
+    }
+}
+
+// Rest world matrix of every node, parents first
+std::vector<glm::mat4>
+restWorld (const std::vector<NodeData> &nodes)
+{
+  std::vector<glm::mat4> world (nodes.size ());
+  std::vector<bool> done (nodes.size (), false);
+  std::vector<int> chain;
+  for (size_t n = 0; n < nodes.size (); n++)
+    {
+      // Up to the first ancestor already known (bounded, in case of a
+      // cycle), then back down
+      chain.clear ();
+      for (int at = (int)n;
+           at >= 0 && !done[at] && chain.size () < nodes.size ();
+           at = nodes[at].parent)
+        chain.push_back (at);
+      for (auto it = chain.rbegin (); it != chain.rend (); ++it)
+        {
+          const int parent = nodes[*it].parent;
+          const glm::mat4 local = nodes[*it].localMatrix ();
+          world[*it] = parent >= 0 && done[parent] ? world[parent] * local
+                                                   : local;
+          done[*it] = true;
+        }
+    }
+  return world;
+}
+
+// What GLTFLoader baked into a submesh's vertices
+glm::mat4
+bakedMatrix (const SubMesh &mesh, const std::vector<glm::mat4> &world)
+{
+  if (mesh.skin < 0 && mesh.node >= 0 && mesh.node < (int)world.size ()
+      && bakesRestWorld (world[mesh.node]))
+    return world[mesh.node];
+  return glm::mat4 (1.0f);
+}
+
+// Takes the loader's bake back out of a rigid mesh so it can go under its
+// node again: positions by the inverse, directions renormalized and their
+// morph deltas scaled alike, winding and bitangent sign restored
+void
+unbake (SubMesh &mesh, const glm::mat4 &world)
+{
+  const glm::mat4 inverse = glm::inverse (world);
+  const glm::mat3 linear (inverse);
+  const glm::mat3 normalMatrix = glm::transpose (glm::mat3 (world));
+  const bool mirrored = glm::determinant (linear) < 0.0f;
+  const VertexLayout &layout = mesh.layout;
+  std::vector<float> normalScale (mesh.vertexCount, 1.0f);
+  std::vector<float> tangentScale (mesh.vertexCount, 1.0f);
+  for (size_t v = 0; v < mesh.vertexCount; v++)
+    {
+      unsigned char *vertex = &mesh.vertexData[v * layout.stride];
+      const glm::vec4 p = layout.position.read (vertex);
+      writeComponents (vertex, layout.position,
+                       inverse * glm::vec4 (glm::vec3 (p), 1.0f));
+
+      const glm::vec3 n
+          = normalMatrix * glm::vec3 (layout.normal.read (vertex));
+      const float normalLength = glm::length (n);
+      normalScale[v] = normalLength > 0.0f ? 1.0f / normalLength : 0.0f;
+      writeComponents (vertex, layout.normal,
+                       glm::vec4 (n * normalScale[v], 0.0f));
+
+      if (layout.tangent.components == 4)
+        {
+          const glm::vec4 t = layout.tangent.read (vertex);
+          const glm::vec3 xyz = linear * glm::vec3 (t);
+          const float length = glm::length (xyz);
+          tangentScale[v] = length > 0.0f ? 1.0f / length : 0.0f;
+          writeComponents (
+              vertex, layout.tangent,
+              glm::vec4 (xyz * tangentScale[v], mirrored ? -t.w : t.w));
+        }
+    }
+
+  for (MorphTarget &target : mesh.targets)
+    for (size_t v = 0; v < mesh.vertexCount; v++)
+      {
+        if (v < target.positions.size ())
+          target.positions[v] = linear * target.positions[v];
+        if (v < target.normals.size ())
+          target.normals[v] = normalMatrix * target.normals[v]
+                              * normalScale[v];
+        if (v < target.tangents.size ())
+          target.tangents[v] = linear * target.tangents[v] * tangentScale[v];
+      }
+
+  if (mirrored)
+    for (size_t i = 0; i + 2 < mesh.indices.size (); i += 3)
+      std::swap (mesh.indices[i + 1], mesh.indices[i + 2]);
+}
+
+// The loader zero-fills the normal slot of primitives without NORMAL
+bool
+hasNormals (const SubMesh &mesh)
+{
+  const VertexAttribute &normal = mesh.layout.normal;
+  const unsigned int size = normal.components * componentSize (normal.type);
+  for (size_t v = 0; v < mesh.vertexCount; v++)
+    {
+      const unsigned char *src = mesh.vertex (v) + normal.offset;
+      for (unsigned int b = 0; b < size; b++)
+        if (src[b])
+          return true;
+    }
+  return false;
+}
+
+bool
+unitTexCoords (const SubMesh &mesh)
+{
+  for (size_t v = 0; v < mesh.vertexCount; v++)
+    {
+      const glm::vec2 uv = mesh.texCoords (v);
+      if (!(uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f))
+        return false;
+    }
+  return true;
+}
+
+double
+acmr (const SubMesh &mesh)
+{
+  if (mesh.indices.empty ())
+    return 0.0;
+  return meshopt_analyzeVertexCache (mesh.indices.data (),
+                                     mesh.indices.size (), mesh.vertexCount,
+                                     kCacheSize, 0, 0)
+      .acmr;
+}
+
+// Drops triangles with out-of-range corners (and a trailing partial one),
+// then reorders triangles for the vertex cache and vertices (morph deltas
+// along) for fetch locality. Unreferenced vertices go away too.
+void
+reorder (SubMesh &mesh)
+{
+  std::vector<unsigned int> &indices = mesh.indices;
+  size_t kept = 0;
+  for (size_t i = 0; i + 2 < indices.size (); i += 3)
+    {
+      if (indices[i] >= mesh.vertexCount
+          || indices[i + 1] >= mesh.vertexCount
+          || indices[i + 2] >= mesh.vertexCount)
+        continue;
+      std::copy_n (&indices[i], 3, &indices[kept]);
+      kept += 3;
+    }
+  indices.resize (kept);
+  if (indices.empty ())
+    return;
+
+  meshopt_optimizeVertexCache (indices.data (), indices.data (),
+                               indices.size (), mesh.vertexCount);
+  std::vector<unsigned int> remap (mesh.vertexCount);
+  const size_t unique = meshopt_optimizeVertexFetchRemap (
+      remap.data (), indices.data (), indices.size (), mesh.vertexCount);
+  meshopt_remapIndexBuffer (indices.data (), indices.data (),
+                            indices.size (), remap.data ());
+
+  std::vector<unsigned char> vertexData (unique * mesh.layout.stride);
+  meshopt_remapVertexBuffer (vertexData.data (), mesh.vertexData.data (),
+                             mesh.vertexCount, mesh.layout.stride,
+                             remap.data ());
+  for (MorphTarget &target : mesh.targets)
+    for (std::vector<glm::vec3> *deltas :
+         { &target.positions, &target.normals, &target.tangents })
+      {
+        if (deltas->size () != mesh.vertexCount)
+          {
+            deltas->clear ();
+            continue;
+          }
+        std::vector<glm::vec3> remapped (unique);
+        meshopt_remapVertexBuffer (remapped.data (), deltas->data (),
+                                   mesh.vertexCount, sizeof (glm::vec3),
+                                   remap.data ());
+        *deltas = std::move (remapped);
+      }
+  mesh.vertexCount = unique;
+  mesh.vertexData = std::move (vertexData);
+}
+
+// Rewrites the vertices without placeholder attributes and, with `shrink`,
+// with 8-bit normals and tangents and 16-bit UVs where they fit
+void
+quantize (SubMesh &mesh, bool shrink)
+{
+  const VertexLayout &in = mesh.layout;
+  VertexLayout out;
+  unsigned int stride = 0;
+  auto place = [&] (const VertexAttribute &src, bool toBytes,
+                    bool toShorts) {
+    VertexAttribute attribute = src;
+    if (toBytes || toShorts)
+      {
+        attribute.type = toBytes ? ComponentByte : ComponentUnsignedShort;
+        attribute.normalized = true;
+      }
+    attribute.offset = stride;
+    stride += (attribute.components * componentSize (attribute.type) + 3)
+              & ~3u;
+    return attribute;
+  };
+  auto unitVector = [&] (const VertexAttribute &attribute) {
+    return shrink
+           && (attribute.type == ComponentFloat
+               || attribute.type == ComponentShort);
+  };
+
+  out.position = place (in.position, false, false);
+  if (hasNormals (mesh))
+    out.normal = place (in.normal, unitVector (in.normal), false);
+  if (mesh.hasTexCoords)
+    out.texCoords = place (in.texCoords, false,
+                           shrink && in.texCoords.type == ComponentFloat
+                               && unitTexCoords (mesh));
+  if (in.tangent.components == 4)
+    out.tangent = place (in.tangent, unitVector (in.tangent), false);
+  if (in.joints.components && in.weights.components)
+    {
+      out.joints = place (in.joints, false, false);
+      out.weights = place (in.weights, false, false);
+    }
+  out.stride = stride;
+
+  std::vector<unsigned char> vertexData (mesh.vertexCount * stride, 0);
+  parallelFor (
+      mesh.vertexCount,
+      [&] (size_t v) {
+        const unsigned char *src = mesh.vertex (v);
+        unsigned char *dst = &vertexData[v * stride];
+        for (auto member : { &VertexLayout::position, &VertexLayout::normal,
+                             &VertexLayout::texCoords, &VertexLayout::tangent,
+                             &VertexLayout::joints, &VertexLayout::weights })
+          {
+            const VertexAttribute &from = in.*member;
+            const VertexAttribute &to = out.*member;
+            if (to.components == 0)
+              continue;
+            if (to.type == from.type)
+              std::memcpy (dst + to.offset, src + from.offset,
+                           to.components * componentSize (to.type));
+            else
+              writeComponents (dst, to, from.read (src));
+          }
+      },
+      kVertexGrain);
+
+  mesh.layout = out;
+  mesh.vertexData = std::move (vertexData);
+}
+
+void
+encode (const SubMesh &mesh, bool compress, EncodedGeometry &out)
+{
+  const VertexAttribute &position = mesh.layout.position;
+  out.min.assign (position.components, HUGE_VAL);
+  out.max.assign (position.components, -HUGE_VAL);
+  for (size_t v = 0; v < mesh.vertexCount; v++)
+    for (int c = 0; c < position.components; c++)
+      {
+        const double x = rawComponent (mesh.vertex (v), position, c);
+        out.min[c] = std::min (out.min[c], x);
+        out.max[c] = std::max (out.max[c], x);
+      }
+
+  // glTF reserves the largest value of the index type (primitive restart)
+  const size_t count = mesh.indices.size ();
+  out.indexSize = mesh.vertexCount < 0xFFFF ? 2 : 4;
+  out.indexData.resize (count * out.indexSize);
+  for (size_t i = 0; i < count; i++)
+    {
+      if (out.indexSize == 2)
+        {
+          const uint16_t index = (uint16_t)mesh.indices[i];
+          std::memcpy (&out.indexData[i * 2], &index, 2);
+        }
+      else
+        {
+          std::memcpy (&out.indexData[i * 4], &mesh.indices[i], 4);
+        }
+    }
+
+  if (!compress)
+    return;
+  out.vertexStream = GlbWriter::encodeMeshopt (
+      mesh.vertexData.data (), mesh.vertexCount, (int)mesh.layout.stride,
+      GlbWriter::MeshoptAttributes);
+  out.indexStream
+      = GlbWriter::encodeMeshopt (out.indexData.data (), count,
+                                  out.indexSize, GlbWriter::MeshoptTriangles);
+}
+
+// Anything but float POSITION/NORMAL/TANGENT and float or normalized
+// unsigned TEXCOORD needs KHR_mesh_quantization
+bool
+needsQuantization (const VertexLayout &layout)
+{
+  for (const VertexAttribute *attribute :
+       { &layout.position, &layout.normal, &layout.tangent })
+    if (attribute->components && attribute->type != ComponentFloat)
+      return true;
+  const VertexAttribute &uv = layout.texCoords;
+  return uv.components && uv.type != ComponentFloat
+         && !(uv.normalized
+              && (uv.type == ComponentUnsignedByte
+                  || uv.type == ComponentUnsignedShort));
+}
+
+// The stored PNG/JPEG, or level 0 re-encoded as PNG
+bool
+encodedImage (const TextureData &texture, QByteArray *bytes,
+              QString *mimeType)
+{
+  const std::vector<unsigned char> &encoded = texture.encoded;
+  if (encoded.size () > 3)
+    {
+      *mimeType = QString::fromStdString (texture.mimeType);
+      if (mimeType->isEmpty () && encoded[0] == 0x89 && encoded[1] == 'P')
+        *mimeType = "image/png";
+      else if (mimeType->isEmpty () && encoded[0] == 0xFF
+               && encoded[1] == 0xD8)
+        *mimeType = "image/jpeg";
+      if (*mimeType == "image/png" || *mimeType == "image/jpeg")
+        {
+          *bytes = QByteArray (reinterpret_cast<const char *> (
+                                   encoded.data ()),
+                               (qsizetype)encoded.size ());
+          return true;
+        }
+    }
+
+  const int components = texture.components;
+  if (texture.codec != 0 || components < 1 || components > 4
+      || texture.pixels.size ()
+             < (size_t)texture.width * texture.height * components)
+    return false;
+
+  QImage image (texture.width, texture.height, QImage::Format_RGBA8888);
+  for (int y = 0; y < texture.height; y++)
+    {
+      const unsigned char *src
+          = &texture.pixels[(size_t)y * texture.width * components];
+      unsigned char *dst = image.scanLine (y);
+      for (int x = 0; x < texture.width; x++, src += components, dst += 4)
+        {
+          dst[0] = src[0];
+          dst[1] = components >= 3 ? src[1] : src[0];
+          dst[2] = components >= 3 ? src[2] : src[0];
+          dst[3] = components == 2   ? src[1]
+                   : components == 4 ? src[3]
+                                     : 255;
+        }
+    }
+
+  QBuffer buffer (bytes);
+  buffer.open (QIODevice::WriteOnly);
+  *mimeType = "image/png";
+  return image.save (&buffer, "PNG");
+}
+
+// Tightly packed floats outside the vertex streams (morph deltas, inverse
+// bind matrices, keyframes), with bounds on request
+int
+addFloats (GlbWriter &writer, const float *values, size_t count,
+           int components, const QString &type, bool bounds, bool compress)
+{
+  const int stride = components * (int)sizeof (float);
+  const int view
+      = compress ? writer.addMeshoptBufferView (values, count, stride,
+                                                GlbWriter::MeshoptAttributes)
+                 : writer.addBufferView (values, count * stride);
+  std::vector<double> min, max;
+  if (bounds)
+    {
+      min.assign (components, HUGE_VAL);
+      max.assign (components, -HUGE_VAL);
+      for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < components; c++)
+          {
+            const double x = values[i * components + c];
+            min[c] = std::min (min[c], x);
+            max[c] = std::max (max[c], x);
+          }
+    }
+  return writer.addAccessor (view, 0, GlbWriter::Float, count, type, false,
+                             min, max);
+}
+
+QString
+accessorType (int components)
+{
+  static const char *const types[] = { "SCALAR", "SCALAR", "VEC2", "VEC3",
+                                       "VEC4" };
+  return types[std::clamp (components, 0, 4)];
+}
+} // namespace
+
+int
+GlbOptimizer::runFromCommandLine (const QStringList &arguments)
+{
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy glTF optimizer");
+  parser.addHelpOption ();
+
+  QCommandLineOption weldOpt (
+      "weld", "Weld vertices within this tolerance (0 = identical only).",
+      "epsilon", "0");
+  QCommandLineOption noWeldOpt ("no-weld", "Keep duplicate vertices.");
+  QCommandLineOption noQuantizeOpt ("no-quantize",
+                                    "Keep attribute formats as loaded.");
+  QCommandLineOption noCompressOpt ("no-compress",
+                                    "Skip EXT_meshopt_compression.");
+  parser.addOptions ({ weldOpt, noWeldOpt, noQuantizeOpt, noCompressOpt });
+  parser.addPositionalArgument ("optimize", "Optimize mode.");
+  parser.addPositionalArgument ("input", "Model to read.");
+  parser.addPositionalArgument ("output", "GLB to write.");
+  parser.process (arguments);
+
+  const QStringList positional = parser.positionalArguments ();
+  Options options;
+  bool epsilonOk = false;
+  options.weld = !parser.isSet (noWeldOpt);
+  options.weldEpsilon = parser.value (weldOpt).toFloat (&epsilonOk);
+  options.quantize = !parser.isSet (noQuantizeOpt);
+  options.compress = !parser.isSet (noCompressOpt);
+  if (positional.size () != 3 || !epsilonOk || options.weldEpsilon < 0.0f)
+    {
+      std::fprintf (stderr,
+                    "Usage: mesh-spy optimize [--weld EPSILON] [--no-weld] "
+                    "[--no-quantize] [--no-compress] in.glb out.glb\n");
+      return 2;
+    }
+  options.input = positional[1];
+  options.output = positional[2];
+
+  Report report;
+  QString errorMsg;
+  if (!run (options, &report, &errorMsg))
+    {
+      std::fprintf (stderr, "Optimize failed: %s\n", qPrintable (errorMsg));
+      return 1;
+    }
+
+  for (const QString &warning : report.warnings)
+    std::fprintf (stderr, "Warning: %s\n", qPrintable (warning));
+
+  const LoadStats &load = report.load;
+  const struct
+  {
+    const char *name;
+    double ms;
+  } stages[] = {
+    { "parse", load.parseMs },
+    { "image decode", load.imageDecodeMs },
+    { "mesh decode", load.meshDecodeMs },
+    { "assembly", load.vertexAssemblyMs + load.indexConversionMs },
+    { "dedup", load.dedupMs },
+    { "weld", load.weldMs },
+    { "tangents", load.tangentMs },
+    { "reorder", report.reorderMs },
+    { "quantize", report.quantizeMs },
+    { "encode", report.encodeMs },
+    { "write", report.writeMs },
+  };
+
+  double totalMs = 0.0;
+  std::printf ("%-14s %10s\n", "stage", "ms");
+  for (const auto &stage : stages)
+    {
+      std::printf ("%-14s %10.2f\n", stage.name, stage.ms);
+      totalMs += stage.ms;
+    }
+  std::printf ("%-14s %10.2f\n\n", "total", totalMs);
+
+  const double mib = 1024.0 * 1024.0;
+  std::printf ("input   %10.2f MiB  %s\n", report.inputBytes / mib,
+               qPrintable (options.input));
+  std::printf ("output  %10.2f MiB  %s (%.1f%%)\n", report.outputBytes / mib,
+               qPrintable (options.output),
+               report.inputBytes
+                   ? 100.0 * report.outputBytes / report.inputBytes
+                   : 0.0);
+  std::printf ("vertices %zu (%zu welded), triangles %zu, "
+               "ACMR %.3f -> %.3f\n",
+               report.vertices, load.weldedVertices, report.indices / 3,
+               report.acmrBefore, report.acmrAfter);
+  return 0;
+}
+
+bool
+GlbOptimizer::run (const Options &options, Report *report,
+                   QString *errorMsg)
+{
+  // 1. The loader's own stages. Textures stay at level 0 and keep their
+  // file bytes, mips and block compression are the consumer's business.
+  LoaderOptions loaderOptions;
+  loaderOptions.processTextures = false;
+  loaderOptions.weldVertices = options.weld;
+  loaderOptions.weldEpsilon = options.weldEpsilon;
+  loaderOptions.keepEncodedImages = true;
+  std::unique_ptr<SceneData> scene (
+      GLTFLoader::load (options.input, errorMsg, loaderOptions));
+  if (!scene)
+    return false;
+  report->load = scene->stats;
+  report->inputBytes = scene->stats.fileBytes;
+
+  for (size_t s = 0; s < scene->skins.size (); s++)
+    for (int joint : scene->skins[s].joints)
+      if (joint < 0)
+        {
+          if (errorMsg)
+            *errorMsg = QString ("skin %1 has a joint that is not a node")
+                            .arg (s);
+          return false;
+        }
+  if (scene->stats.ignoredAttributes)
+    report->warnings
+        << QString ("%1 primitive attributes other than POSITION, NORMAL, "
+                    "TEXCOORD_0, TANGENT, JOINTS_0 and WEIGHTS_0 are not "
+                    "written")
+               .arg (scene->stats.ignoredAttributes);
+  if (scene->stats.ignoredChannels)
+    report->warnings
+        << QString ("%1 animation channels that cannot be played are not "
+                    "written")
+               .arg (scene->stats.ignoredChannels);
+
+  // Geometry shared by submeshes whose node transforms the loader baked
+  // differently is split again, since each is unbaked with its own
+  const std::vector<glm::mat4> world = restWorld (scene->nodes);
+  for (SubMesh &mesh : scene->meshes)
+    {
+      if (mesh.sharedGeometry < 0)
+        continue;
+      const SubMesh &owner = scene->meshes[mesh.sharedGeometry];
+      if (bakedMatrix (mesh, world) == bakedMatrix (owner, world))
+        continue;
+      mesh.vertexData = owner.vertexData;
+      mesh.vertexCount = owner.vertexCount;
+      mesh.indices = owner.indices;
+      mesh.targets = owner.targets;
+      mesh.layout = owner.layout;
+      mesh.sharedGeometry = -1;
+    }
+
+  // Submeshes that own their geometry, the rest point at one of these
+  std::vector<size_t> owners;
+  for (size_t m = 0; m < scene->meshes.size (); m++)
+    if (scene->meshes[m].sharedGeometry < 0)
+      owners.push_back (m);
+
+  // 2. Back to node space, then cache and fetch order, one submesh per
+  // task
+  QElapsedTimer stageTimer;
+  stageTimer.start ();
+  std::vector<double> acmrBefore (owners.size ());
+  std::vector<double> acmrAfter (owners.size ());
+  parallelFor (owners.size (), [&] (size_t i) {
+    SubMesh &mesh = scene->meshes[owners[i]];
+    const glm::mat4 baked = bakedMatrix (mesh, world);
+    if (baked != glm::mat4 (1.0f))
+      unbake (mesh, baked);
+    acmrBefore[i] = acmr (mesh);
+    reorder (mesh);
+    acmrAfter[i] = acmr (mesh);
+  });
+  report->reorderMs = stageTimer.nsecsElapsed () / 1.0e6;
+
+  size_t triangles = 0;
+  for (size_t i = 0; i < owners.size (); i++)
+    {
+      const SubMesh &mesh = scene->meshes[owners[i]];
+      const size_t count = mesh.indices.size () / 3;
+      report->acmrBefore += acmrBefore[i] * count;
+      report->acmrAfter += acmrAfter[i] * count;
+      report->vertices += mesh.vertexCount;
+      report->indices += mesh.indices.size ();
+      triangles += count;
+    }
+  if (triangles > 0)
+    {
+      report->acmrBefore /= triangles;
+      report->acmrAfter /= triangles;
+    }
+
+  // 3. Attribute formats
+  stageTimer.restart ();
+  parallelFor (owners.size (), [&] (size_t i) {
+    quantize (scene->meshes[owners[i]], options.quantize);
+  });
+  report->quantizeMs = stageTimer.nsecsElapsed () / 1.0e6;
+
+  // 4. Index packing, bounds and meshopt streams
+  stageTimer.restart ();
+  std::vector<EncodedGeometry> encoded (owners.size ());
+  parallelFor (owners.size (), [&] (size_t i) {
+    encode (scene->meshes[owners[i]], options.compress, encoded[i]);
+  });
+  report->encodeMs = stageTimer.nsecsElapsed () / 1.0e6;
+
+  // 5. Assemble and write, in file order
+  stageTimer.restart ();
+  GlbWriter writer;
+  std::vector<int> textureIds (scene->textures.size (), -1);
+  for (size_t t = 0; t < scene->textures.size (); t++)
+    {
+      QByteArray bytes;
+      QString mimeType;
+      if (encodedImage (scene->textures[t], &bytes, &mimeType))
+        textureIds[t] = writer.addTexture (writer.addImage (bytes, mimeType));
+    }
+
+  auto textureRef = [&] (int index) {
+    return QJsonObject{ { "index", textureIds[index] } };
+  };
+  auto hasTexture = [&] (int index) {
+    return index >= 0 && index < (int)textureIds.size ()
+           && textureIds[index] >= 0;
+  };
+  for (const MaterialData &data : scene->materials)
+    {
+      const glm::vec4 &color = data.baseColorFactor;
+      QJsonObject pbr;
+      pbr["baseColorFactor"] = QJsonArray{ color.r, color.g, color.b,
+                                           color.a };
+      pbr["metallicFactor"] = data.metallicFactor;
+      pbr["roughnessFactor"] = data.roughnessFactor;
+      if (hasTexture (data.baseColorIndex))
+        pbr["baseColorTexture"] = textureRef (data.baseColorIndex);
+      if (hasTexture (data.metallicRoughnessIndex))
+        pbr["metallicRoughnessTexture"]
+            = textureRef (data.metallicRoughnessIndex);
+
+      QJsonObject material;
+      material["pbrMetallicRoughness"] = pbr;
+      if (hasTexture (data.normalIndex))
+        material["normalTexture"] = textureRef (data.normalIndex);
+      if (data.alphaMode == AlphaMask)
+        {
+          material["alphaMode"] = "MASK";
+          material["alphaCutoff"] = data.alphaCutoff;
+        }
+      else if (data.alphaMode == AlphaBlend)
+        material["alphaMode"] = "BLEND";
+      if (!data.name.empty ())
+        material["name"] = QString::fromStdString (data.name);
+      writer.addMaterial (material);
+    }
+
+  std::vector<QJsonObject> primitives (scene->meshes.size ());
+  bool quantized = false;
+  for (size_t i = 0; i < owners.size (); i++)
+    {
+      const SubMesh &mesh = scene->meshes[owners[i]];
+      const EncodedGeometry &geometry = encoded[i];
+      if (mesh.indices.empty ())
+        continue;
+      quantized = quantized || needsQuantization (mesh.layout);
+
+      const int vertexView
+          = options.compress
+                ? writer.addMeshoptBufferView (geometry.vertexStream,
+                                               GlbWriter::ArrayBuffer)
+                : writer.addBufferView (mesh.vertexData.data (),
+                                        mesh.vertexData.size (),
+                                        (int)mesh.layout.stride,
+                                        GlbWriter::ArrayBuffer);
+      const int indexView
+          = options.compress
+                ? writer.addMeshoptBufferView (
+                      geometry.indexStream, GlbWriter::ElementArrayBuffer)
+                : writer.addBufferView (geometry.indexData.data (),
+                                        geometry.indexData.size (), 0,
+                                        GlbWriter::ElementArrayBuffer);
+
+      QJsonObject attributes;
+      const struct
+      {
+        const char *name;
+        const VertexAttribute &attribute;
+      } semantics[] = {
+        { "POSITION", mesh.layout.position },
+        { "NORMAL", mesh.layout.normal },
+        { "TEXCOORD_0", mesh.layout.texCoords },
+        { "TANGENT", mesh.layout.tangent },
+        { "JOINTS_0", mesh.layout.joints },
+        { "WEIGHTS_0", mesh.layout.weights },
+      };
+      for (const auto &semantic : semantics)
+        {
+          const VertexAttribute &attribute = semantic.attribute;
+          if (attribute.components == 0)
+            continue;
+          const bool isPosition = &attribute == &mesh.layout.position;
+          attributes[semantic.name] = writer.addAccessor (
+              vertexView, attribute.offset,
+              (GlbWriter::ComponentType)attribute.type, mesh.vertexCount,
+              accessorType (attribute.components), attribute.normalized,
+              isPosition ? geometry.min : std::vector<double> (),
+              isPosition ? geometry.max : std::vector<double> ());
+        }
+
+      QJsonObject primitive;
+      primitive["attributes"] = attributes;
+      primitive["indices"] = writer.addAccessor (
+          indexView, 0,
+          geometry.indexSize == 2 ? GlbWriter::UnsignedShort
+                                  : GlbWriter::UnsignedInt,
+          mesh.indices.size (), "SCALAR");
+
+      // A target needs at least one attribute
+      QJsonArray targets;
+      const std::vector<glm::vec3> zeros (
+          mesh.targets.empty () ? 0 : mesh.vertexCount, glm::vec3 (0.0f));
+      for (const MorphTarget &target : mesh.targets)
+        {
+          QJsonObject deltas;
+          const struct
+          {
+            const char *name;
+            const std::vector<glm::vec3> &values;
+          } streams[] = { { "POSITION", target.positions },
+                          { "NORMAL", target.normals },
+                          { "TANGENT", target.tangents } };
+          for (const auto &stream : streams)
+            if (stream.values.size () == mesh.vertexCount)
+              deltas[stream.name] = addFloats (
+                  writer, &stream.values[0][0], mesh.vertexCount, 3, "VEC3",
+                  &stream.values == &target.positions, options.compress);
+          if (deltas.isEmpty ())
+            deltas["POSITION"]
+                = addFloats (writer, &zeros[0][0], mesh.vertexCount, 3,
+                             "VEC3", true, options.compress);
+          targets.append (deltas);
+        }
+      if (!targets.isEmpty ())
+        primitive["targets"] = targets;
+      primitives[owners[i]] = primitive;
+    }
+  if (quantized)
+    writer.addExtension ("KHR_mesh_quantization", true);
+
+  // 6. The scene graph as loaded: every node with its rest transform and
+  // children, one mesh per node holding its primitives, skins and clips
+  const std::vector<NodeData> &nodes = scene->nodes;
+  std::vector<QJsonArray> nodePrimitives (nodes.size ());
+  std::vector<QJsonArray> children (nodes.size ());
+  std::vector<int> nodeMesh (nodes.size (), -1); // First submesh
+  std::vector<bool> mixedTargets (nodes.size (), false);
+  QJsonArray orphans; // Primitives without a valid node
+  for (size_t m = 0; m < scene->meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene->meshes[m];
+      const int owner = mesh.sharedGeometry >= 0 ? mesh.sharedGeometry
+                                                 : (int)m;
+      QJsonObject primitive = primitives[owner];
+      if (primitive.isEmpty ())
+        continue;
+      if (mesh.materialIndex < (int)scene->materials.size ())
+        primitive["material"] = mesh.materialIndex;
+
+      const int n = mesh.node;
+      if (n < 0 || n >= (int)nodes.size ())
+        {
+          orphans.append (primitive);
+          continue;
+        }
+      // glTF wants the same target count on every primitive of a mesh
+      if (nodeMesh[n] < 0)
+        nodeMesh[n] = (int)m;
+      else if (scene->geometry (m).targets.size ()
+               != scene->geometry (nodeMesh[n]).targets.size ())
+        mixedTargets[n] = true;
+      nodePrimitives[n].append (primitive);
+    }
+  for (size_t n = 0; n < nodes.size (); n++)
+    if (nodes[n].parent >= 0 && nodes[n].parent < (int)nodes.size ())
+      children[nodes[n].parent].append ((int)n);
+
+  for (size_t n = 0; n < nodes.size (); n++)
+    {
+      const NodeData &data = nodes[n];
+      QJsonObject node;
+      if (!data.name.empty ())
+        node["name"] = QString::fromStdString (data.name);
+      if (data.hasMatrix)
+        {
+          QJsonArray matrix;
+          for (int i = 0; i < 16; i++)
+            matrix.append (data.matrix[i / 4][i % 4]);
+          node["matrix"] = matrix;
+        }
+      else
+        {
+          const glm::vec3 &t = data.translation;
+          const glm::vec4 &r = data.rotation;
+          const glm::vec3 &s = data.scale;
+          if (t != glm::vec3 (0.0f))
+            node["translation"] = QJsonArray{ t.x, t.y, t.z };
+          if (r != glm::vec4 (0.0f, 0.0f, 0.0f, 1.0f))
+            node["rotation"] = QJsonArray{ r.x, r.y, r.z, r.w };
+          if (s != glm::vec3 (1.0f))
+            node["scale"] = QJsonArray{ s.x, s.y, s.z };
+        }
+      if (!children[n].isEmpty ())
+        node["children"] = children[n];
+
+      if (nodeMesh[n] >= 0)
+        {
+          const SubMesh &first = scene->meshes[nodeMesh[n]];
+          QJsonArray primitiveList = nodePrimitives[n];
+          QJsonObject mesh;
+          if (mixedTargets[n])
+            {
+              report->warnings
+                  << QString ("Node %1 mixes primitives with different "
+                              "morph target counts; its targets are not "
+                              "written")
+                         .arg (n);
+              for (int p = 0; p < primitiveList.size (); p++)
+                {
+                  QJsonObject primitive = primitiveList[p].toObject ();
+                  primitive.remove ("targets");
+                  primitiveList[p] = primitive;
+                }
+            }
+          else if (!first.morphWeights.empty ())
+            {
+              QJsonArray weights;
+              for (float weight : first.morphWeights)
+                weights.append (weight);
+              mesh["weights"] = weights;
+            }
+          mesh["primitives"] = primitiveList;
+          const std::string name
+              = first.name.substr (0, first.name.rfind (" #"));
+          mesh["name"] = QString::fromStdString (name);
+          node["mesh"] = writer.addMesh (mesh);
+          if (first.skin >= 0 && first.skin < (int)scene->skins.size ())
+            node["skin"] = first.skin;
+        }
+      writer.addNode (node);
+    }
+  for (const QJsonValue &primitive : orphans)
+    writer.addNode (QJsonObject{
+        { "mesh", writer.addMesh (QJsonArray{ primitive }) } });
+
+  for (const SkinData &skin : scene->skins)
+    {
+      QJsonArray joints;
+      for (int joint : skin.joints)
+        joints.append (joint);
+      QJsonObject json{ { "joints", joints } };
+      if (!skin.inverseBindMatrices.empty ())
+        json["inverseBindMatrices"] = addFloats (
+            writer, &skin.inverseBindMatrices[0][0][0],
+            skin.inverseBindMatrices.size (), 16, "MAT4", false,
+            options.compress);
+      if (!skin.name.empty ())
+        json["name"] = QString::fromStdString (skin.name);
+      writer.addSkin (json);
+    }
+
+  static const char *const paths[]
+      = { "translation", "rotation", "scale", "weights" };
+  static const char *const interpolations[]
+      = { "LINEAR", "STEP", "CUBICSPLINE" };
+  for (const AnimationData &clip : scene->animations)
+    {
+      QJsonArray samplers;
+      QJsonArray channels;
+      for (const AnimationChannelData &channel : clip.channels)
+        {
+          // Weights are scalars, one per target and key
+          const bool weights = channel.path == PathWeights;
+          const int components = weights ? 1 : channel.components;
+          const int input = addFloats (writer, channel.times.data (),
+                                       channel.times.size (), 1, "SCALAR",
+                                       true, options.compress);
+          const int output = addFloats (
+              writer, channel.values.data (),
+              channel.values.size () / components, components,
+              accessorType (components), false, options.compress);
+          samplers.append (QJsonObject{
+              { "input", input },
+              { "output", output },
+              { "interpolation", interpolations[channel.interpolation] } });
+          channels.append (QJsonObject{
+              { "sampler", (int)samplers.size () - 1 },
+              { "target", QJsonObject{ { "node", channel.node },
+                                       { "path", paths[channel.path] } } } });
+        }
+      QJsonObject animation{ { "samplers", samplers },
+                             { "channels", channels } };
+      if (!clip.name.empty ())
+        animation["name"] = QString::fromStdString (clip.name);
+      writer.addAnimation (animation);
+    }
+
+  if (!writer.write (options.output, errorMsg))
+    return false;
+  report->writeMs = stageTimer.nsecsElapsed () / 1.0e6;
+  report->outputBytes = (size_t)QFileInfo (options.output).size ();
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef GLBOPTIMIZER_H
+#define GLBOPTIMIZER_H
+
+#include "meshdata.h"
+
+#include <QString>
+#include <QStringList>
+
+// Offline "optimize in.glb out.glb" mode for the content pipeline.
+//
+// The model goes through the regular loader (dedup and welding included,
+// images kept in their PNG/JPEG form), then every geometry is reordered for
+// the post-transform cache and vertex fetch, requantized and meshopt
+// encoded, one submesh per pool task, and written back through GlbWriter.
+// Normals and tangents become 8-bit and UVs in [0, 1] 16-bit normalized
+// (KHR_mesh_quantization), vertex and index views are compressed with
+// EXT_meshopt_compression. Positions, joints and weights stay in their
+// stored format.
+//
+// The scene graph round-trips: every node with its rest transform, one
+// mesh per node with its primitives, morph targets and default weights,
+// skins and animation clips. The rest transform the loader baked into
+// rigid meshes is taken back out first (positions it baked stay float).
+// What the loader drops (extra UV and joint sets, vertex colors, channels
+// it cannot play) is listed in Report::warnings.
+class GlbOptimizer
+{
+public:
+  struct Options
+  {
+    QString input;
+    QString output;
+    bool weld = true;
+    float weldEpsilon = 0.0f;
+    bool quantize = true;
+    bool compress = true;
+  };
+
+  struct Report
+  {
+    LoadStats load;
+    double reorderMs = 0.0;
+    double quantizeMs = 0.0;
+    double encodeMs = 0.0;
+    double writeMs = 0.0;
+
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+    size_t vertices = 0; // Written, after welding and reordering
+    size_t indices = 0;
+
+    // Average post-transform cache miss ratio over all triangles
+    double acmrBefore = 0.0;
+    double acmrAfter = 0.0;
+
+    // Input that is not written to the output
+    QStringList warnings;
+  };
+
+  // Parses "optimize [--weld EPSILON] [--no-weld] [--no-quantize]
+  // [--no-compress] in.glb out.glb", runs it and prints sizes and stage
+  // timings to stdout. Returns the process exit code.
+  static int runFromCommandLine (const QStringList &arguments);
+
+  static bool run (const Options &options, Report *report,
+                   QString *errorMsg);
+};
+
+#endif // GLBOPTIMIZER_H
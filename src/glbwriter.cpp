@@ -0,0 +1,349 @@
+#include "glbwriter.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <meshoptimizer.h>
+
+static void
+padTo4 (QByteArray &bytes, char fill)
+{
+  while (bytes.size () % 4 != 0)
+    bytes.append (fill);
+}
+
+int
+GlbWriter::addBufferView (const void *data, size_t size, int byteStride,
+                          Target target)
+{
+  padTo4 (m_bin, '\0');
+
+  QJsonObject view;
+  view["buffer"] = 0;
+  view["byteOffset"] = (double)m_bin.size ();
+  view["byteLength"] = (double)size;
+  if (byteStride > 0)
+    view["byteStride"] = byteStride;
+  if (target != NoTarget)
+    view["target"] = (int)target;
+
+  m_bin.append (static_cast<const char *> (data), (qsizetype)size);
+  m_bufferViews.append (view);
+  return (int)m_bufferViews.size () - 1;
+}
+
+int
+GlbWriter::addMeshoptBufferView (const void *data, size_t count,
+                                 int byteStride, MeshoptMode mode,
+                                 Target target)
+{
+  return addMeshoptBufferView (encodeMeshopt (data, count, byteStride, mode),
+                               target);
+}
+
+GlbWriter::MeshoptStream
+GlbWriter::encodeMeshopt (const void *data, size_t count, int byteStride,
+                          MeshoptMode mode)
+{
+  // The extension only defines version 0 of the vertex codec. Set once,
+  // encoders may run concurrently.
+  static const bool versionsSet = [] {
+    meshopt_encodeVertexVersion (0);
+    meshopt_encodeIndexVersion (1);
+    return true;
+  }();
+  (void)versionsSet;
+
+  MeshoptStream stream;
+  stream.count = count;
+  stream.byteStride = byteStride;
+  stream.mode = mode;
+  std::vector<unsigned char> &encoded = stream.encoded;
+  if (mode == MeshoptAttributes)
+    {
+      encoded.resize (meshopt_encodeVertexBufferBound (count, byteStride));
+      encoded.resize (meshopt_encodeVertexBuffer (
+          encoded.data (), encoded.size (), data, count, byteStride));
+      return stream;
+    }
+
+  std::vector<unsigned int> indices (count);
+  unsigned int vertexCount = 0;
+  for (size_t i = 0; i < count; i++)
+    {
+      const unsigned char *element
+          = static_cast<const unsigned char *> (data) + i * byteStride;
+      if (byteStride == 2)
+        {
+          unsigned short value;
+          std::memcpy (&value, element, 2);
+          indices[i] = value;
+        }
+      else
+        {
+          std::memcpy (&indices[i], element, 4);
+        }
+      vertexCount = std::max (vertexCount, indices[i] + 1);
+    }
+
+  if (mode == MeshoptTriangles)
+    {
+      encoded.resize (meshopt_encodeIndexBufferBound (count, vertexCount));
+      encoded.resize (meshopt_encodeIndexBuffer (
+          encoded.data (), encoded.size (), indices.data (), count));
+    }
+  else
+    {
+      encoded.resize (meshopt_encodeIndexSequenceBound (count, vertexCount));
+      encoded.resize (meshopt_encodeIndexSequence (
+          encoded.data (), encoded.size (), indices.data (), count));
+    }
+  return stream;
+}
+
+int
+GlbWriter::addMeshoptBufferView (const MeshoptStream &stream, Target target)
+{
+  static const char *const modeNames[]
+      = { "ATTRIBUTES", "TRIANGLES", "INDICES" };
+  const size_t count = stream.count;
+  const int byteStride = stream.byteStride;
+
+  padTo4 (m_bin, '\0');
+  QJsonObject compression;
+  compression["buffer"] = 0;
+  compression["byteOffset"] = (double)m_bin.size ();
+  compression["byteLength"] = (double)stream.encoded.size ();
+  compression["byteStride"] = byteStride;
+  compression["count"] = (double)count;
+  compression["mode"] = modeNames[stream.mode];
+  m_bin.append (reinterpret_cast<const char *> (stream.encoded.data ()),
+                (qsizetype)stream.encoded.size ());
+
+  m_fallbackSize = (m_fallbackSize + 3) & ~size_t (3);
+  QJsonObject view;
+  view["buffer"] = 1;
+  view["byteOffset"] = (double)m_fallbackSize;
+  view["byteLength"] = (double)(count * byteStride);
+  if (stream.mode == MeshoptAttributes)
+    view["byteStride"] = byteStride;
+  if (target != NoTarget)
+    view["target"] = (int)target;
+  view["extensions"]
+      = QJsonObject{ { "EXT_meshopt_compression", compression } };
+  m_fallbackSize += count * byteStride;
+
+  addExtension ("EXT_meshopt_compression", true);
+  m_bufferViews.append (view);
+  return (int)m_bufferViews.size () - 1;
+}
+
+int
+GlbWriter::addAccessor (int bufferView, size_t byteOffset,
+                        ComponentType componentType, size_t count,
+                        const QString &type, bool normalized,
+                        const std::vector<double> &min,
+                        const std::vector<double> &max)
+{
+  QJsonObject accessor;
+  if (bufferView >= 0)
+    accessor["bufferView"] = bufferView;
+  if (byteOffset > 0)
+    accessor["byteOffset"] = (double)byteOffset;
+  accessor["componentType"] = (int)componentType;
+  accessor["count"] = (double)count;
+  accessor["type"] = type;
+  if (normalized)
+    accessor["normalized"] = true;
+
+  if (!min.empty () && !max.empty ())
+    {
+      QJsonArray minArray;
+      QJsonArray maxArray;
+      for (double v : min)
+        minArray.append (v);
+      for (double v : max)
+        maxArray.append (v);
+      accessor["min"] = minArray;
+      accessor["max"] = maxArray;
+    }
+
+  m_accessors.append (accessor);
+  return (int)m_accessors.size () - 1;
+}
+
+int
+GlbWriter::addImage (const QByteArray &encoded, const QString &mimeType)
+{
+  int view = addBufferView (encoded.constData (), (size_t)encoded.size ());
+
+  QJsonObject image;
+  image["bufferView"] = view;
+  image["mimeType"] = mimeType;
+  m_images.append (image);
+  return (int)m_images.size () - 1;
+}
+
+int
+GlbWriter::addTexture (int image)
+{
+  QJsonObject texture;
+  texture["source"] = image;
+  m_textures.append (texture);
+  return (int)m_textures.size () - 1;
+}
+
+int
+GlbWriter::addMaterial (const QJsonObject &material)
+{
+  m_materials.append (material);
+  return (int)m_materials.size () - 1;
+}
+
+int
+GlbWriter::addMesh (const QJsonArray &primitives)
+{
+  QJsonObject mesh;
+  mesh["primitives"] = primitives;
+  return addMesh (mesh);
+}
+
+int
+GlbWriter::addMesh (const QJsonObject &mesh)
+{
+  m_meshes.append (mesh);
+  return (int)m_meshes.size () - 1;
+}
+
+int
+GlbWriter::addNode (const QJsonObject &node)
+{
+  m_nodes.append (node);
+  return (int)m_nodes.size () - 1;
+}
+
+int
+GlbWriter::addSkin (const QJsonObject &skin)
+{
+  m_skins.append (skin);
+  return (int)m_skins.size () - 1;
+}
+
+int
+GlbWriter::addAnimation (const QJsonObject &animation)
+{
+  m_animations.append (animation);
+  return (int)m_animations.size () - 1;
+}
+
+void
+GlbWriter::addExtension (const QString &name, bool required)
+{
+  if (!m_extensionsUsed.contains (name))
+    m_extensionsUsed.append (name);
+  if (required && !m_extensionsRequired.contains (name))
+    m_extensionsRequired.append (name);
+}
+
+QByteArray
+GlbWriter::toGlb () const
+{
+  QJsonObject root;
+  root["asset"] = QJsonObject{ { "version", "2.0" },
+                               { "generator", "meshSpy" } };
+
+  std::vector<bool> child (m_nodes.size (), false);
+  for (const QJsonValue &node : m_nodes)
+    {
+      const QJsonArray children
+          = node.toObject ().value ("children").toArray ();
+      for (const QJsonValue &index : children)
+        if (index.toInt () >= 0 && index.toInt () < m_nodes.size ())
+          child[index.toInt ()] = true;
+    }
+  QJsonArray sceneNodes;
+  for (int i = 0; i < m_nodes.size (); i++)
+    if (!child[i])
+      sceneNodes.append (i);
+  root["scene"] = 0;
+  root["scenes"] = QJsonArray{ QJsonObject{ { "nodes", sceneNodes } } };
+  root["nodes"] = m_nodes;
+  root["meshes"] = m_meshes;
+  if (!m_skins.isEmpty ())
+    root["skins"] = m_skins;
+  if (!m_animations.isEmpty ())
+    root["animations"] = m_animations;
+  if (!m_materials.isEmpty ())
+    root["materials"] = m_materials;
+  if (!m_textures.isEmpty ())
+    root["textures"] = m_textures;
+  if (!m_images.isEmpty ())
+    root["images"] = m_images;
+  root["accessors"] = m_accessors;
+  root["bufferViews"] = m_bufferViews;
+
+  QByteArray bin = m_bin;
+  padTo4 (bin, '\0');
+  QJsonArray buffers{ QJsonObject{ { "byteLength", (double)bin.size () } } };
+  if (m_fallbackSize > 0)
+    {
+      QJsonObject fallback;
+      fallback["byteLength"] = (double)m_fallbackSize;
+      fallback["extensions"] = QJsonObject{
+        { "EXT_meshopt_compression", QJsonObject{ { "fallback", true } } }
+      };
+      buffers.append (fallback);
+    }
+  root["buffers"] = buffers;
+
+  if (!m_extensionsUsed.isEmpty ())
+    root["extensionsUsed"] = QJsonArray::fromStringList (m_extensionsUsed);
+  if (!m_extensionsRequired.isEmpty ())
+    root["extensionsRequired"]
+        = QJsonArray::fromStringList (m_extensionsRequired);
+
+  QByteArray json = QJsonDocument (root).toJson (QJsonDocument::Compact);
+  padTo4 (json, ' ');
+
+  // Header (12 bytes) + JSON chunk + BIN chunk, all little endian.
+  auto appendU32 = [] (QByteArray &out, quint32 value) {
+    quint32 le = qToLittleEndian (value);
+    out.append (reinterpret_cast<const char *> (&le), 4);
+  };
+
+  QByteArray glb;
+  quint32 total = 12 + 8 + json.size () + 8 + bin.size ();
+  appendU32 (glb, 0x46546C67); // "glTF"
+  appendU32 (glb, 2);
+  appendU32 (glb, total);
+  appendU32 (glb, (quint32)json.size ());
+  appendU32 (glb, 0x4E4F534A); // "JSON"
+  glb.append (json);
+  appendU32 (glb, (quint32)bin.size ());
+  appendU32 (glb, 0x004E4942); // "BIN\0"
+  glb.append (bin);
+  return glb;
+}
+
+bool
+GlbWriter::write (const QString &path, QString *errorMsg) const
+{
+  QFile file (path);
+  if (!file.open (QIODevice::WriteOnly))
+    {
+      if (errorMsg)
+        *errorMsg = file.errorString ();
+      return false;
+    }
+
+  QByteArray glb = toGlb ();
+  if (file.write (glb) != glb.size ())
+    {
+      if (errorMsg)
+        *errorMsg = file.errorString ();
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,118 @@
+#ifndef GLBWRITER_H
+#define GLBWRITER_H
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// Minimal builder for binary glTF 2.0 files. All binary payloads go into a
+// single BIN chunk; every add* call returns the index of the new element.
+// Meshopt views decode into a second, fallback-only buffer.
+class GlbWriter
+{
+public:
+  // glTF componentType values
+  enum ComponentType
+  {
+    Byte = 5120,
+    UnsignedByte = 5121,
+    Short = 5122,
+    UnsignedShort = 5123,
+    UnsignedInt = 5125,
+    Float = 5126
+  };
+
+  // bufferView targets
+  enum Target
+  {
+    NoTarget = 0,
+    ArrayBuffer = 34962,
+    ElementArrayBuffer = 34963
+  };
+
+  // EXT_meshopt_compression modes
+  enum MeshoptMode
+  {
+    MeshoptAttributes,
+    MeshoptTriangles, // byteStride 2 or 4
+    MeshoptIndices    // byteStride 2 or 4
+  };
+
+  // One meshoptimizer-encoded bufferView, not yet in the file
+  struct MeshoptStream
+  {
+    std::vector<unsigned char> encoded;
+    size_t count = 0;
+    int byteStride = 0;
+    MeshoptMode mode = MeshoptAttributes;
+  };
+
+  int addBufferView (const void *data, size_t size, int byteStride = 0,
+                     Target target = NoTarget);
+
+  // Encodes `count` elements of `byteStride` bytes with meshoptimizer into
+  // the BIN chunk and returns a view of the uncompressed fallback buffer
+  // they decode to. Attribute strides must be a multiple of 4.
+  int addMeshoptBufferView (const void *data, size_t count, int byteStride,
+                            MeshoptMode mode, Target target = NoTarget);
+
+  // The same in two steps: encoding touches no writer state and may run on
+  // any thread, appending must happen in bufferView order.
+  static MeshoptStream encodeMeshopt (const void *data, size_t count,
+                                      int byteStride, MeshoptMode mode);
+  int addMeshoptBufferView (const MeshoptStream &stream,
+                            Target target = NoTarget);
+
+  // bufferView -1 leaves the accessor without data (Draco primitives).
+  int addAccessor (int bufferView, size_t byteOffset,
+                   ComponentType componentType, size_t count,
+                   const QString &type, bool normalized = false,
+                   const std::vector<double> &min = {},
+                   const std::vector<double> &max = {});
+  int addImage (const QByteArray &encoded, const QString &mimeType);
+  int addTexture (int image);
+  int addMaterial (const QJsonObject &material);
+  int addMesh (const QJsonArray &primitives);
+  int addMesh (const QJsonObject &mesh); // Primitives, weights, name
+  // Nodes no other node lists as a child become the scene roots
+  int addNode (const QJsonObject &node);
+  int addSkin (const QJsonObject &skin);
+  int addAnimation (const QJsonObject &animation);
+  void addExtension (const QString &name, bool required);
+
+  // Escape hatch for extensions that need to decorate existing elements.
+  QJsonArray &
+  bufferViews ()
+  {
+    return m_bufferViews;
+  }
+
+  size_t
+  binarySize () const
+  {
+    return (size_t)m_bin.size ();
+  }
+
+  QByteArray toGlb () const;
+  bool write (const QString &path, QString *errorMsg) const;
+
+private:
+  QByteArray m_bin;
+  size_t m_fallbackSize = 0;
+  QJsonArray m_bufferViews;
+  QJsonArray m_accessors;
+  QJsonArray m_images;
+  QJsonArray m_textures;
+  QJsonArray m_materials;
+  QJsonArray m_meshes;
+  QJsonArray m_nodes;
+  QJsonArray m_skins;
+  QJsonArray m_animations;
+  QStringList m_extensionsUsed;
+  QStringList m_extensionsRequired;
+};
+
+#endif // GLBWRITER_H
@@ -0,0 +1,31 @@
+#ifndef GLCORE_H
+#define GLCORE_H
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLVersionFunctionsFactory>
+
+// QOpenGLExtraFunctions only covers the ES 3.x subset. Desktop-only entry
+// points (timer queries, buffer storage, ...) come from the 4.5 core
+// function table of the current context. Returns nullptr when the context
+// is older than 4.5 or not a desktop core context, so callers must keep a
+// fallback path.
+inline QOpenGLFunctions_4_5_Core *
+coreFunctions45 ()
+{
+  QOpenGLContext *ctx = QOpenGLContext::currentContext ();
+  if (!ctx || ctx->isOpenGLES ())
+    return nullptr;
+
+  const QSurfaceFormat fmt = ctx->format ();
+  if (fmt.version () < qMakePair (4, 5))
+    return nullptr;
+
+  auto *funcs
+      = QOpenGLVersionFunctionsFactory::get<QOpenGLFunctions_4_5_Core> (ctx);
+  if (funcs && !funcs->initializeOpenGLFunctions ())
+    return nullptr;
+  return funcs;
+}
+
+#endif // GLCORE_H
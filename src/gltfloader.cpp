@@ -1,4 +1,11 @@
 #include "gltfloader.h"
+#include "meshdecoder.h"
+#include "parallel.h"
+#include "scenededup.h"
+#include "tangentgenerator.h"
+#include "textureprocessor.h"
+#include "tracer.h"
+#include "vertexwelder.h"
 
 // Define implementation only here
 #define TINYGLTF_IMPLEMENTATION
@@ -7,28 +14,424 @@
 #include <tiny_gltf.h>
 
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <cmath>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
 
+struct ImageLoaderState
+{
+  LoadStats *stats;
+  std::vector<std::vector<unsigned char>> *encoded; // Per image, optional
+};
+
+// Wraps tinygltf's stb_image based decoder so image decoding can be timed
+// separately from parsing.
+static bool
+timedImageLoader (tinygltf::Image *image, const int imageIndex,
+                  std::string *err, std::string *warn, int reqWidth,
+                  int reqHeight, const unsigned char *bytes, int size,
+                  void *userData)
+{
+  TRACE_SCOPE_CAT ("loader", "Image Decode");
+  QElapsedTimer timer;
+  timer.start ();
+  bool ok = tinygltf::LoadImageData (image, imageIndex, err, warn, reqWidth,
+                                     reqHeight, bytes, size, nullptr);
+  const ImageLoaderState *state = static_cast<ImageLoaderState *> (userData);
+  state->stats->imageDecodeMs += timer.nsecsElapsed () / 1.0e6;
+  if (ok && state->encoded && imageIndex >= 0)
+    {
+      if ((size_t)imageIndex >= state->encoded->size ())
+        state->encoded->resize (imageIndex + 1);
+      (*state->encoded)[imageIndex].assign (bytes, bytes + size);
+    }
+  return ok;
+}
+
+// Elements of an accessor in their stored component type. Points straight
+// into the buffer unless the accessor is sparse or has no buffer view, in
+// which case the substituted elements are materialized in `storage`.
+struct AccessorData
+{
+  const unsigned char *data = nullptr;
+  size_t stride = 0;
+  size_t elementSize = 0;
+  size_t count = 0;
+  int componentType = 0;
+  int components = 0;
+  bool normalized = false;
+  std::vector<unsigned char> storage;
+
+  const unsigned char *
+  element (size_t i) const
+  {
+    return data + i * stride;
+  }
+};
+
+static bool
+inRange (const tinygltf::Model &model, int viewIndex, size_t offset,
+         size_t size)
+{
+  if (viewIndex < 0 || viewIndex >= (int)model.bufferViews.size ())
+    return false;
+  const tinygltf::BufferView &view = model.bufferViews[viewIndex];
+  if (view.buffer < 0 || view.buffer >= (int)model.buffers.size ())
+    return false;
+  return offset + size <= view.byteLength
+         && view.byteOffset + view.byteLength
+                <= model.buffers[view.buffer].data.size ();
+}
+
+static const unsigned char *
+viewData (const tinygltf::Model &model, int viewIndex, size_t offset)
+{
+  const tinygltf::BufferView &view = model.bufferViews[viewIndex];
+  return model.buffers[view.buffer].data.data () + view.byteOffset + offset;
+}
+
+static size_t
+readIndex (const unsigned char *src, int componentType)
+{
+  if (componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+    return *src;
+  if (componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+    {
+      unsigned short value;
+      std::memcpy (&value, src, 2);
+      return value;
+    }
+  unsigned int value;
+  std::memcpy (&value, src, 4);
+  return value;
+}
+
+static bool
+readAccessor (const tinygltf::Model &model, int index, AccessorData &out)
+{
+  if (index < 0 || index >= (int)model.accessors.size ())
+    return false;
+  const tinygltf::Accessor &acc = model.accessors[index];
+
+  out.count = acc.count;
+  out.componentType = acc.componentType;
+  out.components = tinygltf::GetNumComponentsInType (acc.type);
+  out.normalized = acc.normalized;
+  const int componentSize
+      = tinygltf::GetComponentSizeInBytes (acc.componentType);
+  if (out.components <= 0 || componentSize <= 0)
+    return false;
+  out.elementSize = (size_t)out.components * componentSize;
+
+  // 1. Dense elements
+  if (acc.bufferView >= 0)
+    {
+      const tinygltf::BufferView &view = model.bufferViews[acc.bufferView];
+      const int stride = acc.ByteStride (view);
+      if (stride <= 0)
+        return false;
+      out.stride = (size_t)stride;
+      const size_t span
+          = acc.count ? (acc.count - 1) * out.stride + out.elementSize : 0;
+      if (!inRange (model, acc.bufferView, acc.byteOffset, span))
+        return false;
+      out.data = viewData (model, acc.bufferView, acc.byteOffset);
+    }
+
+  if (!acc.sparse.isSparse && out.data)
+    return true;
+
+  // 2. Sparse substitution on a tight copy (zeros without a buffer view)
+  out.storage.assign (out.count * out.elementSize, 0);
+  if (out.data)
+    for (size_t i = 0; i < out.count; i++)
+      std::memcpy (&out.storage[i * out.elementSize], out.element (i),
+                   out.elementSize);
+  out.data = out.storage.data ();
+  out.stride = out.elementSize;
+
+  if (acc.sparse.isSparse)
+    {
+      const auto &sparse = acc.sparse;
+      const size_t count = (size_t)sparse.count;
+      const int indexType = sparse.indices.component_type;
+      const int indexSize = tinygltf::GetComponentSizeInBytes (indexType);
+      if (indexSize <= 0
+          || !inRange (model, sparse.indices.bufferView,
+                       sparse.indices.byteOffset, count * indexSize)
+          || !inRange (model, sparse.values.bufferView,
+                       sparse.values.byteOffset, count * out.elementSize))
+        return false;
+
+      const unsigned char *indices = viewData (
+          model, sparse.indices.bufferView, sparse.indices.byteOffset);
+      const unsigned char *values = viewData (
+          model, sparse.values.bufferView, sparse.values.byteOffset);
+      for (size_t i = 0; i < count; i++)
+        {
+          const size_t target = readIndex (indices + i * indexSize, indexType);
+          if (target < out.count)
+            std::memcpy (&out.storage[target * out.elementSize],
+                         values + i * out.elementSize, out.elementSize);
+        }
+    }
+  return true;
+}
+
+// Attribute in the accessor's own format (every glTF component type is a
+// valid glVertexAttribPointer type), padded to 4 bytes inside the vertex.
+static VertexAttribute
+placeAttribute (const AccessorData &src, int components, unsigned int &stride)
+{
+  VertexAttribute attribute;
+  attribute.components = std::min (components, src.components);
+  attribute.type = src.componentType;
+  attribute.normalized = src.normalized;
+  attribute.offset = stride;
+  const unsigned int size
+      = attribute.components
+        * tinygltf::GetComponentSizeInBytes (src.componentType);
+  stride += (size + 3) & ~3u;
+  return attribute;
+}
+
+// Float attribute for values the loader computes instead of copying
+static VertexAttribute
+placeFloats (int components, unsigned int &stride)
+{
+  VertexAttribute attribute;
+  attribute.components = components;
+  attribute.offset = stride;
+  stride += components * 4;
+  return attribute;
+}
+
+// Unit length direction, or the zero vector it came as
+static glm::vec3
+safeNormalize (const glm::vec3 &v)
+{
+  const float length = glm::length (v);
+  return length > 0.0f ? v / length : v;
+}
+
+// Every element of an accessor decoded to floats, components after
+// components (matrices included, up to 16 per element)
+static std::vector<float>
+readFloats (const AccessorData &data)
+{
+  std::vector<float> values;
+  values.reserve (data.count * data.components);
+  const int componentSize
+      = tinygltf::GetComponentSizeInBytes (data.componentType);
+  for (size_t i = 0; i < data.count; i++)
+    for (int c = 0; c < data.components; c += 4)
+      {
+        const VertexAttribute decode
+            = { std::min (4, data.components - c), data.componentType,
+                data.normalized, (unsigned int)(c * componentSize) };
+        const glm::vec4 value = decode.read (data.element (i));
+        for (int k = 0; k < decode.components; k++)
+          values.push_back (value[k]);
+      }
+  return values;
+}
+
+// Rest pose hierarchy, skins and animation clips. Channels the viewer
+// cannot play (KHR_animation_pointer, broken accessors) are dropped and
+// counted.
+static void
+loadAnimation (const tinygltf::Model &model, SceneData &scene,
+               LoadStats &stats)
+{
+  // 1. Nodes and their parents
+  scene.nodes.resize (model.nodes.size ());
+  for (size_t n = 0; n < model.nodes.size (); n++)
+    {
+      const tinygltf::Node &src = model.nodes[n];
+      NodeData &node = scene.nodes[n];
+      node.name = src.name;
+      if (src.translation.size () == 3)
+        node.translation = glm::vec3 (src.translation[0], src.translation[1],
+                                      src.translation[2]);
+      if (src.rotation.size () == 4)
+        node.rotation = glm::vec4 (src.rotation[0], src.rotation[1],
+                                   src.rotation[2], src.rotation[3]);
+      if (src.scale.size () == 3)
+        node.scale = glm::vec3 (src.scale[0], src.scale[1], src.scale[2]);
+      if (src.matrix.size () == 16)
+        {
+          node.hasMatrix = true;
+          for (int i = 0; i < 16; i++)
+            node.matrix[i / 4][i % 4] = (float)src.matrix[i];
+        }
+    }
+  for (size_t n = 0; n < model.nodes.size (); n++)
+    for (int child : model.nodes[n].children)
+      if (child >= 0 && child < (int)scene.nodes.size ())
+        scene.nodes[child].parent = (int)n;
+
+  // 2. Skins
+  for (const tinygltf::Skin &src : model.skins)
+    {
+      SkinData skin;
+      skin.name = src.name;
+      for (int joint : src.joints)
+        skin.joints.push_back (
+            joint >= 0 && joint < (int)scene.nodes.size () ? joint : -1);
+      skin.inverseBindMatrices.assign (skin.joints.size (), glm::mat4 (1.0f));
+
+      AccessorData matrices;
+      if (readAccessor (model, src.inverseBindMatrices, matrices)
+          && matrices.components == 16)
+        {
+          const std::vector<float> values = readFloats (matrices);
+          for (size_t j = 0;
+               j < skin.joints.size () && j < matrices.count; j++)
+            for (int i = 0; i < 16; i++)
+              skin.inverseBindMatrices[j][i / 4][i % 4] = values[j * 16 + i];
+        }
+      scene.skins.push_back (std::move (skin));
+    }
+
+  // 3. Clips
+  for (size_t a = 0; a < model.animations.size (); a++)
+    {
+      const tinygltf::Animation &src = model.animations[a];
+      AnimationData clip;
+      clip.name = src.name.empty () ? "Animation " + std::to_string (a)
+                                    : src.name;
+      for (const tinygltf::AnimationChannel &channel : src.channels)
+        {
+          if (channel.target_node < 0
+              || channel.target_node >= (int)scene.nodes.size ()
+              || channel.sampler < 0
+              || channel.sampler >= (int)src.samplers.size ())
+            continue;
+
+          AnimationChannelData data;
+          data.node = channel.target_node;
+          if (channel.target_path == "translation")
+            data.path = PathTranslation;
+          else if (channel.target_path == "rotation")
+            data.path = PathRotation;
+          else if (channel.target_path == "scale")
+            data.path = PathScale;
+          else if (channel.target_path == "weights")
+            data.path = PathWeights;
+          else
+            continue;
+
+          const tinygltf::AnimationSampler &sampler
+              = src.samplers[channel.sampler];
+          if (sampler.interpolation == "STEP")
+            data.interpolation = InterpolationStep;
+          else if (sampler.interpolation == "CUBICSPLINE")
+            data.interpolation = InterpolationCubicSpline;
+
+          AccessorData input, output;
+          if (!readAccessor (model, sampler.input, input)
+              || input.components != 1 || input.count == 0
+              || !readAccessor (model, sampler.output, output))
+            continue;
+          data.times = readFloats (input);
+          data.values = readFloats (output);
+
+          const size_t keys = data.times.size ();
+          const size_t perKey
+              = data.interpolation == InterpolationCubicSpline ? 3 : 1;
+          if (data.path == PathWeights)
+            data.components = (int)(data.values.size () / (keys * perKey));
+          else
+            data.components = data.path == PathRotation ? 4 : 3;
+          if (data.components == 0
+              || data.values.size () != keys * perKey * data.components)
+            continue;
+
+          clip.duration = std::max (clip.duration, data.times.back ());
+          clip.channels.push_back (std::move (data));
+        }
+      stats.ignoredChannels += src.channels.size () - clip.channels.size ();
+      scene.animations.push_back (std::move (clip));
+    }
+}
+
 void
 GLTFLoader::process (QString filepath)
 {
+  Tracer::setThreadName ("Loader");
+  QString errorMsg;
+  SceneData *sceneData = load (filepath, &errorMsg, m_options);
+
+  if (!sceneData)
+    {
+      emit error (errorMsg);
+      return;
+    }
+
+  emit finished (sceneData);
+}
+
+SceneData *
+GLTFLoader::load (const QString &filepath, QString *errorMsg,
+                  const LoaderOptions &options)
+{
+  TRACE_SCOPE_CAT ("loader", "GLTFLoader::load");
   tinygltf::Model model;
   tinygltf::TinyGLTF loader;
   std::string err;
   std::string warn;
 
-  bool ret = loader.LoadBinaryFromFile (&model, &err, &warn,
-                                        filepath.toStdString ());
+  LoadStats stats;
+  std::vector<std::vector<unsigned char>> encodedImages;
+  ImageLoaderState imageState{
+    &stats, options.keepEncodedImages ? &encodedImages : nullptr
+  };
+  loader.SetImageLoader (timedImageLoader, &imageState);
+
+  QElapsedTimer stageTimer;
+  stageTimer.start ();
+  QFile file (filepath);
+  if (!file.open (QIODevice::ReadOnly))
+    {
+      if (errorMsg)
+        *errorMsg = file.errorString ();
+      return nullptr;
+    }
+  TRACE_BEGIN ("loader", "Parse");
+  const QByteArray glb = MeshDecoder::prepareGlb (file.readAll ());
+  stats.fileBytes = (size_t)file.size ();
+  file.close ();
+
+  bool ret = loader.LoadBinaryFromMemory (
+      &model, &err, &warn,
+      reinterpret_cast<const unsigned char *> (glb.constData ()),
+      (unsigned int)glb.size (),
+      QFileInfo (filepath).absolutePath ().toStdString ());
+  stats.parseMs = stageTimer.nsecsElapsed () / 1.0e6 - stats.imageDecodeMs;
+  TRACE_END ();
 
   if (!warn.empty ())
     {
       qWarning () << "GLTF Warning: " << QString::fromStdString (warn);
     }
 
+  // Compressed geometry is expanded in place before anything reads it
+  if (ret)
+    {
+      TRACE_SCOPE_CAT ("loader", "Mesh Decode");
+      stageTimer.restart ();
+      ret = MeshDecoder::decode (model, &err, &stats.decodedBytes);
+      stats.meshDecodeMs = stageTimer.nsecsElapsed () / 1.0e6;
+    }
+
   if (!ret)
     {
-      emit error (QString::fromStdString (err));
-      return;
+      if (errorMsg)
+        *errorMsg = QString::fromStdString (err);
+      return nullptr;
     }
 
   SceneData *sceneData = new SceneData ();
@@ -39,6 +442,7 @@ GLTFLoader::process (QString filepath)
   glm::vec3 globalMax (-FLT_MAX);
 
   // 1. Load Textures
+  TRACE_BEGIN ("loader", "Materials");
   for (const auto &tex : model.textures)
     {
       if (tex.source > -1 && tex.source < model.images.size ())
@@ -50,6 +454,11 @@ GLTFLoader::process (QString filepath)
           texData.components = image.component;
           texData.pixels = image.image; // Copy data
           texData.name = image.name;
+          if ((size_t)tex.source < encodedImages.size ())
+            {
+              texData.encoded = encodedImages[tex.source];
+              texData.mimeType = image.mimeType;
+            }
           sceneData->textures.push_back (texData);
         }
       else
@@ -72,38 +481,63 @@ GLTFLoader::process (QString filepath)
           = glm::vec4 (baseColor[0], baseColor[1], baseColor[2], baseColor[3]);
       mData.metallicFactor = (float)mat.pbrMetallicRoughness.metallicFactor;
       mData.roughnessFactor = (float)mat.pbrMetallicRoughness.roughnessFactor;
+      if (mat.alphaMode == "MASK")
+        mData.alphaMode = AlphaMask;
+      else if (mat.alphaMode == "BLEND")
+        mData.alphaMode = AlphaBlend;
+      mData.alphaCutoff = (float)mat.alphaCutoff;
 
       mData.baseColorIndex = mat.pbrMetallicRoughness.baseColorTexture.index;
       mData.metallicRoughnessIndex
           = mat.pbrMetallicRoughness.metallicRoughnessTexture.index;
       mData.normalIndex = mat.normalTexture.index;
+      mData.name = mat.name;
 
       sceneData->materials.push_back (mData);
     }
 
-  // 3. Load Meshes (Iterate nodes to find meshes)
+  // 3. Scene graph, skins and animations
+  TRACE_END ();
+  TRACE_BEGIN ("loader", "Animation");
+  loadAnimation (model, *sceneData, stats);
+  TRACE_END ();
+
+  // 4. Load Meshes (Iterate nodes to find meshes)
+  TRACE_BEGIN ("loader", "Meshes");
   const tinygltf::Scene &scene
       = model.scenes[model.defaultScene > -1 ? model.defaultScene : 0];
 
-  // Simple recursive node traverser
-  std::vector<int> nodesToVisit = scene.nodes;
+  // Simple recursive node traverser, parents first, carrying the rest
+  // world matrix down
+  std::vector<std::pair<int, glm::mat4>> nodesToVisit;
+  for (int root : scene.nodes)
+    nodesToVisit.emplace_back (root, glm::mat4 (1.0f));
+  std::vector<size_t> tangentMeshes; // Reserved a tangent slot to fill
   while (!nodesToVisit.empty ())
     {
-      int nodeIdx = nodesToVisit.back ();
+      const int nodeIdx = nodesToVisit.back ().first;
+      const glm::mat4 world = nodesToVisit.back ().second
+                              * sceneData->nodes[nodeIdx].localMatrix ();
       nodesToVisit.pop_back ();
       const tinygltf::Node &node = model.nodes[nodeIdx];
 
       // Add children
-      nodesToVisit.insert (nodesToVisit.end (), node.children.begin (),
-                           node.children.end ());
+      for (int child : node.children)
+        nodesToVisit.emplace_back (child, world);
 
       if (node.mesh > -1)
         {
           const tinygltf::Mesh &mesh = model.meshes[node.mesh];
 
-          for (const auto &primitive : mesh.primitives)
+          const std::string meshName
+              = mesh.name.empty () ? "Mesh " + std::to_string (node.mesh)
+                                   : mesh.name;
+
+          for (size_t p = 0; p < mesh.primitives.size (); p++)
             {
+              const tinygltf::Primitive &primitive = mesh.primitives[p];
               SubMesh subMesh;
+              subMesh.name = meshName + " #" + std::to_string (p);
 
               // Get Material Index
               subMesh.materialIndex = primitive.material;
@@ -111,153 +545,413 @@ GLTFLoader::process (QString filepath)
                 subMesh.materialIndex = 0; // fallback to default
 
               // --- Accessors ---
-              const float *bufferPos = nullptr;
-              const float *bufferNormals = nullptr;
-              const float *bufferTexCoords = nullptr;
-              int stridePos = 0, strideNorm = 0, strideTex = 0;
-              size_t count = 0;
-
-              // Position
-              if (primitive.attributes.find ("POSITION")
-                  != primitive.attributes.end ())
+              auto attribute = [&] (const char *name, AccessorData &out) {
+                auto it = primitive.attributes.find (name);
+                return it != primitive.attributes.end ()
+                       && readAccessor (model, it->second, out);
+              };
+
+              AccessorData positions, normals, texCoords;
+              if (!attribute ("POSITION", positions))
                 {
-                  const tinygltf::Accessor &acc
-                      = model.accessors[primitive.attributes.at ("POSITION")];
-                  const tinygltf::BufferView &view
-                      = model.bufferViews[acc.bufferView];
-                  bufferPos = reinterpret_cast<const float *> (
-                      &model.buffers[view.buffer]
-                           .data[acc.byteOffset + view.byteOffset]);
-                  stridePos
-                      = acc.ByteStride (view)
-                            ? (acc.ByteStride (view) / sizeof (float))
-                            : tinygltf::GetNumComponentsInType (acc.type);
-                  count = acc.count;
+                  qWarning () << "GLTF Warning: skipping primitive of mesh"
+                              << node.mesh << "without usable positions";
+                  continue;
                 }
+              const size_t count = positions.count;
+              const bool hasNormals
+                  = attribute ("NORMAL", normals) && normals.count >= count;
+              const bool hasTexCoords
+                  = attribute ("TEXCOORD_0", texCoords)
+                    && texCoords.count >= count;
+              subMesh.hasTexCoords = hasTexCoords;
+
+              AccessorData joints, weights;
+              const bool skinned
+                  = node.skin >= 0 && node.skin < (int)model.skins.size ()
+                    && attribute ("JOINTS_0", joints)
+                    && joints.count >= count && joints.components == 4
+                    && attribute ("WEIGHTS_0", weights)
+                    && weights.count >= count && weights.components == 4;
 
-              // Normal
-              if (primitive.attributes.find ("NORMAL")
-                  != primitive.attributes.end ())
+              // Rigid primitives are baked into their node's rest world
+              // space (Animator moves them relative to it); skinned ones
+              // stay in bind space for their joints to place
+              const bool baked = !skinned && bakesRestWorld (world);
+              const glm::mat3 linear = baked ? glm::mat3 (world)
+                                             : glm::mat3 (1.0f);
+              const glm::mat3 normalMatrix
+                  = glm::transpose (glm::inverse (linear));
+              const bool mirrored = glm::determinant (linear) < 0.0f;
+
+              // Interleaved layout in the source formats, or floats for
+              // baked positions and directions. Missing normals and UVs
+              // get constant compact defaults.
+              VertexLayout &layout = subMesh.layout;
+              unsigned int stride = 0;
+              layout.position = baked ? placeFloats (3, stride)
+                                      : placeAttribute (positions, 3, stride);
+              if (hasNormals)
+                {
+                  layout.normal = baked
+                                      ? placeFloats (3, stride)
+                                      : placeAttribute (normals, 3, stride);
+                }
+              else
+                {
+                  layout.normal = { 3, ComponentByte, true, stride };
+                  stride += 4;
+                }
+              if (hasTexCoords)
+                {
+                  layout.texCoords = placeAttribute (texCoords, 2, stride);
+                }
+              else
+                {
+                  layout.texCoords
+                      = { 2, ComponentUnsignedShort, true, stride };
+                  stride += 4;
+                }
+
+              // Tangents from the file, or a slot MikkTSpace fills once
+              // every primitive is read (normal-mapped materials only)
+              AccessorData tangents;
+              const bool hasTangents = attribute ("TANGENT", tangents)
+                                       && tangents.count >= count
+                                       && tangents.components == 4;
+              const bool normalMapped
+                  = primitive.material >= 0
+                    && primitive.material < (int)model.materials.size ()
+                    && model.materials[primitive.material].normalTexture.index
+                           >= 0;
+              if (hasTangents)
+                {
+                  layout.tangent = baked
+                                       ? placeFloats (4, stride)
+                                       : placeAttribute (tangents, 4, stride);
+                }
+              else if (normalMapped && hasTexCoords)
                 {
-                  const tinygltf::Accessor &acc
-                      = model.accessors[primitive.attributes.at ("NORMAL")];
-                  const tinygltf::BufferView &view
-                      = model.bufferViews[acc.bufferView];
-                  bufferNormals = reinterpret_cast<const float *> (
-                      &model.buffers[view.buffer]
-                           .data[acc.byteOffset + view.byteOffset]);
-                  strideNorm
-                      = acc.ByteStride (view)
-                            ? (acc.ByteStride (view) / sizeof (float))
-                            : tinygltf::GetNumComponentsInType (acc.type);
+                  layout.tangent = { 4, ComponentShort, true, stride };
+                  stride += 8;
                 }
 
-              // TexCoord 0
-              if (primitive.attributes.find ("TEXCOORD_0")
-                  != primitive.attributes.end ())
+              // Skinning attributes ride in the interleaved vertex, so
+              // welding and tangent splitting carry them along
+              if (skinned)
                 {
-                  const tinygltf::Accessor &acc
-                      = model
-                            .accessors[primitive.attributes.at ("TEXCOORD_0")];
-                  const tinygltf::BufferView &view
-                      = model.bufferViews[acc.bufferView];
-                  bufferTexCoords = reinterpret_cast<const float *> (
-                      &model.buffers[view.buffer]
-                           .data[acc.byteOffset + view.byteOffset]);
-                  strideTex
-                      = acc.ByteStride (view)
-                            ? (acc.ByteStride (view) / sizeof (float))
-                            : tinygltf::GetNumComponentsInType (acc.type);
+                  layout.joints = placeAttribute (joints, 4, stride);
+                  layout.weights = placeAttribute (weights, 4, stride);
+                  subMesh.skin = node.skin;
                 }
+              layout.stride = stride;
+              subMesh.node = nodeIdx;
+              for (const auto &entry : primitive.attributes)
+                if (entry.first != "POSITION" && entry.first != "NORMAL"
+                    && entry.first != "TEXCOORD_0" && entry.first != "TANGENT"
+                    && !(skinned
+                         && (entry.first == "JOINTS_0"
+                             || entry.first == "WEIGHTS_0")))
+                  stats.ignoredAttributes++;
 
               // Assemble Vertices
+              stageTimer.restart ();
+              subMesh.vertexCount = count;
+              subMesh.vertexData.assign (count * stride, 0);
+              const size_t positionSize
+                  = layout.position.components
+                    * tinygltf::GetComponentSizeInBytes (
+                        layout.position.type);
+              const size_t normalSize
+                  = hasNormals ? layout.normal.components
+                                     * tinygltf::GetComponentSizeInBytes (
+                                         layout.normal.type)
+                               : 0;
+              const size_t texCoordSize
+                  = hasTexCoords ? layout.texCoords.components
+                                       * tinygltf::GetComponentSizeInBytes (
+                                           layout.texCoords.type)
+                                 : 0;
+              const size_t tangentSize
+                  = hasTangents ? 4
+                                      * tinygltf::GetComponentSizeInBytes (
+                                          layout.tangent.type)
+                                : 0;
+              const size_t jointSize
+                  = skinned ? 4
+                                  * tinygltf::GetComponentSizeInBytes (
+                                      layout.joints.type)
+                            : 0;
+              const size_t weightSize
+                  = skinned ? 4
+                                  * tinygltf::GetComponentSizeInBytes (
+                                      layout.weights.type)
+                            : 0;
+
+              // Baked directions are renormalized; morph deltas are
+              // scaled by the same per-vertex factor below
+              const VertexAttribute positionSource
+                  = { 3, positions.componentType, positions.normalized, 0 };
+              const VertexAttribute normalSource
+                  = { 3, normals.componentType, normals.normalized, 0 };
+              const VertexAttribute tangentSource
+                  = { 4, tangents.componentType, tangents.normalized, 0 };
+              std::vector<float> normalScale, tangentScale;
+              int8_t defaultNormal[3] = { 0, 127, 0 }; // +Y
+              if (baked && hasNormals)
+                normalScale.resize (count);
+              if (baked && hasTangents)
+                tangentScale.resize (count);
+              if (baked && !hasNormals)
+                {
+                  const glm::vec3 up = safeNormalize (
+                      normalMatrix * glm::vec3 (0.0f, 1.0f, 0.0f));
+                  for (int c = 0; c < 3; c++)
+                    defaultNormal[c] = (int8_t)std::lround (up[c] * 127.0f);
+                }
+
               for (size_t i = 0; i < count; i++)
                 {
-                  Vertex v;
-                  if (bufferPos)
+                  unsigned char *dst = &subMesh.vertexData[i * stride];
+                  if (baked)
                     {
-                      v.position = glm::vec3 (bufferPos[i * stridePos + 0],
-                                              bufferPos[i * stridePos + 1],
-                                              bufferPos[i * stridePos + 2]);
+                      const glm::vec3 p (
+                          world
+                          * glm::vec4 (glm::vec3 (positionSource.read (
+                                           positions.element (i))),
+                                       1.0f));
+                      std::memcpy (dst + layout.position.offset, &p,
+                                   sizeof (p));
                     }
-                  if (bufferNormals)
+                  else
                     {
-                      v.normal = glm::vec3 (bufferNormals[i * strideNorm + 0],
-                                            bufferNormals[i * strideNorm + 1],
-                                            bufferNormals[i * strideNorm + 2]);
+                      std::memcpy (dst + layout.position.offset,
+                                   positions.element (i), positionSize);
                     }
-                  else
+
+                  if (hasNormals && baked)
                     {
-                      v.normal = glm::vec3 (0, 1, 0);
+                      const glm::vec3 n
+                          = normalMatrix
+                            * glm::vec3 (
+                                normalSource.read (normals.element (i)));
+                      const float length = glm::length (n);
+                      normalScale[i] = length > 0.0f ? 1.0f / length : 0.0f;
+                      const glm::vec3 unit = n * normalScale[i];
+                      std::memcpy (dst + layout.normal.offset, &unit,
+                                   sizeof (unit));
                     }
-                  if (bufferTexCoords)
+                  else if (hasNormals)
                     {
-                      v.texCoords
-                          = glm::vec2 (bufferTexCoords[i * strideTex + 0],
-                                       bufferTexCoords[i * strideTex + 1]);
+                      std::memcpy (dst + layout.normal.offset,
+                                   normals.element (i), normalSize);
                     }
                   else
                     {
-                      v.texCoords = glm::vec2 (0, 0);
+                      std::memcpy (dst + layout.normal.offset, defaultNormal,
+                                   3);
                     }
 
-                  // UPDATE BOUNDS
-                  if (bufferPos)
+                  if (hasTexCoords)
+                    std::memcpy (dst + layout.texCoords.offset,
+                                 texCoords.element (i), texCoordSize);
+
+                  if (hasTangents && baked)
+                    {
+                      // A mirroring transform flips the bitangent
+                      const glm::vec4 t
+                          = tangentSource.read (tangents.element (i));
+                      const glm::vec3 xyz = linear * glm::vec3 (t);
+                      const float length = glm::length (xyz);
+                      tangentScale[i] = length > 0.0f ? 1.0f / length : 0.0f;
+                      const glm::vec4 unit (xyz * tangentScale[i],
+                                            mirrored ? -t.w : t.w);
+                      std::memcpy (dst + layout.tangent.offset, &unit,
+                                   sizeof (unit));
+                    }
+                  else if (hasTangents)
                     {
-                      globalMin = glm::min (globalMin, v.position);
-                      globalMax = glm::max (globalMax, v.position);
+                      std::memcpy (dst + layout.tangent.offset,
+                                   tangents.element (i), tangentSize);
                     }
 
-                  subMesh.vertices.push_back (v);
+                  if (skinned)
+                    {
+                      std::memcpy (dst + layout.joints.offset,
+                                   joints.element (i), jointSize);
+                      std::memcpy (dst + layout.weights.offset,
+                                   weights.element (i), weightSize);
+                    }
+
+                  // UPDATE BOUNDS
+                  const glm::vec3 p = subMesh.position (i);
+                  subMesh.minBounds = glm::min (subMesh.minBounds, p);
+                  subMesh.maxBounds = glm::max (subMesh.maxBounds, p);
                 }
+              stats.vertexAssemblyMs += stageTimer.nsecsElapsed () / 1.0e6;
+              stats.vertexCount += count;
+              globalMin = glm::min (globalMin, subMesh.minBounds);
+              globalMax = glm::max (globalMax, subMesh.maxBounds);
 
               // Indices
-              if (primitive.indices > -1)
+              AccessorData indices;
+              if (primitive.indices > -1
+                  && readAccessor (model, primitive.indices, indices))
                 {
-                  const tinygltf::Accessor &acc
-                      = model.accessors[primitive.indices];
-                  const tinygltf::BufferView &view
-                      = model.bufferViews[acc.bufferView];
-                  const unsigned char *bufferIndex
-                      = &model.buffers[view.buffer]
-                             .data[acc.byteOffset + view.byteOffset];
-                  int strideIndex = acc.ByteStride (view);
-
-                  for (size_t i = 0; i < acc.count; i++)
-                    {
-                      unsigned int val = 0;
-                      if (acc.componentType
-                          == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-                        {
-                          val = *(reinterpret_cast<const unsigned short *> (
-                              bufferIndex
-                              + i * (strideIndex ? strideIndex : 2)));
-                        }
-                      else if (acc.componentType
-                               == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
-                        {
-                          val = *(reinterpret_cast<const unsigned int *> (
-                              bufferIndex
-                              + i * (strideIndex ? strideIndex : 4)));
-                        }
-                      else if (acc.componentType
-                               == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
-                        {
-                          val = *(reinterpret_cast<const unsigned char *> (
-                              bufferIndex
-                              + i * (strideIndex ? strideIndex : 1)));
-                        }
-                      subMesh.indices.push_back (val);
-                    }
+                  stageTimer.restart ();
+                  subMesh.indices.resize (indices.count);
+                  for (size_t i = 0; i < indices.count; i++)
+                    subMesh.indices[i] = (unsigned int)readIndex (
+                        indices.element (i), indices.componentType);
+                  stats.indexConversionMs
+                      += stageTimer.nsecsElapsed () / 1.0e6;
+                  stats.indexCount += indices.count;
+                }
+              else
+                {
+                  // Unindexed: one index per vertex, for the welder (and
+                  // glDrawElements) to work with
+                  subMesh.indices.resize (count);
+                  for (size_t i = 0; i < count; i++)
+                    subMesh.indices[i] = (unsigned int)i;
                 }
 
-              sceneData->meshes.push_back (subMesh);
+              // A mirroring transform turns the triangles inside out
+              if (mirrored)
+                for (size_t i = 0; i + 2 < subMesh.indices.size (); i += 3)
+                  std::swap (subMesh.indices[i + 1], subMesh.indices[i + 2]);
+
+              // Morph targets, decoded to float deltas
+              for (const auto &target : primitive.targets)
+                {
+                  MorphTarget morph;
+                  auto delta = [&] (const char *name,
+                                    std::vector<glm::vec3> &out,
+                                    const glm::mat3 &bake,
+                                    const std::vector<float> &scale) {
+                    auto it = target.find (name);
+                    AccessorData data;
+                    if (it == target.end ()
+                        || !readAccessor (model, it->second, data)
+                        || data.count < count || data.components != 3)
+                      return;
+                    const VertexAttribute decode
+                        = { 3, data.componentType, data.normalized, 0 };
+                    out.resize (count);
+                    for (size_t i = 0; i < count; i++)
+                      out[i] = glm::vec3 (decode.read (data.element (i)));
+                    if (!baked)
+                      return;
+                    for (size_t i = 0; i < count; i++)
+                      out[i] = bake * out[i] * (scale.empty () ? 1.0f
+                                                               : scale[i]);
+                  };
+                  delta ("POSITION", morph.positions, linear, {});
+                  delta ("NORMAL", morph.normals, normalMatrix,
+                         normalScale);
+                  delta ("TANGENT", morph.tangents, linear, tangentScale);
+                  subMesh.targets.push_back (std::move (morph));
+                }
+              const std::vector<double> &defaultWeights
+                  = node.weights.size () == subMesh.targets.size ()
+                        ? node.weights
+                        : mesh.weights;
+              subMesh.morphWeights.assign (subMesh.targets.size (), 0.0f);
+              for (size_t t = 0; t < subMesh.targets.size ()
+                                 && t < defaultWeights.size ();
+                   t++)
+                subMesh.morphWeights[t] = (float)defaultWeights[t];
+
+              if (layout.tangent.components && !hasTangents)
+                tangentMeshes.push_back (sceneData->meshes.size ());
+              sceneData->meshes.push_back (std::move (subMesh));
             }
         }
     }
 
+  TRACE_END ();
+
+  // 5. Fold duplicate textures, materials and geometry. Shared meshes
+  // are left without indices, so the tangent pass skips them.
+  TRACE_BEGIN ("loader", "Dedup");
+  stageTimer.restart ();
+  SceneDedup::process (*sceneData, stats);
+  stats.dedupMs = stageTimer.nsecsElapsed () / 1.0e6;
+  TRACE_END ();
+
+  // 6. Optional welding, before MikkTSpace splits vertices again where
+  // tangents differ. Large submeshes spread across the pool themselves.
+  TRACE_BEGIN ("loader", "Weld");
+  stageTimer.restart ();
+  if (options.weldVertices)
+    {
+      std::vector<size_t> removed (sceneData->meshes.size (), 0);
+      parallelFor (sceneData->meshes.size (), [&] (size_t m) {
+        removed[m] = VertexWelder::weld (sceneData->meshes[m],
+                                         options.weldEpsilon);
+      });
+      for (size_t m = 0; m < removed.size (); m++)
+        {
+          stats.weldedVertices += removed[m];
+          stats.weldBytes
+              += removed[m] * sceneData->meshes[m].layout.stride;
+        }
+    }
+  stats.weldMs = stageTimer.nsecsElapsed () / 1.0e6;
+  TRACE_END ();
+
+  // 7. MikkTSpace tangents, one submesh per task
+  TRACE_BEGIN ("loader", "Tangents");
+  stageTimer.restart ();
+  parallelFor (tangentMeshes.size (), [&] (size_t i) {
+    SubMesh &mesh = sceneData->meshes[tangentMeshes[i]];
+    TangentGenerator::generate (mesh);
+  });
+  stats.tangentMs = stageTimer.nsecsElapsed () / 1.0e6;
+  TRACE_END ();
+
+  for (const SubMesh &mesh : sceneData->meshes)
+    stats.vertexBytes += mesh.vertexData.size ();
+
+  // 8. Mips and block compression, still on the loader thread
+  TRACE_BEGIN ("loader", "Texture Processing");
+  stageTimer.restart ();
+  if (options.processTextures)
+    TextureProcessor::process (*sceneData, options.textureCodecs);
+  stats.textureProcessMs = stageTimer.nsecsElapsed () / 1.0e6;
+  TRACE_END ();
+
+  for (const TextureData &texture : sceneData->textures)
+    {
+      stats.textureBytesUncompressed
+          += TextureProcessor::uncompressedBytes (texture);
+      stats.textureBytes += TextureProcessor::memoryBytes (texture);
+    }
+
   sceneData->minBounds = globalMin;
   sceneData->maxBounds = globalMax;
+  sceneData->stats = stats;
 
-  emit finished (sceneData);
+  return sceneData;
+}
+
+bool
+GLTFLoader::decodeImage (const std::vector<unsigned char> &encoded,
+                         TextureData *texture)
+{
+  TRACE_SCOPE_CAT ("loader", "Image Decode");
+  tinygltf::Image image;
+  std::string err;
+  std::string warn;
+  if (encoded.empty ()
+      || !tinygltf::LoadImageData (&image, 0, &err, &warn, 0, 0,
+                                   encoded.data (), (int)encoded.size (),
+                                   nullptr))
+    return false;
+
+  texture->width = image.width;
+  texture->height = image.height;
+  texture->components = image.component;
+  texture->pixels = std::move (image.image);
+  return true;
 }
@@ -5,11 +5,47 @@
 #include <QObject>
 #include <QString>
 
+struct LoaderOptions
+{
+  // Build mip chains on the loader thread (see TextureProcessor). Off
+  // keeps level 0 only and leaves glGenerateMipmap to the upload.
+  bool processTextures = true;
+
+  // TextureCodec bits the target context samples, usually
+  // TextureProcessor::supportedCodecs(). 0 uploads uncompressed texels.
+  unsigned int textureCodecs = 0;
+
+  // Merge duplicate vertices and rebuild the indices (VertexWelder), for
+  // unindexed or poorly indexed exports. weldEpsilon 0 merges identical
+  // vertices only.
+  bool weldVertices = false;
+  float weldEpsilon = 0.0f;
+
+  // Keep each image's PNG/JPEG bytes next to its decoded texels, for
+  // writing the scene back out (GlbOptimizer) or decoding the finer levels
+  // of streamed textures again on demand (Model)
+  bool keepEncodedImages = false;
+};
+
 class GLTFLoader : public QObject
 {
   Q_OBJECT
 public:
-  explicit GLTFLoader (QObject *parent = nullptr) : QObject (parent) {}
+  explicit GLTFLoader (const LoaderOptions &options = LoaderOptions (),
+                       QObject *parent = nullptr)
+      : QObject (parent), m_options (options)
+  {
+  }
+
+  // Synchronous load for callers that are already off the GUI thread (or
+  // have no GUI at all). Returns nullptr and fills errorMsg on failure.
+  static SceneData *load (const QString &filepath, QString *errorMsg,
+                          const LoaderOptions &options = LoaderOptions ());
+
+  // Decodes an image as stored in the file (TextureData::encoded) into
+  // level 0 texels, as load() does. Safe on any thread.
+  static bool decodeImage (const std::vector<unsigned char> &encoded,
+                           TextureData *texture);
 
 public slots:
   void process (QString filepath);
@@ -18,6 +54,9 @@ signals:
   void
   finished (SceneData *data); // Passing raw pointer to be managed by receiver
   void error (QString msg);
+
+private:
+  LoaderOptions m_options;
 };
 
 #endif // GLTFLOADER_H
@@ -1,7 +1,14 @@
 #include "glviewwidget.h"
+#include "aobaker.h"
 #include "camera.h"
 #include "deferredrenderer.h"
+#include "meshbvh.h"
+#include "meshdiff.h"
+#include "textureprocessor.h"
+#include "tracer.h"
 #include <QDebug>
+#include <QPainter>
+#include <algorithm>
 
 GLViewWidget::GLViewWidget (QWidget *parent) : QOpenGLWidget (parent)
 {
@@ -34,14 +41,22 @@ GLViewWidget::initializeGL ()
   initializeOpenGLFunctions ();
   m_camera = std::make_unique<Camera> ();
   m_renderer = std::make_unique<DeferredRenderer> ();
-  m_renderer->init (width (), height ());
+  const qreal ratio = devicePixelRatioF ();
+  m_renderer->init (qRound (width () * ratio), qRound (height () * ratio));
+  m_renderer->setUploadBudget (m_uploadBudgetMs);
+  m_renderer->setTextureBudget (m_textureBudgetBytes);
+  m_renderer->setAnimationClip (m_animationClip);
+  m_renderer->setAnimationInstances (m_animationInstances);
+  m_textureCodecs = TextureProcessor::supportedCodecs (context ());
 }
 
 void
 GLViewWidget::resizeGL (int w, int h)
 {
+  // The renderer sizes its targets and viewport in device pixels
+  const qreal ratio = devicePixelRatioF ();
   if (m_renderer)
-    m_renderer->resize (w, h);
+    m_renderer->resize (qRound (w * ratio), qRound (h * ratio));
   if (m_camera)
     m_camera->setViewportSize (w, h);
 }
@@ -49,6 +64,8 @@ GLViewWidget::resizeGL (int w, int h)
 void
 GLViewWidget::paintGL ()
 {
+  TRACE_SCOPE_CAT ("render", "GLViewWidget::paintGL");
+
   // Update Auto-rotation logic
   if (m_autoRotateActive)
     {
@@ -58,21 +75,43 @@ GLViewWidget::paintGL ()
       m_modelRotationAngle += 0.0087f;
     }
 
+  if (m_uploading)
+    {
+      if (m_frameTimer.isValid ())
+        m_uploadMaxFrameMs = std::max (m_uploadMaxFrameMs,
+                                       m_frameTimer.nsecsElapsed () / 1.0e6);
+      m_frameTimer.start ();
+    }
+
+  const double frameSeconds
+      = m_animationClock.isValid () ? m_animationClock.nsecsElapsed () / 1.0e9
+                                    : 0.0;
+  m_animationClock.start ();
+  if (m_animationPlaying)
+    m_animationTime += frameSeconds;
+
   if (m_renderer && m_camera)
     {
+      m_renderer->setAnimationTime (m_animationTime);
       m_renderer->render (m_camera.get (), m_modelRotationAngle);
     }
-}
 
-void
-GLViewWidget::loadModel (SceneData *data)
-{
-  makeCurrent ();
-  if (m_renderer)
+  if (m_uploading && m_renderer && !m_renderer->uploadPending ())
     {
-      m_renderer->loadModel (data);
+      m_uploading = false;
+      double uploadMs = m_uploadTimer.nsecsElapsed () / 1.0e6;
+      qDebug () << "Model upload finished in" << uploadMs
+                << "ms, max frame time" << m_uploadMaxFrameMs << "ms";
+      emit modelUploaded (uploadMs, m_uploadMaxFrameMs);
     }
 
+  if (m_overlayVisible)
+    drawOverlay ();
+}
+
+void
+GLViewWidget::loadModel (std::shared_ptr<SceneData> data)
+{
   // Auto-center camera on model
   if (m_camera && data)
     {
@@ -83,12 +122,57 @@ GLViewWidget::loadModel (SceneData *data)
       m_camera->setDistance (size * 1.5f); // Fit to view
     }
 
-  delete data;
+  // The old model's BVH no longer matches
+  m_bvh.reset ();
+  m_hasPivot = false;
+
+  // Only GL objects are created here; the data itself streams in over the
+  // next frames (paintGL) so the UI stays responsive.
+  makeCurrent ();
+  if (m_renderer)
+    {
+      m_renderer->beginModelUpload (std::move (data));
+      m_uploading = true;
+      m_uploadMaxFrameMs = 0.0;
+      m_uploadTimer.start ();
+      m_frameTimer.invalidate ();
+    }
   doneCurrent ();
 
   // Reset rotation angle
   m_modelRotationAngle = 0.0f;
   m_autoRotateActive = true;
+  m_animationTime = 0.0;
+}
+
+void
+GLViewWidget::setAnimation (int clip, bool playing, int instances)
+{
+  m_animationClip = clip;
+  m_animationInstances = instances;
+  m_animationPlaying = playing;
+  if (m_renderer)
+    {
+      m_renderer->setAnimationClip (clip);
+      m_renderer->setAnimationInstances (instances);
+    }
+  update ();
+}
+
+void
+GLViewWidget::setUploadBudget (double ms)
+{
+  m_uploadBudgetMs = ms;
+  if (m_renderer)
+    m_renderer->setUploadBudget (ms);
+}
+
+void
+GLViewWidget::setTextureBudget (int megabytes)
+{
+  m_textureBudgetBytes = (size_t)megabytes * 1024 * 1024;
+  if (m_renderer)
+    m_renderer->setTextureBudget (m_textureBudgetBytes);
 }
 
 void
@@ -101,6 +185,102 @@ GLViewWidget::setMaterialSettings (const RenderConfig &config)
     }
 }
 
+ProfilerSnapshot
+GLViewWidget::profilerSnapshot () const
+{
+  if (m_renderer && m_renderer->profiler ())
+    return m_renderer->profiler ()->snapshot ();
+  return ProfilerSnapshot ();
+}
+
+void
+GLViewWidget::setOverlayVisible (bool visible)
+{
+  m_overlayVisible = visible;
+  m_overlayRefresh.invalidate ();
+  update ();
+}
+
+void
+GLViewWidget::drawOverlay ()
+{
+  // Percentiles sort the history, so only refresh the text at ~4 Hz.
+  if (!m_overlayRefresh.isValid () || m_overlayRefresh.elapsed () > 250)
+    {
+      m_overlaySnapshot = profilerSnapshot ();
+      m_overlayRefresh.start ();
+    }
+
+  QStringList lines;
+  lines << QString ("%1  %2  %3  %4  %5")
+               .arg ("Pass", -12)
+               .arg ("CPU avg", 8)
+               .arg ("CPU p95", 8)
+               .arg ("GPU avg", 8)
+               .arg ("GPU p95", 8);
+  for (const auto &section : m_overlaySnapshot.sections)
+    {
+      QString gpuAvg = "-";
+      QString gpuP95 = "-";
+      if (section.gpuSamples > 0)
+        {
+          gpuAvg = QString::number (section.gpuAvg, 'f', 3);
+          gpuP95 = QString::number (section.gpuP95, 'f', 3);
+        }
+      lines << QString ("%1  %2  %3  %4  %5")
+                   .arg (section.name, -12)
+                   .arg (section.cpuAvg, 8, 'f', 3)
+                   .arg (section.cpuP95, 8, 'f', 3)
+                   .arg (gpuAvg, 8)
+                   .arg (gpuP95, 8);
+    }
+  lines << QString ("Draw calls: %1   Triangles: %2")
+               .arg (m_overlaySnapshot.counters.drawCalls)
+               .arg (m_overlaySnapshot.counters.triangles);
+
+  const TextureStreamingStats streaming
+      = m_renderer ? m_renderer->textureStreamingStats ()
+                   : TextureStreamingStats ();
+  if (streaming.streamedTextures > 0)
+    {
+      const QString budget
+          = streaming.budgetBytes
+                ? QString::number (streaming.budgetBytes / 1048576.0, 'f', 0)
+                : QString ("unlimited");
+      lines << QString ("Textures: %1 / %2 MB   full %3/%4   pending %5")
+                   .arg (streaming.residentBytes / 1048576.0, 0, 'f', 1)
+                   .arg (budget)
+                   .arg (streaming.fullyResident)
+                   .arg (streaming.streamedTextures)
+                   .arg (streaming.pendingRequests);
+      lines << QString ("Streaming latency: %1 ms avg, %2 ms max   "
+                        "evictions %3")
+                   .arg (streaming.latencyMsAvg, 0, 'f', 1)
+                   .arg (streaming.latencyMsMax, 0, 'f', 1)
+                   .arg (streaming.evictions);
+    }
+
+  QPainter painter (this);
+  QFont font ("Monospace");
+  font.setStyleHint (QFont::TypeWriter);
+  font.setPointSize (9);
+  painter.setFont (font);
+
+  QFontMetrics metrics (font);
+  int lineHeight = metrics.height ();
+  int boxWidth = 0;
+  for (const auto &line : lines)
+    boxWidth = std::max (boxWidth, metrics.horizontalAdvance (line));
+
+  QRect box (8, 8, boxWidth + 16, lineHeight * lines.size () + 12);
+  painter.fillRect (box, QColor (0, 0, 0, 160));
+  painter.setPen (Qt::white);
+  for (int i = 0; i < lines.size (); i++)
+    painter.drawText (box.left () + 8,
+                      box.top () + 6 + metrics.ascent () + i * lineHeight,
+                      lines[i]);
+}
+
 void
 GLViewWidget::handleInteraction ()
 {
@@ -108,10 +288,120 @@ GLViewWidget::handleInteraction ()
   m_idleTimer.start (); // Restart the 3 second countdown
 }
 
+void
+GLViewWidget::setPickingBvh (std::shared_ptr<const MeshBVH> bvh)
+{
+  m_bvh = std::move (bvh);
+}
+
+void
+GLViewWidget::setDeviationHeatmap (const MeshDiffResult &diff)
+{
+  if (!m_renderer)
+    return;
+  makeCurrent ();
+  m_renderer->setDeviation (diff.heatmap, diff.forward.maxDistance);
+  doneCurrent ();
+  update ();
+}
+
+void
+GLViewWidget::clearDeviationHeatmap ()
+{
+  if (!m_renderer)
+    return;
+  makeCurrent ();
+  m_renderer->clearDeviation ();
+  doneCurrent ();
+  update ();
+}
+
+void
+GLViewWidget::setAmbientOcclusion (const AoBakeResult &ao)
+{
+  if (!m_renderer)
+    return;
+  makeCurrent ();
+  m_renderer->setOcclusion (ao.perMesh);
+  doneCurrent ();
+  update ();
+}
+
+void
+GLViewWidget::clearAmbientOcclusion ()
+{
+  if (!m_renderer)
+    return;
+  makeCurrent ();
+  m_renderer->clearOcclusion ();
+  doneCurrent ();
+  update ();
+}
+
+PickResult
+GLViewWidget::pick (const QPoint &pos) const
+{
+  PickResult result;
+  if (!m_bvh || !m_camera || !m_renderer || width () <= 0 || height () <= 0)
+    return result;
+
+  QElapsedTimer timer;
+  timer.start ();
+
+  // Rays from the near to the far plane in model space, through the four
+  // quarter-pixel positions so thin geometry under the cursor is not missed
+  const glm::mat4 &model = m_renderer->modelMatrix ();
+  const glm::mat4 toModel
+      = glm::inverse (m_camera->getProjectionMatrix ()
+                      * m_camera->getViewMatrix () * model);
+  const float offsets[4][2]
+      = { { 0.25f, 0.25f }, { 0.75f, 0.25f }, { 0.25f, 0.75f },
+          { 0.75f, 0.75f } };
+
+  RayPacket rays;
+  for (int lane = 0; lane < 4; lane++)
+    {
+      const float x = 2.0f * (pos.x () + offsets[lane][0]) / width () - 1.0f;
+      const float y
+          = 1.0f - 2.0f * (pos.y () + offsets[lane][1]) / height ();
+      glm::vec4 nearPoint = toModel * glm::vec4 (x, y, -1.0f, 1.0f);
+      glm::vec4 farPoint = toModel * glm::vec4 (x, y, 1.0f, 1.0f);
+      nearPoint /= nearPoint.w;
+      farPoint /= farPoint.w;
+      rays.set (lane, glm::vec3 (nearPoint),
+                glm::vec3 (farPoint - nearPoint), 1.0f);
+    }
+
+  const std::array<BvhHit, 4> hits = m_bvh->intersect (rays);
+  const BvhHit *closest = nullptr;
+  for (const BvhHit &hit : hits)
+    if (hit.mesh >= 0 && (!closest || hit.distance < closest->distance))
+      closest = &hit;
+
+  if (closest)
+    {
+      result.mesh = closest->mesh;
+      result.triangle = closest->triangle;
+      result.material = closest->material;
+      result.point = glm::vec3 (model * glm::vec4 (closest->point, 1.0f));
+    }
+  result.pickMs = timer.nsecsElapsed () / 1.0e6;
+  return result;
+}
+
 void
 GLViewWidget::mousePressEvent (QMouseEvent *event)
 {
   m_lastMousePos = event->pos ();
+  if (event->button () == Qt::LeftButton && m_bvh)
+    {
+      const PickResult result = pick (event->pos ());
+      m_hasPivot = result.mesh >= 0;
+      m_pivot = result.point;
+      if (m_renderer)
+        m_renderer->setSelection (result.mesh);
+      emit meshPicked (result);
+    }
   if (event->button () == Qt::LeftButton)
     m_isRotating = true;
   if (event->button () == Qt::RightButton)
@@ -131,7 +421,10 @@ GLViewWidget::mouseMoveEvent (QMouseEvent *event)
   if (m_isRotating)
     {
       // Sensitivity factor
-      m_camera->rotate (dx * 0.01f, dy * 0.01f);
+      if (m_pivotOrbit && m_hasPivot)
+        m_camera->rotateAround (m_pivot, dx * 0.01f, dy * 0.01f);
+      else
+        m_camera->rotate (dx * 0.01f, dy * 0.01f);
       handleInteraction ();
     }
 
@@ -2,7 +2,9 @@
 #define GLVIEWWIDGET_H
 
 #include "meshdata.h"
+#include "profiler.h"
 #include "renderconfig.h"
+#include <QElapsedTimer>
 #include <QMouseEvent>
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLWidget>
@@ -12,6 +14,19 @@
 
 class DeferredRenderer;
 class Camera;
+struct AoBakeResult;
+class MeshBVH;
+struct MeshDiffResult;
+
+// What a click hit, see GLViewWidget::meshPicked.
+struct PickResult
+{
+  int mesh = -1;             // SceneData::meshes index, -1 = nothing
+  unsigned int triangle = 0; // Within that submesh
+  int material = -1;
+  glm::vec3 point = glm::vec3 (0.0f); // World space
+  double pickMs = 0.0;
+};
 
 class GLViewWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 {
@@ -20,9 +35,72 @@ class GLViewWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 public:
   explicit GLViewWidget (QWidget *parent = nullptr);
   ~GLViewWidget () override;
-  void loadModel (SceneData *data);
+  void loadModel (std::shared_ptr<SceneData> data);
   void setMaterialSettings (const RenderConfig &config);
 
+  // Milliseconds of GPU upload work per frame while a model streams in.
+  void setUploadBudget (double ms);
+
+  // VRAM budget for streamed texture levels, 0 = unlimited.
+  void setTextureBudget (int megabytes);
+
+  // TextureCodec bits this widget's context samples (0 before the first
+  // initializeGL), for LoaderOptions::textureCodecs.
+  unsigned int
+  textureCodecs () const
+  {
+    return m_textureCodecs;
+  }
+
+  // Profiling
+  ProfilerSnapshot profilerSnapshot () const;
+  void setOverlayVisible (bool visible);
+
+  // Triangle BVH of the current model; clicks pick against it once set.
+  void setPickingBvh (std::shared_ptr<const MeshBVH> bvh);
+
+  std::shared_ptr<const MeshBVH>
+  pickingBvh () const
+  {
+    return m_bvh;
+  }
+
+  // Compare mode: colors the current model by its deviation from the
+  // other revision (MeshDiffResult::heatmap), until cleared or the next
+  // loadModel.
+  void setDeviationHeatmap (const MeshDiffResult &diff);
+  void clearDeviationHeatmap ();
+
+  // Baked ambient occlusion of the current model (AoBaker), until cleared
+  // or the next loadModel.
+  void setAmbientOcclusion (const AoBakeResult &ao);
+  void clearAmbientOcclusion ();
+
+  // Playback of animated models: clip index into SceneData::animations
+  // (-1 = rest pose), paused or playing, and how many instances to draw.
+  // Kept across loadModel; the clock restarts with every model.
+  void setAnimation (int clip, bool playing, int instances);
+
+  // Left-drag orbits the point that was clicked instead of the target.
+  void
+  setPivotOrbit (bool enabled)
+  {
+    m_pivotOrbit = enabled;
+  }
+
+  // Casts a packet of four rays through the pixel at pos (widget
+  // coordinates) and returns the closest hit.
+  PickResult pick (const QPoint &pos) const;
+
+signals:
+  // Emitted when the last buffer/texture of a model is on the GPU.
+  // maxFrameMs is the longest frame-to-frame interval during the upload.
+  void modelUploaded (double uploadMs, double maxFrameMs);
+
+  // Emitted on every left click once a picking BVH is set; a miss clears
+  // the selection.
+  void meshPicked (const PickResult &result);
+
 protected:
   void initializeGL () override;
   void resizeGL (int w, int h) override;
@@ -36,6 +114,7 @@ protected:
 
 private:
   void handleInteraction ();
+  void drawOverlay ();
 
   QTimer m_renderTimer;
   QTimer m_idleTimer; // Detects 3 seconds of inactivity
@@ -48,9 +127,36 @@ private:
   bool m_isRotating = false;
   bool m_isPanning = false;
 
+  // Picking
+  std::shared_ptr<const MeshBVH> m_bvh;
+  bool m_pivotOrbit = false;
+  bool m_hasPivot = false;
+  glm::vec3 m_pivot = glm::vec3 (0.0f);
+
   // Auto-rotation State
   bool m_autoRotateActive = true; // Starts active
   float m_modelRotationAngle = 0.0f;
+
+  // Animation clock, advanced by the frame time while playing
+  int m_animationClip = 0;
+  int m_animationInstances = 1;
+  bool m_animationPlaying = true;
+  double m_animationTime = 0.0;
+  QElapsedTimer m_animationClock;
+
+  // Streaming upload tracking
+  bool m_uploading = false;
+  unsigned int m_textureCodecs = 0;
+  size_t m_textureBudgetBytes = 0;
+  double m_uploadBudgetMs = 4.0;
+  double m_uploadMaxFrameMs = 0.0;
+  QElapsedTimer m_uploadTimer;
+  QElapsedTimer m_frameTimer;
+
+  // Profiler overlay (refreshed a few times per second, not every frame)
+  bool m_overlayVisible = false;
+  ProfilerSnapshot m_overlaySnapshot;
+  QElapsedTimer m_overlayRefresh;
 };
 
 #endif // GLVIEWWIDGET_H
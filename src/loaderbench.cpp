@@ -0,0 +1,423 @@
+// Loader benchmark: generates synthetic GLBs and times every load stage.
+//
+//   mesh-spy-loaderbench [--scale small|medium|large] [--iterations N]
+//                        [--work-dir DIR] [--out results.json]
+//                        [--baseline previous.json] [--no-upload]
+//                        [--weld EPSILON]
+
+#include "gltfloader.h"
+#include "model.h"
+#include "syntheticglb.h"
+#include "textureprocessor.h"
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSurfaceFormat>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+struct BenchCase
+{
+  QString group;
+  SyntheticSceneSpec spec;
+};
+
+// One axis is varied at a time around a base case, so every group isolates
+// a single property of the input.
+static std::vector<BenchCase>
+makeCases (const QString &scale)
+{
+  size_t base = 100000;
+  int texSize = 1024;
+  if (scale == "small")
+    {
+      base = 20000;
+      texSize = 256;
+    }
+  else if (scale == "large")
+    {
+      base = 1000000;
+      texSize = 2048;
+    }
+
+  std::vector<BenchCase> cases;
+  auto add = [&cases] (const QString &group, SyntheticSceneSpec spec) {
+    cases.push_back ({ group, spec });
+  };
+
+  SyntheticSceneSpec spec;
+  spec.vertexCount = base;
+
+  for (size_t count : { base / 10, base, base * 10 })
+    {
+      SyntheticSceneSpec s = spec;
+      s.vertexCount = count;
+      add ("vertex-count", s);
+    }
+
+  for (int prims : { 16, 256 })
+    {
+      SyntheticSceneSpec s = spec;
+      s.primitiveCount = prims;
+      add ("primitive-count", s);
+    }
+
+  {
+    SyntheticSceneSpec s = spec;
+    s.interleaved = false;
+    add ("layout", s);
+  }
+
+  for (int bytes : { 1, 2 })
+    {
+      SyntheticSceneSpec s = spec;
+      s.indexBytes = bytes;
+      add ("index-width", s);
+    }
+
+  {
+    SyntheticSceneSpec s = spec;
+    s.quantized = true;
+    add ("quantization", s);
+  }
+
+  for (auto compression : { SyntheticSceneSpec::MeshoptCompression,
+                            SyntheticSceneSpec::DracoCompression })
+    {
+      SyntheticSceneSpec s = spec;
+      s.compression = compression;
+      add ("compression", s);
+    }
+
+  const int textureCases[][2]
+      = { { 4, texSize / 2 }, { 4, texSize }, { 16, texSize } };
+  for (const auto &tex : textureCases)
+    {
+      SyntheticSceneSpec s = spec;
+      s.textureCount = tex[0];
+      s.textureSize = tex[1];
+      add ("textures", s);
+    }
+
+  return cases;
+}
+
+static double
+median (std::vector<double> values)
+{
+  if (values.empty ())
+    return 0.0;
+  std::sort (values.begin (), values.end ());
+  return values[values.size () / 2];
+}
+
+// File size and load time of every compressed case against the same scene
+// without compression (always part of the vertex-count group).
+static void
+printCompression (const QJsonArray &results)
+{
+  bool header = false;
+  for (const auto &entry : results)
+    {
+      const QJsonObject now = entry.toObject ();
+      const QString reference = now.value ("uncompressed").toString ();
+      if (reference.isEmpty ())
+        continue;
+
+      for (const auto &other : results)
+        {
+          const QJsonObject raw = other.toObject ();
+          if (raw.value ("name").toString () != reference)
+            continue;
+
+          if (!header)
+            {
+              std::printf ("\n%-44s %9s %9s %7s %9s %9s %9s\n", "case",
+                           "raw MB", "MB", "ratio", "raw ms", "ms",
+                           "decode");
+              header = true;
+            }
+          const double rawBytes = raw.value ("fileBytes").toDouble ();
+          const double bytes = now.value ("fileBytes").toDouble ();
+          std::printf ("%-44s %9.2f %9.2f %6.1fx %9.2f %9.2f %9.2f\n",
+                       qPrintable (now.value ("name").toString ()),
+                       rawBytes / 1.0e6, bytes / 1.0e6,
+                       bytes > 0.0 ? rawBytes / bytes : 0.0,
+                       raw.value ("totalMs").toDouble (),
+                       now.value ("totalMs").toDouble (),
+                       now.value ("stages")
+                           .toObject ()
+                           .value ("meshDecodeMs")
+                           .toDouble ());
+        }
+    }
+}
+
+static void
+printComparison (const QJsonArray &current, const QString &baselinePath)
+{
+  QFile file (baselinePath);
+  if (!file.open (QIODevice::ReadOnly))
+    {
+      std::fprintf (stderr, "Cannot open baseline %s\n",
+                    qPrintable (baselinePath));
+      return;
+    }
+
+  QJsonArray baseline = QJsonDocument::fromJson (file.readAll ())
+                            .object ()
+                            .value ("cases")
+                            .toArray ();
+
+  std::printf ("\n%-44s %10s %10s %8s\n", "case", "base ms", "new ms",
+               "delta");
+  for (const auto &entry : current)
+    {
+      const QJsonObject now = entry.toObject ();
+      const QString name = now.value ("name").toString ();
+      for (const auto &old : baseline)
+        {
+          const QJsonObject before = old.toObject ();
+          if (before.value ("name").toString () != name)
+            continue;
+
+          double a = before.value ("totalMs").toDouble ();
+          double b = now.value ("totalMs").toDouble ();
+          double delta = a > 0.0 ? (b - a) / a * 100.0 : 0.0;
+          std::printf ("%-44s %10.2f %10.2f %+7.1f%%\n", qPrintable (name), a,
+                       b, delta);
+        }
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")
+      && qEnvironmentVariableIsEmpty ("DISPLAY")
+      && qEnvironmentVariableIsEmpty ("WAYLAND_DISPLAY"))
+    qputenv ("QT_QPA_PLATFORM", "offscreen");
+
+  QSurfaceFormat format;
+  format.setVersion (4, 5);
+  format.setProfile (QSurfaceFormat::CoreProfile);
+  QSurfaceFormat::setDefaultFormat (format);
+
+  QGuiApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy loader benchmark");
+  parser.addHelpOption ();
+  QCommandLineOption scaleOpt ("scale", "small, medium or large.", "scale",
+                               "medium");
+  QCommandLineOption iterOpt ("iterations", "Loads per case.", "count", "5");
+  QCommandLineOption dirOpt ("work-dir", "Where generated GLBs are cached.",
+                             "dir", QDir::tempPath () + "/mesh-spy-bench");
+  QCommandLineOption outOpt ("out", "Results file.", "file",
+                             "loaderbench.json");
+  QCommandLineOption baselineOpt ("baseline", "Previous results to compare.",
+                                  "file");
+  QCommandLineOption noUploadOpt ("no-upload", "Skip the GPU upload stage.");
+  QCommandLineOption weldOpt (
+      "weld", "Weld vertices within this tolerance (0 = exact).", "epsilon");
+  parser.addOptions ({ scaleOpt, iterOpt, dirOpt, outOpt, baselineOpt,
+                       noUploadOpt, weldOpt });
+  parser.process (app);
+
+  const int iterations = std::max (1, parser.value (iterOpt).toInt ());
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+
+  // Offscreen context for the upload stage
+  QOpenGLContext context;
+  QOffscreenSurface surface;
+  bool haveGL = false;
+  if (!parser.isSet (noUploadOpt) && context.create ())
+    {
+      surface.setFormat (context.format ());
+      surface.create ();
+      haveGL = context.makeCurrent (&surface);
+    }
+  if (!haveGL && !parser.isSet (noUploadOpt))
+    std::fprintf (stderr, "No OpenGL context, upload stage skipped.\n");
+
+  // Without a context textures still get their mips, uncompressed
+  LoaderOptions loaderOptions;
+  if (haveGL)
+    loaderOptions.textureCodecs
+        = TextureProcessor::supportedCodecs (&context);
+  loaderOptions.weldVertices = parser.isSet (weldOpt);
+  loaderOptions.weldEpsilon = parser.value (weldOpt).toFloat ();
+
+  QJsonArray results;
+  std::printf ("%-44s %8s %8s %8s %8s %8s %8s %8s %9s %10s\n", "case",
+               "parse", "mesh", "decode", "texture", "verts", "index",
+               "upload", "MB/s", "Mverts/s");
+
+  for (const BenchCase &bench : makeCases (parser.value (scaleOpt)))
+    {
+      const QString name = bench.spec.name ();
+      const QString path = workDir.filePath (name + ".glb");
+
+      // Generated files are reused across runs (and builds), so keep them
+      // deterministic and only write them once.
+      if (!QFileInfo::exists (path))
+        {
+          QString error;
+          if (!writeSyntheticGlb (bench.spec, path, nullptr, &error))
+            {
+              std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                            qPrintable (error));
+              return 1;
+            }
+        }
+
+      std::vector<double> parse, meshDecode, decode, texture, tangent,
+          dedup, weld, assembly, index, upload, total;
+      LoadStats last;
+
+      for (int it = 0; it < iterations; it++)
+        {
+          QElapsedTimer timer;
+          timer.start ();
+          QString error;
+          std::unique_ptr<SceneData> data (
+              GLTFLoader::load (path, &error, loaderOptions));
+          double loadMs = timer.nsecsElapsed () / 1.0e6;
+          if (!data)
+            {
+              std::fprintf (stderr, "Load failed for %s: %s\n",
+                            qPrintable (name), qPrintable (error));
+              return 1;
+            }
+
+          if (haveGL)
+            {
+              timer.restart ();
+              {
+                Model model;
+                model.create (data.get ());
+                context.functions ()->glFinish ();
+                data->stats.uploadMs = timer.nsecsElapsed () / 1.0e6;
+              }
+            }
+
+          last = data->stats;
+          parse.push_back (last.parseMs);
+          meshDecode.push_back (last.meshDecodeMs);
+          decode.push_back (last.imageDecodeMs);
+          texture.push_back (last.textureProcessMs);
+          tangent.push_back (last.tangentMs);
+          dedup.push_back (last.dedupMs);
+          weld.push_back (last.weldMs);
+          assembly.push_back (last.vertexAssemblyMs);
+          index.push_back (last.indexConversionMs);
+          upload.push_back (last.uploadMs);
+          total.push_back (loadMs);
+        }
+
+      double totalMs = median (total);
+      double mbPerSec = (last.fileBytes / 1.0e6) / (totalMs / 1000.0);
+      double vertsPerSec = last.vertexCount / (totalMs / 1000.0);
+
+      QJsonObject stages{ { "parseMs", median (parse) },
+                          { "meshDecodeMs", median (meshDecode) },
+                          { "imageDecodeMs", median (decode) },
+                          { "textureProcessMs", median (texture) },
+                          { "tangentMs", median (tangent) },
+                          { "dedupMs", median (dedup) },
+                          { "weldMs", median (weld) },
+                          { "vertexAssemblyMs", median (assembly) },
+                          { "indexConversionMs", median (index) },
+                          { "uploadMs", median (upload) } };
+
+      QJsonObject entry;
+      entry["name"] = name;
+      entry["group"] = bench.group;
+      entry["fileBytes"] = (double)last.fileBytes;
+      entry["decodedBytes"] = (double)last.decodedBytes;
+      entry["vertexBytes"] = (double)last.vertexBytes;
+      entry["dedup"] = QJsonObject{
+        { "textures", (double)last.duplicateTextures },
+        { "materials", (double)last.duplicateMaterials },
+        { "meshes", (double)last.duplicateMeshes },
+        { "bytes", (double)last.dedupBytes },
+      };
+      if (loaderOptions.weldVertices)
+        entry["weld"] = QJsonObject{
+          { "vertices", (double)last.weldedVertices },
+          { "bytes", (double)last.weldBytes },
+        };
+      if (bench.spec.compression != SyntheticSceneSpec::NoCompression)
+        {
+          SyntheticSceneSpec raw = bench.spec;
+          raw.compression = SyntheticSceneSpec::NoCompression;
+          entry["uncompressed"] = raw.name ();
+        }
+      entry["vertices"] = (double)last.vertexCount;
+      entry["indices"] = (double)last.indexCount;
+      entry["textureBytesUncompressed"]
+          = (double)last.textureBytesUncompressed;
+      entry["textureBytes"] = (double)last.textureBytes;
+      entry["stages"] = stages;
+      entry["totalMs"] = totalMs;
+      entry["mbPerSec"] = mbPerSec;
+      entry["verticesPerSec"] = vertsPerSec;
+      results.append (entry);
+
+      std::printf (
+          "%-44s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %9.1f %10.2f\n",
+          qPrintable (name), median (parse), median (meshDecode),
+          median (decode), median (texture), median (assembly),
+          median (index), median (upload), mbPerSec, vertsPerSec / 1.0e6);
+    }
+
+  printCompression (results);
+
+  QJsonObject meta;
+  meta["date"] = QDateTime::currentDateTimeUtc ().toString (Qt::ISODate);
+  meta["scale"] = parser.value (scaleOpt);
+  meta["iterations"] = iterations;
+  if (loaderOptions.weldVertices)
+    meta["weldEpsilon"] = loaderOptions.weldEpsilon;
+  if (haveGL)
+    meta["glRenderer"] = (const char *)context.functions ()->glGetString (
+        GL_RENDERER);
+
+  QJsonObject report;
+  report["meta"] = meta;
+  report["cases"] = results;
+
+  QFile out (parser.value (outOpt));
+  if (out.open (QIODevice::WriteOnly))
+    {
+      out.write (QJsonDocument (report).toJson (QJsonDocument::Indented));
+      std::printf ("\nResults written to %s\n",
+                   qPrintable (parser.value (outOpt)));
+    }
+  else
+    {
+      std::fprintf (stderr, "Cannot write %s\n",
+                    qPrintable (parser.value (outOpt)));
+    }
+
+  if (parser.isSet (baselineOpt))
+    printComparison (results, parser.value (baselineOpt));
+
+  if (haveGL)
+    context.doneCurrent ();
+  return 0;
+}
@@ -1,12 +1,90 @@
+#include "batchrenderer.h"
+#include "glboptimizer.h"
 #include "mainwindow.h"
+#include "renderbenchmark.h"
+#include "tracer.h"
 #include <QApplication>
+#include <QCoreApplication>
 #include <QFile>
+#include <QGuiApplication>
 #include <QSurfaceFormat>
+#include <cstdio>
+#include <cstring>
+
+static bool
+hasArgument (int argc, char *argv[], const char *name)
+{
+  for (int i = 1; i < argc; i++)
+    {
+      if (std::strcmp (argv[i], name) == 0)
+        return true;
+    }
+  return false;
+}
+
+// Removes "name value" from the arguments and returns the value, so the
+// modes' own parsers never see it
+static const char *
+takeArgument (int &argc, char *argv[], const char *name)
+{
+  for (int i = 1; i + 1 < argc; i++)
+    {
+      if (std::strcmp (argv[i], name) != 0)
+        continue;
+      const char *value = argv[i + 1];
+      for (int j = i; j + 2 <= argc; j++)
+        argv[j] = argv[j + 2];
+      argc -= 2;
+      return value;
+    }
+  return nullptr;
+}
+
+// Writes the trace started by --trace, unless it was stopped (and saved)
+// from the window
+static int
+finishTrace (const char *tracePath, int exitCode)
+{
+  if (!tracePath || !Tracer::enabled ())
+    return exitCode;
+
+  Tracer::setEnabled (false);
+  QString error;
+  if (!Tracer::write (QString::fromLocal8Bit (tracePath), &error))
+    std::fprintf (stderr, "Cannot write trace %s: %s\n", tracePath,
+                  qPrintable (error));
+  return exitCode;
+}
 
 int
 main (int argc, char *argv[])
 {
-  QApplication app (argc, argv);
+  // "--trace out.json" records from startup and writes a Chrome trace on
+  // exit, in every mode
+  Tracer::setThreadName ("Main");
+  const char *tracePath = takeArgument (argc, argv, "--trace");
+  if (tracePath && !Tracer::available ())
+    std::fprintf (stderr, "Built without MESHSPY_TRACING, --trace "
+                          "ignored.\n");
+  Tracer::setEnabled (tracePath != nullptr);
+
+  // "mesh-spy optimize in.glb out.glb" needs neither a display nor GL
+  if (argc > 1 && std::strcmp (argv[1], "optimize") == 0)
+    {
+      QCoreApplication app (argc, argv);
+      return finishTrace (tracePath,
+                          GlbOptimizer::runFromCommandLine (app.arguments ()));
+    }
+
+  // Headless modes must pick the platform plugin before the application
+  // object exists.
+  const bool benchMode = hasArgument (argc, argv, "--bench");
+  const bool batchMode = hasArgument (argc, argv, "--batch");
+  if ((benchMode || batchMode)
+      && qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")
+      && qEnvironmentVariableIsEmpty ("DISPLAY")
+      && qEnvironmentVariableIsEmpty ("WAYLAND_DISPLAY"))
+    qputenv ("QT_QPA_PLATFORM", "offscreen");
 
   // Set OpenGL format requirements for Deferred Rendering (G-Buffer needs
   // precision)
@@ -19,6 +97,22 @@ main (int argc, char *argv[])
                          // enabled for forward/composition)
   QSurfaceFormat::setDefaultFormat (format);
 
+  if (benchMode)
+    {
+      QGuiApplication app (argc, argv);
+      return finishTrace (
+          tracePath, RenderBenchmark::runFromCommandLine (app.arguments ()));
+    }
+
+  if (batchMode)
+    {
+      QGuiApplication app (argc, argv);
+      return finishTrace (
+          tracePath, BatchRenderer::runFromCommandLine (app.arguments ()));
+    }
+
+  QApplication app (argc, argv);
+
   // Set dark theme.
   QFile f (":qdarkstyle/dark/darkstyle.qss");
 
@@ -35,5 +129,5 @@ main (int argc, char *argv[])
   MainWindow window;
   window.show ();
 
-  return app.exec ();
+  return finishTrace (tracePath, app.exec ());
 }
@@ -1,21 +1,37 @@
 #include "mainwindow.h"
+#include "analysispanel.h"
+#include "animator.h"
+#include "aobaker.h"
 #include "gltfloader.h"
 #include "glviewwidget.h"
+#include "meshanalyzer.h"
+#include "meshbvh.h"
+#include "meshdiff.h"
+#include "profilerpanel.h"
 #include "renderconfig.h"
+#include "tracer.h"
 
 #include <QApplication>
 #include <QCheckBox>
+#include <QComboBox>
+#include <QDebug>
+#include <QDoubleSpinBox>
+#include <QFormLayout>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QGroupBox>
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QMenu>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QPointer>
 #include <QProgressBar>
 #include <QPushButton>
+#include <QSpinBox>
 #include <QSplitter>
 #include <QStatusBar>
+#include <QThreadPool>
 #include <QVBoxLayout>
 
 MainWindow::MainWindow (QWidget *parent)
@@ -37,10 +53,40 @@ MainWindow::setupUi ()
   QAction *actLoad = fileMenu->addAction ("&Load Model...", this,
                                           &MainWindow::onLoadModelClicked);
   actLoad->setShortcut (QKeySequence::Open);
+  fileMenu->addAction ("&Compare With...", this,
+                       &MainWindow::onCompareClicked);
+  fileMenu->addAction ("Clear Co&mparison", m_glView,
+                       &GLViewWidget::clearDeviationHeatmap);
   fileMenu->addSeparator ();
   QAction *actQuit = fileMenu->addAction ("&Quit", qApp, &QApplication::quit);
   actQuit->setShortcut (QKeySequence::Quit);
 
+  QMenu *viewMenu = menuBar ()->addMenu ("&View");
+  QAction *actOverlay = viewMenu->addAction ("Profiler &Overlay");
+  actOverlay->setCheckable (true);
+  actOverlay->setShortcut (Qt::Key_F3);
+  connect (actOverlay, &QAction::toggled, m_glView,
+           &GLViewWidget::setOverlayVisible);
+  QAction *actPivot = viewMenu->addAction ("Orbit Around &Cursor");
+  actPivot->setCheckable (true);
+  actPivot->setToolTip ("Left-drag orbits the clicked point instead of the "
+                        "model center.");
+  connect (actPivot, &QAction::toggled, m_glView,
+           &GLViewWidget::setPivotOrbit);
+  QAction *actTrace = viewMenu->addAction ("Record &Trace");
+  actTrace->setCheckable (true);
+  actTrace->setChecked (Tracer::enabled ());
+  actTrace->setShortcut (Qt::Key_F4);
+  actTrace->setToolTip ("Records loading and frames until unchecked, then "
+                        "saves a Chrome trace (open it in Perfetto).");
+  actTrace->setVisible (Tracer::available ());
+  connect (actTrace, &QAction::toggled, this, &MainWindow::onTraceToggled);
+  viewMenu->addSeparator ();
+  viewMenu->addAction ("Bake &Ambient Occlusion", this,
+                       &MainWindow::onBakeAoClicked);
+  viewMenu->addAction ("Clear Ambient Occlusion", m_glView,
+                       &GLViewWidget::clearAmbientOcclusion);
+
   QMenu *helpMenu = menuBar ()->addMenu ("&Help");
   helpMenu->addAction ("&About meshSpy", this, &MainWindow::onAboutClicked);
 
@@ -91,7 +137,76 @@ MainWindow::setupUi ()
   matLayout->addWidget (m_chkWireframe);
 
   sideLayout->addWidget (matGroup);
-  sideLayout->addStretch (); // Push everything up
+
+  // Animation Section, enabled for models with skins, morph targets or
+  // clips
+  m_animGroup = new QGroupBox ("Animation", this);
+  QFormLayout *animLayout = new QFormLayout (m_animGroup);
+
+  m_comboClip = new QComboBox (this);
+  m_comboClip->addItem ("Rest pose");
+  animLayout->addRow ("Clip", m_comboClip);
+
+  m_chkPlay = new QCheckBox ("Play", this);
+  m_chkPlay->setChecked (true);
+  animLayout->addRow (m_chkPlay);
+
+  m_spinInstances = new QSpinBox (this);
+  m_spinInstances->setRange (1, Animator::kMaxInstances);
+  m_spinInstances->setValue (1);
+  m_spinInstances->setToolTip ("Copies of the model, each playing the clip "
+                               "at its own phase.");
+  animLayout->addRow ("Instances", m_spinInstances);
+
+  m_animGroup->setEnabled (false);
+  sideLayout->addWidget (m_animGroup);
+
+  // Loading Section
+  QGroupBox *loadGroup = new QGroupBox ("Loading", this);
+  QFormLayout *loadLayout = new QFormLayout (loadGroup);
+
+  m_spinUploadBudget = new QDoubleSpinBox (this);
+  m_spinUploadBudget->setRange (0.5, 100.0);
+  m_spinUploadBudget->setSingleStep (0.5);
+  m_spinUploadBudget->setValue (4.0);
+  m_spinUploadBudget->setSuffix (" ms");
+  m_spinUploadBudget->setToolTip ("GPU upload time per frame while a model "
+                                  "streams in.");
+  loadLayout->addRow ("Upload budget", m_spinUploadBudget);
+
+  m_spinTextureBudget = new QSpinBox (this);
+  m_spinTextureBudget->setRange (0, 65536);
+  m_spinTextureBudget->setSingleStep (128);
+  m_spinTextureBudget->setValue (1024);
+  m_spinTextureBudget->setSuffix (" MB");
+  m_spinTextureBudget->setSpecialValueText ("Unlimited");
+  m_spinTextureBudget->setToolTip ("VRAM for streamed texture mip levels; "
+                                   "least recently used levels are evicted "
+                                   "beyond it.");
+  loadLayout->addRow ("Texture budget", m_spinTextureBudget);
+
+  m_chkWeld = new QCheckBox ("Weld vertices", this);
+  m_chkWeld->setToolTip ("Merge duplicate vertices and rebuild the index "
+                         "buffers of the next model loaded.");
+  loadLayout->addRow (m_chkWeld);
+
+  m_spinWeldEpsilon = new QDoubleSpinBox (this);
+  m_spinWeldEpsilon->setDecimals (6);
+  m_spinWeldEpsilon->setRange (0.0, 1.0);
+  m_spinWeldEpsilon->setSingleStep (0.0001);
+  m_spinWeldEpsilon->setSpecialValueText ("Exact");
+  m_spinWeldEpsilon->setToolTip ("Largest difference per attribute "
+                                 "component that still welds.");
+  m_spinWeldEpsilon->setEnabled (false);
+  connect (m_chkWeld, &QCheckBox::toggled, m_spinWeldEpsilon,
+           &QWidget::setEnabled);
+  loadLayout->addRow ("Weld tolerance", m_spinWeldEpsilon);
+
+  sideLayout->addWidget (loadGroup);
+
+  // Analysis Section, takes the remaining height
+  m_analysisPanel = new AnalysisPanel (this);
+  sideLayout->addWidget (m_analysisPanel, 1);
 
   // --- GL Viewport ---
   // Added directly to main layout
@@ -105,6 +220,12 @@ MainWindow::setupUi ()
 
   mainLayout->addWidget (splitter);
 
+  // --- Profiler Dock ---
+  m_profilerPanel = new ProfilerPanel (m_glView, this);
+  addDockWidget (Qt::RightDockWidgetArea, m_profilerPanel);
+  m_profilerPanel->hide ();
+  viewMenu->addAction (m_profilerPanel->toggleViewAction ());
+
   // --- Status Bar ---
   m_statusLabel = new QLabel ("Ready", this);
   statusBar ()->addWidget (m_statusLabel);
@@ -125,6 +246,23 @@ MainWindow::setupUi ()
            [this] (bool) { updateRenderConfig (); });
   connect (m_chkWireframe, &QCheckBox::toggled, this,
            [this] (bool) { updateRenderConfig (); });
+
+  connect (m_comboClip, &QComboBox::currentIndexChanged, this,
+           [this] (int) { updateAnimation (); });
+  connect (m_chkPlay, &QCheckBox::toggled, this,
+           [this] (bool) { updateAnimation (); });
+  connect (m_spinInstances, &QSpinBox::valueChanged, this,
+           [this] (int) { updateAnimation (); });
+
+  connect (m_spinUploadBudget, &QDoubleSpinBox::valueChanged, m_glView,
+           &GLViewWidget::setUploadBudget);
+  connect (m_spinTextureBudget, &QSpinBox::valueChanged, m_glView,
+           &GLViewWidget::setTextureBudget);
+  m_glView->setTextureBudget (m_spinTextureBudget->value ());
+  connect (m_glView, &GLViewWidget::modelUploaded, this,
+           &MainWindow::onModelUploaded);
+  connect (m_glView, &GLViewWidget::meshPicked, this,
+           &MainWindow::onMeshPicked);
 }
 
 void
@@ -135,6 +273,8 @@ MainWindow::onLoadModelClicked ()
   if (fileName.isEmpty ())
     return;
 
+  m_modelPath = fileName;
+
   // UI Feedback
   m_btnLoad->setEnabled (false);
   m_statusLabel->setText ("Loading " + fileName + "...");
@@ -147,7 +287,12 @@ MainWindow::onLoadModelClicked ()
 
   // Threading Setup
   m_loaderThread = new QThread;
-  GLTFLoader *worker = new GLTFLoader;
+  LoaderOptions options;
+  options.textureCodecs = m_glView->textureCodecs ();
+  options.keepEncodedImages = true; // Streamed levels are decoded again
+  options.weldVertices = m_chkWeld->isChecked ();
+  options.weldEpsilon = (float)m_spinWeldEpsilon->value ();
+  GLTFLoader *worker = new GLTFLoader (options);
   worker->moveToThread (m_loaderThread);
 
   connect (m_loaderThread, &QThread::started, worker,
@@ -172,14 +317,269 @@ void
 MainWindow::onModelLoaded (SceneData *data)
 {
   m_btnLoad->setEnabled (true);
-  m_statusLabel->setText ("Loaded successfully.");
+  m_statusLabel->setText ("Uploading to GPU...");
   m_progressBar->setVisible (false);
 
-  // Pass to GLView (requires exposing the renderer or adding a method to
-  // GLView)
-  m_glView->loadModel (data); // Needs to be added to GLViewWidget
+  const LoadStats &stats = data->stats;
+  qDebug () << "Textures:" << stats.textureBytes / 1048576.0 << "MB VRAM,"
+            << stats.textureBytesUncompressed / 1048576.0
+            << "MB uncompressed, processed in" << stats.textureProcessMs
+            << "ms";
+  qDebug () << "Dedup:" << stats.duplicateTextures << "textures,"
+            << stats.duplicateMaterials << "materials,"
+            << stats.duplicateMeshes << "meshes,"
+            << stats.dedupBytes / 1048576.0 << "MB reclaimed in"
+            << stats.dedupMs << "ms";
+  if (stats.weldedVertices)
+    qDebug () << "Weld:" << stats.weldedVertices << "vertices,"
+              << stats.weldBytes / 1048576.0 << "MB reclaimed in"
+              << stats.weldMs << "ms";
+
+  // Shared with the analysis, so the renderer keeps the mesh data until
+  // it is done
+  std::shared_ptr<SceneData> scene (data);
+  m_sceneGeneration++;
+
+  // The first clip plays by default
+  m_comboClip->blockSignals (true);
+  m_comboClip->clear ();
+  m_comboClip->addItem ("Rest pose");
+  for (const AnimationData &clip : scene->animations)
+    m_comboClip->addItem (QString ("%1 (%2 s)")
+                              .arg (QString::fromStdString (clip.name))
+                              .arg (clip.duration, 0, 'f', 2));
+  m_comboClip->setCurrentIndex (scene->animations.empty () ? 0 : 1);
+  m_comboClip->blockSignals (false);
+  m_animGroup->setEnabled (scene->animated ());
+  updateAnimation ();
+
+  startAnalysis (scene);
+  startPickingBuild (scene, m_modelPath);
+  m_glView->loadModel (scene);
+}
+
+void
+MainWindow::updateAnimation ()
+{
+  m_glView->setAnimation (m_comboClip->currentIndex () - 1,
+                          m_chkPlay->isChecked (), m_spinInstances->value ());
+}
+
+void
+MainWindow::startAnalysis (std::shared_ptr<const SceneData> scene)
+{
+  const int generation = m_sceneGeneration;
+  m_analysisPanel->setPending ();
+
+  // One pool thread runs it and recruits the idle ones; the GUI thread
+  // only receives the result
+  QPointer<MainWindow> self (this);
+  QThreadPool::globalInstance ()->start ([self, scene, generation] () {
+    auto analysis
+        = std::make_shared<SceneAnalysis> (MeshAnalyzer::analyze (*scene));
+    qDebug () << "Analysis:" << analysis->total.triangles << "triangles in"
+              << analysis->analysisMs << "ms";
+    if (!self)
+      return;
+    QMetaObject::invokeMethod (
+        self,
+        [self, analysis, generation] () {
+          if (self && generation == self->m_sceneGeneration)
+            self->m_analysisPanel->setAnalysis (*analysis);
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void
+MainWindow::startPickingBuild (std::shared_ptr<const SceneData> scene,
+                               const QString &modelPath)
+{
+  const int generation = m_sceneGeneration;
+
+  // Same scheme as the analysis; clicks only select once it arrives. AO
+  // baked earlier for this geometry comes along from its cache.
+  QPointer<MainWindow> self (this);
+  QThreadPool::globalInstance ()->start ([self, scene, modelPath,
+                                          generation] () {
+    auto bvh = std::make_shared<MeshBVH> ();
+    bvh->build (*scene);
+    qDebug () << "Picking BVH:" << bvh->nodeCount () << "nodes over"
+              << bvh->triangleCount () << "triangles in" << bvh->buildMs ()
+              << "ms";
+    auto ao = std::make_shared<AoBakeResult> ();
+    const bool cached = AoBaker::loadCache (modelPath, *bvh,
+                                            AoBaker::Settings (), ao.get ());
+    if (!self)
+      return;
+    QMetaObject::invokeMethod (
+        self,
+        [self, bvh, ao, cached, generation] () {
+          if (!self || generation != self->m_sceneGeneration)
+            return;
+          self->m_glView->setPickingBvh (bvh);
+          if (cached)
+            self->m_glView->setAmbientOcclusion (*ao);
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void
+MainWindow::onMeshPicked (const PickResult &result)
+{
+  if (result.mesh < 0)
+    {
+      m_statusLabel->setText ("Nothing selected.");
+      return;
+    }
+  m_statusLabel->setText (
+      QString ("Submesh %1, triangle %2, material %3 at (%4, %5, %6), "
+               "picked in %7 ms")
+          .arg (result.mesh)
+          .arg (result.triangle)
+          .arg (result.material)
+          .arg (result.point.x, 0, 'f', 3)
+          .arg (result.point.y, 0, 'f', 3)
+          .arg (result.point.z, 0, 'f', 3)
+          .arg (result.pickMs, 0, 'f', 3));
+}
+
+void
+MainWindow::onCompareClicked ()
+{
+  // The current model's picking BVH is the reference surface
+  std::shared_ptr<const MeshBVH> reference = m_glView->pickingBvh ();
+  if (!reference)
+    {
+      m_statusLabel->setText ("Load a model first (or wait for its BVH).");
+      return;
+    }
+
+  QString fileName = QFileDialog::getOpenFileName (
+      this, "Compare With GLTF/GLB", "", "GLTF Files (*.gltf *.glb)");
+  if (fileName.isEmpty ())
+    return;
+
+  m_statusLabel->setText ("Comparing with " + fileName + "...");
+  m_progressBar->setRange (0, 0);
+  m_progressBar->setVisible (true);
+
+  // Load, index and measure on the pool; only the geometry of the other
+  // revision is needed, and it is dropped once its BVH is built
+  const int generation = m_sceneGeneration;
+  QPointer<MainWindow> self (this);
+  QThreadPool::globalInstance ()->start ([self, reference, fileName,
+                                          generation] () {
+    LoaderOptions options;
+    options.processTextures = false;
+    QString error;
+    std::unique_ptr<SceneData> other (
+        GLTFLoader::load (fileName, &error, options));
+
+    auto diff = std::make_shared<MeshDiffResult> ();
+    if (other)
+      {
+        MeshBVH bvh;
+        bvh.build (*other);
+        other.reset ();
+        *diff = MeshDiff::compare (*reference, bvh);
+        qDebug () << "Compare:" << reference->positions ().size () << "+"
+                  << bvh.positions ().size () << "vertices, Hausdorff"
+                  << diff->hausdorff << "in" << bvh.buildMs () << "ms BVH +"
+                  << diff->diffMs << "ms";
+      }
+    if (!self)
+      return;
+    QMetaObject::invokeMethod (
+        self,
+        [self, diff, error, fileName, generation] () {
+          if (!self)
+            return;
+          self->m_progressBar->setVisible (false);
+          if (!error.isEmpty ())
+            {
+              self->m_statusLabel->setText ("Error loading model.");
+              QMessageBox::critical (self, "Error", error);
+            }
+          else if (generation == self->m_sceneGeneration)
+            self->showComparison (*diff, fileName);
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void
+MainWindow::onBakeAoClicked ()
+{
+  std::shared_ptr<const MeshBVH> bvh = m_glView->pickingBvh ();
+  if (!bvh)
+    {
+      m_statusLabel->setText ("Load a model first (or wait for its BVH).");
+      return;
+    }
+
+  m_statusLabel->setText ("Baking ambient occlusion...");
+  m_progressBar->setRange (0, 0);
+  m_progressBar->setVisible (true);
 
-  // Note: SceneData* ownership is transferred to GLView/Renderer
+  // Traced on the whole pool from one pool thread, then cached next to
+  // the model
+  const int generation = m_sceneGeneration;
+  const QString modelPath = m_modelPath;
+  QPointer<MainWindow> self (this);
+  QThreadPool::globalInstance ()->start ([self, bvh, modelPath,
+                                          generation] () {
+    const AoBaker::Settings settings;
+    auto ao = std::make_shared<AoBakeResult> (AoBaker::bake (*bvh, settings));
+    QString cacheError;
+    if (!AoBaker::saveCache (modelPath, *bvh, settings, *ao, &cacheError))
+      qWarning () << "AO cache not written:" << cacheError;
+    qDebug () << "AO bake:" << ao->rays << "rays in" << ao->bakeMs << "ms,"
+              << ao->raysPerSecond () / 1.0e6 << "Mrays/s";
+    if (!self)
+      return;
+    QMetaObject::invokeMethod (
+        self,
+        [self, ao, generation] () {
+          if (!self)
+            return;
+          self->m_progressBar->setVisible (false);
+          if (generation != self->m_sceneGeneration)
+            return;
+          self->m_glView->setAmbientOcclusion (*ao);
+          self->m_statusLabel->setText (
+              QString ("Ambient occlusion: %1 M rays in %2 ms "
+                       "(%3 M rays/s)")
+                  .arg (ao->rays / 1.0e6, 0, 'f', 1)
+                  .arg (ao->bakeMs, 0, 'f', 0)
+                  .arg (ao->raysPerSecond () / 1.0e6, 0, 'f', 2));
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void
+MainWindow::showComparison (const MeshDiffResult &diff,
+                            const QString &fileName)
+{
+  m_glView->setDeviationHeatmap (diff);
+  m_statusLabel->setText (
+      QString ("vs %1: Hausdorff %2, RMS %3 / %4 (%5 ms)")
+          .arg (QFileInfo (fileName).fileName ())
+          .arg (diff.hausdorff, 0, 'g', 4)
+          .arg (diff.forward.rms, 0, 'g', 4)
+          .arg (diff.backward.rms, 0, 'g', 4)
+          .arg (diff.diffMs, 0, 'f', 0));
+}
+
+void
+MainWindow::onModelUploaded (double uploadMs, double maxFrameMs)
+{
+  m_statusLabel->setText (
+      QString ("Loaded successfully (upload %1 ms, max frame %2 ms).")
+          .arg (uploadMs, 0, 'f', 0)
+          .arg (maxFrameMs, 0, 'f', 1));
 }
 
 void
@@ -204,6 +604,37 @@ MainWindow::updateRenderConfig ()
   m_glView->setMaterialSettings (config);
 }
 
+void
+MainWindow::onTraceToggled (bool recording)
+{
+  if (recording)
+    {
+      Tracer::setEnabled (true);
+      m_statusLabel->setText ("Recording trace...");
+      return;
+    }
+
+  Tracer::setEnabled (false);
+  const size_t events = Tracer::eventCount ();
+  QString fileName = QFileDialog::getSaveFileName (
+      this, "Save Trace", "meshspy-trace.json", "Chrome Trace (*.json)");
+  if (fileName.isEmpty ())
+    {
+      m_statusLabel->setText ("Trace discarded.");
+      return;
+    }
+
+  QString error;
+  if (!Tracer::write (fileName, &error))
+    {
+      QMessageBox::critical (this, "Error", "Cannot save trace: " + error);
+      return;
+    }
+  m_statusLabel->setText (QString ("Trace of %1 events saved to %2")
+                              .arg (events)
+                              .arg (fileName));
+}
+
 void
 MainWindow::onAboutClicked ()
 {
@@ -1,15 +1,23 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "glviewwidget.h"
 #include "meshdata.h"
 #include "renderconfig.h"
 
 #include <QMainWindow>
 #include <QThread>
+#include <memory>
 
-class GLViewWidget;
+class AnalysisPanel;
+struct MeshDiffResult;
+class ProfilerPanel;
 class QPushButton;
 class QCheckBox;
+class QComboBox;
+class QDoubleSpinBox;
+class QGroupBox;
+class QSpinBox;
 class QLabel;
 class QProgressBar;
 
@@ -25,6 +33,11 @@ private slots:
   void onLoadModelClicked ();
   void onModelLoaded (SceneData *data);
   void onModelLoadError (QString error);
+  void onModelUploaded (double uploadMs, double maxFrameMs);
+  void onMeshPicked (const PickResult &result);
+  void onCompareClicked ();
+  void onBakeAoClicked ();
+  void onTraceToggled (bool recording);
 
   // New Actions
   void onAboutClicked ();
@@ -42,6 +55,14 @@ private:
   QCheckBox *m_chkRough;
   QCheckBox *m_chkNormal;
   QCheckBox *m_chkWireframe;
+  QDoubleSpinBox *m_spinUploadBudget;
+  QSpinBox *m_spinTextureBudget;
+  QCheckBox *m_chkWeld;
+  QDoubleSpinBox *m_spinWeldEpsilon;
+  QGroupBox *m_animGroup;
+  QComboBox *m_comboClip;
+  QCheckBox *m_chkPlay;
+  QSpinBox *m_spinInstances;
 
   // Feedback
   QLabel *m_statusLabel;
@@ -49,8 +70,18 @@ private:
 
   QThread *m_loaderThread;
 
+  ProfilerPanel *m_profilerPanel;
+  AnalysisPanel *m_analysisPanel;
+  int m_sceneGeneration = 0; // Drops results of superseded models
+  QString m_modelPath;         // Model being loaded, then shown
+
 private:
   void updateRenderConfig ();
+  void updateAnimation ();
+  void startAnalysis (std::shared_ptr<const SceneData> scene);
+  void startPickingBuild (std::shared_ptr<const SceneData> scene,
+                          const QString &modelPath);
+  void showComparison (const MeshDiffResult &diff, const QString &fileName);
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,291 @@
+#include "meshanalyzer.h"
+#include "parallel.h"
+#include "tracer.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <meshoptimizer.h>
+
+namespace
+{
+// Large submeshes are cut into chunks of this many triangles, and their
+// keys spread over kShards shards
+constexpr size_t kChunkTriangles = 1 << 16;
+constexpr size_t kShards = 64;
+
+// Same FIFO size as meshopt_optimizeVertexCache assumes
+constexpr unsigned int kCacheSize = 16;
+
+using EdgeKey = uint64_t;                      // Lower index << 32 | higher
+using TriangleKey = std::array<uint32_t, 3>; // Sorted vertex indices
+
+size_t
+mix (uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return (size_t)key;
+}
+
+size_t
+shardOf (EdgeKey key)
+{
+  return mix (key);
+}
+
+size_t
+shardOf (const TriangleKey &key)
+{
+  return mix (((uint64_t)key[0] << 32 | key[1]) ^ mix (key[2]));
+}
+
+struct Runs
+{
+  size_t repeats = 0;  // Keys equal to an earlier one
+  size_t longRuns = 0; // Keys present more than twice
+};
+
+template <typename Key>
+Runs
+countRuns (std::vector<Key> &keys)
+{
+  std::sort (keys.begin (), keys.end ());
+  Runs runs;
+  for (size_t i = 0; i < keys.size ();)
+    {
+      size_t end = i + 1;
+      while (end < keys.size () && keys[end] == keys[i])
+        end++;
+      runs.repeats += end - i - 1;
+      if (end - i > 2)
+        runs.longRuns++;
+      i = end;
+    }
+  return runs;
+}
+
+// Moves every chunk's list for one shard into a single vector
+template <typename Key>
+std::vector<Key>
+gather (std::vector<std::vector<Key>> &lists, size_t shard, size_t shards)
+{
+  size_t total = 0;
+  for (size_t i = shard; i < lists.size (); i += shards)
+    total += lists[i].size ();
+
+  std::vector<Key> keys;
+  keys.reserve (total);
+  for (size_t i = shard; i < lists.size (); i += shards)
+    {
+      keys.insert (keys.end (), lists[i].begin (), lists[i].end ());
+      std::vector<Key> ().swap (lists[i]);
+    }
+  return keys;
+}
+
+bool
+isDegenerate (const SubMesh &mesh, uint32_t a, uint32_t b, uint32_t c)
+{
+  if (a == b || b == c || a == c)
+    return true;
+  const glm::vec3 pa = mesh.position (a);
+  const glm::vec3 n
+      = glm::cross (mesh.position (b) - pa, mesh.position (c) - pa);
+  return glm::dot (n, n) == 0.0f;
+}
+
+// split: cut into chunks and shards for the whole pool. Otherwise the mesh
+// is analyzed on the calling thread.
+MeshMetrics
+analyzeMesh (const SubMesh &mesh, bool split)
+{
+  MeshMetrics metrics;
+  metrics.submeshes = 1;
+  metrics.triangles = mesh.indices.size () / 3;
+  metrics.vertices = mesh.vertexCount;
+  metrics.withoutTexCoords = mesh.hasTexCoords ? 0 : 1;
+  metrics.weldedVertices = mesh.weldedVertices;
+  metrics.weldedBytes = mesh.weldedVertices * mesh.layout.stride;
+
+  const size_t triangles = metrics.triangles;
+  const uint32_t *indices = mesh.indices.data ();
+  const size_t chunkSize = split ? kChunkTriangles : triangles;
+  const size_t chunks
+      = chunkSize ? (triangles + chunkSize - 1) / chunkSize : 0;
+  const size_t shards = split ? kShards : 1;
+
+  // 1. Degenerate triangles and referenced vertices; edge and triangle
+  // keys of the rest go to their shard
+  std::vector<std::vector<EdgeKey>> edges (chunks * shards);
+  std::vector<std::vector<TriangleKey>> faces (chunks * shards);
+  std::vector<size_t> degenerate (chunks, 0);
+  std::vector<uint32_t> maxIndex (chunks, 0);
+  std::vector<std::atomic<bool>> used (mesh.vertexCount);
+
+  parallelFor (chunks, [&] (size_t chunk) {
+    std::vector<EdgeKey> *chunkEdges = &edges[chunk * shards];
+    std::vector<TriangleKey> *chunkFaces = &faces[chunk * shards];
+    const size_t end = std::min (triangles, (chunk + 1) * chunkSize);
+
+    for (size_t t = chunk * chunkSize; t < end; t++)
+      {
+        TriangleKey key
+            = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+        bool valid = true;
+        for (uint32_t v : key)
+          {
+            maxIndex[chunk] = std::max (maxIndex[chunk], v);
+            if (v < mesh.vertexCount)
+              used[v].store (true, std::memory_order_relaxed);
+            else
+              valid = false;
+          }
+        if (!valid || isDegenerate (mesh, key[0], key[1], key[2]))
+          {
+            degenerate[chunk]++;
+            continue;
+          }
+
+        for (int e = 0; e < 3; e++)
+          {
+            const uint32_t a = key[e], b = key[(e + 1) % 3];
+            const EdgeKey edge
+                = (uint64_t)std::min (a, b) << 32 | std::max (a, b);
+            chunkEdges[shardOf (edge) % shards].push_back (edge);
+          }
+        std::sort (key.begin (), key.end ());
+        chunkFaces[shardOf (key) % shards].push_back (key);
+      }
+  });
+
+  // 2. Each shard sorted and counted on its own
+  std::vector<Runs> edgeRuns (shards), faceRuns (shards);
+  parallelFor (shards, [&] (size_t shard) {
+    std::vector<EdgeKey> edgeKeys = gather (edges, shard, shards);
+    edgeRuns[shard] = countRuns (edgeKeys);
+    std::vector<TriangleKey> faceKeys = gather (faces, shard, shards);
+    faceRuns[shard] = countRuns (faceKeys);
+  });
+
+  // 3. Reductions
+  uint32_t highest = 0;
+  for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+      metrics.degenerateTriangles += degenerate[chunk];
+      highest = std::max (highest, maxIndex[chunk]);
+    }
+  for (size_t shard = 0; shard < shards; shard++)
+    {
+      metrics.nonManifoldEdges += edgeRuns[shard].longRuns;
+      metrics.duplicateTriangles += faceRuns[shard].repeats;
+    }
+  for (const std::atomic<bool> &flag : used)
+    if (!flag.load (std::memory_order_relaxed))
+      metrics.unusedVertices++;
+
+  if (triangles)
+    {
+      const meshopt_VertexCacheStatistics cache
+          = meshopt_analyzeVertexCache (
+              indices, triangles * 3,
+              std::max<size_t> (mesh.vertexCount, (size_t)highest + 1),
+              kCacheSize, 0, 0);
+      metrics.cacheMisses = cache.vertices_transformed;
+    }
+  return metrics;
+}
+} // namespace
+
+double
+MeshMetrics::acmr () const
+{
+  return triangles ? (double)cacheMisses / triangles : 0.0;
+}
+
+double
+MeshMetrics::atvr () const
+{
+  const size_t referenced = vertices - unusedVertices;
+  return referenced ? (double)cacheMisses / referenced : 0.0;
+}
+
+void
+MeshMetrics::add (const MeshMetrics &other)
+{
+  submeshes += other.submeshes;
+  triangles += other.triangles;
+  vertices += other.vertices;
+  degenerateTriangles += other.degenerateTriangles;
+  duplicateTriangles += other.duplicateTriangles;
+  nonManifoldEdges += other.nonManifoldEdges;
+  unusedVertices += other.unusedVertices;
+  withoutTexCoords += other.withoutTexCoords;
+  cacheMisses += other.cacheMisses;
+  weldedVertices += other.weldedVertices;
+  weldedBytes += other.weldedBytes;
+}
+
+SceneAnalysis
+MeshAnalyzer::analyze (const SceneData &scene)
+{
+  TRACE_SCOPE_CAT ("analysis", "MeshAnalyzer::analyze");
+  QElapsedTimer timer;
+  timer.start ();
+
+  SceneAnalysis analysis;
+  analysis.meshes.resize (scene.meshes.size ());
+
+  // 1. Small submeshes one per task, large ones split across the pool.
+  // Shared geometry is analyzed once, at its source.
+  std::vector<size_t> small, large;
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene.meshes[m];
+      if (mesh.sharedGeometry >= 0)
+        continue;
+      (mesh.indices.size () / 3 > kChunkTriangles ? large : small)
+          .push_back (m);
+    }
+
+  parallelFor (small.size (), [&] (size_t i) {
+    analysis.meshes[small[i]].metrics
+        = analyzeMesh (scene.meshes[small[i]], false);
+  });
+  for (size_t m : large)
+    analysis.meshes[m].metrics = analyzeMesh (scene.meshes[m], true);
+
+  // 2. Per material and scene totals
+  for (size_t i = 0; i < scene.materials.size (); i++)
+    {
+      const std::string &name = scene.materials[i].name;
+      analysis.materialNames.push_back (
+          name.empty () ? "Material " + std::to_string (i) : name);
+    }
+  analysis.materials.resize (scene.materials.size ());
+
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene.meshes[m];
+      SubMeshReport &report = analysis.meshes[m];
+      report.name = mesh.name;
+      report.materialIndex = mesh.materialIndex;
+      report.sharedGeometry = mesh.sharedGeometry;
+      if (mesh.sharedGeometry >= 0)
+        {
+          report.metrics = analysis.meshes[mesh.sharedGeometry].metrics;
+          report.metrics.withoutTexCoords = mesh.hasTexCoords ? 0 : 1;
+        }
+
+      if (mesh.materialIndex >= 0
+          && mesh.materialIndex < (int)analysis.materials.size ())
+        analysis.materials[mesh.materialIndex].add (report.metrics);
+      analysis.total.add (report.metrics);
+    }
+
+  analysis.analysisMs = timer.nsecsElapsed () / 1.0e6;
+  return analysis;
+}
@@ -0,0 +1,63 @@
+#ifndef MESHANALYZER_H
+#define MESHANALYZER_H
+
+#include "meshdata.h"
+
+#include <string>
+#include <vector>
+
+// Geometry quality counters. They add up across submeshes, so material and
+// scene totals are plain sums.
+struct MeshMetrics
+{
+  size_t submeshes = 0;
+  size_t triangles = 0;
+  size_t vertices = 0;
+  size_t degenerateTriangles = 0; // Repeated index or zero area
+  size_t duplicateTriangles = 0;  // Same three vertices as another one
+  size_t nonManifoldEdges = 0;    // Shared by more than two triangles
+  size_t unusedVertices = 0;      // Never referenced by an index
+  size_t withoutTexCoords = 0;    // Submeshes without TEXCOORD_0
+  size_t cacheMisses = 0;         // Vertex shader runs, 16-entry FIFO cache
+  size_t weldedVertices = 0;      // Merged at load (VertexWelder)
+  size_t weldedBytes = 0;         // Vertex buffer bytes they took
+
+  // Average cache miss ratio (vertex shader runs per triangle, 0.5 is
+  // ideal) and average transform to vertex ratio (1.0 is ideal)
+  double acmr () const;
+  double atvr () const;
+
+  void add (const MeshMetrics &other);
+};
+
+struct SubMeshReport
+{
+  std::string name;
+  int materialIndex = 0;
+  int sharedGeometry = -1;
+  MeshMetrics metrics;
+};
+
+struct SceneAnalysis
+{
+  std::vector<SubMeshReport> meshes;
+  std::vector<std::string> materialNames;
+  std::vector<MeshMetrics> materials; // Per SceneData::materials entry
+  MeshMetrics total;
+  double analysisMs = 0.0;
+};
+
+// Mesh inspection over a loaded scene.
+//
+// Edges and triangles are keyed by vertex index and sharded by hash; each
+// shard is sorted and counted on its own pool thread, so large submeshes are
+// split across every core. Submeshes below the sharding threshold are
+// analyzed whole, one per task. The scene is only read; run it off the GUI
+// thread and keep the SceneData alive until it returns.
+class MeshAnalyzer
+{
+public:
+  static SceneAnalysis analyze (const SceneData &scene);
+};
+
+#endif // MESHANALYZER_H
@@ -0,0 +1,820 @@
+#include "meshbvh.h"
+#include "parallel.h"
+#include "tracer.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#define MESHBVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+constexpr int kBins = 16;
+constexpr uint32_t kMaxLeafSize = 4;
+constexpr size_t kSubtreeSize = 1 << 16; // Smaller ranges: one task each
+constexpr size_t kChunk = 1 << 14;       // Triangles per pool task
+
+struct Box
+{
+  glm::vec3 min = glm::vec3 (FLT_MAX);
+  glm::vec3 max = glm::vec3 (-FLT_MAX);
+
+  void
+  grow (const glm::vec3 &p)
+  {
+    min = glm::min (min, p);
+    max = glm::max (max, p);
+  }
+
+  void
+  grow (const Box &box)
+  {
+    min = glm::min (min, box.min);
+    max = glm::max (max, box.max);
+  }
+
+  float
+  area () const
+  {
+    const glm::vec3 e = max - min;
+    if (e.x < 0.0f)
+      return 0.0f;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+};
+
+struct Bin
+{
+  Box box;
+  Box centroids;
+  size_t count = 0;
+};
+
+using Bins = std::array<Bin, kBins>;
+
+// Bounds of a range of triangles and of their centroids
+struct RangeBounds
+{
+  Box box;
+  Box centroids;
+};
+
+// fn(begin, end) over [begin, end), in kChunk pieces on the pool when
+// `parallel`, partial results folded with merge(into, from)
+template <typename T, typename Fn, typename Merge>
+T
+reduceRange (size_t begin, size_t end, bool parallel, Fn fn, Merge merge)
+{
+  if (!parallel)
+    return fn (begin, end);
+
+  const size_t chunks = (end - begin + kChunk - 1) / kChunk;
+  std::vector<T> partial (chunks);
+  parallelFor (chunks, [&] (size_t c) {
+    partial[c]
+        = fn (begin + c * kChunk, std::min (end, begin + (c + 1) * kChunk));
+  });
+  T result = partial[0];
+  for (size_t c = 1; c < chunks; c++)
+    merge (result, partial[c]);
+  return result;
+}
+
+// Lanes whose ray enters the box before its closest hit so far, as a
+// movemask; `entry` receives the nearest entry distance among them
+int
+boxMask (const glm::vec3 &min, const glm::vec3 &max, const RayPacket &rays,
+         const float (&inverse)[3][4], const float (&tMax)[4], float &entry)
+{
+  alignas (16) float tNear[4];
+#ifdef MESHBVH_SSE
+  __m128 near4 = _mm_setzero_ps ();
+  __m128 far4 = _mm_load_ps (tMax);
+  for (int a = 0; a < 3; a++)
+    {
+      const __m128 origin = _mm_load_ps (rays.origin[a]);
+      const __m128 inv = _mm_load_ps (inverse[a]);
+      const __m128 t0
+          = _mm_mul_ps (_mm_sub_ps (_mm_set1_ps (min[a]), origin), inv);
+      const __m128 t1
+          = _mm_mul_ps (_mm_sub_ps (_mm_set1_ps (max[a]), origin), inv);
+      near4 = _mm_max_ps (near4, _mm_min_ps (t0, t1));
+      far4 = _mm_min_ps (far4, _mm_max_ps (t0, t1));
+    }
+  const int mask = _mm_movemask_ps (_mm_cmple_ps (near4, far4));
+  _mm_store_ps (tNear, near4);
+#else
+  int mask = 0;
+  for (int lane = 0; lane < 4; lane++)
+    {
+      float tFar = tMax[lane];
+      tNear[lane] = 0.0f;
+      for (int a = 0; a < 3; a++)
+        {
+          const float t0 = (min[a] - rays.origin[a][lane]) * inverse[a][lane];
+          const float t1 = (max[a] - rays.origin[a][lane]) * inverse[a][lane];
+          tNear[lane] = std::max (tNear[lane], std::min (t0, t1));
+          tFar = std::min (tFar, std::max (t0, t1));
+        }
+      if (tNear[lane] <= tFar)
+        mask |= 1 << lane;
+    }
+#endif
+
+  entry = FLT_MAX;
+  for (int lane = 0; lane < 4; lane++)
+    if (mask & (1 << lane))
+      entry = std::min (entry, tNear[lane]);
+  return mask;
+}
+
+// Lanes whose ray crosses triangle (p0, p0 + e1, p0 + e2) in [0, tMax),
+// as a movemask. Möller-Trumbore, both faces.
+int
+triangleMask (const glm::vec3 &p0, const glm::vec3 &e1, const glm::vec3 &e2,
+              const RayPacket &rays, const float (&tMax)[4])
+{
+#ifdef MESHBVH_SSE
+  auto splat = [] (float x) { return _mm_set1_ps (x); };
+  auto dot = [] (__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by,
+                 __m128 bz) {
+    return _mm_add_ps (_mm_add_ps (_mm_mul_ps (ax, bx), _mm_mul_ps (ay, by)),
+                       _mm_mul_ps (az, bz));
+  };
+  auto cross = [] (__m128 a, __m128 b, __m128 c, __m128 d) {
+    return _mm_sub_ps (_mm_mul_ps (a, b), _mm_mul_ps (c, d));
+  };
+
+  const __m128 dx = _mm_load_ps (rays.direction[0]);
+  const __m128 dy = _mm_load_ps (rays.direction[1]);
+  const __m128 dz = _mm_load_ps (rays.direction[2]);
+  const __m128 e1x = splat (e1.x), e1y = splat (e1.y), e1z = splat (e1.z);
+  const __m128 e2x = splat (e2.x), e2y = splat (e2.y), e2z = splat (e2.z);
+
+  // p = d x e2, s = o - p0, q = s x e1
+  const __m128 px = cross (dy, e2z, dz, e2y);
+  const __m128 py = cross (dz, e2x, dx, e2z);
+  const __m128 pz = cross (dx, e2y, dy, e2x);
+  const __m128 det = dot (e1x, e1y, e1z, px, py, pz);
+  const __m128 invDet = _mm_div_ps (splat (1.0f), det);
+  const __m128 sx = _mm_sub_ps (_mm_load_ps (rays.origin[0]), splat (p0.x));
+  const __m128 sy = _mm_sub_ps (_mm_load_ps (rays.origin[1]), splat (p0.y));
+  const __m128 sz = _mm_sub_ps (_mm_load_ps (rays.origin[2]), splat (p0.z));
+  const __m128 u = _mm_mul_ps (dot (sx, sy, sz, px, py, pz), invDet);
+  const __m128 qx = cross (sy, e1z, sz, e1y);
+  const __m128 qy = cross (sz, e1x, sx, e1z);
+  const __m128 qz = cross (sx, e1y, sy, e1x);
+  const __m128 v = _mm_mul_ps (dot (dx, dy, dz, qx, qy, qz), invDet);
+  const __m128 t = _mm_mul_ps (dot (e2x, e2y, e2z, qx, qy, qz), invDet);
+
+  // NaNs from a zero determinant fail every comparison
+  const __m128 zero = _mm_setzero_ps ();
+  __m128 hit = _mm_cmpneq_ps (det, zero);
+  hit = _mm_and_ps (hit, _mm_cmpge_ps (u, zero));
+  hit = _mm_and_ps (hit, _mm_cmpge_ps (v, zero));
+  hit = _mm_and_ps (hit, _mm_cmple_ps (_mm_add_ps (u, v), splat (1.0f)));
+  hit = _mm_and_ps (hit, _mm_cmpge_ps (t, zero));
+  hit = _mm_and_ps (hit, _mm_cmplt_ps (t, _mm_load_ps (tMax)));
+  return _mm_movemask_ps (hit);
+#else
+  int mask = 0;
+  for (int lane = 0; lane < 4; lane++)
+    {
+      const glm::vec3 o (rays.origin[0][lane], rays.origin[1][lane],
+                         rays.origin[2][lane]);
+      const glm::vec3 d (rays.direction[0][lane], rays.direction[1][lane],
+                         rays.direction[2][lane]);
+      const glm::vec3 p = glm::cross (d, e2);
+      const float det = glm::dot (e1, p);
+      if (det == 0.0f)
+        continue;
+      const float invDet = 1.0f / det;
+      const glm::vec3 s = o - p0;
+      const float u = glm::dot (s, p) * invDet;
+      const glm::vec3 q = glm::cross (s, e1);
+      const float v = glm::dot (d, q) * invDet;
+      const float t = glm::dot (e2, q) * invDet;
+      if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f
+          && t < tMax[lane])
+        mask |= 1 << lane;
+    }
+  return mask;
+#endif
+}
+
+// Squared distance from p to a box, 0 inside
+float
+boxDistance2 (const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &p)
+{
+  const glm::vec3 d
+      = glm::max (glm::max (min - p, p - max), glm::vec3 (0.0f));
+  return glm::dot (d, d);
+}
+
+// Closest point to p on triangle abc (Ericson, Real-Time Collision
+// Detection 5.1.5)
+glm::vec3
+closestOnTriangle (const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b,
+                   const glm::vec3 &c)
+{
+  const glm::vec3 ab = b - a;
+  const glm::vec3 ac = c - a;
+  const glm::vec3 ap = p - a;
+  const float d1 = glm::dot (ab, ap);
+  const float d2 = glm::dot (ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f)
+    return a;
+
+  const glm::vec3 bp = p - b;
+  const float d3 = glm::dot (ab, bp);
+  const float d4 = glm::dot (ac, bp);
+  if (d3 >= 0.0f && d4 <= d3)
+    return b;
+
+  const float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    return a + ab * (d1 / (d1 - d3));
+
+  const glm::vec3 cp = p - c;
+  const float d5 = glm::dot (ab, cp);
+  const float d6 = glm::dot (ac, cp);
+  if (d6 >= 0.0f && d5 <= d6)
+    return c;
+
+  const float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    return a + ac * (d2 / (d2 - d6));
+
+  const float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  const float denom = 1.0f / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+} // namespace
+
+void
+RayPacket::set (int lane, const glm::vec3 &from, const glm::vec3 &dir,
+                float maxDistance)
+{
+  for (int a = 0; a < 3; a++)
+    {
+      origin[a][lane] = from[a];
+      direction[a][lane] = dir[a];
+    }
+  tMax[lane] = maxDistance;
+}
+
+struct MeshBVH::Builder
+{
+  // Min and max per triangle, so binning reads one record instead of
+  // three vertices
+  std::vector<glm::vec3> boxes;
+  std::vector<glm::vec3> centroids;
+  std::vector<uint32_t> order; // Triangle numbers, partitioned in place
+
+  Box
+  triangleBox (uint32_t t) const
+  {
+    return { boxes[2 * t], boxes[2 * t + 1] };
+  }
+
+  RangeBounds
+  bounds (size_t begin, size_t end, bool parallel) const
+  {
+    return reduceRange<RangeBounds> (
+        begin, end, parallel,
+        [this] (size_t from, size_t to) {
+          RangeBounds range;
+          for (size_t i = from; i < to; i++)
+            {
+              range.box.grow (triangleBox (order[i]));
+              range.centroids.grow (centroids[order[i]]);
+            }
+          return range;
+        },
+        [] (RangeBounds &into, const RangeBounds &from) {
+          into.box.grow (from.box);
+          into.centroids.grow (from.centroids);
+        });
+  }
+
+  // Partitions [begin, end) at the cheapest SAH plane and returns the
+  // split position with the bounds of both sides, or end for a leaf
+  size_t
+  split (size_t begin, size_t end, const RangeBounds &range, bool parallel,
+         RangeBounds &left, RangeBounds &right)
+  {
+    const size_t count = end - begin;
+    if (count <= kMaxLeafSize)
+      return end;
+
+    // Halves in whatever order the range is in, bounds recomputed
+    auto median = [&] () {
+      const size_t mid = begin + count / 2;
+      left = bounds (begin, mid, parallel);
+      right = bounds (mid, end, parallel);
+      return mid;
+    };
+
+    const glm::vec3 extent = range.centroids.max - range.centroids.min;
+    int axis = 0;
+    if (extent.y > extent[axis])
+      axis = 1;
+    if (extent.z > extent[axis])
+      axis = 2;
+
+    // All centroids coincide: no plane separates them
+    if (!(extent[axis] > 0.0f))
+      return median ();
+
+    // 1. Bin triangles by centroid
+    const float origin = range.centroids.min[axis];
+    const float scale = kBins / extent[axis];
+    auto binOf = [&] (uint32_t t) {
+      return std::min (kBins - 1,
+                       (int)((centroids[t][axis] - origin) * scale));
+    };
+
+    const Bins bins = reduceRange<Bins> (
+        begin, end, parallel,
+        [&] (size_t from, size_t to) {
+          Bins local;
+          for (size_t i = from; i < to; i++)
+            {
+              Bin &bin = local[binOf (order[i])];
+              bin.box.grow (triangleBox (order[i]));
+              bin.centroids.grow (centroids[order[i]]);
+              bin.count++;
+            }
+          return local;
+        },
+        [] (Bins &into, const Bins &from) {
+          for (int b = 0; b < kBins; b++)
+            {
+              into[b].box.grow (from[b].box);
+              into[b].centroids.grow (from[b].centroids);
+              into[b].count += from[b].count;
+            }
+        });
+
+    // 2. Sweep: surface area heuristic of splitting after each bin
+    std::array<float, kBins - 1> leftCost;
+    Box box;
+    size_t n = 0;
+    for (int b = 0; b < kBins - 1; b++)
+      {
+        box.grow (bins[b].box);
+        n += bins[b].count;
+        leftCost[b] = n * box.area ();
+      }
+
+    // Leaves stop at kMaxLeafSize, so the best plane is always taken
+    float best = FLT_MAX;
+    int bestBin = 0;
+    box = Box ();
+    n = 0;
+    for (int b = kBins - 1; b > 0; b--)
+      {
+        box.grow (bins[b].box);
+        n += bins[b].count;
+        const float cost = leftCost[b - 1] + n * box.area ();
+        if (cost < best)
+          {
+            best = cost;
+            bestBin = b - 1;
+          }
+      }
+
+    // 3. Partition; the children's bounds come from the bins
+    auto middle = std::partition (
+        order.begin () + begin, order.begin () + end,
+        [&] (uint32_t t) { return binOf (t) <= bestBin; });
+    const size_t mid = middle - order.begin ();
+    if (mid == begin || mid == end)
+      return median ();
+
+    left = RangeBounds ();
+    right = RangeBounds ();
+    for (int b = 0; b < kBins; b++)
+      {
+        RangeBounds &side = b <= bestBin ? left : right;
+        side.box.grow (bins[b].box);
+        side.centroids.grow (bins[b].centroids);
+      }
+    return mid;
+  }
+
+  // Serial build of [begin, end) below `node`, children appended to nodes
+  void
+  buildSubtree (std::vector<Node> &nodes, size_t node, size_t begin,
+                size_t end, const RangeBounds &range)
+  {
+    nodes[node].min = range.box.min;
+    nodes[node].max = range.box.max;
+
+    RangeBounds leftRange, rightRange;
+    const size_t mid = split (begin, end, range, false, leftRange,
+                              rightRange);
+    if (mid == end)
+      {
+        nodes[node].first = (uint32_t)begin;
+        nodes[node].count = (uint32_t)(end - begin);
+        return;
+      }
+
+    const size_t left = nodes.size ();
+    nodes[node].first = (uint32_t)left;
+    nodes[node].count = 0;
+    nodes.resize (left + 2);
+    buildSubtree (nodes, left, begin, mid, leftRange);
+    buildSubtree (nodes, left + 1, mid, end, rightRange);
+  }
+};
+
+void
+MeshBVH::build (const SceneData &scene)
+{
+  TRACE_SCOPE_CAT ("analysis", "MeshBVH::build");
+  QElapsedTimer timer;
+  timer.start ();
+  *this = MeshBVH ();
+
+  // 1. Flatten the submeshes, positions decoded to float
+  size_t vertexCount = 0;
+  size_t triangleCount = 0;
+  for (size_t m = 0; m < scene.meshes.size (); m++)
+    {
+      const SubMesh &mesh = scene.meshes[m];
+      if (mesh.sharedGeometry >= 0 || mesh.indices.size () < 3)
+        continue;
+      m_meshes.push_back ((int)m);
+      m_materials.push_back (mesh.materialIndex);
+      m_meshTriangles.push_back ((uint32_t)triangleCount);
+      m_meshVertices.push_back (vertexCount);
+      vertexCount += mesh.vertexCount;
+      triangleCount += mesh.indices.size () / 3;
+    }
+  if (triangleCount == 0)
+    return;
+
+  m_positions.resize (vertexCount);
+  std::vector<glm::uvec3> triangles (triangleCount);
+  parallelFor (m_meshes.size (), [&] (size_t k) {
+    const SubMesh &mesh = scene.meshes[m_meshes[k]];
+    const uint32_t base = (uint32_t)m_meshVertices[k];
+    parallelFor (
+        mesh.vertexCount,
+        [&] (size_t v) { m_positions[base + v] = mesh.position (v); },
+        kChunk);
+    parallelFor (
+        mesh.indices.size () / 3,
+        [&] (size_t t) {
+          const unsigned int *index = &mesh.indices[t * 3];
+          glm::uvec3 &triangle = triangles[m_meshTriangles[k] + t];
+          if (index[0] >= mesh.vertexCount || index[1] >= mesh.vertexCount
+              || index[2] >= mesh.vertexCount)
+            triangle = glm::uvec3 (base); // Degenerate, never hit
+          else
+            triangle = glm::uvec3 (index[0], index[1], index[2]) + base;
+        },
+        kChunk);
+  });
+
+  // 2. Triangle bounds and centroids
+  Builder builder;
+  builder.boxes.resize (2 * triangleCount);
+  builder.centroids.resize (triangleCount);
+  builder.order.resize (triangleCount);
+  parallelFor (
+      triangleCount,
+      [&] (size_t t) {
+        const glm::uvec3 &tri = triangles[t];
+        Box box;
+        box.grow (m_positions[tri.x]);
+        box.grow (m_positions[tri.y]);
+        box.grow (m_positions[tri.z]);
+        builder.boxes[2 * t] = box.min;
+        builder.boxes[2 * t + 1] = box.max;
+        builder.centroids[t] = (box.min + box.max) * 0.5f;
+        builder.order[t] = (uint32_t)t;
+      },
+      kChunk);
+
+  // 3. Top levels, each node binned on the whole pool
+  struct Range
+  {
+    size_t node, begin, end;
+    RangeBounds bounds;
+  };
+  std::vector<Range> pending{
+    { 0, 0, triangleCount, builder.bounds (0, triangleCount, true) }
+  };
+  std::vector<Range> subtrees;
+  m_nodes.resize (1);
+  while (!pending.empty ())
+    {
+      const Range range = pending.back ();
+      pending.pop_back ();
+      if (range.end - range.begin <= kSubtreeSize)
+        {
+          subtrees.push_back (range);
+          continue;
+        }
+
+      RangeBounds leftRange, rightRange;
+      const size_t mid = builder.split (range.begin, range.end,
+                                        range.bounds, true, leftRange,
+                                        rightRange);
+      const size_t left = m_nodes.size ();
+      m_nodes[range.node] = { range.bounds.box.min, (uint32_t)left,
+                              range.bounds.box.max, 0 };
+      m_nodes.resize (left + 2);
+      pending.push_back ({ left, range.begin, mid, leftRange });
+      pending.push_back ({ left + 1, mid, range.end, rightRange });
+    }
+
+  // 4. Subtrees one per task, then appended with their children relocated
+  std::vector<std::vector<Node>> local (subtrees.size ());
+  parallelFor (subtrees.size (), [&] (size_t s) {
+    local[s].resize (1);
+    builder.buildSubtree (local[s], 0, subtrees[s].begin, subtrees[s].end,
+                          subtrees[s].bounds);
+  });
+
+  for (size_t s = 0; s < subtrees.size (); s++)
+    {
+      const uint32_t offset = (uint32_t)m_nodes.size () - 1;
+      auto relocate = [offset] (Node node) {
+        if (node.count == 0)
+          node.first += offset;
+        return node;
+      };
+      m_nodes[subtrees[s].node] = relocate (local[s][0]);
+      for (size_t n = 1; n < local[s].size (); n++)
+        m_nodes.push_back (relocate (local[s][n]));
+      std::vector<Node> ().swap (local[s]);
+    }
+
+  // 5. Triangles in leaf order
+  m_triangles.resize (triangleCount);
+  m_triangleIds = std::move (builder.order);
+  parallelFor (
+      triangleCount,
+      [&] (size_t i) { m_triangles[i] = triangles[m_triangleIds[i]]; },
+      kChunk);
+
+  m_buildMs = timer.nsecsElapsed () / 1.0e6;
+}
+
+std::array<BvhHit, 4>
+MeshBVH::intersect (const RayPacket &rays) const
+{
+  std::array<BvhHit, 4> hits;
+  if (m_nodes.empty ())
+    return hits;
+
+  alignas (16) float inverse[3][4];
+  alignas (16) float tMax[4];
+  uint32_t closest[4] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+  for (int lane = 0; lane < 4; lane++)
+    {
+      tMax[lane] = rays.tMax[lane];
+      for (int a = 0; a < 3; a++)
+        inverse[a][lane] = 1.0f / rays.direction[a][lane];
+    }
+
+  // 1. Traversal, nearer child first
+  float entry;
+  if (!boxMask (m_nodes[0].min, m_nodes[0].max, rays, inverse, tMax, entry))
+    return hits;
+
+  std::vector<uint32_t> stack{ 0 };
+  stack.reserve (64);
+  while (!stack.empty ())
+    {
+      const Node &node = m_nodes[stack.back ()];
+      stack.pop_back ();
+
+      if (node.count > 0)
+        {
+          // Möller-Trumbore, both faces
+          for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+              const glm::uvec3 &tri = m_triangles[i];
+              const glm::vec3 p0 = m_positions[tri.x];
+              const glm::vec3 e1 = m_positions[tri.y] - p0;
+              const glm::vec3 e2 = m_positions[tri.z] - p0;
+
+              for (int lane = 0; lane < 4; lane++)
+                {
+                  if (tMax[lane] < 0.0f)
+                    continue;
+                  const glm::vec3 o (rays.origin[0][lane],
+                                     rays.origin[1][lane],
+                                     rays.origin[2][lane]);
+                  const glm::vec3 d (rays.direction[0][lane],
+                                     rays.direction[1][lane],
+                                     rays.direction[2][lane]);
+
+                  const glm::vec3 p = glm::cross (d, e2);
+                  const float det = glm::dot (e1, p);
+                  if (det == 0.0f)
+                    continue;
+                  const float invDet = 1.0f / det;
+                  const glm::vec3 s = o - p0;
+                  const float u = glm::dot (s, p) * invDet;
+                  if (u < 0.0f || u > 1.0f)
+                    continue;
+                  const glm::vec3 q = glm::cross (s, e1);
+                  const float v = glm::dot (d, q) * invDet;
+                  if (v < 0.0f || u + v > 1.0f)
+                    continue;
+                  const float t = glm::dot (e2, q) * invDet;
+                  if (t >= 0.0f && t < tMax[lane])
+                    {
+                      tMax[lane] = t;
+                      closest[lane] = i;
+                    }
+                }
+            }
+          continue;
+        }
+
+      const Node &left = m_nodes[node.first];
+      const Node &right = m_nodes[node.first + 1];
+      float leftEntry, rightEntry;
+      const bool hitLeft
+          = boxMask (left.min, left.max, rays, inverse, tMax, leftEntry);
+      const bool hitRight
+          = boxMask (right.min, right.max, rays, inverse, tMax, rightEntry);
+      if (hitLeft && hitRight)
+        {
+          const bool leftFirst = leftEntry <= rightEntry;
+          stack.push_back (leftFirst ? node.first + 1 : node.first);
+          stack.push_back (leftFirst ? node.first : node.first + 1);
+        }
+      else if (hitLeft)
+        stack.push_back (node.first);
+      else if (hitRight)
+        stack.push_back (node.first + 1);
+    }
+
+  // 2. Leaf order back to submesh and triangle
+  for (int lane = 0; lane < 4; lane++)
+    {
+      if (closest[lane] == UINT32_MAX)
+        continue;
+      BvhHit &hit = hits[lane];
+      hit = hitFromLeaf (closest[lane]);
+      hit.distance = tMax[lane];
+      for (int a = 0; a < 3; a++)
+        hit.point[a]
+            = rays.origin[a][lane] + rays.direction[a][lane] * tMax[lane];
+    }
+  return hits;
+}
+
+int
+MeshBVH::occluded (const RayPacket &rays) const
+{
+  alignas (16) float inverse[3][4];
+  alignas (16) float tMax[4];
+  int active = 0;
+  for (int lane = 0; lane < 4; lane++)
+    {
+      tMax[lane] = rays.tMax[lane];
+      for (int a = 0; a < 3; a++)
+        inverse[a][lane] = 1.0f / rays.direction[a][lane];
+      if (tMax[lane] >= 0.0f)
+        active |= 1 << lane;
+    }
+  if (m_nodes.empty () || !active)
+    return 0;
+
+  // Reused across calls, occlusion bakes issue millions of them
+  thread_local std::vector<uint32_t> stack;
+  stack.assign (1, 0);
+  int blocked = 0;
+  while (!stack.empty () && blocked != active)
+    {
+      const Node &node = m_nodes[stack.back ()];
+      stack.pop_back ();
+      float entry;
+      if (!boxMask (node.min, node.max, rays, inverse, tMax, entry))
+        continue;
+
+      if (node.count == 0)
+        {
+          stack.push_back (node.first);
+          stack.push_back (node.first + 1);
+          continue;
+        }
+
+      for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+          const glm::uvec3 &tri = m_triangles[i];
+          const glm::vec3 p0 = m_positions[tri.x];
+          blocked |= triangleMask (p0, m_positions[tri.y] - p0,
+                                   m_positions[tri.z] - p0, rays, tMax);
+        }
+
+      // Finished lanes drop out of every further box and triangle test
+      for (int lane = 0; lane < 4; lane++)
+        if (blocked & (1 << lane))
+          tMax[lane] = -1.0f;
+    }
+  return blocked;
+}
+
+BvhHit
+MeshBVH::closestPoint (const glm::vec3 &p, float maxDistance) const
+{
+  BvhHit hit;
+  if (m_nodes.empty ())
+    return hit;
+
+  // 1. Traversal, nearer child first, pruned by the best distance so far
+  float best2 = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+  uint32_t closest = UINT32_MAX;
+  glm::vec3 point (0.0f);
+
+  if (boxDistance2 (m_nodes[0].min, m_nodes[0].max, p) > best2)
+    return hit;
+
+  std::vector<uint32_t> stack{ 0 };
+  stack.reserve (64);
+  while (!stack.empty ())
+    {
+      const Node &node = m_nodes[stack.back ()];
+      stack.pop_back ();
+      if (boxDistance2 (node.min, node.max, p) > best2)
+        continue; // Something nearer turned up since the push
+
+      if (node.count > 0)
+        {
+          for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+              const glm::uvec3 &tri = m_triangles[i];
+              const glm::vec3 q
+                  = closestOnTriangle (p, m_positions[tri.x],
+                                       m_positions[tri.y], m_positions[tri.z]);
+              const float d2 = glm::dot (p - q, p - q);
+              if (d2 <= best2)
+                {
+                  best2 = d2;
+                  closest = i;
+                  point = q;
+                }
+            }
+          continue;
+        }
+
+      const Node &left = m_nodes[node.first];
+      const Node &right = m_nodes[node.first + 1];
+      const float leftD2 = boxDistance2 (left.min, left.max, p);
+      const float rightD2 = boxDistance2 (right.min, right.max, p);
+      const bool leftFirst = leftD2 <= rightD2;
+      const float nearD2 = leftFirst ? leftD2 : rightD2;
+      const float farD2 = leftFirst ? rightD2 : leftD2;
+      if (farD2 <= best2)
+        stack.push_back (leftFirst ? node.first + 1 : node.first);
+      if (nearD2 <= best2)
+        stack.push_back (leftFirst ? node.first : node.first + 1);
+    }
+
+  if (closest == UINT32_MAX)
+    return hit;
+
+  // 2. Sign from the side of the triangle's face
+  hit = hitFromLeaf (closest);
+  hit.point = point;
+  const glm::uvec3 &tri = m_triangles[closest];
+  const glm::vec3 normal
+      = glm::cross (m_positions[tri.y] - m_positions[tri.x],
+                    m_positions[tri.z] - m_positions[tri.x]);
+  hit.distance = std::sqrt (best2);
+  if (glm::dot (p - point, normal) < 0.0f)
+    hit.distance = -hit.distance;
+  return hit;
+}
+
+BvhHit
+MeshBVH::hitFromLeaf (uint32_t leaf) const
+{
+  const uint32_t id = m_triangleIds[leaf];
+  const size_t k = std::upper_bound (m_meshTriangles.begin (),
+                                     m_meshTriangles.end (), id)
+                   - m_meshTriangles.begin () - 1;
+
+  BvhHit hit;
+  hit.mesh = m_meshes[k];
+  hit.triangle = id - m_meshTriangles[k];
+  hit.material = m_materials[k];
+  return hit;
+}
@@ -0,0 +1,144 @@
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include "meshdata.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Closest hit of one ray, or closest surface point to a query point, in
+// model space.
+struct BvhHit
+{
+  int mesh = -1;             // SceneData::meshes index, -1 = miss
+  unsigned int triangle = 0; // Triangle of that submesh (index / 3)
+  int material = -1;
+  // Rays: in units of the ray direction. Points: signed, negative behind
+  // the closest triangle's face.
+  float distance = FLT_MAX;
+  glm::vec3 point = glm::vec3 (0.0f);
+};
+
+// Up to four rays traced together, one SIMD lane each (structure of
+// arrays). Lanes that were never set are inactive.
+struct RayPacket
+{
+  alignas (16) float origin[3][4] = {};
+  alignas (16) float direction[3][4] = {};
+  alignas (16) float tMax[4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+
+  void set (int lane, const glm::vec3 &from, const glm::vec3 &dir,
+            float maxDistance = FLT_MAX);
+};
+
+// Triangle BVH over a loaded scene for CPU picking and closest-point
+// queries (MeshDiff).
+//
+// Built with binned SAH (16 bins along the widest centroid axis, leaves of
+// up to four triangles). Ranges above 64K triangles are binned on the whole
+// thread pool; smaller ones are built as independent subtrees, one per task,
+// and appended. Traversal walks a packet of four rays, testing every box
+// against all lanes at once (SSE where available). Positions are copied out
+// as floats, so the SceneData can go once build() returns. Shared geometry
+// (SceneDedup) is inserted once, under its source submesh.
+class MeshBVH
+{
+public:
+  void build (const SceneData &scene);
+
+  std::array<BvhHit, 4> intersect (const RayPacket &packet) const;
+
+  // Any-hit query for shadow and occlusion rays: the lanes (bit per lane)
+  // that hit something closer than their tMax. Stops at the first hit of
+  // every lane and tests triangles against all four lanes at once.
+  int occluded (const RayPacket &packet) const;
+
+  // Closest surface point to p no farther than maxDistance; a miss
+  // otherwise. Thread-safe, like intersect().
+  BvhHit closestPoint (const glm::vec3 &p,
+                       float maxDistance = FLT_MAX) const;
+
+  // Vertices of every inserted submesh, back to back
+  const std::vector<glm::vec3> &
+  positions () const
+  {
+    return m_positions;
+  }
+
+  // Inserted submeshes: SceneData::meshes index and first vertex in
+  // positions()
+  size_t
+  meshCount () const
+  {
+    return m_meshes.size ();
+  }
+
+  int
+  sceneMesh (size_t k) const
+  {
+    return m_meshes[k];
+  }
+
+  size_t
+  firstVertex (size_t k) const
+  {
+    return m_meshVertices[k];
+  }
+
+  // Triangles into positions(), in leaf order
+  const std::vector<glm::uvec3> &
+  triangles () const
+  {
+    return m_triangles;
+  }
+
+  size_t
+  triangleCount () const
+  {
+    return m_triangles.size ();
+  }
+
+  size_t
+  nodeCount () const
+  {
+    return m_nodes.size ();
+  }
+
+  double
+  buildMs () const
+  {
+    return m_buildMs;
+  }
+
+private:
+  // Inner nodes: count == 0, children at first and first + 1. Leaves:
+  // count triangles from first (leaf order).
+  struct Node
+  {
+    glm::vec3 min;
+    uint32_t first;
+    glm::vec3 max;
+    uint32_t count;
+  };
+
+  struct Builder;
+
+  std::vector<Node> m_nodes;
+  std::vector<glm::vec3> m_positions;  // Every submesh, model space
+  std::vector<glm::uvec3> m_triangles; // Into m_positions, leaf order
+  std::vector<uint32_t> m_triangleIds; // Scene-wide triangle numbers
+
+  // Per inserted submesh: SceneData::meshes index, material, first
+  // scene-wide triangle number and first vertex
+  std::vector<int> m_meshes;
+  std::vector<int> m_materials;
+  std::vector<uint32_t> m_meshTriangles;
+  std::vector<size_t> m_meshVertices;
+
+  BvhHit hitFromLeaf (uint32_t leaf) const;
+
+  double m_buildMs = 0.0;
+};
+
+#endif // MESHBVH_H
@@ -1,24 +1,97 @@
 #ifndef MESHDATA_H
 #define MESHDATA_H
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
-struct Vertex
+// glTF componentType values, which are also the GL type enums
+enum ComponentType
 {
-  glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec2 texCoords;
+  ComponentByte = 5120,
+  ComponentUnsignedByte = 5121,
+  ComponentShort = 5122,
+  ComponentUnsignedShort = 5123,
+  ComponentUnsignedInt = 5125,
+  ComponentFloat = 5126
+};
+
+// One attribute of an interleaved vertex. Quantized glTF data
+// (KHR_mesh_quantization, normalized integers) keeps its component type and
+// goes to glVertexAttribPointer as is.
+struct VertexAttribute
+{
+  int components = 0; // 0 = absent
+  int type = ComponentFloat;
+  bool normalized = false;
+  unsigned int offset = 0;
+
+  // The value as the vertex shader sees it
+  glm::vec4 read (const unsigned char *vertex) const;
+};
+
+struct VertexLayout
+{
+  VertexAttribute position;
+  VertexAttribute normal;
+  VertexAttribute texCoords;
+  VertexAttribute tangent; // XYZ + bitangent sign, normal-mapped only
+  VertexAttribute joints;  // JOINTS_0, skinned meshes only
+  VertexAttribute weights; // WEIGHTS_0, likewise
+  unsigned int stride = 0;
+};
+
+// Block-compressed encodings, also used as a bit set of what a context can
+// sample (see TextureProcessor::supportedCodecs).
+enum TextureCodec
+{
+  CodecBC1 = 1, // Opaque RGB
+  CodecBC4 = 2, // Single channel
+  CodecBC5 = 4, // Two channels (normal XY, roughness + metal)
+  CodecBC7 = 8  // RGBA
+};
+
+// What the materials sample a texture as; decides mip filter and codec.
+enum TextureUsage
+{
+  UsageColor = 0,         // sRGB color, linear alpha
+  UsageMetallicRoughness, // G=Roughness, B=Metal
+  UsageNormal             // Tangent-space XYZ
 };
 
 struct TextureData
 {
+  // Level 0 only, or every mip level back to back when levelOffsets is set.
+  // Compressed textures hold 4x4 blocks instead of texels.
   std::vector<unsigned char> pixels;
+  // Levels finer than this were dropped from pixels, which then start at
+  // levelOffsets[firstLevel] (Model decodes them from `encoded` again)
+  int firstLevel = 0;
   int width;
   int height;
-  int components;
+  int components; // Channels of the source image
   std::string name;
+
+  int usage = UsageColor;
+  unsigned int codec = 0; // TextureCodec, 0 = uncompressed
+  std::vector<size_t> levelOffsets; // Empty = mips are built on the GPU
+
+  // The image file as stored in the glTF (LoaderOptions::keepEncodedImages)
+  std::vector<unsigned char> encoded;
+  std::string mimeType;
+};
+
+// glTF material alphaMode
+enum AlphaMode
+{
+  AlphaOpaque = 0,
+  AlphaMask, // Alpha tested against alphaCutoff in the geometry pass
+  AlphaBlend // Weighted blended OIT pass after lighting
 };
 
 struct MaterialData
@@ -26,18 +99,221 @@ struct MaterialData
   glm::vec4 baseColorFactor = { 1.0f, 1.0f, 1.0f, 1.0f };
   float metallicFactor = 1.0f;
   float roughnessFactor = 1.0f;
+  int alphaMode = AlphaOpaque;
+  float alphaCutoff = 0.5f;
 
   // -1 means no texture
   int baseColorIndex = -1;
   int metallicRoughnessIndex = -1;
   int normalIndex = -1;
+
+  std::string name;
+};
+
+// Per-vertex displacements of one morph target. Attributes the target
+// leaves alone have empty streams.
+struct MorphTarget
+{
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec3> tangents;
 };
 
 struct SubMesh
 {
-  std::vector<Vertex> vertices;
+  // vertexCount interleaved vertices of layout.stride bytes
+  std::vector<unsigned char> vertexData;
+  VertexLayout layout;
+  size_t vertexCount = 0;
   std::vector<unsigned int> indices;
   int materialIndex = 0;
+  std::string name;          // glTF mesh name and primitive number
+  bool hasTexCoords = false; // False when zero UVs stand in for TEXCOORD_0
+
+  // Index of an earlier SubMesh with identical vertices and indices
+  // (SceneDedup). The geometry then lives there only; this one keeps its
+  // material, bounds and UV density. See SceneData::geometry().
+  int sharedGeometry = -1;
+
+  // Vertices VertexWelder merged into others (vertexCount is what is
+  // left)
+  size_t weldedVertices = 0;
+
+  // Node that instanced the primitive and its skin (SceneData::skins, -1 =
+  // rigid). Morph targets follow the vertices; their default weights come
+  // from the node or the glTF mesh.
+  int node = -1;
+  int skin = -1;
+  std::vector<MorphTarget> targets;
+  std::vector<float> morphWeights;
+
+  // Model space bounds
+  glm::vec3 minBounds = glm::vec3 (FLT_MAX);
+  glm::vec3 maxBounds = glm::vec3 (-FLT_MAX);
+
+  glm::vec3
+  position (size_t i) const
+  {
+    return glm::vec3 (layout.position.read (vertex (i)));
+  }
+
+  glm::vec3
+  normal (size_t i) const
+  {
+    return glm::vec3 (layout.normal.read (vertex (i)));
+  }
+
+  glm::vec2
+  texCoords (size_t i) const
+  {
+    return glm::vec2 (layout.texCoords.read (vertex (i)));
+  }
+
+  glm::vec4
+  tangent (size_t i) const
+  {
+    return layout.tangent.read (vertex (i));
+  }
+
+  const unsigned char *
+  vertex (size_t i) const
+  {
+    return vertexData.data () + i * layout.stride;
+  }
+};
+
+// Translation * rotation (quaternion XYZW) * scale, as glTF composes them
+inline glm::mat4
+composeTRS (const glm::vec3 &t, const glm::vec4 &q, const glm::vec3 &s)
+{
+  const float x = q.x, y = q.y, z = q.z, w = q.w;
+  glm::mat4 m (1.0f);
+  m[0] = glm::vec4 ((1.0f - 2.0f * (y * y + z * z)) * s.x,
+                    2.0f * (x * y + z * w) * s.x,
+                    2.0f * (x * z - y * w) * s.x, 0.0f);
+  m[1] = glm::vec4 (2.0f * (x * y - z * w) * s.y,
+                    (1.0f - 2.0f * (x * x + z * z)) * s.y,
+                    2.0f * (y * z + x * w) * s.y, 0.0f);
+  m[2] = glm::vec4 (2.0f * (x * z + y * w) * s.z,
+                    2.0f * (y * z - x * w) * s.z,
+                    (1.0f - 2.0f * (x * x + y * y)) * s.z, 0.0f);
+  m[3] = glm::vec4 (t, 1.0f);
+  return m;
+}
+
+// Whether GLTFLoader bakes a node's rest world matrix into its rigid
+// meshes: not the identity, and not a singular one, which would flatten
+// the mesh for good (nodes scaled to zero until an animation pops them
+// in). Animator moves baked meshes relative to the rest pose.
+inline bool
+bakesRestWorld (const glm::mat4 &world)
+{
+  return world != glm::mat4 (1.0f)
+         && std::abs (glm::determinant (glm::mat3 (world))) > 1.0e-12f;
+}
+
+// glTF node in its rest pose. Nodes given as a matrix are never animated.
+struct NodeData
+{
+  int parent = -1;
+  glm::vec3 translation = glm::vec3 (0.0f);
+  glm::vec4 rotation = glm::vec4 (0.0f, 0.0f, 0.0f, 1.0f); // Quaternion XYZW
+  glm::vec3 scale = glm::vec3 (1.0f);
+  bool hasMatrix = false;
+  glm::mat4 matrix = glm::mat4 (1.0f);
+  std::string name;
+
+  // Relative to the parent
+  glm::mat4
+  localMatrix () const
+  {
+    return hasMatrix ? matrix : composeTRS (translation, rotation, scale);
+  }
+};
+
+struct SkinData
+{
+  std::vector<int> joints; // Node per joint, -1 = invalid
+  std::vector<glm::mat4> inverseBindMatrices; // One per joint
+  std::string name;
+};
+
+enum AnimationPath
+{
+  PathTranslation = 0,
+  PathRotation,
+  PathScale,
+  PathWeights
+};
+
+enum AnimationInterpolation
+{
+  InterpolationLinear = 0,
+  InterpolationStep,
+  InterpolationCubicSpline
+};
+
+// One animated node property as the file stores it: `components` floats
+// per key (3, 4 or the morph target count), key after key. Cubic splines
+// hold in-tangent, value and out-tangent per key.
+struct AnimationChannelData
+{
+  int node = -1;
+  int path = PathTranslation;
+  int interpolation = InterpolationLinear;
+  int components = 0;
+  std::vector<float> times;
+  std::vector<float> values;
+};
+
+struct AnimationData
+{
+  std::string name;
+  std::vector<AnimationChannelData> channels;
+  float duration = 0.0f; // Last key time over all channels
+};
+
+// Per-stage load timings. GLTFLoader fills everything except uploadMs,
+// which belongs to whoever uploads the scene to the GPU.
+struct LoadStats
+{
+  double parseMs = 0.0; // File read + JSON/GLB parsing, excluding images
+  double imageDecodeMs = 0.0;
+  double meshDecodeMs = 0.0; // meshopt and Draco streams
+  double vertexAssemblyMs = 0.0;
+  double indexConversionMs = 0.0;
+  double textureProcessMs = 0.0; // Mip generation + block compression
+  double tangentMs = 0.0;        // MikkTSpace for meshes without TANGENT
+  double dedupMs = 0.0;          // Hashing and remapping duplicates
+  double weldMs = 0.0;           // Optional vertex welding
+  double uploadMs = 0.0;
+
+  size_t fileBytes = 0;
+  size_t vertexCount = 0;
+  size_t indexCount = 0;
+  size_t decodedBytes = 0; // Geometry produced by meshDecode
+  size_t vertexBytes = 0;  // Interleaved vertices in their stored formats
+
+  // Copies SceneDedup folded into an earlier identical one, and the
+  // decoded texels plus vertex/index bytes that no longer get uploaded
+  size_t duplicateTextures = 0;
+  size_t duplicateMaterials = 0;
+  size_t duplicateMeshes = 0;
+  size_t dedupBytes = 0;
+
+  // Vertices welded away (LoaderOptions::weldVertices) and their bytes
+  size_t weldedVertices = 0;
+  size_t weldBytes = 0;
+
+  // Texture VRAM as plain RGBA8 with mips vs. what is actually uploaded
+  size_t textureBytesUncompressed = 0;
+  size_t textureBytes = 0;
+
+  // Input the scene has no place for: primitive attributes other than
+  // POSITION, NORMAL, TEXCOORD_0, TANGENT and a skinned node's JOINTS_0 and
+  // WEIGHTS_0, and animation channels that cannot be played
+  size_t ignoredAttributes = 0;
+  size_t ignoredChannels = 0;
 };
 
 struct SceneData
@@ -47,10 +323,87 @@ struct SceneData
   std::vector<TextureData> textures;
   bool success = false;
   std::string error;
+  LoadStats stats;
+
+  // Scene graph in its rest pose, for skins and animations. Rigid meshes
+  // are flattened with their node's rest world matrix baked into the
+  // vertices (see bakesRestWorld()); skinned ones stay in bind space, as
+  // glTF ignores the transform of a skinned mesh's node.
+  std::vector<NodeData> nodes;
+  std::vector<SkinData> skins;
+  std::vector<AnimationData> animations;
 
   // Bounding box
   glm::vec3 minBounds = glm::vec3 (FLT_MAX);
   glm::vec3 maxBounds = glm::vec3 (-FLT_MAX);
+
+  // The SubMesh holding the vertices and indices of meshes[i]
+  const SubMesh &
+  geometry (size_t i) const
+  {
+    const int shared = meshes[i].sharedGeometry;
+    return shared >= 0 ? meshes[shared] : meshes[i];
+  }
+
+  // Something for Animator to play: skins, morph targets or clips
+  bool
+  animated () const
+  {
+    if (!skins.empty () || !animations.empty ())
+      return true;
+    for (const SubMesh &mesh : meshes)
+      if (!mesh.targets.empty ())
+        return true;
+    return false;
+  }
 };
 
+inline glm::vec4
+VertexAttribute::read (const unsigned char *vertex) const
+{
+  glm::vec4 value (0.0f, 0.0f, 0.0f, 1.0f);
+  const unsigned char *src = vertex + offset;
+  for (int c = 0; c < components; c++)
+    {
+      switch (type)
+        {
+        case ComponentByte:
+          {
+            int8_t v;
+            std::memcpy (&v, src + c, 1);
+            value[c] = normalized ? std::max (v / 127.0f, -1.0f) : v;
+            break;
+          }
+        case ComponentUnsignedByte:
+          value[c] = normalized ? src[c] / 255.0f : src[c];
+          break;
+        case ComponentShort:
+          {
+            int16_t v;
+            std::memcpy (&v, src + c * 2, 2);
+            value[c] = normalized ? std::max (v / 32767.0f, -1.0f) : v;
+            break;
+          }
+        case ComponentUnsignedShort:
+          {
+            uint16_t v;
+            std::memcpy (&v, src + c * 2, 2);
+            value[c] = normalized ? v / 65535.0f : v;
+            break;
+          }
+        case ComponentUnsignedInt:
+          {
+            uint32_t v;
+            std::memcpy (&v, src + c * 4, 4);
+            value[c] = normalized ? (float)(v / 4294967295.0) : (float)v;
+            break;
+          }
+        default:
+          std::memcpy (&value[c], src + c * 4, 4);
+          break;
+        }
+    }
+  return value;
+}
+
 #endif // MESHDATA_H
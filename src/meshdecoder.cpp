@@ -0,0 +1,469 @@
+#include "meshdecoder.h"
+#include "parallel.h"
+
+#include <tiny_gltf.h>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+#include <algorithm>
+#include <cstdint>
+#include <draco/compression/decode.h>
+#include <draco/core/decoder_buffer.h>
+#include <draco/mesh/mesh.h>
+#include <meshoptimizer.h>
+#include <memory>
+#include <vector>
+
+static const char *kMeshopt = "EXT_meshopt_compression";
+static const char *kDraco = "KHR_draco_mesh_compression";
+
+static size_t
+sizeMember (const tinygltf::Value &object, const char *key,
+            size_t fallback = 0)
+{
+  if (!object.Has (key) || !object.Get (key).IsNumber ())
+    return fallback;
+  return (size_t)object.Get (key).GetNumberAsDouble ();
+}
+
+static std::string
+stringMember (const tinygltf::Value &object, const char *key,
+              const std::string &fallback)
+{
+  if (!object.Has (key) || !object.Get (key).IsString ())
+    return fallback;
+  return object.Get (key).Get<std::string> ();
+}
+
+static bool
+isMeshoptFallback (const tinygltf::Buffer &buffer)
+{
+  auto ext = buffer.extensions.find (kMeshopt);
+  if (ext == buffer.extensions.end () || !ext->second.Has ("fallback"))
+    return false;
+  const tinygltf::Value &fallback = ext->second.Get ("fallback");
+  return fallback.IsBool () && fallback.Get<bool> ();
+}
+
+QByteArray
+MeshDecoder::prepareGlb (const QByteArray &glb)
+{
+  if (glb.size () < 20)
+    return glb;
+
+  const uchar *bytes = reinterpret_cast<const uchar *> (glb.constData ());
+  const quint32 jsonLength = qFromLittleEndian<quint32> (bytes + 12);
+  if (qFromLittleEndian<quint32> (bytes) != 0x46546C67
+      || qFromLittleEndian<quint32> (bytes + 16) != 0x4E4F534A
+      || 20 + (qsizetype)jsonLength > glb.size ())
+    return glb;
+
+  const QByteArray json = glb.mid (20, jsonLength);
+  if (!json.contains (kMeshopt))
+    return glb;
+
+  QJsonObject root = QJsonDocument::fromJson (json).object ();
+  QJsonArray buffers = root.value ("buffers").toArray ();
+  bool patched = false;
+  for (qsizetype i = 0; i < buffers.size (); i++)
+    {
+      QJsonObject buffer = buffers[i].toObject ();
+      const QJsonObject ext = buffer.value ("extensions")
+                                  .toObject ()
+                                  .value (kMeshopt)
+                                  .toObject ();
+      if (!ext.value ("fallback").toBool ())
+        continue;
+
+      // One byte of the BIN chunk; the contents are never read
+      buffer.remove ("uri");
+      buffer["byteLength"] = 1;
+      buffers[i] = buffer;
+      patched = true;
+    }
+  if (!patched)
+    return glb;
+  root["buffers"] = buffers;
+
+  QByteArray patchedJson
+      = QJsonDocument (root).toJson (QJsonDocument::Compact);
+  while (patchedJson.size () % 4 != 0)
+    patchedJson.append (' ');
+
+  // Header and JSON chunk are rebuilt, the BIN chunk is kept as is
+  const QByteArray rest = glb.mid (20 + jsonLength);
+  auto appendU32 = [] (QByteArray &out, quint32 value) {
+    quint32 le = qToLittleEndian (value);
+    out.append (reinterpret_cast<const char *> (&le), 4);
+  };
+
+  QByteArray out;
+  out.reserve (20 + patchedJson.size () + rest.size ());
+  out.append (glb.left (8));
+  appendU32 (out, (quint32)(20 + patchedJson.size () + rest.size ()));
+  appendU32 (out, (quint32)patchedJson.size ());
+  appendU32 (out, 0x4E4F534A);
+  out.append (patchedJson);
+  out.append (rest);
+  return out;
+}
+
+// One EXT_meshopt_compression buffer view
+struct MeshoptJob
+{
+  int view = -1;
+  const unsigned char *source = nullptr;
+  size_t sourceSize = 0;
+  unsigned char *target = nullptr;
+  size_t count = 0;
+  size_t stride = 0;
+  std::string mode;
+  std::string filter;
+  std::string error;
+};
+
+static void
+decodeMeshopt (MeshoptJob &job)
+{
+  int result = -1;
+  if (job.mode == "ATTRIBUTES")
+    result = meshopt_decodeVertexBuffer (job.target, job.count, job.stride,
+                                         job.source, job.sourceSize);
+  else if (job.mode == "TRIANGLES")
+    result = meshopt_decodeIndexBuffer (job.target, job.count, job.stride,
+                                        job.source, job.sourceSize);
+  else if (job.mode == "INDICES")
+    result = meshopt_decodeIndexSequence (job.target, job.count, job.stride,
+                                          job.source, job.sourceSize);
+  else
+    {
+      job.error = "unknown mode " + job.mode;
+      return;
+    }
+
+  if (result != 0)
+    {
+      job.error = "corrupt " + job.mode + " stream";
+      return;
+    }
+
+  if (job.filter == "OCTAHEDRAL")
+    meshopt_decodeFilterOct (job.target, job.count, job.stride);
+  else if (job.filter == "QUATERNION")
+    meshopt_decodeFilterQuat (job.target, job.count, job.stride);
+  else if (job.filter == "EXPONENTIAL")
+    meshopt_decodeFilterExp (job.target, job.count, job.stride);
+  else if (job.filter != "NONE")
+    job.error = "unknown filter " + job.filter;
+}
+
+// Collects the compressed views, sizes the fallback buffers and decodes
+// every view into its own byte range of them.
+static bool
+decodeMeshoptViews (tinygltf::Model &model, std::string *err,
+                    size_t *decodedBytes)
+{
+  std::vector<size_t> required (model.buffers.size (), 0);
+  for (const tinygltf::BufferView &view : model.bufferViews)
+    if (view.extensions.count (kMeshopt) && view.buffer >= 0
+        && (size_t)view.buffer < required.size ())
+      required[view.buffer] = std::max (required[view.buffer],
+                                        view.byteOffset + view.byteLength);
+
+  for (size_t b = 0; b < model.buffers.size (); b++)
+    {
+      tinygltf::Buffer &buffer = model.buffers[b];
+      if (isMeshoptFallback (buffer))
+        buffer.data.assign (required[b], 0);
+      else if (buffer.data.size () < required[b])
+        buffer.data.resize (required[b], 0);
+    }
+
+  std::vector<MeshoptJob> jobs;
+  for (size_t v = 0; v < model.bufferViews.size (); v++)
+    {
+      const tinygltf::BufferView &view = model.bufferViews[v];
+      auto ext = view.extensions.find (kMeshopt);
+      if (ext == view.extensions.end ())
+        continue;
+
+      const tinygltf::Value &params = ext->second;
+      const size_t sourceBuffer = sizeMember (params, "buffer", SIZE_MAX);
+      const size_t sourceOffset = sizeMember (params, "byteOffset");
+      const size_t sourceSize = sizeMember (params, "byteLength");
+
+      MeshoptJob job;
+      job.view = (int)v;
+      job.count = sizeMember (params, "count");
+      job.stride = sizeMember (params, "byteStride");
+      job.mode = stringMember (params, "mode", "");
+      job.filter = stringMember (params, "filter", "NONE");
+
+      if (sourceBuffer >= model.buffers.size () || view.buffer < 0
+          || (size_t)view.buffer >= model.buffers.size ()
+          || sourceOffset + sourceSize
+                 > model.buffers[sourceBuffer].data.size ()
+          || job.count * job.stride > view.byteLength)
+        {
+          if (err)
+            *err = "EXT_meshopt_compression: bufferView "
+                   + std::to_string (v) + " is out of range";
+          return false;
+        }
+
+      job.source = model.buffers[sourceBuffer].data.data () + sourceOffset;
+      job.sourceSize = sourceSize;
+      job.target = model.buffers[view.buffer].data.data () + view.byteOffset;
+      jobs.push_back (job);
+    }
+
+  parallelFor (jobs.size (), [&jobs] (size_t i) { decodeMeshopt (jobs[i]); });
+
+  for (const MeshoptJob &job : jobs)
+    {
+      if (!job.error.empty ())
+        {
+          if (err)
+            *err = "EXT_meshopt_compression: bufferView "
+                   + std::to_string (job.view) + ": " + job.error;
+          return false;
+        }
+      if (decodedBytes)
+        *decodedBytes += job.count * job.stride;
+    }
+  return true;
+}
+
+// One KHR_draco_mesh_compression primitive. Decoded attributes and indices
+// are packed into `data`; every stream becomes a buffer view afterwards.
+struct DracoJob
+{
+  struct Stream
+  {
+    int accessor = -1;
+    int uniqueId = -1; // -1 = indices
+    size_t offset = 0;
+    size_t size = 0;
+    size_t count = 0;
+  };
+
+  const unsigned char *source = nullptr;
+  size_t sourceSize = 0;
+  std::vector<Stream> streams;
+  std::vector<int> componentTypes; // Per stream, from the accessor
+  std::vector<int> components;
+  std::vector<unsigned char> data;
+  std::string error;
+};
+
+template <typename T>
+static void
+convertAttribute (const draco::Mesh &mesh,
+                  const draco::PointAttribute &attribute, int components,
+                  unsigned char *out)
+{
+  T *values = reinterpret_cast<T *> (out);
+  for (draco::PointIndex i (0); i < mesh.num_points (); ++i)
+    attribute.ConvertValue<T> (attribute.mapped_index (i),
+                               (int8_t)components,
+                               values + (size_t)i.value () * components);
+}
+
+static void
+decodeDraco (DracoJob &job)
+{
+  draco::DecoderBuffer buffer;
+  buffer.Init (reinterpret_cast<const char *> (job.source), job.sourceSize);
+  draco::Decoder decoder;
+  auto result = decoder.DecodeMeshFromBuffer (&buffer);
+  if (!result.ok ())
+    {
+      job.error = result.status ().error_msg_string ();
+      return;
+    }
+  std::unique_ptr<draco::Mesh> mesh = std::move (result).value ();
+
+  // 1. Layout: every stream 4-byte aligned
+  size_t offset = 0;
+  for (size_t s = 0; s < job.streams.size (); s++)
+    {
+      DracoJob::Stream &stream = job.streams[s];
+      if (stream.uniqueId < 0)
+        {
+          stream.count = (size_t)mesh->num_faces () * 3;
+          stream.size = stream.count * sizeof (uint32_t);
+        }
+      else
+        {
+          stream.count = mesh->num_points ();
+          stream.size
+              = stream.count * job.components[s]
+                * tinygltf::GetComponentSizeInBytes (job.componentTypes[s]);
+        }
+      stream.offset = offset;
+      offset += (stream.size + 3) & ~size_t (3);
+    }
+  job.data.assign (offset, 0);
+
+  // 2. Convert into the accessor's declared component type
+  for (size_t s = 0; s < job.streams.size (); s++)
+    {
+      const DracoJob::Stream &stream = job.streams[s];
+      unsigned char *out = job.data.data () + stream.offset;
+      if (stream.uniqueId < 0)
+        {
+          uint32_t *indices = reinterpret_cast<uint32_t *> (out);
+          for (draco::FaceIndex f (0); f < mesh->num_faces (); ++f)
+            for (int k = 0; k < 3; k++)
+              *indices++ = mesh->face (f)[k].value ();
+          continue;
+        }
+
+      const draco::PointAttribute *attribute
+          = mesh->GetAttributeByUniqueId ((uint32_t)stream.uniqueId);
+      if (!attribute)
+        {
+          job.error = "missing attribute " + std::to_string (stream.uniqueId);
+          return;
+        }
+
+      const int components = job.components[s];
+      switch (job.componentTypes[s])
+        {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+          convertAttribute<float> (*mesh, *attribute, components, out);
+          break;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+          convertAttribute<int8_t> (*mesh, *attribute, components, out);
+          break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+          convertAttribute<uint8_t> (*mesh, *attribute, components, out);
+          break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+          convertAttribute<int16_t> (*mesh, *attribute, components, out);
+          break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+          convertAttribute<uint16_t> (*mesh, *attribute, components, out);
+          break;
+        default:
+          convertAttribute<uint32_t> (*mesh, *attribute, components, out);
+          break;
+        }
+    }
+}
+
+static bool
+decodeDracoPrimitives (tinygltf::Model &model, std::string *err,
+                       size_t *decodedBytes)
+{
+  // 1. One job per compressed primitive
+  std::vector<DracoJob> jobs;
+  for (const tinygltf::Mesh &mesh : model.meshes)
+    for (const tinygltf::Primitive &primitive : mesh.primitives)
+      {
+        auto ext = primitive.extensions.find (kDraco);
+        if (ext == primitive.extensions.end ())
+          continue;
+
+        const tinygltf::Value &params = ext->second;
+        const size_t viewIndex
+            = sizeMember (params, "bufferView", SIZE_MAX);
+        if (viewIndex >= model.bufferViews.size ()
+            || !params.Has ("attributes"))
+          {
+            if (err)
+              *err = "KHR_draco_mesh_compression: invalid extension object";
+            return false;
+          }
+
+        const tinygltf::BufferView &view = model.bufferViews[viewIndex];
+        const tinygltf::Buffer &buffer = model.buffers[view.buffer];
+        if (view.byteOffset + view.byteLength > buffer.data.size ())
+          {
+            if (err)
+              *err = "KHR_draco_mesh_compression: bufferView out of range";
+            return false;
+          }
+
+        DracoJob job;
+        job.source = buffer.data.data () + view.byteOffset;
+        job.sourceSize = view.byteLength;
+
+        const tinygltf::Value &attributes = params.Get ("attributes");
+        for (const auto &[name, accessor] : primitive.attributes)
+          {
+            if (!attributes.Has (name)
+                || accessor >= (int)model.accessors.size ())
+              continue;
+            const tinygltf::Accessor &acc = model.accessors[accessor];
+            job.streams.push_back (
+                { accessor, attributes.Get (name).GetNumberAsInt () });
+            job.componentTypes.push_back (acc.componentType);
+            job.components.push_back (
+                tinygltf::GetNumComponentsInType (acc.type));
+          }
+        if (primitive.indices >= 0)
+          {
+            job.streams.push_back ({ primitive.indices, -1 });
+            job.componentTypes.push_back (
+                TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT);
+            job.components.push_back (1);
+          }
+        jobs.push_back (std::move (job));
+      }
+
+  if (jobs.empty ())
+    return true;
+
+  // 2. Decode in parallel
+  parallelFor (jobs.size (), [&jobs] (size_t i) { decodeDraco (jobs[i]); });
+
+  // 3. New buffer per primitive, accessors repointed at its views
+  for (DracoJob &job : jobs)
+    {
+      if (!job.error.empty ())
+        {
+          if (err)
+            *err = "KHR_draco_mesh_compression: " + job.error;
+          return false;
+        }
+
+      const int bufferIndex = (int)model.buffers.size ();
+      for (size_t s = 0; s < job.streams.size (); s++)
+        {
+          const DracoJob::Stream &stream = job.streams[s];
+          tinygltf::BufferView view;
+          view.buffer = bufferIndex;
+          view.byteOffset = stream.offset;
+          view.byteLength = stream.size;
+          model.bufferViews.push_back (view);
+
+          tinygltf::Accessor &acc = model.accessors[stream.accessor];
+          acc.bufferView = (int)model.bufferViews.size () - 1;
+          acc.byteOffset = 0;
+          acc.count = stream.count;
+          acc.componentType = job.componentTypes[s];
+        }
+
+      if (decodedBytes)
+        *decodedBytes += job.data.size ();
+      tinygltf::Buffer buffer;
+      buffer.data = std::move (job.data);
+      model.buffers.push_back (std::move (buffer));
+    }
+  return true;
+}
+
+bool
+MeshDecoder::decode (tinygltf::Model &model, std::string *err,
+                     size_t *decodedBytes)
+{
+  size_t bytes = 0;
+  const bool ok = decodeMeshoptViews (model, err, &bytes)
+                  && decodeDracoPrimitives (model, err, &bytes);
+  if (decodedBytes)
+    *decodedBytes = bytes;
+  return ok;
+}
@@ -0,0 +1,36 @@
+#ifndef MESHDECODER_H
+#define MESHDECODER_H
+
+#include <QByteArray>
+#include <string>
+
+namespace tinygltf
+{
+class Model;
+}
+
+// Loader-side decoding of compressed glTF geometry.
+//
+// EXT_meshopt_compression buffer views are decoded with meshoptimizer (SSE
+// or NEON paths picked at run time) into their fallback buffers, and
+// KHR_draco_mesh_compression primitives are decoded into fresh buffers with
+// their accessors pointed at the result. Afterwards the model looks like an
+// uncompressed file, so the assembly code never sees either extension.
+// Independent views and primitives are decoded in parallel on idle pool
+// threads.
+class MeshDecoder
+{
+public:
+  // tinygltf copies the BIN chunk into every buffer without a uri and
+  // rejects buffers longer than that chunk, which is exactly what meshopt
+  // fallback buffers are. Shrinks them to a placeholder; decode() sizes
+  // them again. Returns the input when the file uses no meshopt.
+  static QByteArray prepareGlb (const QByteArray &glb);
+
+  // Decodes everything in place. Returns false and fills err when a stream
+  // is malformed. decodedBytes receives the size of the produced data.
+  static bool decode (tinygltf::Model &model, std::string *err,
+                      size_t *decodedBytes = nullptr);
+};
+
+#endif // MESHDECODER_H
@@ -0,0 +1,103 @@
+#include "meshdiff.h"
+#include "meshbvh.h"
+#include "parallel.h"
+#include "tracer.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Vertices per pool task; queries within one run in order so each can be
+// bounded by the previous result
+constexpr size_t kVertexChunk = 4096;
+
+// Per-chunk totals, a cache line each so the workers do not share lines
+struct alignas (64) ChunkTotals
+{
+  double sum = 0.0;
+  float maximum = 0.0f;
+};
+
+DiffSide
+measure (const MeshBVH &from, const MeshBVH &to)
+{
+  DiffSide side;
+  const std::vector<glm::vec3> &positions = from.positions ();
+  side.distances.resize (positions.size ());
+
+  const size_t chunks = (positions.size () + kVertexChunk - 1) / kVertexChunk;
+  std::vector<ChunkTotals> totals (chunks);
+  parallelFor (chunks, [&] (size_t c) {
+    const size_t end = std::min (positions.size (), (c + 1) * kVertexChunk);
+    glm::vec3 previous (0.0f);
+    bool bounded = false;
+    double sum = 0.0;
+    float maximum = 0.0f;
+    for (size_t v = c * kVertexChunk; v < end; v++)
+      {
+        const glm::vec3 &p = positions[v];
+
+        // The previous closest point is a surface point too, so the
+        // answer is no farther than it (padded for rounding)
+        BvhHit hit;
+        if (bounded)
+          hit = to.closestPoint (
+              p, glm::length (p - previous) * 1.0001f + 1e-6f);
+        if (hit.mesh < 0)
+          hit = to.closestPoint (p);
+
+        bounded = hit.mesh >= 0;
+        previous = hit.point;
+        const float distance = bounded ? hit.distance : 0.0f;
+        side.distances[v] = distance;
+        sum += (double)distance * distance;
+        maximum = std::max (maximum, std::abs (distance));
+      }
+    totals[c].sum = sum;
+    totals[c].maximum = maximum;
+  });
+
+  double sum = 0.0;
+  for (const ChunkTotals &chunk : totals)
+    {
+      sum += chunk.sum;
+      side.maxDistance = std::max (side.maxDistance, chunk.maximum);
+    }
+  if (!positions.empty ())
+    side.rms = std::sqrt (sum / positions.size ());
+  return side;
+}
+} // namespace
+
+MeshDiffResult
+MeshDiff::compare (const MeshBVH &a, const MeshBVH &b)
+{
+  TRACE_SCOPE_CAT ("analysis", "MeshDiff::compare");
+  QElapsedTimer timer;
+  timer.start ();
+
+  // 1. Both directions; each spreads its vertices over the pool
+  MeshDiffResult result;
+  result.forward = measure (a, b);
+  result.backward = measure (b, a);
+  result.hausdorff
+      = std::max (result.forward.maxDistance, result.backward.maxDistance);
+
+  // 2. Per submesh of A, for the heatmap
+  for (size_t k = 0; k < a.meshCount (); k++)
+    {
+      const size_t mesh = (size_t)a.sceneMesh (k);
+      const size_t first = a.firstVertex (k);
+      const size_t end = k + 1 < a.meshCount () ? a.firstVertex (k + 1)
+                                                : a.positions ().size ();
+      if (result.heatmap.size () <= mesh)
+        result.heatmap.resize (mesh + 1);
+      result.heatmap[mesh].assign (result.forward.distances.begin () + first,
+                                   result.forward.distances.begin () + end);
+    }
+
+  result.diffMs = timer.nsecsElapsed () / 1.0e6;
+  return result;
+}
@@ -0,0 +1,42 @@
+#ifndef MESHDIFF_H
+#define MESHDIFF_H
+
+#include <vector>
+
+class MeshBVH;
+
+// Deviation of one model's vertices from the other model's surface.
+struct DiffSide
+{
+  std::vector<float> distances; // Signed, per MeshBVH::positions() vertex
+  float maxDistance = 0.0f;     // Largest |distance|
+  double rms = 0.0;
+};
+
+struct MeshDiffResult
+{
+  DiffSide forward;  // Vertices of A against the surface of B
+  DiffSide backward; // Vertices of B against the surface of A
+  float hausdorff = 0.0f; // Larger of the two maxima (symmetric)
+  double diffMs = 0.0;
+
+  // forward.distances split by SceneData::meshes index of A, for the
+  // heatmap. Empty for submeshes whose geometry lives in another one.
+  std::vector<std::vector<float>> heatmap;
+};
+
+// Geometric comparison of two revisions of a model, in model space.
+//
+// Every vertex of each model is projected onto the other model's surface
+// with a closest-point query on its BVH; the sign tells which side of the
+// closest triangle it lies on. Vertices are split into chunks on the pool,
+// and each query is bounded by the distance to the previous vertex's
+// closest point, which prunes most of the tree on connected meshes. Both
+// BVHs are only read and may be shared with picking.
+class MeshDiff
+{
+public:
+  static MeshDiffResult compare (const MeshBVH &a, const MeshBVH &b);
+};
+
+#endif // MESHDIFF_H
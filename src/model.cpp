@@ -1,15 +1,84 @@
 #include "model.h"
+#include "geometryprograms.h"
+#include "gltfloader.h"
+#include "profiler.h"
+#include "stagingring.h"
+#include "textureprocessor.h"
+#include "tracer.h"
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
-Model::Model () { initializeOpenGLFunctions (); }
+// Not every GL header ships the S3TC / RGTC / BPTC tokens
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+static unsigned int
+compressedFormat (unsigned int codec)
+{
+  switch (codec)
+    {
+    case CodecBC1:
+      return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case CodecBC4:
+      return GL_COMPRESSED_RED_RGTC1;
+    case CodecBC5:
+      return GL_COMPRESSED_RG_RGTC2;
+    default:
+      return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+// Streamed textures start at the first level no larger than this
+static const int kInitialSize = 128;
+
+// Streaming replacements uploading at once
+static const int kMaxInFlight = 4;
+
+static int
+initialLevel (const TextureData &texData)
+{
+  const int levels = (int)texData.levelOffsets.size ();
+  int level = 0;
+  while (level + 1 < levels
+         && std::max (texData.width >> level, texData.height >> level)
+                > kInitialSize)
+    level++;
+  return level;
+}
+
+Model::Model ()
+{
+  initializeOpenGLFunctions ();
+  m_clock.start ();
+}
 
 Model::~Model () { clear (); }
 
 void
 Model::clear ()
 {
+  clearDeviation ();
+  clearOcclusion ();
   for (auto &mesh : m_glMeshes)
     {
+      if (mesh.source >= 0)
+        continue; // Buffers belong to another mesh
       glDeleteVertexArrays (1, &mesh.vao);
       glDeleteBuffers (1, &mesh.vbo);
       glDeleteBuffers (1, &mesh.ebo);
@@ -18,10 +87,43 @@ Model::clear ()
 
   for (auto &tex : m_glTextures)
     {
-      if (tex.isValid)
+      if (tex.id)
         glDeleteTextures (1, &tex.id);
+      if (tex.pendingId)
+        glDeleteTextures (1, &tex.pendingId);
     }
   m_glTextures.clear ();
+  m_gpuMemoryBytes = 0;
+  m_transparentCount = 0;
+  m_drawOrder.clear ();
+
+  m_uploadJobs.clear ();
+  m_nextJob = 0;
+  m_pending = nullptr;
+  m_owned.reset ();
+  m_uploadMs = 0.0;
+
+  m_streamJobs.clear ();
+  m_nextStreamJob = 0;
+  m_reloads.clear (); // Decodes still running finish into their own copy
+  m_streamedCount = 0;
+  m_evictions = 0;
+  m_swaps = 0;
+  m_latencyMsTotal = 0.0;
+  m_latencyMsMax = 0.0;
+
+  for (GLsync &fence : m_feedbackFences)
+    {
+      if (fence)
+        glDeleteSync (fence);
+      fence = nullptr;
+    }
+  if (m_feedbackBuffers[0])
+    glDeleteBuffers (kFeedbackFrames, m_feedbackBuffers);
+  std::fill (std::begin (m_feedbackBuffers), std::end (m_feedbackBuffers),
+             0u);
+  m_feedbackSlot = 0;
+  m_feedbackActive = false;
 }
 
 void
@@ -31,50 +133,99 @@ Model::create (SceneData *data)
   if (!data)
     return;
 
-  // 1. Upload Textures
-  for (const auto &texData : data->textures)
-    {
-      GLTexture tex;
-      tex.isValid = false;
+  allocate (*data);
+  m_pending = data;
+  uploadStep (nullptr, std::numeric_limits<double>::infinity ());
+}
+
+void
+Model::beginUpload (std::shared_ptr<SceneData> data)
+{
+  clear ();
+  if (!data)
+    return;
 
+  m_owned = std::move (data);
+  m_pending = m_owned.get ();
+  allocate (*m_owned);
+}
+
+void
+Model::allocate (const SceneData &data)
+{
+  // 1. Textures: storage only, pixels follow in upload jobs. With owned
+  // data, textures that have a mip chain are streamed and start small.
+  std::vector<UploadJob> textureJobs;
+  for (size_t t = 0; t < data.textures.size (); t++)
+    {
+      const TextureData &texData = data.textures[t];
+      GLTexture tex = {};
       if (!texData.pixels.empty ())
         {
-          glGenTextures (1, &tex.id);
-          glBindTexture (GL_TEXTURE_2D, tex.id);
-
-          GLenum format = GL_RGBA;
+          tex.format = GL_RGBA;
           if (texData.components == 1)
-            format = GL_RED;
+            tex.format = GL_RED;
+          else if (texData.components == 2)
+            tex.format = GL_RG;
           else if (texData.components == 3)
-            format = GL_RGB;
-          else if (texData.components == 4)
-            format = GL_RGBA;
-
-          glTexImage2D (GL_TEXTURE_2D, 0, format, texData.width,
-                        texData.height, 0, format, GL_UNSIGNED_BYTE,
-                        texData.pixels.data ());
-          glGenerateMipmap (GL_TEXTURE_2D);
-
-          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                           GL_LINEAR_MIPMAP_LINEAR);
-          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-          tex.isValid = true;
+            tex.format = GL_RGB;
+          tex.compressed = texData.codec != 0;
+          if (tex.compressed)
+            tex.format = compressedFormat (texData.codec);
+          tex.gpuMips = texData.levelOffsets.empty ();
+          tex.streamed = m_owned && texData.levelOffsets.size () > 1;
+          if (tex.streamed)
+            {
+              tex.baseLevel = initialLevel (texData);
+              tex.log2Size = std::log2 (
+                  (float)std::max (texData.width, texData.height));
+              m_streamedCount++;
+            }
         }
       m_glTextures.push_back (tex);
+
+      if (!texData.pixels.empty ())
+        {
+          m_glTextures[t].id
+              = createTexture ((int)t, texData, tex.baseLevel, textureJobs);
+          m_gpuMemoryBytes
+              += TextureProcessor::memoryBytes (texData, tex.baseLevel);
+        }
     }
 
   // 2. Upload Materials
-  m_materials = data->materials;
+  m_materials = data.materials;
 
-  // 3. Upload Meshes
-  for (const auto &subMesh : data->meshes)
+  // 3. Meshes: buffers are sized now and filled by upload jobs
+  for (size_t m = 0; m < data.meshes.size (); m++)
     {
+      const SubMesh &subMesh = data.meshes[m];
+      const SubMesh &geometry = data.geometry (m);
       GLMesh mesh;
-      mesh.indexCount = (unsigned int)subMesh.indices.size ();
+      mesh.indexCount = (unsigned int)geometry.indices.size ();
       mesh.materialIndex = subMesh.materialIndex;
+      // Fallback material until textures arrive (textures are not valid
+      // yet, so only the alpha mode counts)
+      mesh.features = materialFeatures (mesh.materialIndex);
+      mesh.ready = false;
+      mesh.transparent
+          = mesh.materialIndex >= 0
+            && mesh.materialIndex < (int)m_materials.size ()
+            && m_materials[mesh.materialIndex].alphaMode == AlphaBlend;
+      if (mesh.transparent)
+        m_transparentCount++;
+      mesh.source = subMesh.sharedGeometry;
+
+      if (mesh.source >= 0)
+        {
+          // Deduplicated: draw from the source's buffers, no upload
+          const GLMesh &source = m_glMeshes[mesh.source];
+          mesh.vao = source.vao;
+          mesh.vbo = source.vbo;
+          mesh.ebo = source.ebo;
+          m_glMeshes.push_back (mesh);
+          continue;
+        }
 
       glGenVertexArrays (1, &mesh.vao);
       glGenBuffers (1, &mesh.vbo);
@@ -82,112 +233,1065 @@ Model::create (SceneData *data)
 
       glBindVertexArray (mesh.vao);
 
+      const size_t vertexBytes = subMesh.vertexData.size ();
+      const size_t indexBytes
+          = subMesh.indices.size () * sizeof (unsigned int);
+
       glBindBuffer (GL_ARRAY_BUFFER, mesh.vbo);
-      glBufferData (GL_ARRAY_BUFFER,
-                    subMesh.vertices.size () * sizeof (Vertex),
-                    subMesh.vertices.data (), GL_STATIC_DRAW);
+      glBufferData (GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
 
       glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-      glBufferData (GL_ELEMENT_ARRAY_BUFFER,
-                    subMesh.indices.size () * sizeof (unsigned int),
-                    subMesh.indices.data (), GL_STATIC_DRAW);
-
-      // Pos
-      glEnableVertexAttribArray (0);
-      glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (Vertex),
-                             (void *)0);
-      // Norm
-      glEnableVertexAttribArray (1);
-      glVertexAttribPointer (1, 3, GL_FLOAT, GL_FALSE, sizeof (Vertex),
-                             (void *)offsetof (Vertex, normal));
-      // Tex
-      glEnableVertexAttribArray (2);
-      glVertexAttribPointer (2, 2, GL_FLOAT, GL_FALSE, sizeof (Vertex),
-                             (void *)offsetof (Vertex, texCoords));
+      glBufferData (GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr,
+                    GL_STATIC_DRAW);
+
+      m_gpuMemoryBytes += vertexBytes + indexBytes;
+
+      // Pos, Norm, Tex, Tangent in whatever formats the file stored them
+      const VertexLayout &layout = subMesh.layout;
+      const VertexAttribute *attributes[]
+          = { &layout.position, &layout.normal, &layout.texCoords,
+              &layout.tangent };
+      for (GLuint a = 0; a < 4; a++)
+        {
+          const VertexAttribute &attribute = *attributes[a];
+          if (attribute.components == 0)
+            continue;
+          glEnableVertexAttribArray (a);
+          glVertexAttribPointer (a, attribute.components,
+                                 (GLenum)attribute.type,
+                                 attribute.normalized ? GL_TRUE : GL_FALSE,
+                                 (GLsizei)layout.stride,
+                                 (void *)(uintptr_t)attribute.offset);
+        }
 
       glBindVertexArray (0);
       m_glMeshes.push_back (mesh);
+
+      UploadJob vertices;
+      vertices.object = mesh.vbo;
+      vertices.src = subMesh.vertexData.data ();
+      vertices.size = vertexBytes;
+      m_uploadJobs.push_back (vertices);
+
+      UploadJob indices;
+      indices.mesh = (int)m;
+      indices.object = mesh.ebo;
+      indices.src
+          = reinterpret_cast<const unsigned char *> (subMesh.indices.data ());
+      indices.size = indexBytes;
+      m_uploadJobs.push_back (indices);
     }
+
+  // Geometry first so the model shows up early, textures after
+  m_uploadJobs.insert (m_uploadJobs.end (), textureJobs.begin (),
+                       textureJobs.end ());
 }
 
-void
-Model::draw (QOpenGLShaderProgram *shader, const RenderConfig &config)
+unsigned int
+Model::createTexture (int texture, const TextureData &texData, int base,
+                      std::vector<UploadJob> &jobs)
 {
-  // Set UI Toggles
-  shader->setUniformValue ("uUseBaseColorMap", config.useBaseColorMap);
-  shader->setUniformValue ("uUseMetallicMap", config.useMetallicMap);
-  shader->setUniformValue ("uUseRoughnessMap", config.useRoughnessMap);
-  shader->setUniformValue ("uUseNormalMap", config.useNormalMap);
+  const GLTexture &tex = m_glTextures[texture];
+  unsigned int id = 0;
+  glGenTextures (1, &id);
+  glBindTexture (GL_TEXTURE_2D, id);
+
+  const int width = std::max (1, texData.width >> base);
+  const int height = std::max (1, texData.height >> base);
+  const int levels
+      = tex.gpuMips ? 1 : (int)texData.levelOffsets.size () - base;
+
+  if (tex.gpuMips)
+    {
+      glTexImage2D (GL_TEXTURE_2D, 0, tex.format, width, height, 0,
+                    tex.format, GL_UNSIGNED_BYTE, nullptr);
+    }
+  else
+    {
+      // Chain from the loader: immutable storage, no glGenerateMipmap
+      unsigned int internalFormat = GL_RGBA8;
+      if (tex.compressed)
+        internalFormat = tex.format;
+      else if (tex.format == GL_RED)
+        internalFormat = GL_R8;
+      else if (tex.format == GL_RG)
+        internalFormat = GL_RG8;
+      else if (tex.format == GL_RGB)
+        internalFormat = GL_RGB8;
+      glTexStorage2D (GL_TEXTURE_2D, levels, internalFormat, width, height);
+    }
 
-  // Set Sampler Units once (assuming specific slots)
-  // 0 = BaseColor, 1 = MetalRough, 2 = Normal
-  shader->setUniformValue ("texture_baseColor", 0);
-  shader->setUniformValue ("texture_metallicRoughness", 1);
-  shader->setUniformValue ("texture_normal", 2);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                   GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  for (const auto &mesh : m_glMeshes)
+  // BC5 metallic-roughness holds roughness in R and metal in G; the shader
+  // keeps reading the glTF G/B layout.
+  if (texData.codec == CodecBC5 && texData.usage == UsageMetallicRoughness)
     {
-      // FIX: Change default Metallic to 0.0 (Plastic) instead of 1.0 (Metal).
-      // This ensures objects without explicit material data are visible
-      // (Diffuse works).
-      shader->setUniformValue ("uBaseColorFactor", 1.0f, 1.0f, 1.0f, 1.0f);
-      shader->setUniformValue ("uMetallicFactor", 0.0f);  // Was 1.0f
-      shader->setUniformValue ("uRoughnessFactor", 1.0f); // Matte
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_GREEN);
+    }
 
-      // Defaults if no material
-      shader->setUniformValue ("uBaseColorFactor", 1.0f, 1.0f, 1.0f, 1.0f);
-      shader->setUniformValue ("uMetallicFactor", 1.0f);
-      shader->setUniformValue ("uRoughnessFactor", 1.0f);
-      shader->setUniformValue ("uHasBaseColorMap", false);
-      shader->setUniformValue ("uHasMetallicRoughnessMap", false);
-      shader->setUniformValue ("uHasNormalMap", false);
+  // One job per level, rows of texels or of 4x4 blocks. Levels before
+  // firstLevel are no longer in pixels.
+  const size_t dropped
+      = tex.gpuMips ? 0 : texData.levelOffsets[texData.firstLevel];
+  int levelWidth = width;
+  int levelHeight = height;
+  for (int level = 0; level < levels; level++)
+    {
+      const int source = base + level;
+      const size_t begin
+          = tex.gpuMips ? 0 : texData.levelOffsets[source] - dropped;
+      const size_t end = source + 1 < (int)texData.levelOffsets.size ()
+                             ? texData.levelOffsets[source + 1] - dropped
+                             : texData.pixels.size ();
 
-      if (mesh.materialIndex >= 0 && mesh.materialIndex < m_materials.size ())
+      UploadJob job;
+      job.texture = texture;
+      job.object = id;
+      job.level = level;
+      job.src = texData.pixels.data () + begin;
+      job.size = end - begin;
+      job.width = levelWidth;
+      job.height = levelHeight;
+      job.last = level + 1 == levels;
+      if (tex.compressed)
         {
-          const MaterialData &mat = m_materials[mesh.materialIndex];
+          job.rowHeight = 4;
+          job.rowBytes = job.size / ((levelHeight + 3) / 4);
+        }
+      else
+        {
+          job.rowBytes = (size_t)levelWidth * texData.components;
+        }
+      jobs.push_back (job);
 
-          // Factors
-          shader->setUniformValue (
-              "uBaseColorFactor", mat.baseColorFactor.x, mat.baseColorFactor.y,
-              mat.baseColorFactor.z, mat.baseColorFactor.w);
-          shader->setUniformValue ("uMetallicFactor", mat.metallicFactor);
-          shader->setUniformValue ("uRoughnessFactor", mat.roughnessFactor);
+      levelWidth = std::max (1, levelWidth / 2);
+      levelHeight = std::max (1, levelHeight / 2);
+    }
+  return id;
+}
 
-          // Bind Textures
-          // Base Color
-          if (mat.baseColorIndex >= 0
-              && mat.baseColorIndex < m_glTextures.size ()
-              && m_glTextures[mat.baseColorIndex].isValid)
+bool
+Model::uploadStep (StagingRing *ring, double budgetMs)
+{
+  if (!uploadPending ())
+    return false;
+
+  QElapsedTimer timer;
+  timer.start ();
+  const bool finished = runJobs (m_uploadJobs, m_nextJob, ring, budgetMs);
+  m_uploadMs += timer.nsecsElapsed () / 1.0e6;
+  TRACE_COUNTER ("Upload Jobs Left",
+                 (double)(m_uploadJobs.size () - m_nextJob));
+
+  if (finished)
+    {
+      m_pending = nullptr;
+      if (m_owned && !streaming ())
+        {
+          m_owned.reset ();
+        }
+      else if (m_owned && m_owned.use_count () == 1)
+        {
+          // Only the texture chains are needed from here on
+          for (SubMesh &mesh : m_owned->meshes)
             {
-              glActiveTexture (GL_TEXTURE0);
-              glBindTexture (GL_TEXTURE_2D,
-                             m_glTextures[mat.baseColorIndex].id);
-              shader->setUniformValue ("uHasBaseColorMap", true);
+              std::vector<unsigned char> ().swap (mesh.vertexData);
+              std::vector<unsigned int> ().swap (mesh.indices);
+              std::vector<MorphTarget> ().swap (mesh.targets);
             }
+        }
+    }
+  return uploadPending ();
+}
+
+// Runs jobs in order until budgetMs is spent or the staging ring is full.
+// Returns true (and empties the list) once every job is done.
+bool
+Model::runJobs (std::vector<UploadJob> &jobs, size_t &next,
+                StagingRing *ring, double budgetMs)
+{
+  QElapsedTimer timer;
+  timer.start ();
+
+  // Texture rows are tightly packed
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+  while (next < jobs.size ())
+    {
+      UploadJob &job = jobs[next];
+      if (job.done < job.size && !uploadChunk (job, ring))
+        break; // Staging ring full, continue next frame
+
+      if (job.done >= job.size)
+        {
+          finishJob (job);
+          next++;
+        }
+
+      if (timer.nsecsElapsed () / 1.0e6 >= budgetMs)
+        break;
+    }
+
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+
+  if (next < jobs.size ())
+    return false;
+  jobs.clear ();
+  next = 0;
+  return true;
+}
+
+bool
+Model::uploadChunk (UploadJob &job, StagingRing *ring)
+{
+  TRACE_SCOPE_CAT ("upload",
+                   job.texture >= 0 ? "Texture Chunk" : "Buffer Chunk");
+  size_t bytes = job.size - job.done;
+  if (ring)
+    bytes = std::min (bytes, StagingRing::kSlotBytes);
+  if (job.texture >= 0)
+    bytes = std::max<size_t> (1, bytes / job.rowBytes) * job.rowBytes;
+
+  // Rows wider than a staging slot go straight from client memory
+  const bool staged = ring && bytes <= StagingRing::kSlotBytes;
+  const unsigned char *source = job.src + job.done;
+  unsigned int staging = 0;
+
+  if (staged)
+    {
+      void *dst = ring->map ();
+      if (!dst)
+        return false;
+      std::memcpy (dst, source, bytes);
+      staging = ring->unmap ();
+      source = nullptr; // Offset 0 into the staging buffer
+    }
+
+  if (job.texture >= 0)
+    {
+      const GLTexture &tex = m_glTextures[job.texture];
+      // The last block row may extend past the level's edge
+      const int y = (int)(job.done / job.rowBytes) * job.rowHeight;
+      const int rows = std::min ((int)(bytes / job.rowBytes) * job.rowHeight,
+                                 job.height - y);
+
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, staging);
+      glBindTexture (GL_TEXTURE_2D, job.object);
+      if (tex.compressed)
+        glCompressedTexSubImage2D (GL_TEXTURE_2D, job.level, 0, y,
+                                   job.width, rows, tex.format,
+                                   (GLsizei)bytes, source);
+      else
+        glTexSubImage2D (GL_TEXTURE_2D, job.level, 0, y, job.width, rows,
+                         tex.format, GL_UNSIGNED_BYTE, source);
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+  else
+    {
+      // COPY_WRITE leaves the VAO's element buffer binding alone
+      glBindBuffer (GL_COPY_WRITE_BUFFER, job.object);
+      if (staged)
+        {
+          glBindBuffer (GL_COPY_READ_BUFFER, staging);
+          glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                               (GLintptr)job.done, (GLsizeiptr)bytes);
+          glBindBuffer (GL_COPY_READ_BUFFER, 0);
+        }
+      else
+        {
+          glBufferSubData (GL_COPY_WRITE_BUFFER, (GLintptr)job.done,
+                           (GLsizeiptr)bytes, source);
+        }
+      glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+    }
+
+  if (staged)
+    ring->fence ();
+
+  job.done += bytes;
+  return true;
+}
+
+void
+Model::finishJob (const UploadJob &job)
+{
+  if (job.mesh >= 0)
+    {
+      // Index buffer is the last job of a mesh; copies sharing its
+      // buffers become drawable with it
+      m_glMeshes[job.mesh].ready = true;
+      for (GLMesh &mesh : m_glMeshes)
+        if (mesh.source == job.mesh)
+          mesh.ready = true;
+    }
+  else if (job.texture >= 0)
+    {
+      GLTexture &tex = m_glTextures[job.texture];
+      if (!job.last)
+        return; // More levels to come
+
+      if (tex.pendingId && job.object == tex.pendingId)
+        {
+          // Streamed replacement complete: swap and free the old levels
+          const TextureData &texData = m_owned->textures[job.texture];
+          glDeleteTextures (1, &tex.id);
+          m_gpuMemoryBytes
+              -= TextureProcessor::memoryBytes (texData, tex.baseLevel);
+          tex.id = tex.pendingId;
+          tex.baseLevel = tex.pendingBase;
+          tex.pendingId = 0;
+
+          // Reloaded levels are in VRAM now, their copy can go
+          m_reloads.erase (
+              std::remove_if (m_reloads.begin (), m_reloads.end (),
+                              [&] (const std::shared_ptr<TextureReload> &r) {
+                                return r->texture == job.texture;
+                              }),
+              m_reloads.end ());
+
+          const double latencyMs
+              = (m_clock.nsecsElapsed () - tex.requestNs) / 1.0e6;
+          m_swaps++;
+          m_latencyMsTotal += latencyMs;
+          m_latencyMsMax = std::max (m_latencyMsMax, latencyMs);
+          return;
+        }
+
+      if (tex.gpuMips)
+        {
+          glBindTexture (GL_TEXTURE_2D, tex.id);
+          glGenerateMipmap (GL_TEXTURE_2D);
+        }
+      tex.isValid = true;
 
-          // Metallic Roughness
-          if (mat.metallicRoughnessIndex >= 0
-              && mat.metallicRoughnessIndex < m_glTextures.size ()
-              && m_glTextures[mat.metallicRoughnessIndex].isValid)
+      // Streamed: keep only the levels just uploaded when the finer ones
+      // can be decoded from the image again
+      if (tex.streamed && !m_owned->textures[job.texture].encoded.empty ())
+        {
+          TextureData &texData = m_owned->textures[job.texture];
+          const size_t offset = texData.levelOffsets[tex.baseLevel];
+          std::vector<unsigned char> (texData.pixels.begin () + offset,
+                                      texData.pixels.end ())
+              .swap (texData.pixels);
+          texData.firstLevel = tex.baseLevel;
+        }
+
+      // Meshes leave the fallback material once their textures arrive
+      for (auto &mesh : m_glMeshes)
+        mesh.features = materialFeatures (mesh.materialIndex);
+      m_drawOrderMask = ~0u;
+    }
+}
+
+void
+Model::updateStreaming (size_t budgetBytes)
+{
+  // Streaming starts once every texture has its initial levels
+  if (!streaming () || uploadPending ())
+    return;
+
+  m_frame++;
+  m_budgetBytes = budgetBytes;
+  collectReloads ();
+
+  // 1. Feedback: the finest level the draws of a few frames ago sampled
+  // of each texture. Nothing to act on until it has been read back.
+  std::vector<int> wanted;
+  if (!readFeedback (wanted))
+    return;
+  const std::vector<TextureData> &source = m_owned->textures;
+  for (size_t t = 0; t < m_glTextures.size (); t++)
+    if (wanted[t] != INT_MAX)
+      m_glTextures[t].lastUsed = m_frame;
+
+  // 2. Budget is checked against committed residency, i.e. the levels a
+  // texture will hold once its pending replacement lands.
+  auto pending = [this] (int t) {
+    return m_glTextures[t].pendingId || m_glTextures[t].loading;
+  };
+  size_t committed = 0;
+  int inFlight = 0;
+  for (size_t t = 0; t < m_glTextures.size (); t++)
+    {
+      const GLTexture &tex = m_glTextures[t];
+      if (!tex.streamed)
+        continue;
+      committed += TextureProcessor::memoryBytes (
+          source[t], pending ((int)t) ? tex.pendingBase : tex.baseLevel);
+      if (pending ((int)t))
+        inFlight++;
+    }
+  if (m_budgetBytes && committed > m_budgetBytes)
+    committed -= evict (committed - m_budgetBytes, -1, wanted);
+
+  // 3. Raise residency, most under-resolved textures first
+  std::vector<int> requests;
+  for (size_t t = 0; t < m_glTextures.size (); t++)
+    {
+      const GLTexture &tex = m_glTextures[t];
+      if (tex.streamed && tex.isValid && !pending ((int)t)
+          && wanted[t] < tex.baseLevel)
+        requests.push_back ((int)t);
+    }
+  std::sort (requests.begin (), requests.end (), [&] (int a, int b) {
+    return m_glTextures[a].baseLevel - wanted[a]
+           > m_glTextures[b].baseLevel - wanted[b];
+  });
+
+  for (int t : requests)
+    {
+      if (inFlight >= kMaxInFlight)
+        break;
+
+      const GLTexture &tex = m_glTextures[t];
+      const size_t current
+          = TextureProcessor::memoryBytes (source[t], tex.baseLevel);
+      int base = wanted[t];
+      size_t growth
+          = TextureProcessor::memoryBytes (source[t], base) - current;
+
+      if (m_budgetBytes && committed + growth > m_budgetBytes)
+        committed -= evict (committed + growth - m_budgetBytes, t, wanted);
+
+      // Settle for a coarser level when eviction did not free enough
+      while (m_budgetBytes && base < tex.baseLevel
+             && committed + growth > m_budgetBytes)
+        {
+          base++;
+          growth = TextureProcessor::memoryBytes (source[t], base) - current;
+        }
+      if (base >= tex.baseLevel)
+        continue;
+
+      requestLevel (t, base);
+      committed += growth;
+      inFlight++;
+    }
+}
+
+// Drops levels from the least recently used textures until `bytes` are
+// freed: textures seen this frame down to the level they need, others down
+// to their initial level. Returns the bytes that will be freed.
+size_t
+Model::evict (size_t bytes, int keep, const std::vector<int> &wanted)
+{
+  const std::vector<TextureData> &source = m_owned->textures;
+  auto floorLevel = [&] (int t) {
+    const int initial = initialLevel (source[t]);
+    if (m_glTextures[t].lastUsed == m_frame)
+      return std::min (wanted[t], initial);
+    return initial;
+  };
+
+  std::vector<int> victims;
+  for (size_t t = 0; t < m_glTextures.size (); t++)
+    {
+      const GLTexture &tex = m_glTextures[t];
+      if ((int)t != keep && tex.streamed && tex.isValid && !tex.pendingId
+          && !tex.loading && tex.baseLevel < floorLevel ((int)t))
+        victims.push_back ((int)t);
+    }
+  std::sort (victims.begin (), victims.end (), [this] (int a, int b) {
+    return m_glTextures[a].lastUsed < m_glTextures[b].lastUsed;
+  });
+
+  size_t freed = 0;
+  for (int t : victims)
+    {
+      if (freed >= bytes)
+        break;
+      const int base = floorLevel (t);
+      freed += TextureProcessor::memoryBytes (source[t],
+                                              m_glTextures[t].baseLevel)
+               - TextureProcessor::memoryBytes (source[t], base);
+      requestLevel (t, base);
+      m_evictions++;
+    }
+  return freed;
+}
+
+void
+Model::requestLevel (int texture, int base)
+{
+  GLTexture &tex = m_glTextures[texture];
+  const TextureData &texData = m_owned->textures[texture];
+  tex.requestNs = m_clock.nsecsElapsed ();
+  if (base >= texData.firstLevel)
+    {
+      replaceTexture (texture, texData, base);
+      return;
+    }
+
+  // Finer than what is kept: the image is decoded and its chain rebuilt
+  // on the pool, collectReloads() uploads it
+  tex.pendingBase = base;
+  tex.loading = true;
+  auto reload = std::make_shared<TextureReload> ();
+  reload->texture = texture;
+  reload->base = base;
+  m_reloads.push_back (reload);
+
+  std::shared_ptr<const SceneData> scene = m_owned;
+  QThreadPool::globalInstance ()->start ([reload, scene] () {
+    TRACE_SCOPE_CAT ("upload", "Texture Reload");
+    const TextureData &source = scene->textures[reload->texture];
+    TextureData &chain = reload->chain;
+    chain.usage = source.usage;
+    if (GLTFLoader::decodeImage (source.encoded, &chain))
+      TextureProcessor::process (chain, source.codec);
+    reload->ready.store (true, std::memory_order_release);
+  });
+}
+
+void
+Model::replaceTexture (int texture, const TextureData &texData, int base)
+{
+  GLTexture &tex = m_glTextures[texture];
+  tex.pendingBase = base;
+  tex.pendingId = createTexture (texture, texData, base, m_streamJobs);
+  m_gpuMemoryBytes += TextureProcessor::memoryBytes (texData, base);
+}
+
+void
+Model::collectReloads ()
+{
+  for (size_t i = 0; i < m_reloads.size ();)
+    {
+      const std::shared_ptr<TextureReload> reload = m_reloads[i];
+      GLTexture &tex = m_glTextures[reload->texture];
+      if (!tex.loading
+          || !reload->ready.load (std::memory_order_acquire))
+        {
+          i++; // Uploading, or still decoding
+          continue;
+        }
+
+      tex.loading = false;
+      TextureData &source = m_owned->textures[reload->texture];
+      const TextureData &chain = reload->chain;
+      if (chain.width == source.width && chain.height == source.height
+          && chain.components == source.components
+          && chain.codec == source.codec
+          && chain.levelOffsets.size () == source.levelOffsets.size ())
+        {
+          replaceTexture (reload->texture, chain, reload->base);
+          i++;
+          continue;
+        }
+
+      // Not the image it was loaded from: stay with the kept levels
+      qWarning () << "Texture streaming: cannot decode"
+                  << QString::fromStdString (source.name) << "again";
+      std::vector<unsigned char> ().swap (source.encoded);
+      m_reloads.erase (m_reloads.begin () + i);
+    }
+}
+
+int
+Model::finestLevel (int texture) const
+{
+  const TextureData &texData = m_owned->textures[texture];
+  return texData.encoded.empty () ? texData.firstLevel : 0;
+}
+
+bool
+Model::readFeedback (std::vector<int> &wanted)
+{
+  const size_t bytes = m_glTextures.size () * sizeof (GLuint);
+  if (!m_feedbackBuffers[0])
+    {
+      glGenBuffers (kFeedbackFrames, m_feedbackBuffers);
+      for (unsigned int buffer : m_feedbackBuffers)
+        {
+          glBindBuffer (GL_COPY_READ_BUFFER, buffer);
+          glBufferData (GL_COPY_READ_BUFFER, bytes, nullptr, GL_DYNAMIC_READ);
+        }
+    }
+
+  // 1. The last frame's draws are all queued: fence their buffer. Shader
+  // writes reach a mapping only after the barrier.
+  if (m_feedbackActive)
+    {
+      glMemoryBarrier (GL_BUFFER_UPDATE_BARRIER_BIT);
+      m_feedbackFences[m_feedbackSlot]
+          = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      m_feedbackSlot = (m_feedbackSlot + 1) % kFeedbackFrames;
+      m_feedbackActive = false;
+    }
+
+  // 2. The oldest buffer, unless the GPU has not got through it yet; then
+  // it is kept and this frame writes no feedback
+  GLsync &fence = m_feedbackFences[m_feedbackSlot];
+  bool fresh = false;
+  glBindBuffer (GL_COPY_READ_BUFFER, m_feedbackBuffers[m_feedbackSlot]);
+  if (fence)
+    {
+      if (glClientWaitSync (fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+          glBindBuffer (GL_COPY_READ_BUFFER, 0);
+          return false;
+        }
+      glDeleteSync (fence);
+      fence = nullptr;
+
+      const GLuint *levels = static_cast<const GLuint *> (
+          glMapBufferRange (GL_COPY_READ_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+      if (levels)
+        {
+          wanted.assign (m_glTextures.size (), INT_MAX);
+          for (size_t t = 0; t < m_glTextures.size (); t++)
             {
-              glActiveTexture (GL_TEXTURE1);
-              glBindTexture (GL_TEXTURE_2D,
-                             m_glTextures[mat.metallicRoughnessIndex].id);
-              shader->setUniformValue ("uHasMetallicRoughnessMap", true);
+              if (levels[t] == UINT_MAX || !m_glTextures[t].streamed)
+                continue;
+              const int coarsest
+                  = (int)m_owned->textures[t].levelOffsets.size () - 1;
+              wanted[t] = std::clamp ((int)std::min<GLuint> (levels[t], 32),
+                                      finestLevel ((int)t), coarsest);
             }
+          glUnmapBuffer (GL_COPY_READ_BUFFER);
+          fresh = true;
+        }
+    }
+
+  // 3. Reset for this frame's draws: no texture sampled yet
+  const std::vector<GLuint> unseen (m_glTextures.size (), UINT_MAX);
+  glBufferSubData (GL_COPY_READ_BUFFER, 0, bytes, unseen.data ());
+  glBindBuffer (GL_COPY_READ_BUFFER, 0);
+  m_feedbackActive = true;
+  return fresh;
+}
+
+void
+Model::streamStep (StagingRing *ring, double budgetMs)
+{
+  if (!m_streamJobs.empty ())
+    runJobs (m_streamJobs, m_nextStreamJob, ring, budgetMs);
+}
+
+TextureStreamingStats
+Model::streamingStats () const
+{
+  TextureStreamingStats stats;
+  stats.budgetBytes = m_budgetBytes;
+  stats.evictions = m_evictions;
+  stats.latencyMsMax = m_latencyMsMax;
+  if (m_swaps > 0)
+    stats.latencyMsAvg = m_latencyMsTotal / m_swaps;
+  if (!m_owned)
+    return stats;
+
+  for (size_t t = 0; t < m_glTextures.size (); t++)
+    {
+      const GLTexture &tex = m_glTextures[t];
+      if (!tex.streamed)
+        continue;
+      const TextureData &texData = m_owned->textures[t];
+      stats.streamedTextures++;
+      stats.residentBytes
+          += TextureProcessor::memoryBytes (texData, tex.baseLevel);
+      if (tex.pendingId)
+        {
+          stats.pendingRequests++;
+          stats.residentBytes
+              += TextureProcessor::memoryBytes (texData, tex.pendingBase);
+        }
+      else if (tex.loading)
+        {
+          stats.pendingRequests++;
+        }
+      else if (tex.baseLevel == 0)
+        {
+          stats.fullyResident++;
+        }
+    }
+  return stats;
+}
+
+unsigned int
+Model::materialFeatures (int materialIndex) const
+{
+  if (materialIndex < 0 || materialIndex >= (int)m_materials.size ())
+    return 0;
+
+  auto valid = [this] (int index) {
+    return index >= 0 && index < (int)m_glTextures.size ()
+           && m_glTextures[index].isValid;
+  };
+
+  const MaterialData &mat = m_materials[materialIndex];
+  unsigned int features = 0;
+  if (valid (mat.baseColorIndex))
+    features |= FeatureBaseColorMap;
+  if (valid (mat.metallicRoughnessIndex))
+    features |= FeatureMetallicMap | FeatureRoughnessMap;
+  if (valid (mat.normalIndex))
+    features |= FeatureNormalMap;
+  if (mat.alphaMode == AlphaMask)
+    features |= FeatureAlphaMask;
+  return features;
+}
+
+unsigned int
+Model::viewFeatures (const RenderConfig &config) const
+{
+  unsigned int features
+      = config.derivativeTangents ? FeatureDerivativeTangents : 0;
+  if (showsDeviation ())
+    features |= FeatureHeatmap;
+  if (showsOcclusion ())
+    features |= FeatureOcclusion;
+  return features;
+}
+
+void
+Model::draw (GeometryPrograms *programs, const RenderConfig &config,
+             Profiler *profiler)
+{
+  const unsigned int mask = featureMask (config);
+
+  // Group meshes by effective variant so each program is bound once. The
+  // order only changes with the UI toggles.
+  if (m_drawOrder.size () != m_glMeshes.size () || mask != m_drawOrderMask)
+    {
+      m_drawOrder.resize (m_glMeshes.size ());
+      for (size_t i = 0; i < m_drawOrder.size (); i++)
+        m_drawOrder[i] = i;
+      std::stable_sort (m_drawOrder.begin (), m_drawOrder.end (),
+                        [this, mask] (size_t a, size_t b) {
+                          return (m_glMeshes[a].features & mask)
+                                 < (m_glMeshes[b].features & mask);
+                        });
+      m_drawOrderMask = mask;
+    }
+
+  const GeometryProgram *current = nullptr;
+  unsigned int currentFeatures = ~0u;
+  const unsigned int view = viewFeatures (config);
+  if (m_feedbackActive)
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, kStreamingFeedbackBinding,
+                      m_feedbackBuffers[m_feedbackSlot]);
+
+  for (size_t index : m_drawOrder)
+    {
+      const GLMesh &mesh = m_glMeshes[index];
+      if (!mesh.ready || mesh.transparent)
+        continue;
+      unsigned int features = (mesh.features & mask) | view;
+      if (features & FeatureHeatmap)
+        features &= ~FeatureBaseColorMap; // Replaced anyway
 
-          // Normal
-          if (mat.normalIndex >= 0 && mat.normalIndex < m_glTextures.size ()
-              && m_glTextures[mat.normalIndex].isValid)
+      if (config.uberShader)
+        {
+          if (!current)
             {
-              glActiveTexture (GL_TEXTURE2);
-              glBindTexture (GL_TEXTURE_2D, m_glTextures[mat.normalIndex].id);
-              shader->setUniformValue ("uHasNormalMap", true);
+              current = &programs->uber ();
+              current->program->bind ();
+              glUniform1f (current->heatmapRange, m_deviationRange);
             }
+          glUniform1i (current->features, (int)features);
+        }
+      else if (features != currentFeatures)
+        {
+          current = &programs->variant (features);
+          current->program->bind ();
+          currentFeatures = features;
+          if (features & FeatureHeatmap)
+            glUniform1f (current->heatmapRange, m_deviationRange);
         }
 
+      drawMesh (mesh, *current, features, profiler);
+    }
+
+  if (current)
+    current->program->release ();
+}
+
+void
+Model::drawTransparent (GeometryPrograms *programs,
+                        const RenderConfig &config, Profiler *profiler)
+{
+  if (m_transparentCount == 0)
+    return;
+
+  // Few meshes, so no grouping: the program is rebound on changes only
+  const unsigned int mask = featureMask (config) & ~FeatureAlphaMask;
+  const unsigned int view = viewFeatures (config);
+  const GeometryProgram *current = nullptr;
+  unsigned int currentFeatures = ~0u;
+  if (m_feedbackActive)
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, kStreamingFeedbackBinding,
+                      m_feedbackBuffers[m_feedbackSlot]);
+
+  for (const GLMesh &mesh : m_glMeshes)
+    {
+      if (!mesh.ready || !mesh.transparent)
+        continue;
+      unsigned int features = (mesh.features & mask) | view;
+
+      if (features != currentFeatures)
+        {
+          current = &programs->transparent (features);
+          current->program->bind ();
+          currentFeatures = features;
+          if (features & FeatureHeatmap)
+            glUniform1f (current->heatmapRange, m_deviationRange);
+        }
+
+      drawMesh (mesh, *current, features, profiler);
+    }
+
+  if (current)
+    current->program->release ();
+}
+
+void
+Model::drawMesh (const GLMesh &mesh, const GeometryProgram &program,
+                 unsigned int features, Profiler *profiler)
+{
+  // Defaults if no material
+  glm::vec4 baseColor (1.0f);
+  float metallic = 1.0f;
+  float roughness = 1.0f;
+  float alphaCutoff = 0.5f;
+
+  // Streamed textures the draw reports its levels of
+  int feedback[3] = { -1, -1, -1 };
+  float log2Size[3] = {};
+  auto report = [&] (int slot, int index) {
+    if (m_feedbackActive && m_glTextures[index].streamed)
+      {
+        feedback[slot] = index;
+        log2Size[slot] = m_glTextures[index].log2Size;
+      }
+  };
+
+  if (mesh.materialIndex >= 0 && mesh.materialIndex < m_materials.size ())
+    {
+      const MaterialData &mat = m_materials[mesh.materialIndex];
+      baseColor = mat.baseColorFactor;
+      metallic = mat.metallicFactor;
+      roughness = mat.roughnessFactor;
+      alphaCutoff = mat.alphaCutoff;
+
+      // Bind only what the variant samples
+      if (features & FeatureBaseColorMap)
+        {
+          glActiveTexture (GL_TEXTURE0);
+          glBindTexture (GL_TEXTURE_2D, m_glTextures[mat.baseColorIndex].id);
+          report (0, mat.baseColorIndex);
+        }
+      if (features & (FeatureMetallicMap | FeatureRoughnessMap))
+        {
+          glActiveTexture (GL_TEXTURE1);
+          glBindTexture (GL_TEXTURE_2D,
+                         m_glTextures[mat.metallicRoughnessIndex].id);
+          report (1, mat.metallicRoughnessIndex);
+        }
+      if (features & FeatureNormalMap)
+        {
+          glActiveTexture (GL_TEXTURE2);
+          glBindTexture (GL_TEXTURE_2D, m_glTextures[mat.normalIndex].id);
+          report (2, mat.normalIndex);
+        }
+    }
+
+  glUniform4f (program.baseColorFactor, baseColor.x, baseColor.y,
+               baseColor.z, baseColor.w);
+  glUniform1f (program.metallicFactor, metallic);
+  glUniform1f (program.roughnessFactor, roughness);
+  if (features & FeatureAlphaMask)
+    glUniform1f (program.alphaCutoff, alphaCutoff);
+  glUniform3i (program.feedbackTextures, feedback[0], feedback[1],
+               feedback[2]);
+  glUniform3f (program.feedbackLog2Size, log2Size[0], log2Size[1],
+               log2Size[2]);
+
+  if (mesh.deformVao)
+    {
+      // Every instance's copy lives in the same buffer. It is selected by
+      // the binding offset rather than a base vertex, so the per-vertex
+      // deviation and occlusion (one copy for all) still start at 0.
+      glBindVertexArray (mesh.deformVao);
+      for (int i = 0; i < mesh.instances; i++)
+        {
+          glBindVertexBuffer (0, mesh.deformBuffer,
+                              (GLintptr)i * mesh.deformVertices
+                                  * mesh.deformStride,
+                              mesh.deformStride);
+          glDrawElements (GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0);
+          if (profiler)
+            profiler->countDraw (mesh.indexCount / 3);
+        }
+      glBindVertexBuffer (0, mesh.deformBuffer, 0, mesh.deformStride);
+      glBindVertexArray (0);
+      return;
+    }
+
+  glBindVertexArray (mesh.vao);
+  glDrawElements (GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0);
+  glBindVertexArray (0);
+
+  if (profiler)
+    profiler->countDraw (mesh.indexCount / 3);
+}
+
+void
+Model::drawHighlight (GeometryPrograms *programs, int index,
+                      const glm::vec4 &color)
+{
+  if (index < 0 || index >= (int)m_glMeshes.size ()
+      || !m_glMeshes[index].ready)
+    return;
+
+  const GLMesh &mesh = m_glMeshes[index];
+  const GeometryProgram &program = programs->variant (0);
+  program.program->bind ();
+  glUniform4f (program.baseColorFactor, color.r, color.g, color.b, color.a);
+  glUniform1f (program.metallicFactor, 0.0f);
+  glUniform1f (program.roughnessFactor, 1.0f);
+  glUniform3i (program.feedbackTextures, -1, -1, -1);
+
+  // Animated: the first instance's copy
+  glBindVertexArray (mesh.deformVao ? mesh.deformVao : mesh.vao);
+  glDrawElements (GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0);
+  glBindVertexArray (0);
+  program.program->release ();
+}
+
+void
+Model::setDeformed (int mesh, unsigned int vao, unsigned int buffer,
+                    int stride, unsigned int vertexCount, int instances)
+{
+  if (mesh < 0 || mesh >= (int)m_glMeshes.size ())
+    return;
+  GLMesh &glMesh = m_glMeshes[mesh];
+  glMesh.deformVao = vao;
+  glMesh.deformBuffer = buffer;
+  glMesh.deformStride = stride;
+  glMesh.deformVertices = vertexCount;
+  glMesh.instances = vao ? instances : 1;
+
+  // A heatmap or AO set before the animation started
+  attachDeformedFloats (4, mesh, m_deviationBuffers);
+  attachDeformedFloats (5, mesh, m_occlusionBuffers);
+}
+
+size_t
+Model::attachVertexFloats (unsigned int location,
+                           const std::vector<std::vector<float>> &perMesh,
+                           std::vector<unsigned int> &buffers)
+{
+  buffers.assign (m_glMeshes.size (), 0);
+
+  // An attribute of the mesh's own VAO, which meshes sharing its geometry
+  // draw from as well
+  size_t total = 0;
+  for (size_t m = 0; m < m_glMeshes.size () && m < perMesh.size (); m++)
+    {
+      const GLMesh &mesh = m_glMeshes[m];
+      if (mesh.source >= 0 || perMesh[m].empty ())
+        continue;
+
+      const size_t bytes = perMesh[m].size () * sizeof (float);
+      glGenBuffers (1, &buffers[m]);
       glBindVertexArray (mesh.vao);
-      glDrawElements (GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0);
+      glBindBuffer (GL_ARRAY_BUFFER, buffers[m]);
+      glBufferData (GL_ARRAY_BUFFER, bytes, perMesh[m].data (),
+                    GL_STATIC_DRAW);
+      glEnableVertexAttribArray (location);
+      glVertexAttribPointer (location, 1, GL_FLOAT, GL_FALSE, sizeof (float),
+                             nullptr);
       glBindVertexArray (0);
+      total += bytes;
     }
+  for (size_t m = 0; m < m_glMeshes.size (); m++)
+    attachDeformedFloats (location, (int)m, buffers);
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+  m_gpuMemoryBytes += total;
+  return total;
+}
+
+void
+Model::attachDeformedFloats (unsigned int location, int mesh,
+                             const std::vector<unsigned int> &buffers)
+{
+  const GLMesh &glMesh = m_glMeshes[mesh];
+  const int owner = glMesh.source >= 0 ? glMesh.source : mesh;
+  if (!glMesh.deformVao || owner >= (int)buffers.size () || !buffers[owner])
+    return;
+
+  // Rest pose order, which the deformed copies keep
+  glBindVertexArray (glMesh.deformVao);
+  glBindBuffer (GL_ARRAY_BUFFER, buffers[owner]);
+  glEnableVertexAttribArray (location);
+  glVertexAttribPointer (location, 1, GL_FLOAT, GL_FALSE, sizeof (float),
+                         nullptr);
+  glBindVertexArray (0);
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void
+Model::detachVertexFloats (unsigned int location,
+                           std::vector<unsigned int> &buffers, size_t bytes)
+{
+  // Deform VAOs first: deleting a buffer only unbinds it from the bound VAO
+  for (const GLMesh &mesh : m_glMeshes)
+    {
+      if (!mesh.deformVao || buffers.empty ())
+        continue;
+      glBindVertexArray (mesh.deformVao);
+      glDisableVertexAttribArray (location);
+      glBindVertexBuffer (location, 0, 0, sizeof (float));
+    }
+  for (size_t m = 0; m < buffers.size (); m++)
+    {
+      if (!buffers[m])
+        continue;
+      glBindVertexArray (m_glMeshes[m].vao);
+      glDisableVertexAttribArray (location);
+      glDeleteBuffers (1, &buffers[m]);
+    }
+  glBindVertexArray (0);
+  buffers.clear ();
+  m_gpuMemoryBytes -= bytes;
+}
+
+void
+Model::setDeviation (const std::vector<std::vector<float>> &perMesh,
+                     float range)
+{
+  clearDeviation ();
+  m_deviationBytes = attachVertexFloats (4, perMesh, m_deviationBuffers);
+  m_deviationRange = std::max (range, FLT_MIN);
+}
+
+void
+Model::clearDeviation ()
+{
+  detachVertexFloats (4, m_deviationBuffers, m_deviationBytes);
+  m_deviationBytes = 0;
+  m_deviationRange = 0.0f;
+}
+
+void
+Model::setOcclusion (const std::vector<std::vector<float>> &perMesh)
+{
+  clearOcclusion ();
+  m_occlusionBytes = attachVertexFloats (5, perMesh, m_occlusionBuffers);
+
+  // Read by meshes without a buffer of their own: unoccluded
+  glVertexAttrib1f (5, 1.0f);
+}
+
+void
+Model::clearOcclusion ()
+{
+  detachVertexFloats (5, m_occlusionBuffers, m_occlusionBytes);
+  m_occlusionBytes = 0;
 }
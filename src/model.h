@@ -3,8 +3,9 @@
 
 #include "meshdata.h"
 #include "renderconfig.h"
+#include <QElapsedTimer>
 #include <QOpenGLExtraFunctions>
-#include <QOpenGLShaderProgram>
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -15,27 +16,306 @@ struct GLMesh
   unsigned int ebo;
   unsigned int indexCount;
   int materialIndex;
+  unsigned int features; // GeometryFeature bits the material can use
+  bool ready;            // Buffers fully uploaded
+  bool transparent;      // alphaMode BLEND, drawn by drawTransparent()
+  int source;            // Mesh owning vao/vbo/ebo, -1 = this one
+
+  // SkinningPass output drawn instead of vao, deformVertices per instance
+  // of deformStride bytes each in deformBuffer (vertex binding 0)
+  unsigned int deformVao = 0;
+  unsigned int deformBuffer = 0;
+  int deformStride = 0;
+  unsigned int deformVertices = 0;
+  int instances = 1;
 };
 
 struct GLTexture
 {
   unsigned int id;
-  bool isValid;
+  unsigned int format; // Pixel format, or the compressed internal format
+  bool compressed;
+  bool gpuMips; // Level 0 only from the loader, glGenerateMipmap
+  bool isValid; // Pixels and mips uploaded
+
+  // Residency. Streamed textures hold source levels baseLevel..N-1 in
+  // `id`; a change uploads a replacement (pendingId) and swaps on
+  // completion. Levels no longer in system memory are decoded on the pool
+  // first (loading).
+  bool streamed;
+  int baseLevel;
+  unsigned int pendingId;
+  int pendingBase;
+  bool loading;
+  float log2Size;              // Of the source's level 0, for the feedback
+  qint64 requestNs;            // Model clock when the change was requested
+  unsigned long long lastUsed; // Frame number, for LRU eviction
+};
+
+struct TextureStreamingStats
+{
+  size_t budgetBytes = 0;   // 0 = unlimited
+  size_t residentBytes = 0; // Texture VRAM incl. replacements in flight
+  int streamedTextures = 0;
+  int fullyResident = 0; // Streamed textures at their finest level
+  int pendingRequests = 0;
+  int evictions = 0;         // Since the model was loaded
+  double latencyMsAvg = 0.0; // Request to swap
+  double latencyMsMax = 0.0;
 };
 
+class GeometryPrograms;
+struct GeometryProgram;
+class Profiler;
+class StagingRing;
+
 class Model : protected QOpenGLExtraFunctions
 {
 public:
   Model ();
   ~Model ();
 
+  // Synchronous upload, data stays owned by the caller. Every texture is
+  // fully resident (no streaming).
   void create (SceneData *data);
-  void draw (QOpenGLShaderProgram *shader, const RenderConfig &config);
+
+  // Time-sliced upload: takes ownership of data and only allocates GL
+  // objects. uploadStep() then streams vertex, index and texture data
+  // through the staging ring until budgetMs is spent; meshes are drawn as
+  // soon as their buffers are complete, with untextured materials until
+  // their textures arrive. Returns true while work remains.
+  //
+  // Textures with a loader-built mip chain start at a low mip and are
+  // streamed afterwards (see updateStreaming). Once uploaded, only the
+  // initial levels stay in system memory when the stored image
+  // (LoaderOptions::keepEncodedImages) can be decoded again for the finer
+  // ones; otherwise the whole chain does.
+  void beginUpload (std::shared_ptr<SceneData> data);
+  bool uploadStep (StagingRing *ring, double budgetMs);
+
+  // Texture streaming, once per frame before the draws. The draws record
+  // the finest level they sample of each streamed texture on the GPU; a
+  // few frames later, once its fence has signaled, that feedback is read
+  // back and finer levels are requested, evicting least recently used
+  // levels to stay under the budget (0 = unlimited).
+  void updateStreaming (size_t budgetBytes);
+
+  // Uploads requested levels until budgetMs is spent.
+  void streamStep (StagingRing *ring, double budgetMs);
+
+  bool
+  streaming () const
+  {
+    return m_streamedCount > 0;
+  }
+
+  TextureStreamingStats streamingStats () const;
+
+  bool
+  uploadPending () const
+  {
+    return m_pending != nullptr;
+  }
+
+  // CPU time spent in upload calls for the current model.
+  double
+  uploadMs () const
+  {
+    return m_uploadMs;
+  }
+
+  // Binds the geometry program variant of each opaque or alpha-tested
+  // mesh (grouped, so every variant is bound once per frame) and draws it.
+  void draw (GeometryPrograms *programs, const RenderConfig &config,
+             Profiler *profiler = nullptr);
+
+  // Draws the alphaMode BLEND meshes with the transparency programs, in
+  // no particular order (the OIT targets make it irrelevant). The caller
+  // sets up blending and the environment map.
+  void drawTransparent (GeometryPrograms *programs, const RenderConfig &config,
+                        Profiler *profiler = nullptr);
+
+  int
+  transparentCount () const
+  {
+    return m_transparentCount;
+  }
+
+  // Draws one mesh untextured in a flat color (selection outline; the
+  // caller sets the polygon mode).
+  void drawHighlight (GeometryPrograms *programs, int mesh,
+                      const glm::vec4 &color);
+
+  // Compare mode: one signed distance per vertex of each mesh (by
+  // SceneData::meshes index; empty entries and meshes sharing another
+  // one's geometry are skipped) as vertex attribute 4, drawn as a heatmap
+  // in the albedo that saturates at +-range. Replaces any previous one.
+  void setDeviation (const std::vector<std::vector<float>> &perMesh,
+                     float range);
+  void clearDeviation ();
+
+  bool
+  showsDeviation () const
+  {
+    return m_deviationRange > 0.0f;
+  }
+
+  // Baked ambient occlusion (AoBaker), one value per vertex like
+  // setDeviation, as vertex attribute 5 written to the G-buffer AO
+  // channel. Replaces any previous one.
+  void setOcclusion (const std::vector<std::vector<float>> &perMesh);
+  void clearOcclusion ();
+
+  bool
+  showsOcclusion () const
+  {
+    return !m_occlusionBuffers.empty ();
+  }
+
+  // Animated meshes: drawn from `vao` (SkinningPass), whose binding 0
+  // reads `buffer` holding `instances` deformed copies of vertexCount
+  // vertices, one draw per copy. The deviation and occlusion attributes
+  // are added to `vao` as well. vao 0 goes back to the mesh's own buffers.
+  void setDeformed (int mesh, unsigned int vao, unsigned int buffer,
+                    int stride, unsigned int vertexCount, int instances);
+
+  // Index buffer a mesh draws with (its geometry source's when shared)
+  unsigned int
+  indexBuffer (int mesh) const
+  {
+    return m_glMeshes[mesh].ebo;
+  }
+
+  // Estimated VRAM held by textures and buffers (driver padding excluded).
+  size_t
+  gpuMemoryBytes () const
+  {
+    return m_gpuMemoryBytes;
+  }
 
 private:
+  // A contiguous byte range copied into one buffer or texture.
+  struct UploadJob
+  {
+    int mesh = -1;    // Set on the last buffer job of a mesh
+    int texture = -1; // Texture jobs only
+    unsigned int object = 0; // Buffer or texture name
+    const unsigned char *src = nullptr;
+    size_t size = 0;
+    size_t done = 0;
+    // Texture jobs only. A row is one line of texels, or one line of
+    // 4x4 blocks for compressed levels.
+    int level = 0; // Level in the GL texture
+    int width = 0;
+    int height = 0;
+    int rowHeight = 1;
+    size_t rowBytes = 0;
+    bool last = false; // Last level of the texture
+  };
+
+  void allocate (const SceneData &data);
+  bool runJobs (std::vector<UploadJob> &jobs, size_t &next,
+                StagingRing *ring, double budgetMs);
+  bool uploadChunk (UploadJob &job, StagingRing *ring);
+  void finishJob (const UploadJob &job);
+
+  // Creates a texture holding source levels base..N-1 and queues their
+  // upload.
+  unsigned int createTexture (int texture, const TextureData &texData,
+                              int base, std::vector<UploadJob> &jobs);
+  void requestLevel (int texture, int base);
+  void replaceTexture (int texture, const TextureData &texData, int base);
+  size_t evict (size_t bytes, int keep, const std::vector<int> &wanted);
+
+  // Fences the feedback the last frame wrote and clears the next buffer
+  // for this one. Fills `wanted` and returns true when the oldest buffer
+  // has been read back.
+  bool readFeedback (std::vector<int> &wanted);
+
+  // Uploads reloaded levels that have been decoded since the last frame
+  void collectReloads ();
+
+  // Finest level requests can go to: 0 if the image can be decoded again
+  int finestLevel (int texture) const;
+
   std::vector<GLMesh> m_glMeshes;
   std::vector<GLTexture> m_glTextures;
   std::vector<MaterialData> m_materials;
+  size_t m_gpuMemoryBytes = 0;
+  int m_transparentCount = 0;
+
+  // Mesh indices sorted by variant for the current feature mask
+  std::vector<size_t> m_drawOrder;
+  unsigned int m_drawOrderMask = ~0u;
+
+  unsigned int materialFeatures (int materialIndex) const;
+
+  // Bits every mesh gets from the view (compare, AO, tangent mode)
+  unsigned int viewFeatures (const RenderConfig &config) const;
+
+  // Binds the mesh's material to `program` and draws every copy of it
+  void drawMesh (const GLMesh &mesh, const GeometryProgram &program,
+                 unsigned int features, Profiler *profiler);
+
+  // Compare mode heatmap and baked AO, one buffer per mesh (0 = none)
+  std::vector<unsigned int> m_deviationBuffers;
+  size_t m_deviationBytes = 0;
+  float m_deviationRange = 0.0f;
+  std::vector<unsigned int> m_occlusionBuffers;
+  size_t m_occlusionBytes = 0;
+
+  // One float per vertex as attribute `location` of each mesh's VAO;
+  // returns the bytes uploaded
+  size_t attachVertexFloats (unsigned int location,
+                             const std::vector<std::vector<float>> &perMesh,
+                             std::vector<unsigned int> &buffers);
+  void detachVertexFloats (unsigned int location,
+                           std::vector<unsigned int> &buffers, size_t bytes);
+  // The same attribute on the mesh's deform VAO, from its geometry
+  // source's buffer
+  void attachDeformedFloats (unsigned int location, int mesh,
+                             const std::vector<unsigned int> &buffers);
+
+  // Pending upload
+  std::vector<UploadJob> m_uploadJobs;
+  size_t m_nextJob = 0;
+  const SceneData *m_pending = nullptr;
+  double m_uploadMs = 0.0;
+
+  // Set by beginUpload only. Mesh data is dropped after the upload unless
+  // another owner (mesh analysis) still reads it; the textures stay while
+  // any of them is streamed.
+  std::shared_ptr<SceneData> m_owned;
+
+  // Texture streaming
+  struct TextureReload
+  {
+    int texture = -1;
+    int base = 0;
+    TextureData chain; // Decoded and processed again, whole
+    std::atomic<bool> ready{ false };
+  };
+
+  std::vector<UploadJob> m_streamJobs;
+  std::vector<std::shared_ptr<TextureReload>> m_reloads;
+  size_t m_nextStreamJob = 0;
+  int m_streamedCount = 0;
+  unsigned long long m_frame = 0;
+  QElapsedTimer m_clock;
+  int m_evictions = 0;
+  int m_swaps = 0;
+  double m_latencyMsTotal = 0.0;
+  double m_latencyMsMax = 0.0;
+  size_t m_budgetBytes = 0;
+
+  // GPU feedback, one level per texture. The frame's draws write one buffer
+  // of the ring (m_feedbackSlot while m_feedbackActive), which is read back
+  // when the ring comes round to it again.
+  static const int kFeedbackFrames = 3;
+  unsigned int m_feedbackBuffers[kFeedbackFrames] = {};
+  GLsync m_feedbackFences[kFeedbackFrames] = {};
+  int m_feedbackSlot = 0;
+  bool m_feedbackActive = false;
 
   // We keep track to delete them
   void clear ();
@@ -0,0 +1,58 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "tracer.h"
+
+#include <QSemaphore>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// Runs fn(i) for every i in [0, count) on the global thread pool and the
+// calling thread, handing out `grain` indices at a time.
+//
+// Only pool threads that are idle right now are recruited (tryStart), and
+// the caller works through the range itself, so calls from inside pool tasks
+// (batch loaders, nested loops) never wait on a queue that cannot drain.
+template <typename Fn>
+void
+parallelFor (size_t count, Fn &&fn, size_t grain = 1)
+{
+  if (count == 0)
+    return;
+
+  grain = std::max<size_t> (grain, 1);
+  const size_t chunks = (count + grain - 1) / grain;
+  std::atomic<size_t> next{ 0 };
+
+  auto work = [&] () {
+    for (size_t chunk = next++; chunk < chunks; chunk = next++)
+      {
+        const size_t end = std::min (count, (chunk + 1) * grain);
+        for (size_t i = chunk * grain; i < end; i++)
+          fn (i);
+      }
+  };
+
+  QThreadPool *pool = QThreadPool::globalInstance ();
+  QSemaphore finished;
+  int helpers = 0;
+  const size_t wanted
+      = std::min<size_t> (chunks - 1, (size_t)pool->maxThreadCount ());
+  for (size_t h = 0; h < wanted; h++)
+    {
+      if (!pool->tryStart ([&] () {
+            TRACE_SCOPE_CAT ("pool", "parallelFor");
+            work ();
+            finished.release ();
+          }))
+        break;
+      helpers++;
+    }
+
+  work ();
+  finished.acquire (helpers);
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,348 @@
+// Performance regression check against a checked-in baseline.
+//
+//   mesh-spy-perfcheck [--baseline FILE] [--work-dir DIR] [--update-baseline]
+//
+// Every scene runs in its own child process (--run-scene) so peak RSS is
+// measured per scene. Exit code: 0 = pass, 1 = regression or a scene or
+// metric missing from the baseline, 2 = error.
+
+#include "gltfloader.h"
+#include "renderbenchmark.h"
+#include "syntheticglb.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSurfaceFormat>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifndef MESHSPY_PERF_BASELINE
+#define MESHSPY_PERF_BASELINE "perf/baseline.json"
+#endif
+
+struct PerfScene
+{
+  QString name;
+  SyntheticSceneSpec spec;
+};
+
+// Fixed scene set. Changing it invalidates the baseline.
+static std::vector<PerfScene>
+perfScenes ()
+{
+  std::vector<PerfScene> scenes;
+
+  SyntheticSceneSpec grid;
+  grid.vertexCount = 250000;
+  scenes.push_back ({ "grid-250k", grid });
+
+  SyntheticSceneSpec tiles;
+  tiles.vertexCount = 250000;
+  tiles.primitiveCount = 64;
+  tiles.interleaved = false;
+  tiles.indexBytes = 2;
+  scenes.push_back ({ "tiles-64", tiles });
+
+  SyntheticSceneSpec textured;
+  textured.vertexCount = 100000;
+  textured.primitiveCount = 8;
+  textured.textureCount = 8;
+  textured.textureSize = 1024;
+  scenes.push_back ({ "textured-8x1k", textured });
+
+  return scenes;
+}
+
+static double
+peakRssMB ()
+{
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo (GetCurrentProcess (), &counters,
+                            sizeof (counters)))
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+  return 0.0;
+#else
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+#if defined(Q_OS_MACOS)
+  return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+  return usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+#endif
+}
+
+// Child side: measure one scene and print the metrics as JSON.
+static int
+runScene (const PerfScene &scene, const QDir &workDir)
+{
+  const QString path = workDir.filePath (scene.spec.name () + ".glb");
+  QString error;
+  if (!QFileInfo::exists (path)
+      && !writeSyntheticGlb (scene.spec, path, nullptr, &error))
+    {
+      std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                    qPrintable (error));
+      return 2;
+    }
+
+  std::vector<double> loads;
+  for (int i = 0; i < 3; i++)
+    {
+      QElapsedTimer timer;
+      timer.start ();
+      std::unique_ptr<SceneData> data (GLTFLoader::load (path, &error));
+      if (!data)
+        {
+          std::fprintf (stderr, "Load failed: %s\n", qPrintable (error));
+          return 2;
+        }
+      loads.push_back (timer.nsecsElapsed () / 1.0e6);
+    }
+  std::sort (loads.begin (), loads.end ());
+
+  RenderBenchmark::Options options;
+  options.modelPath = path;
+  options.frames = 120;
+  options.warmupFrames = 20;
+  options.size = QSize (1280, 720);
+
+  QJsonObject render = RenderBenchmark::run (options, &error);
+  if (render.isEmpty ())
+    {
+      std::fprintf (stderr, "Render failed: %s\n", qPrintable (error));
+      return 2;
+    }
+
+  // Nothing drawn: the timings and checksum would not measure anything
+  if (render["imageFlat"].toBool ())
+    {
+      std::fprintf (stderr, "Render failed: the reference frame is a "
+                            "single color\n");
+      return 2;
+    }
+
+  QJsonObject result;
+  result["loadMs"] = loads[loads.size () / 2];
+  result["frameMs"] = render["wallMs"].toDouble () / options.frames;
+  result["gpuMemoryMB"]
+      = render["gpuMemoryBytes"].toDouble () / (1024.0 * 1024.0);
+  result["peakRssMB"] = peakRssMB ();
+  result["imageChecksum"] = render["imageChecksum"];
+  result["imageFingerprint"] = render["imageFingerprint"];
+  result["glRenderer"] = render["gl"].toObject ()["renderer"];
+
+  std::fputs (QJsonDocument (result).toJson (QJsonDocument::Compact)
+                  .constData (),
+              stdout);
+  return 0;
+}
+
+static double
+fingerprintDistance (const QJsonArray &a, const QJsonArray &b)
+{
+  if (a.size () != b.size () || a.isEmpty ())
+    return 1.0;
+
+  double sum = 0.0;
+  for (int i = 0; i < a.size (); i++)
+    sum += std::abs (a[i].toInt () - b[i].toInt ());
+  return sum / (a.size () * 255.0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")
+      && qEnvironmentVariableIsEmpty ("DISPLAY")
+      && qEnvironmentVariableIsEmpty ("WAYLAND_DISPLAY"))
+    qputenv ("QT_QPA_PLATFORM", "offscreen");
+
+  QSurfaceFormat format;
+  format.setVersion (4, 5);
+  format.setProfile (QSurfaceFormat::CoreProfile);
+  format.setDepthBufferSize (24);
+  format.setStencilBufferSize (8);
+  QSurfaceFormat::setDefaultFormat (format);
+
+  QGuiApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy performance regression check");
+  parser.addHelpOption ();
+  QCommandLineOption baselineOpt ("baseline", "Baseline file.", "file",
+                                  MESHSPY_PERF_BASELINE);
+  QCommandLineOption dirOpt ("work-dir", "Where generated GLBs are cached.",
+                             "dir", QDir::tempPath () + "/mesh-spy-perf");
+  QCommandLineOption updateOpt ("update-baseline",
+                                "Record the current results as baseline.");
+  QCommandLineOption sceneOpt ("run-scene", "Internal: measure one scene.",
+                               "name");
+  parser.addOptions ({ baselineOpt, dirOpt, updateOpt, sceneOpt });
+  parser.process (app);
+
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+
+  const std::vector<PerfScene> scenes = perfScenes ();
+
+  if (parser.isSet (sceneOpt))
+    {
+      for (const auto &scene : scenes)
+        {
+          if (scene.name == parser.value (sceneOpt))
+            return runScene (scene, workDir);
+        }
+      std::fprintf (stderr, "Unknown scene %s\n",
+                    qPrintable (parser.value (sceneOpt)));
+      return 2;
+    }
+
+  // Load baseline
+  QJsonObject baseline;
+  QFile baselineFile (parser.value (baselineOpt));
+  if (baselineFile.open (QIODevice::ReadOnly))
+    baseline = QJsonDocument::fromJson (baselineFile.readAll ()).object ();
+  baselineFile.close ();
+
+  const QJsonObject tolerances = baseline["tolerances"].toObject ();
+  const QJsonObject baseScenes = baseline["scenes"].toObject ();
+  const char *metrics[] = { "loadMs", "frameMs", "peakRssMB", "gpuMemoryMB" };
+
+  QJsonObject current;
+  bool failed = false;
+  bool missing = false;
+
+  std::printf ("%-16s %-14s %10s %10s %8s  %s\n", "scene", "metric", "base",
+               "new", "delta", "status");
+
+  for (const auto &scene : scenes)
+    {
+      QProcess child;
+      child.start (QCoreApplication::applicationFilePath (),
+                   { "--run-scene", scene.name, "--work-dir",
+                     workDir.absolutePath () });
+      // A crash leaves no meaningful exit code
+      if (!child.waitForFinished (10 * 60 * 1000)
+          || child.exitStatus () == QProcess::CrashExit
+          || child.exitCode () != 0)
+        {
+          std::fprintf (stderr, "Scene %s failed:\n%s\n",
+                        qPrintable (scene.name),
+                        child.readAllStandardError ().constData ());
+          return 2;
+        }
+
+      QJsonObject result
+          = QJsonDocument::fromJson (child.readAllStandardOutput ()).object ();
+      current[scene.name] = result;
+
+      // Nothing to compare against is a failure, not a pass: a check that
+      // cannot fail guards nothing
+      if (!baseScenes.contains (scene.name))
+        {
+          std::printf ("%-16s %-14s %10s %10s %8s  NO BASELINE\n",
+                       qPrintable (scene.name), "-", "-", "-", "-");
+          failed = true;
+          missing = true;
+          continue;
+        }
+
+      const QJsonObject base = baseScenes[scene.name].toObject ();
+      for (const char *metric : metrics)
+        {
+          if (!base.contains (metric))
+            {
+              std::printf ("%-16s %-14s %10s %10.2f %8s  NO BASELINE\n",
+                           qPrintable (scene.name), metric, "-",
+                           result[metric].toDouble (), "-");
+              failed = true;
+              missing = true;
+              continue;
+            }
+
+          double a = base[metric].toDouble ();
+          double b = result[metric].toDouble ();
+          double tolerance = tolerances[metric].toDouble (0.15);
+          double delta = a > 0.0 ? (b - a) / a : 0.0;
+
+          const char *status = "ok";
+          if (delta > tolerance)
+            {
+              status = "REGRESSION";
+              failed = true;
+            }
+          else if (delta < -tolerance)
+            status = "faster (update baseline?)";
+
+          std::printf ("%-16s %-14s %10.2f %10.2f %+7.1f%%  %s\n",
+                       qPrintable (scene.name), metric, a, b, delta * 100.0,
+                       status);
+        }
+
+      // Exact checksums are only comparable on the same renderer; across
+      // drivers fall back to the coarse fingerprint.
+      bool sameRenderer = base["glRenderer"] == result["glRenderer"];
+      double distance = fingerprintDistance (
+          base["imageFingerprint"].toArray (),
+          result["imageFingerprint"].toArray ());
+      bool imageOk
+          = sameRenderer
+                ? base["imageChecksum"] == result["imageChecksum"]
+                : distance <= tolerances["imageFingerprint"].toDouble (0.02);
+      if (!imageOk)
+        failed = true;
+
+      std::printf ("%-16s %-14s %10s %10s %7.3f   %s\n",
+                   qPrintable (scene.name), "image", "-", "-", distance,
+                   imageOk ? "ok" : "IMAGE CHANGED");
+    }
+
+  if (parser.isSet (updateOpt))
+    {
+      if (!baseline.contains ("tolerances"))
+        baseline["tolerances"] = QJsonObject{ { "loadMs", 0.25 },
+                                              { "frameMs", 0.15 },
+                                              { "peakRssMB", 0.10 },
+                                              { "gpuMemoryMB", 0.02 },
+                                              { "imageFingerprint", 0.02 } };
+      baseline["scenes"] = current;
+
+      QFile out (parser.value (baselineOpt));
+      if (!out.open (QIODevice::WriteOnly))
+        {
+          std::fprintf (stderr, "Cannot write %s\n",
+                        qPrintable (parser.value (baselineOpt)));
+          return 2;
+        }
+      out.write (QJsonDocument (baseline).toJson (QJsonDocument::Indented));
+      std::printf ("\nBaseline updated: %s\n",
+                   qPrintable (parser.value (baselineOpt)));
+      return 0;
+    }
+
+  if (missing)
+    std::printf ("\nRecord a baseline on this machine with "
+                 "--update-baseline.\n");
+  std::printf ("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed ? 1 : 0;
+}
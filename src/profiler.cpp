@@ -0,0 +1,388 @@
+#include "profiler.h"
+#include "glcore.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <algorithm>
+
+//---------------------------
+// RollingStats
+//---------------------------
+
+RollingStats::RollingStats (int capacity)
+    : m_capacity (std::max (1, capacity))
+{
+  m_samples.resize (m_capacity, 0.0);
+}
+
+void
+RollingStats::add (double value)
+{
+  m_samples[m_head] = value;
+  m_head = (m_head + 1) % m_capacity;
+  if (m_count < m_capacity)
+    m_count++;
+}
+
+void
+RollingStats::clear ()
+{
+  m_head = 0;
+  m_count = 0;
+}
+
+void
+RollingStats::setCapacity (int capacity)
+{
+  m_capacity = std::max (1, capacity);
+  m_samples.assign (m_capacity, 0.0);
+  clear ();
+}
+
+double
+RollingStats::last () const
+{
+  if (m_count == 0)
+    return 0.0;
+  return m_samples[(m_head + m_capacity - 1) % m_capacity];
+}
+
+double
+RollingStats::average () const
+{
+  if (m_count == 0)
+    return 0.0;
+
+  // While the ring is filling, valid samples are [0, m_count).
+  double sum = 0.0;
+  for (int i = 0; i < m_count; i++)
+    sum += m_samples[i];
+  return sum / m_count;
+}
+
+double
+RollingStats::max () const
+{
+  if (m_count == 0)
+    return 0.0;
+  return *std::max_element (m_samples.begin (), m_samples.begin () + m_count);
+}
+
+double
+RollingStats::percentile (double p) const
+{
+  if (m_count == 0)
+    return 0.0;
+
+  std::vector<double> sorted (m_samples.begin (),
+                              m_samples.begin () + m_count);
+  size_t rank = (size_t)std::clamp (p / 100.0 * (m_count - 1) + 0.5, 0.0,
+                                    (double)(m_count - 1));
+  std::nth_element (sorted.begin (), sorted.begin () + rank, sorted.end ());
+  return sorted[rank];
+}
+
+//---------------------------
+// Profiler
+//---------------------------
+
+Profiler::Profiler () { m_frame.name = "Frame"; }
+
+Profiler::~Profiler ()
+{
+  if (!m_gpuTimers)
+    return;
+
+  for (auto &slot : m_slots)
+    {
+      if (!slot.sectionQueries.empty ())
+        glDeleteQueries ((int)slot.sectionQueries.size (),
+                         slot.sectionQueries.data ());
+      if (!slot.sectionStamps.empty ())
+        glDeleteQueries ((int)slot.sectionStamps.size (),
+                         slot.sectionStamps.data ());
+      glDeleteQueries (1, &slot.beginStamp);
+      glDeleteQueries (1, &slot.endStamp);
+    }
+}
+
+void
+Profiler::init ()
+{
+  initializeOpenGLFunctions ();
+
+  // glQueryCounter and 64-bit results are not part of the ES subset.
+  m_gl45 = coreFunctions45 ();
+  m_gpuTimers = (m_gl45 != nullptr);
+
+  if (!m_gpuTimers)
+    {
+      qDebug () << "Profiler: GL 4.5 core unavailable, GPU timers disabled.";
+      return;
+    }
+
+  for (auto &slot : m_slots)
+    {
+      glGenQueries (1, &slot.beginStamp);
+      glGenQueries (1, &slot.endStamp);
+    }
+}
+
+void
+Profiler::setHistorySize (int frames)
+{
+  m_historySize = std::max (1, frames);
+  m_frame.cpu.setCapacity (m_historySize);
+  m_frame.gpu.setCapacity (m_historySize);
+  for (auto &section : m_sections)
+    {
+      section.cpu.setCapacity (m_historySize);
+      section.gpu.setCapacity (m_historySize);
+    }
+}
+
+int
+Profiler::sectionIndex (const char *name)
+{
+  // A handful of passes per frame, a linear scan is cheaper than hashing.
+  for (size_t i = 0; i < m_sections.size (); i++)
+    {
+      if (m_sections[i].name == QLatin1String (name))
+        return (int)i;
+    }
+
+  Section section;
+  section.name = QString::fromLatin1 (name);
+  section.label = name;
+  section.cpu.setCapacity (m_historySize);
+  section.gpu.setCapacity (m_historySize);
+  m_sections.push_back (section);
+
+  for (auto &slot : m_slots)
+    {
+      unsigned int queries[2] = { 0, 0 };
+      if (m_gpuTimers)
+        glGenQueries (2, queries);
+      slot.sectionQueries.push_back (queries[0]);
+      slot.sectionStamps.push_back (queries[1]);
+      slot.sectionUsed.push_back (false);
+    }
+
+  return (int)m_sections.size () - 1;
+}
+
+bool
+Profiler::collect (FrameSlot &slot, bool wait)
+{
+  if (!slot.pending)
+    return true;
+
+  if (!wait)
+    {
+      // The end timestamp is the last query issued for the frame; once it is
+      // available every earlier query of that frame is too.
+      unsigned int available = 0;
+      glGetQueryObjectuiv (slot.endStamp, GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+      if (!available)
+        return false;
+    }
+
+  GLuint64 begin = 0;
+  GLuint64 end = 0;
+  m_gl45->glGetQueryObjectui64v (slot.beginStamp, GL_QUERY_RESULT, &begin);
+  m_gl45->glGetQueryObjectui64v (slot.endStamp, GL_QUERY_RESULT, &end);
+  m_frame.gpu.add ((end - begin) / 1.0e6);
+
+  for (size_t i = 0; i < slot.sectionQueries.size (); i++)
+    {
+      if (!slot.sectionUsed[i])
+        continue;
+
+      GLuint64 elapsed = 0;
+      m_gl45->glGetQueryObjectui64v (slot.sectionQueries[i], GL_QUERY_RESULT,
+                                     &elapsed);
+      m_sections[i].gpu.add (elapsed / 1.0e6);
+    }
+
+  if (slot.traced && Tracer::enabled ())
+    traceGpu (slot, begin, end);
+
+  slot.pending = false;
+  return true;
+}
+
+void
+Profiler::traceGpu (const FrameSlot &slot, GLuint64 begin, GLuint64 end)
+{
+  const int64_t offset = m_gpuClockOffset;
+  Tracer::gpuComplete ("Frame", (int64_t)begin + offset,
+                       (int64_t)end + offset);
+
+  for (size_t i = 0; i < slot.sectionStamps.size (); i++)
+    {
+      if (!slot.sectionUsed[i])
+        continue;
+
+      GLuint64 start = 0;
+      GLuint64 elapsed = 0;
+      m_gl45->glGetQueryObjectui64v (slot.sectionStamps[i], GL_QUERY_RESULT,
+                                     &start);
+      m_gl45->glGetQueryObjectui64v (slot.sectionQueries[i],
+                                     GL_QUERY_RESULT, &elapsed);
+      Tracer::gpuComplete (m_sections[i].label, (int64_t)start + offset,
+                           (int64_t)(start + elapsed) + offset);
+    }
+}
+
+void
+Profiler::beginFrame ()
+{
+  if (m_gpuTimers)
+    {
+      // Drain finished frames oldest first, stop at the first one still in
+      // flight. The slot we are about to reuse is dropped if it is still
+      // pending rather than waited on.
+      for (int i = 0; i < kFrameLatency; i++)
+        {
+          FrameSlot &slot = m_slots[(m_frameIndex + i) % kFrameLatency];
+          if (!collect (slot, false))
+            break;
+        }
+
+      FrameSlot &slot = m_slots[m_frameIndex % kFrameLatency];
+      slot.pending = false;
+      std::fill (slot.sectionUsed.begin (), slot.sectionUsed.end (), false);
+      slot.traced = Tracer::enabled ();
+
+      // The GPU clock has its own origin; GL_TIMESTAMP read back now is
+      // close enough to the CPU's now to line the tracks up
+      m_gpuClockValid = m_gpuClockValid && slot.traced;
+      if (slot.traced && !m_gpuClockValid)
+        {
+          GLint64 gpuNow = 0;
+          glGetInteger64v (GL_TIMESTAMP, &gpuNow);
+          m_gpuClockOffset = Tracer::now () - gpuNow;
+          m_gpuClockValid = true;
+        }
+
+      m_gl45->glQueryCounter (slot.beginStamp, GL_TIMESTAMP);
+    }
+
+  m_current = FrameCounters ();
+  m_inFrame = true;
+  m_frameTraceStart = Tracer::enabled () ? Tracer::now () : -1;
+  m_frameTimer.start ();
+}
+
+void
+Profiler::endFrame ()
+{
+  if (!m_inFrame)
+    return;
+
+  if (m_activeSection >= 0)
+    endSection ();
+
+  if (m_gpuTimers)
+    {
+      FrameSlot &slot = m_slots[m_frameIndex % kFrameLatency];
+      m_gl45->glQueryCounter (slot.endStamp, GL_TIMESTAMP);
+      slot.pending = true;
+    }
+
+  m_frame.cpu.add (m_frameTimer.nsecsElapsed () / 1.0e6);
+  if (m_frameTraceStart >= 0)
+    Tracer::complete ("render", "Frame", m_frameTraceStart, Tracer::now ());
+  m_lastCounters = m_current;
+  m_inFrame = false;
+  m_frameIndex++;
+}
+
+void
+Profiler::beginSection (const char *name)
+{
+  if (!m_inFrame)
+    return;
+
+  if (m_activeSection >= 0)
+    endSection (); // Sections are sequential, close the previous one
+
+  m_activeSection = sectionIndex (name);
+
+  if (m_gpuTimers)
+    {
+      FrameSlot &slot = m_slots[m_frameIndex % kFrameLatency];
+      if (slot.traced)
+        m_gl45->glQueryCounter (slot.sectionStamps[m_activeSection],
+                                GL_TIMESTAMP);
+      glBeginQuery (GL_TIME_ELAPSED, slot.sectionQueries[m_activeSection]);
+      slot.sectionUsed[m_activeSection] = true;
+    }
+
+  m_sectionTraceStart = Tracer::enabled () ? Tracer::now () : -1;
+  m_sectionTimer.start ();
+}
+
+void
+Profiler::endSection ()
+{
+  if (m_activeSection < 0)
+    return;
+
+  if (m_gpuTimers)
+    glEndQuery (GL_TIME_ELAPSED);
+
+  m_sections[m_activeSection].cpu.add (m_sectionTimer.nsecsElapsed ()
+                                       / 1.0e6);
+  if (m_sectionTraceStart >= 0)
+    Tracer::complete ("render", m_sections[m_activeSection].label,
+                      m_sectionTraceStart, Tracer::now ());
+  m_activeSection = -1;
+}
+
+void
+Profiler::countDraw (unsigned long long triangles)
+{
+  m_current.drawCalls++;
+  m_current.triangles += triangles;
+}
+
+void
+Profiler::flush ()
+{
+  if (!m_gpuTimers)
+    return;
+
+  for (int i = 0; i < kFrameLatency; i++)
+    collect (m_slots[(m_frameIndex + i) % kFrameLatency], true);
+}
+
+ProfilerSnapshot
+Profiler::snapshot () const
+{
+  ProfilerSnapshot snap;
+  snap.counters = m_lastCounters;
+  snap.gpuTimersAvailable = m_gpuTimers;
+
+  auto fill = [] (const Section &section) {
+    ProfileSectionStats stats;
+    stats.name = section.name;
+    stats.cpuAvg = section.cpu.average ();
+    stats.cpuP50 = section.cpu.percentile (50.0);
+    stats.cpuP95 = section.cpu.percentile (95.0);
+    stats.cpuP99 = section.cpu.percentile (99.0);
+    stats.gpuAvg = section.gpu.average ();
+    stats.gpuP50 = section.gpu.percentile (50.0);
+    stats.gpuP95 = section.gpu.percentile (95.0);
+    stats.gpuP99 = section.gpu.percentile (99.0);
+    stats.gpuSamples = section.gpu.count ();
+    return stats;
+  };
+
+  snap.sections.push_back (fill (m_frame));
+  for (const auto &section : m_sections)
+    snap.sections.push_back (fill (section));
+
+  return snap;
+}
@@ -0,0 +1,177 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QElapsedTimer>
+#include <QOpenGLExtraFunctions>
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+class QOpenGLFunctions_4_5_Core;
+
+// Fixed-size history of samples (in milliseconds) with rolling statistics.
+class RollingStats
+{
+public:
+  explicit RollingStats (int capacity = 240);
+
+  void add (double value);
+  void clear ();
+  void setCapacity (int capacity);
+
+  int
+  count () const
+  {
+    return m_count;
+  }
+
+  double last () const;
+  double average () const;
+  double max () const;
+  double percentile (double p) const; // p in [0, 100]
+
+private:
+  std::vector<double> m_samples;
+  int m_capacity;
+  int m_head = 0; // Next slot to overwrite
+  int m_count = 0;
+};
+
+struct ProfileSectionStats
+{
+  QString name;
+  double cpuAvg = 0.0;
+  double cpuP50 = 0.0;
+  double cpuP95 = 0.0;
+  double cpuP99 = 0.0;
+  double gpuAvg = 0.0;
+  double gpuP50 = 0.0;
+  double gpuP95 = 0.0;
+  double gpuP99 = 0.0;
+  int gpuSamples = 0;
+};
+
+struct FrameCounters
+{
+  unsigned int drawCalls = 0;
+  unsigned long long triangles = 0;
+};
+
+struct ProfilerSnapshot
+{
+  // First entry is always the whole frame, followed by the passes in
+  // submission order.
+  std::vector<ProfileSectionStats> sections;
+  FrameCounters counters; // Last completed frame
+  bool gpuTimersAvailable = false;
+};
+
+// Per-pass CPU and GPU timing.
+//
+// GPU times come from GL_TIME_ELAPSED queries around each pass and a pair of
+// GL_TIMESTAMP queries around the whole frame. Query objects live in a ring
+// of kFrameLatency frames and results are only read back once
+// GL_QUERY_RESULT_AVAILABLE reports them ready, so profiling never stalls the
+// pipeline. Passes must not nest (GL only allows one active
+// GL_TIME_ELAPSED query at a time).
+//
+// While the Tracer is on, frames and passes are also traced: CPU spans on
+// the rendering thread, and GPU spans placed by an extra GL_TIMESTAMP query
+// at the start of each pass, shifted onto the CPU clock.
+class Profiler : protected QOpenGLExtraFunctions
+{
+public:
+  static constexpr int kFrameLatency = 4;
+
+  Profiler ();
+  ~Profiler ();
+
+  void init (); // Requires a current context
+  void setHistorySize (int frames);
+
+  void beginFrame ();
+  void endFrame ();
+  void beginSection (const char *name);
+  void endSection ();
+
+  void countDraw (unsigned long long triangles);
+
+  // Blocks until every outstanding query has a result. Only meant for
+  // offline use (benchmarks), never for the interactive loop.
+  void flush ();
+
+  ProfilerSnapshot snapshot () const;
+
+private:
+  struct Section
+  {
+    QString name;
+    const char *label = ""; // As passed to beginSection, for the trace
+    RollingStats cpu;
+    RollingStats gpu;
+  };
+
+  struct FrameSlot
+  {
+    std::vector<unsigned int> sectionQueries; // One per section
+    std::vector<bool> sectionUsed;
+    std::vector<unsigned int> sectionStamps; // Starts, when traced
+    unsigned int beginStamp = 0;
+    unsigned int endStamp = 0;
+    bool pending = false;
+    bool traced = false;
+  };
+
+  int sectionIndex (const char *name);
+  bool collect (FrameSlot &slot, bool wait);
+  void traceGpu (const FrameSlot &slot, GLuint64 begin, GLuint64 end);
+
+  QOpenGLFunctions_4_5_Core *m_gl45 = nullptr;
+  bool m_gpuTimers = false;
+
+  Section m_frame;
+  std::vector<Section> m_sections;
+  FrameSlot m_slots[kFrameLatency];
+  int m_frameIndex = 0;
+  int m_historySize = 240;
+
+  int m_activeSection = -1;
+  bool m_inFrame = false;
+  QElapsedTimer m_frameTimer;
+  QElapsedTimer m_sectionTimer;
+
+  // Trace starts on the Tracer clock, -1 when not traced
+  int64_t m_frameTraceStart = -1;
+  int64_t m_sectionTraceStart = -1;
+  // Tracer::now () minus GL_TIMESTAMP, measured once per trace session
+  int64_t m_gpuClockOffset = 0;
+  bool m_gpuClockValid = false;
+
+  FrameCounters m_current;
+  FrameCounters m_lastCounters;
+};
+
+// RAII helper that times a block on both CPU and GPU.
+class ProfileScope
+{
+public:
+  ProfileScope (Profiler *profiler, const char *name) : m_profiler (profiler)
+  {
+    if (m_profiler)
+      m_profiler->beginSection (name);
+  }
+
+  ~ProfileScope ()
+  {
+    if (m_profiler)
+      m_profiler->endSection ();
+  }
+
+  ProfileScope (const ProfileScope &) = delete;
+  ProfileScope &operator= (const ProfileScope &) = delete;
+
+private:
+  Profiler *m_profiler;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,84 @@
+#include "profilerpanel.h"
+#include "glviewwidget.h"
+
+#include <QHeaderView>
+#include <QLabel>
+#include <QTableWidget>
+#include <QVBoxLayout>
+
+ProfilerPanel::ProfilerPanel (GLViewWidget *view, QWidget *parent)
+    : QDockWidget ("Profiler", parent), m_view (view)
+{
+  setObjectName ("ProfilerPanel");
+
+  QWidget *content = new QWidget (this);
+  QVBoxLayout *layout = new QVBoxLayout (content);
+  layout->setContentsMargins (6, 6, 6, 6);
+
+  const QStringList headers = { "Pass",    "CPU avg", "CPU p50",
+                                "CPU p95", "CPU p99", "GPU avg",
+                                "GPU p50", "GPU p95", "GPU p99" };
+  m_table = new QTableWidget (0, headers.size (), content);
+  m_table->setHorizontalHeaderLabels (headers);
+  m_table->verticalHeader ()->setVisible (false);
+  m_table->setEditTriggers (QAbstractItemView::NoEditTriggers);
+  m_table->setSelectionMode (QAbstractItemView::NoSelection);
+  m_table->horizontalHeader ()->setSectionResizeMode (
+      QHeaderView::ResizeToContents);
+  layout->addWidget (m_table);
+
+  m_counters = new QLabel (content);
+  layout->addWidget (m_counters);
+
+  setWidget (content);
+
+  // Only poll while the panel is visible
+  connect (&m_refreshTimer, &QTimer::timeout, this, &ProfilerPanel::refresh);
+  connect (this, &QDockWidget::visibilityChanged, this,
+           [this] (bool visible) {
+             if (visible)
+               m_refreshTimer.start (250);
+             else
+               m_refreshTimer.stop ();
+           });
+}
+
+void
+ProfilerPanel::refresh ()
+{
+  ProfilerSnapshot snap = m_view->profilerSnapshot ();
+
+  m_table->setRowCount ((int)snap.sections.size ());
+  for (int row = 0; row < (int)snap.sections.size (); row++)
+    {
+      const ProfileSectionStats &s = snap.sections[row];
+      const double values[] = { s.cpuAvg, s.cpuP50, s.cpuP95, s.cpuP99,
+                                s.gpuAvg, s.gpuP50, s.gpuP95, s.gpuP99 };
+
+      auto setCell = [this, row] (int column, const QString &text) {
+        QTableWidgetItem *item = m_table->item (row, column);
+        if (!item)
+          {
+            item = new QTableWidgetItem ();
+            m_table->setItem (row, column, item);
+          }
+        item->setText (text);
+      };
+
+      setCell (0, s.name);
+      for (int i = 0; i < 8; i++)
+        {
+          bool gpuColumn = (i >= 4);
+          if (gpuColumn && s.gpuSamples == 0)
+            setCell (i + 1, "-");
+          else
+            setCell (i + 1, QString::number (values[i], 'f', 3));
+        }
+    }
+
+  m_counters->setText (
+      QString ("Draw calls: %1    Triangles: %2    GPU timers: %3")
+          .arg (snap.counters.drawCalls)
+          .arg (snap.counters.triangles)
+          .arg (snap.gpuTimersAvailable ? "on" : "off"));
+}
@@ -0,0 +1,29 @@
+#ifndef PROFILERPANEL_H
+#define PROFILERPANEL_H
+
+#include <QDockWidget>
+#include <QTimer>
+
+class GLViewWidget;
+class QLabel;
+class QTableWidget;
+
+// Dockable table of per-pass timings, polled from the GL view.
+class ProfilerPanel : public QDockWidget
+{
+  Q_OBJECT
+
+public:
+  explicit ProfilerPanel (GLViewWidget *view, QWidget *parent = nullptr);
+
+private slots:
+  void refresh ();
+
+private:
+  GLViewWidget *m_view;
+  QTableWidget *m_table;
+  QLabel *m_counters;
+  QTimer m_refreshTimer;
+};
+
+#endif // PROFILERPANEL_H
@@ -0,0 +1,323 @@
+#include "renderbenchmark.h"
+#include "camera.h"
+#include "deferredrenderer.h"
+#include "gltfloader.h"
+#include "shadercache.h"
+#include "textureprocessor.h"
+
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <cmath>
+#include <cstdio>
+#include <glm/gtc/constants.hpp>
+#include <memory>
+
+int
+RenderBenchmark::runFromCommandLine (const QStringList &arguments)
+{
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy headless renderer benchmark");
+  parser.addHelpOption ();
+
+  QCommandLineOption benchOpt ("bench", "Model to render.", "model");
+  QCommandLineOption framesOpt ("frames", "Number of measured frames.",
+                                "count", "500");
+  QCommandLineOption warmupOpt ("warmup", "Unmeasured warm-up frames.",
+                                "count", "30");
+  QCommandLineOption sizeOpt ("size", "Framebuffer size.", "WxH",
+                              "1920x1080");
+  QCommandLineOption coldOpt ("cold-shader-cache",
+                              "Clear the shader cache before starting.");
+  QCommandLineOption uberOpt ("uber-shader",
+                              "Use the runtime-branching geometry shader.");
+  QCommandLineOption rawOpt ("raw-textures",
+                             "Upload RGBA8 and build mips on the GPU.");
+  QCommandLineOption derivativeOpt (
+      "derivative-tangents",
+      "Build the normal-map frame from screen-space derivatives.");
+  parser.addOptions ({ benchOpt, framesOpt, warmupOpt, sizeOpt, coldOpt,
+                       uberOpt, rawOpt, derivativeOpt });
+  parser.process (arguments);
+
+  Options options;
+  options.modelPath = parser.value (benchOpt);
+  options.frames = parser.value (framesOpt).toInt ();
+  options.warmupFrames = parser.value (warmupOpt).toInt ();
+  options.coldShaderCache = parser.isSet (coldOpt);
+  options.uberShader = parser.isSet (uberOpt);
+  options.rawTextures = parser.isSet (rawOpt);
+  options.derivativeTangents = parser.isSet (derivativeOpt);
+
+  const QStringList dims = parser.value (sizeOpt).split ('x');
+  if (dims.size () == 2)
+    options.size = QSize (dims[0].toInt (), dims[1].toInt ());
+
+  if (options.modelPath.isEmpty () || options.frames <= 0
+      || options.size.isEmpty ())
+    {
+      std::fprintf (stderr, "Usage: mesh-spy --bench model.glb "
+                            "[--frames N] [--warmup N] [--size WxH] "
+                            "[--cold-shader-cache] [--uber-shader] "
+                            "[--raw-textures] [--derivative-tangents]\n");
+      return 2;
+    }
+
+  QString errorMsg;
+  QJsonObject report = run (options, &errorMsg);
+  if (report.isEmpty ())
+    {
+      std::fprintf (stderr, "Benchmark failed: %s\n", qPrintable (errorMsg));
+      return 1;
+    }
+
+  std::fputs (QJsonDocument (report).toJson (QJsonDocument::Indented)
+                  .constData (),
+              stdout);
+  return 0;
+}
+
+QJsonObject
+RenderBenchmark::statsToJson (const ProfileSectionStats &stats)
+{
+  QJsonObject cpu{ { "avg", stats.cpuAvg },
+                   { "p50", stats.cpuP50 },
+                   { "p95", stats.cpuP95 },
+                   { "p99", stats.cpuP99 } };
+  QJsonObject gpu{ { "avg", stats.gpuAvg },
+                   { "p50", stats.gpuP50 },
+                   { "p95", stats.gpuP95 },
+                   { "p99", stats.gpuP99 },
+                   { "samples", stats.gpuSamples } };
+  return QJsonObject{ { "name", stats.name }, { "cpu", cpu }, { "gpu", gpu } };
+}
+
+QJsonObject
+RenderBenchmark::run (const Options &options, QString *errorMsg)
+{
+  QOpenGLContext context;
+  context.setFormat (QSurfaceFormat::defaultFormat ());
+  if (!context.create ())
+    {
+      *errorMsg = "Could not create an OpenGL context.";
+      return QJsonObject ();
+    }
+
+  QOffscreenSurface surface;
+  surface.setFormat (context.format ());
+  surface.create ();
+  if (!context.makeCurrent (&surface))
+    {
+      *errorMsg = "Could not make the offscreen context current.";
+      return QJsonObject ();
+    }
+
+  QOpenGLFunctions *gl = context.functions ();
+  QJsonObject glInfo{
+    { "vendor", (const char *)gl->glGetString (GL_VENDOR) },
+    { "renderer", (const char *)gl->glGetString (GL_RENDERER) },
+    { "version", (const char *)gl->glGetString (GL_VERSION) }
+  };
+
+  QJsonObject report;
+  {
+    // Combined depth/stencil gives DEPTH24_STENCIL8, matching the G-Buffer
+    // so the depth blit before the skybox is legal.
+    QOpenGLFramebufferObject target (
+        options.size, QOpenGLFramebufferObject::CombinedDepthStencil);
+    if (!target.isValid ())
+      {
+        *errorMsg = "Could not create the offscreen framebuffer.";
+        context.doneCurrent ();
+        return QJsonObject ();
+      }
+
+    LoaderOptions loaderOptions;
+    loaderOptions.processTextures = !options.rawTextures;
+    if (!options.rawTextures)
+      loaderOptions.textureCodecs
+          = TextureProcessor::supportedCodecs (&context);
+
+    QElapsedTimer timer;
+    timer.start ();
+    std::unique_ptr<SceneData> data (
+        GLTFLoader::load (options.modelPath, errorMsg, loaderOptions));
+    if (!data)
+      {
+        context.doneCurrent ();
+        return QJsonObject ();
+      }
+    double loadMs = timer.nsecsElapsed () / 1.0e6;
+
+    const int width = options.size.width ();
+    const int height = options.size.height ();
+
+    Camera camera;
+    camera.setViewportSize (width, height);
+
+    if (options.coldShaderCache)
+      ShaderCache ().clear ();
+
+    timer.restart ();
+    DeferredRenderer renderer;
+    renderer.init (width, height);
+    renderer.setTargetFramebuffer (target.handle ());
+    RenderConfig config;
+    config.uberShader = options.uberShader;
+    config.derivativeTangents = options.derivativeTangents;
+    renderer.setConfig (config);
+    gl->glFinish ();
+    double initMs = timer.nsecsElapsed () / 1.0e6;
+    const ShaderCacheStats cacheStats = renderer.shaderCache ()->stats ();
+
+    timer.restart ();
+    renderer.loadModel (data.get ());
+    gl->glFinish ();
+    double uploadMs = timer.nsecsElapsed () / 1.0e6;
+
+    const LoadStats loadStats = data->stats;
+    glm::vec3 center = (data->minBounds + data->maxBounds) * 0.5f;
+    float size = glm::length (data->maxBounds - data->minBounds);
+    camera.setTarget (center);
+    data.reset ();
+
+    // Scripted path: one full orbit over the run with the camera bobbing in
+    // elevation and dollying in and out, so both near (fragment bound) and
+    // far (vertex bound) views are covered.
+    auto placeCamera = [&camera, size] (int frame, int total) {
+      float t = (float)frame / (float)total;
+      float wave = glm::two_pi<float> () * t;
+      float phi = glm::radians (65.0f)
+                  + glm::radians (25.0f) * std::sin (2.0f * wave);
+      camera.setAngles (wave, phi);
+      camera.setDistance (size * (1.25f + 0.5f * std::cos (wave)));
+    };
+
+    Profiler *profiler = renderer.profiler ();
+
+    for (int i = 0; i < options.warmupFrames; i++)
+      {
+        placeCamera (i, options.warmupFrames);
+        renderer.render (&camera, 0.0f);
+      }
+    gl->glFinish ();
+    profiler->flush ();
+    profiler->setHistorySize (options.frames); // Also resets the history
+
+    timer.restart ();
+    for (int i = 0; i < options.frames; i++)
+      {
+        placeCamera (i, options.frames);
+        renderer.render (&camera, 0.0f);
+      }
+    gl->glFinish ();
+    double wallMs = timer.nsecsElapsed () / 1.0e6;
+    profiler->flush ();
+
+    ProfilerSnapshot snap = profiler->snapshot ();
+
+    // Reference frame for image comparisons: first pose of the path.
+    placeCamera (0, options.frames);
+    renderer.render (&camera, 0.0f);
+    gl->glFinish ();
+    QImage image = target.toImage ().convertToFormat (QImage::Format_RGBA8888);
+
+    // A frame of one color means nothing was drawn (e.g. a wrong
+    // viewport); its timings and checksum would compare nothing
+    QCryptographicHash hash (QCryptographicHash::Sha1);
+    bool flat = true;
+    const QRgb first = image.pixel (0, 0);
+    for (int y = 0; y < image.height (); y++)
+      {
+        hash.addData (QByteArrayView (
+            reinterpret_cast<const char *> (image.constScanLine (y)),
+            image.width () * 4));
+        for (int x = 0; x < image.width () && flat; x++)
+          flat = image.pixel (x, y) == first;
+      }
+    if (flat)
+      qWarning () << "Benchmark: the reference frame is a single color";
+
+    // Coarse thumbnail that survives driver-level rounding differences
+    QImage thumb = image.scaled (16, 9, Qt::IgnoreAspectRatio,
+                                 Qt::SmoothTransformation);
+    QJsonArray fingerprint;
+    for (int y = 0; y < thumb.height (); y++)
+      {
+        const uchar *row = thumb.constScanLine (y);
+        for (int x = 0; x < thumb.width (); x++)
+          {
+            for (int c = 0; c < 3; c++)
+              fingerprint.append ((int)row[x * 4 + c]);
+          }
+      }
+
+    QJsonArray passes;
+    for (size_t i = 1; i < snap.sections.size (); i++)
+      passes.append (statsToJson (snap.sections[i]));
+
+    report["model"] = options.modelPath;
+    report["width"] = width;
+    report["height"] = height;
+    report["frames"] = options.frames;
+    report["gl"] = glInfo;
+    report["startup"] = QJsonObject{
+      { "initMs", initMs },
+      { "shaderMs", cacheStats.totalMs },
+      { "shaderCacheHits", cacheStats.hits },
+      { "shaderCacheMisses", cacheStats.misses },
+      { "shaderCacheRejected", cacheStats.rejected },
+    };
+    report["loadMs"] = loadMs;
+    report["uploadMs"] = uploadMs;
+    report["wallMs"] = wallMs;
+    report["fps"] = options.frames / (wallMs / 1000.0);
+    report["frame"] = statsToJson (snap.sections[0]);
+    report["passes"] = passes;
+    report["geometryShader"] = options.uberShader ? "uber" : "variants";
+    report["geometryVariants"] = renderer.geometryVariantCount ();
+    report["tangentFrame"]
+        = options.derivativeTangents ? "derivative" : "vertex";
+    report["drawCalls"] = (int)snap.counters.drawCalls;
+    report["triangles"] = (double)snap.counters.triangles;
+    report["gpuMemoryBytes"] = (double)renderer.gpuMemoryBytes ();
+    const RenderGraphStats graph = renderer.renderGraphStats ();
+    report["renderGraph"] = QJsonObject{
+      { "passes", graph.passes },
+      { "culled", graph.culled },
+      { "transients", graph.transients },
+      { "allocations", graph.allocations },
+      { "naiveBytes", (double)graph.naiveBytes },
+      { "peakBytes", (double)graph.peakBytes },
+      { "allocatedBytes", (double)graph.allocatedBytes },
+    };
+    report["textures"] = QJsonObject{
+      { "processMs", loadStats.textureProcessMs },
+      { "uncompressedBytes", (double)loadStats.textureBytesUncompressed },
+      { "uploadedBytes", (double)loadStats.textureBytes },
+      { "codecs", (int)loaderOptions.textureCodecs },
+    };
+    report["tangentMs"] = loadStats.tangentMs;
+    report["dedup"] = QJsonObject{
+      { "ms", loadStats.dedupMs },
+      { "textures", (double)loadStats.duplicateTextures },
+      { "materials", (double)loadStats.duplicateMaterials },
+      { "meshes", (double)loadStats.duplicateMeshes },
+      { "bytes", (double)loadStats.dedupBytes },
+    };
+    report["imageChecksum"] = QString (hash.result ().toHex ());
+    report["imageFingerprint"] = fingerprint;
+    report["imageFlat"] = flat;
+  }
+
+  context.doneCurrent ();
+  return report;
+}
@@ -0,0 +1,44 @@
+#ifndef RENDERBENCHMARK_H
+#define RENDERBENCHMARK_H
+
+#include "profiler.h"
+
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+// Headless renderer benchmark.
+//
+// Creates a QOffscreenSurface and an FBO, loads a model synchronously and
+// drives DeferredRenderer along a scripted orbit. Runs anywhere a GL 4.5 core
+// context can be created, including Mesa's llvmpipe
+// (LIBGL_ALWAYS_SOFTWARE=1).
+class RenderBenchmark
+{
+public:
+  struct Options
+  {
+    QString modelPath;
+    int frames = 500;
+    int warmupFrames = 30;
+    QSize size = QSize (1920, 1080);
+    bool coldShaderCache = false; // Clear cached program binaries first
+    bool uberShader = false;      // RenderConfig::uberShader
+    bool rawTextures = false;     // Skip loader mips and compression
+    bool derivativeTangents = false; // RenderConfig::derivativeTangents
+  };
+
+  // Parses "--bench model.glb [--frames N] [--warmup N] [--size WxH]
+  // [--cold-shader-cache] [--uber-shader] [--raw-textures]
+  // [--derivative-tangents]", runs the benchmark and prints the JSON report
+  // to stdout. Returns the process exit code.
+  static int runFromCommandLine (const QStringList &arguments);
+
+  // Returns an empty object and fills errorMsg on failure.
+  static QJsonObject run (const Options &options, QString *errorMsg);
+
+  static QJsonObject statsToJson (const ProfileSectionStats &stats);
+};
+
+#endif // RENDERBENCHMARK_H
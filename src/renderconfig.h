@@ -8,6 +8,14 @@ struct RenderConfig
   bool useRoughnessMap = true;
   bool useNormalMap = true;
   bool wireframe = false;
+
+  // Use the single runtime-branching geometry shader instead of the
+  // per-material variants (for comparisons only).
+  bool uberShader = false;
+
+  // Build the normal-map tangent frame per pixel from dFdx/dFdy instead of
+  // the loader's MikkTSpace tangents (for comparisons only).
+  bool derivativeTangents = false;
 };
 
 #endif // RENDERCONFIG_H
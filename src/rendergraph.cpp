@@ -0,0 +1,411 @@
+#include "rendergraph.h"
+#include "profiler.h"
+
+#include <QDebug>
+#include <algorithm>
+
+namespace
+{
+size_t
+bytesPerPixel (unsigned int format)
+{
+  switch (format)
+    {
+    case GL_R8:
+      return 1;
+    case GL_R16F:
+      return 2;
+    case GL_RGBA32F:
+      return 16;
+    case GL_RGBA16F:
+      return 8;
+    default: // RGBA8, RG16F, R32F, DEPTH24_STENCIL8, DEPTH_COMPONENT32F
+      return 4;
+    }
+}
+
+GLenum
+attachmentPoint (unsigned int format)
+{
+  switch (format)
+    {
+    case GL_DEPTH24_STENCIL8:
+    case GL_DEPTH32F_STENCIL8:
+      return GL_DEPTH_STENCIL_ATTACHMENT;
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32F:
+      return GL_DEPTH_ATTACHMENT;
+    default:
+      return GL_COLOR_ATTACHMENT0;
+    }
+}
+} // namespace
+
+RenderGraph::RenderGraph () {}
+
+RenderGraph::~RenderGraph ()
+{
+  for (auto &entry : m_framebuffers)
+    glDeleteFramebuffers (1, &entry.second.first);
+  for (const Physical &physical : m_physical)
+    glDeleteTextures (1, &physical.texture);
+}
+
+void
+RenderGraph::init ()
+{
+  initializeOpenGLFunctions ();
+}
+
+void
+RenderGraph::begin (int width, int height)
+{
+  m_width = width;
+  m_height = height;
+  m_resources.clear ();
+  m_passes.clear ();
+}
+
+RenderResource
+RenderGraph::createTexture (const char *name, unsigned int format)
+{
+  Resource resource;
+  resource.name = name;
+  resource.format = format;
+  m_resources.push_back (resource);
+  return (RenderResource)m_resources.size () - 1;
+}
+
+RenderResource
+RenderGraph::importFramebuffer (const char *name, unsigned int fbo)
+{
+  Resource resource;
+  resource.name = name;
+  resource.fbo = fbo;
+  resource.imported = true;
+  m_resources.push_back (resource);
+  return (RenderResource)m_resources.size () - 1;
+}
+
+void
+RenderGraph::addPass (RenderPassDesc desc)
+{
+  Pass pass;
+  pass.desc = std::move (desc);
+  m_passes.push_back (std::move (pass));
+}
+
+void
+RenderGraph::cull ()
+{
+  // 1. Reference counts: outputs per pass, readers per resource
+  for (size_t p = 0; p < m_passes.size (); p++)
+    {
+      Pass &pass = m_passes[p];
+      const RenderPassDesc &desc = pass.desc;
+      std::vector<RenderResource> writes = desc.colors;
+      if (desc.depth >= 0 && desc.depthWrite)
+        writes.push_back (desc.depth);
+      for (RenderResource r : writes)
+        {
+          m_resources[r].writers.push_back ((int)p);
+          pass.refs++;
+          pass.root |= m_resources[r].imported;
+        }
+      for (RenderResource r : desc.reads)
+        m_resources[r].readers++;
+      if (desc.depth >= 0 && !desc.depthWrite)
+        m_resources[desc.depth].readers++;
+    }
+
+  // 2. Flood from the transients nobody reads: a writer with no output
+  // left is culled, which may leave its own inputs unread
+  std::vector<int> unread;
+  for (size_t r = 0; r < m_resources.size (); r++)
+    if (!m_resources[r].imported && m_resources[r].readers == 0)
+      unread.push_back ((int)r);
+  while (!unread.empty ())
+    {
+      const Resource &resource = m_resources[unread.back ()];
+      unread.pop_back ();
+      for (int p : resource.writers)
+        {
+          Pass &pass = m_passes[p];
+          if (pass.root || pass.culled || --pass.refs > 0)
+            continue;
+          pass.culled = true;
+          std::vector<RenderResource> inputs = pass.desc.reads;
+          if (pass.desc.depth >= 0 && !pass.desc.depthWrite)
+            inputs.push_back (pass.desc.depth);
+          for (RenderResource r : inputs)
+            if (--m_resources[r].readers == 0 && !m_resources[r].imported)
+              unread.push_back (r);
+        }
+    }
+}
+
+void
+RenderGraph::allocate ()
+{
+  // 1. Lifetimes over the passes that run
+  for (size_t p = 0; p < m_passes.size (); p++)
+    {
+      const Pass &pass = m_passes[p];
+      if (pass.culled)
+        continue;
+      auto touch = [&] (RenderResource r) {
+        Resource &resource = m_resources[r];
+        if (resource.first < 0)
+          resource.first = (int)p;
+        resource.last = (int)p;
+      };
+      for (RenderResource r : pass.desc.reads)
+        touch (r);
+      for (RenderResource r : pass.desc.colors)
+        touch (r);
+      if (pass.desc.depth >= 0)
+        touch (pass.desc.depth);
+    }
+
+  std::vector<int> order;
+  for (size_t r = 0; r < m_resources.size (); r++)
+    if (!m_resources[r].imported && m_resources[r].first >= 0)
+      order.push_back ((int)r);
+  std::stable_sort (order.begin (), order.end (), [this] (int a, int b) {
+    return m_resources[a].first < m_resources[b].first;
+  });
+
+  // 2. Peak: the most bytes alive at any one pass
+  const size_t pixels = (size_t)m_width * m_height;
+  for (size_t p = 0; p < m_passes.size (); p++)
+    {
+      size_t live = 0;
+      for (int r : order)
+        if (m_resources[r].first <= (int)p && (int)p <= m_resources[r].last)
+          live += pixels * bytesPerPixel (m_resources[r].format);
+      m_stats.peakBytes = std::max (m_stats.peakBytes, live);
+    }
+
+  // 3. First fit: a texture of the same size and format that this frame
+  // already used and that is free again, else one left over from earlier
+  // frames, else a new one
+  for (Physical &physical : m_physical)
+    {
+      physical.used = false;
+      physical.busyUntil = -1;
+    }
+  for (int r : order)
+    {
+      Resource &resource = m_resources[r];
+      int match = -1;
+      for (size_t i = 0; i < m_physical.size (); i++)
+        {
+          const Physical &physical = m_physical[i];
+          if (physical.width != m_width || physical.height != m_height
+              || physical.format != resource.format
+              || physical.busyUntil >= resource.first)
+            continue;
+          if (physical.used)
+            {
+              match = (int)i;
+              break;
+            }
+          if (match < 0)
+            match = (int)i;
+        }
+
+      if (match < 0)
+        {
+          Physical physical;
+          physical.width = m_width;
+          physical.height = m_height;
+          physical.format = resource.format;
+          physical.bytes = pixels * bytesPerPixel (resource.format);
+          glGenTextures (1, &physical.texture);
+          glBindTexture (GL_TEXTURE_2D, physical.texture);
+          glTexStorage2D (GL_TEXTURE_2D, 1, resource.format, m_width,
+                          m_height);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+          m_physical.push_back (physical);
+          match = (int)m_physical.size () - 1;
+        }
+
+      Physical &physical = m_physical[match];
+      if (!physical.used)
+        {
+          m_stats.allocations++;
+          m_stats.allocatedBytes += physical.bytes;
+        }
+      physical.used = true;
+      physical.busyUntil = resource.last;
+      resource.physical = match;
+      m_stats.transients++;
+      m_stats.naiveBytes += physical.bytes;
+    }
+  glBindTexture (GL_TEXTURE_2D, 0);
+}
+
+unsigned int
+RenderGraph::framebuffer (const std::vector<unsigned int> &colors,
+                          unsigned int depth)
+{
+  std::vector<unsigned int> key = colors;
+  key.push_back (depth);
+  auto it = m_framebuffers.find (key);
+  if (it != m_framebuffers.end ())
+    {
+      it->second.second = true;
+      return it->second.first;
+    }
+
+  unsigned int fbo = 0;
+  glGenFramebuffers (1, &fbo);
+  glBindFramebuffer (GL_FRAMEBUFFER, fbo);
+  std::vector<GLenum> drawBuffers;
+  for (size_t i = 0; i < colors.size (); i++)
+    {
+      glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i,
+                              GL_TEXTURE_2D, colors[i], 0);
+      drawBuffers.push_back (GL_COLOR_ATTACHMENT0 + (GLenum)i);
+    }
+  if (drawBuffers.empty ())
+    drawBuffers.push_back (GL_NONE);
+  glDrawBuffers ((GLsizei)drawBuffers.size (), drawBuffers.data ());
+  if (depth)
+    {
+      // The depth key is the texture; its format picks the attachment
+      for (const Physical &physical : m_physical)
+        if (physical.texture == depth)
+          glFramebufferTexture2D (GL_FRAMEBUFFER,
+                                  attachmentPoint (physical.format),
+                                  GL_TEXTURE_2D, depth, 0);
+    }
+
+  if (glCheckFramebufferStatus (GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    qDebug () << "Render graph framebuffer not complete!";
+
+  m_framebuffers.emplace (key, std::make_pair (fbo, true));
+  return fbo;
+}
+
+unsigned int
+RenderGraph::readFramebuffer (RenderResource resource)
+{
+  const Resource &res = m_resources[resource];
+  if (res.imported)
+    return res.fbo;
+  if (res.physical < 0)
+    return 0;
+
+  const Physical &physical = m_physical[res.physical];
+  GLint previous = 0;
+  glGetIntegerv (GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+  const unsigned int fbo
+      = attachmentPoint (physical.format) == GL_COLOR_ATTACHMENT0
+            ? framebuffer ({ physical.texture }, 0)
+            : framebuffer ({}, physical.texture);
+  glBindFramebuffer (GL_FRAMEBUFFER, (GLuint)previous);
+  return fbo;
+}
+
+unsigned int
+RenderGraph::texture (RenderResource resource) const
+{
+  const int physical = m_resources[resource].physical;
+  return physical >= 0 ? m_physical[physical].texture : 0;
+}
+
+void
+RenderGraph::bindTextures (std::initializer_list<RenderResource> resources,
+                           unsigned int firstUnit)
+{
+  unsigned int unit = firstUnit;
+  for (RenderResource r : resources)
+    {
+      glActiveTexture (GL_TEXTURE0 + unit++);
+      glBindTexture (GL_TEXTURE_2D, texture (r));
+    }
+}
+
+void
+RenderGraph::releaseUnused ()
+{
+  for (auto it = m_framebuffers.begin (); it != m_framebuffers.end ();)
+    {
+      if (it->second.second)
+        {
+          it->second.second = false;
+          ++it;
+          continue;
+        }
+      glDeleteFramebuffers (1, &it->second.first);
+      it = m_framebuffers.erase (it);
+    }
+
+  std::vector<Physical> kept;
+  for (const Physical &physical : m_physical)
+    {
+      if (physical.used)
+        kept.push_back (physical);
+      else
+        glDeleteTextures (1, &physical.texture);
+    }
+  m_physical.swap (kept);
+}
+
+void
+RenderGraph::execute (Profiler *profiler)
+{
+  const RenderGraphStats previous = m_stats;
+  m_stats = RenderGraphStats ();
+  m_stats.passes = (int)m_passes.size ();
+
+  cull ();
+  allocate ();
+
+  for (const Pass &pass : m_passes)
+    {
+      if (pass.culled)
+        {
+          m_stats.culled++;
+          continue;
+        }
+      const RenderPassDesc &desc = pass.desc;
+      ProfileScope scope (profiler, desc.name);
+
+      // An imported framebuffer brings its own attachments
+      if (desc.colors.size () == 1 && m_resources[desc.colors[0]].imported)
+        glBindFramebuffer (GL_FRAMEBUFFER, m_resources[desc.colors[0]].fbo);
+      else
+        {
+          std::vector<unsigned int> colors;
+          for (RenderResource r : desc.colors)
+            colors.push_back (texture (r));
+          glBindFramebuffer (GL_FRAMEBUFFER,
+                             framebuffer (colors, desc.depth >= 0
+                                                      ? texture (desc.depth)
+                                                      : 0));
+        }
+
+      // Every target is frame sized. Offscreen surfaces start with a 1x1
+      // viewport and only QOpenGLWidget sets one of its own.
+      glViewport (0, 0, m_width, m_height);
+
+      if (desc.execute)
+        desc.execute ();
+    }
+
+  // Textures sized for another resolution or no longer declared go now;
+  // the next frame would not reuse them
+  releaseUnused ();
+
+  if (!(m_stats == previous))
+    qDebug () << "Render graph:" << m_stats.passes << "passes,"
+              << m_stats.culled << "culled," << m_stats.transients
+              << "transient textures in" << m_stats.allocations
+              << "allocations:" << m_stats.allocatedBytes / 1048576.0
+              << "MB allocated, peak" << m_stats.peakBytes / 1048576.0
+              << "MB live, naive" << m_stats.naiveBytes / 1048576.0 << "MB";
+}
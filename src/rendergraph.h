@@ -0,0 +1,159 @@
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include <QOpenGLExtraFunctions>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <vector>
+
+class Profiler;
+
+// Handle of a texture or framebuffer declared for the current frame
+using RenderResource = int;
+
+struct RenderGraphStats
+{
+  int passes = 0;            // Declared
+  int culled = 0;            // Nothing read what they wrote
+  int transients = 0;        // Textures the remaining passes use
+  int allocations = 0;       // Textures backing them after aliasing
+  size_t naiveBytes = 0;     // One allocation per transient
+  size_t peakBytes = 0;      // Most transient bytes alive at one pass
+  size_t allocatedBytes = 0; // What the allocations hold
+
+  bool
+  operator== (const RenderGraphStats &o) const
+  {
+    return passes == o.passes && culled == o.culled
+           && transients == o.transients && allocations == o.allocations
+           && naiveBytes == o.naiveBytes && peakBytes == o.peakBytes
+           && allocatedBytes == o.allocatedBytes;
+  }
+};
+
+// One pass and the resources it touches. Everything it writes is listed
+// in `colors` (attachments in location order, or a single imported
+// framebuffer) and `depth`; everything it samples or blits from in
+// `reads`.
+struct RenderPassDesc
+{
+  const char *name = "";
+  std::vector<RenderResource> reads;
+  std::vector<RenderResource> colors;
+  RenderResource depth = -1;
+  bool depthWrite = true; // False: depth tested only, which is a read
+  std::function<void ()> execute;
+};
+
+// Per-frame graph of the renderer's passes.
+//
+// The frame is declared from scratch every time: transient textures
+// (screen-sized, by internal format), imported framebuffers, and passes in
+// execution order. execute() then
+//  1. culls passes whose outputs no later pass reads; passes writing an
+//     imported framebuffer are the roots and always run,
+//  2. takes each transient's lifetime from its first to its last pass,
+//  3. aliases transients of the same format whose lifetimes do not
+//     overlap onto one texture (GL has no placed resources, so the
+//     texture object is the unit of memory that is shared),
+//  4. runs the passes with a framebuffer over their attachments bound,
+//     each in its own profiler section.
+// Textures and framebuffers are pooled across frames and released once a
+// frame no longer uses them. A transient's content is undefined when its
+// lifetime starts: the first pass writing it must clear it.
+class RenderGraph : protected QOpenGLExtraFunctions
+{
+public:
+  RenderGraph ();
+  ~RenderGraph ();
+
+  void init ();
+
+  // Starts declaring a frame whose transients are width x height
+  void begin (int width, int height);
+
+  RenderResource createTexture (const char *name, unsigned int format);
+  RenderResource importFramebuffer (const char *name, unsigned int fbo);
+  void addPass (RenderPassDesc pass);
+
+  void execute (Profiler *profiler);
+
+  // While a pass executes: the texture behind a resource it reads, bound
+  // to consecutive units from `firstUnit`
+  void bindTextures (std::initializer_list<RenderResource> resources,
+                     unsigned int firstUnit = 0);
+
+  // A framebuffer with only `resource` attached, to blit from
+  unsigned int readFramebuffer (RenderResource resource);
+
+  // The last executed frame
+  const RenderGraphStats &
+  stats () const
+  {
+    return m_stats;
+  }
+
+  size_t
+  memoryBytes () const
+  {
+    return m_stats.allocatedBytes;
+  }
+
+private:
+  struct Resource
+  {
+    const char *name = "";
+    unsigned int format = 0; // Transients only
+    unsigned int fbo = 0;    // Imported only
+    bool imported = false;
+    std::vector<int> writers; // Pass indices
+    int readers = 0;
+    int first = -1; // Lifetime over the passes that run
+    int last = -1;
+    int physical = -1;
+  };
+
+  struct Pass
+  {
+    RenderPassDesc desc;
+    int refs = 0; // Outputs still read by someone
+    bool root = false;
+    bool culled = false;
+  };
+
+  struct Physical
+  {
+    unsigned int texture = 0;
+    int width = 0;
+    int height = 0;
+    unsigned int format = 0;
+    size_t bytes = 0;
+    int busyUntil = -1; // Last pass of its current resource this frame
+    bool used = false;
+  };
+
+  // Texture behind a transient, 0 for imported or unallocated ones
+  unsigned int texture (RenderResource resource) const;
+
+  void cull ();
+  void allocate ();
+  unsigned int framebuffer (const std::vector<unsigned int> &colors,
+                            unsigned int depth);
+  void releaseUnused ();
+
+  int m_width = 0;
+  int m_height = 0;
+  std::vector<Resource> m_resources;
+  std::vector<Pass> m_passes;
+
+  std::vector<Physical> m_physical;
+  // Attachments (colors then depth) to framebuffer, and whether this
+  // frame used it
+  std::map<std::vector<unsigned int>, std::pair<unsigned int, bool>>
+      m_framebuffers;
+
+  RenderGraphStats m_stats;
+};
+
+#endif // RENDERGRAPH_H
@@ -0,0 +1,205 @@
+#include "scenededup.h"
+#include "parallel.h"
+
+#include <QHashFunctions>
+#include <algorithm>
+#include <unordered_map>
+
+// Material fields that decide how a material renders
+static std::vector<float>
+materialKey (const MaterialData &material)
+{
+  return { material.baseColorFactor.r,
+           material.baseColorFactor.g,
+           material.baseColorFactor.b,
+           material.baseColorFactor.a,
+           material.metallicFactor,
+           material.roughnessFactor,
+           (float)material.alphaMode,
+           material.alphaCutoff,
+           (float)material.baseColorIndex,
+           (float)material.metallicRoughnessIndex,
+           (float)material.normalIndex };
+}
+
+static bool
+sameTexture (const TextureData &a, const TextureData &b)
+{
+  return a.width == b.width && a.height == b.height
+         && a.components == b.components && a.pixels == b.pixels;
+}
+
+static bool
+sameLayout (const VertexLayout &a, const VertexLayout &b)
+{
+  auto same = [] (const VertexAttribute &x, const VertexAttribute &y) {
+    return x.components == y.components && x.type == y.type
+           && x.normalized == y.normalized && x.offset == y.offset;
+  };
+  return a.stride == b.stride && same (a.position, b.position)
+         && same (a.normal, b.normal) && same (a.texCoords, b.texCoords)
+         && same (a.tangent, b.tangent) && same (a.joints, b.joints)
+         && same (a.weights, b.weights);
+}
+
+static bool
+sameGeometry (const SubMesh &a, const SubMesh &b)
+{
+  auto sameTarget = [] (const MorphTarget &x, const MorphTarget &y) {
+    return x.positions == y.positions && x.normals == y.normals
+           && x.tangents == y.tangents;
+  };
+  return sameLayout (a.layout, b.layout) && a.vertexData == b.vertexData
+         && a.indices == b.indices
+         && std::equal (a.targets.begin (), a.targets.end (),
+                        b.targets.begin (), b.targets.end (), sameTarget);
+}
+
+// Maps every element to the first equal one. `first` receives, per
+// element, the index of the copy it folds into (itself when unique).
+template <typename Equal>
+static size_t
+findDuplicates (const std::vector<size_t> &hashes, Equal equal,
+                std::vector<int> &first)
+{
+  std::unordered_multimap<size_t, int> seen;
+  size_t duplicates = 0;
+  first.resize (hashes.size ());
+  for (size_t i = 0; i < hashes.size (); i++)
+    {
+      first[i] = (int)i;
+      auto range = seen.equal_range (hashes[i]);
+      for (auto it = range.first; it != range.second; ++it)
+        {
+          if (equal (it->second, (int)i))
+            {
+              first[i] = it->second;
+              duplicates++;
+              break;
+            }
+        }
+      if (first[i] == (int)i)
+        seen.emplace (hashes[i], (int)i);
+    }
+  return duplicates;
+}
+
+// Drops folded elements and returns old index -> new index.
+template <typename T>
+static std::vector<int>
+compact (std::vector<T> &items, const std::vector<int> &first)
+{
+  std::vector<int> remap (items.size (), -1);
+  std::vector<T> kept;
+  for (size_t i = 0; i < items.size (); i++)
+    {
+      if (first[i] != (int)i)
+        continue;
+      remap[i] = (int)kept.size ();
+      kept.push_back (std::move (items[i]));
+    }
+  for (size_t i = 0; i < items.size (); i++)
+    remap[i] = remap[first[i]];
+  items = std::move (kept);
+  return remap;
+}
+
+void
+SceneDedup::process (SceneData &scene, LoadStats &stats)
+{
+  const size_t textureCount = scene.textures.size ();
+  const size_t meshCount = scene.meshes.size ();
+
+  // 1. Hash texels and geometry, one item per task
+  std::vector<size_t> textureHashes (textureCount);
+  std::vector<size_t> meshHashes (meshCount);
+  parallelFor (textureCount + meshCount, [&] (size_t i) {
+    if (i < textureCount)
+      {
+        const TextureData &texture = scene.textures[i];
+        size_t seed = qHashMulti (0, texture.width, texture.height,
+                                  texture.components);
+        textureHashes[i] = qHashBits (texture.pixels.data (),
+                                      texture.pixels.size (), seed);
+        return;
+      }
+
+    const SubMesh &mesh = scene.meshes[i - textureCount];
+    size_t seed = qHashMulti (0, mesh.layout.stride, mesh.vertexCount);
+    seed = qHashBits (mesh.vertexData.data (), mesh.vertexData.size (), seed);
+    meshHashes[i - textureCount]
+        = qHashBits (mesh.indices.data (),
+                     mesh.indices.size () * sizeof (unsigned int), seed);
+  });
+
+  // 2. Textures, then materials (whose keys include texture indices)
+  std::vector<int> first;
+  stats.duplicateTextures = findDuplicates (
+      textureHashes,
+      [&] (int a, int b) {
+        return sameTexture (scene.textures[a], scene.textures[b]);
+      },
+      first);
+  for (size_t i = 0; i < textureCount; i++)
+    if (first[i] != (int)i)
+      stats.dedupBytes += scene.textures[i].pixels.size ();
+
+  if (stats.duplicateTextures)
+    {
+      const std::vector<int> remap = compact (scene.textures, first);
+      auto apply = [&remap] (int &index) {
+        if (index >= 0 && index < (int)remap.size ())
+          index = remap[index];
+      };
+      for (MaterialData &material : scene.materials)
+        {
+          apply (material.baseColorIndex);
+          apply (material.metallicRoughnessIndex);
+          apply (material.normalIndex);
+        }
+    }
+
+  std::vector<std::vector<float>> materialKeys;
+  std::vector<size_t> materialHashes;
+  for (const MaterialData &material : scene.materials)
+    {
+      materialKeys.push_back (materialKey (material));
+      const std::vector<float> &key = materialKeys.back ();
+      materialHashes.push_back (
+          qHashBits (key.data (), key.size () * sizeof (float)));
+    }
+  stats.duplicateMaterials = findDuplicates (
+      materialHashes,
+      [&] (int a, int b) { return materialKeys[a] == materialKeys[b]; },
+      first);
+
+  if (stats.duplicateMaterials)
+    {
+      const std::vector<int> remap = compact (scene.materials, first);
+      for (SubMesh &mesh : scene.meshes)
+        if (mesh.materialIndex >= 0
+            && mesh.materialIndex < (int)remap.size ())
+          mesh.materialIndex = remap[mesh.materialIndex];
+    }
+
+  // 3. Geometry is shared in place: SubMesh order is draw order
+  stats.duplicateMeshes = findDuplicates (
+      meshHashes,
+      [&] (int a, int b) {
+        return sameGeometry (scene.meshes[a], scene.meshes[b]);
+      },
+      first);
+  for (size_t i = 0; i < meshCount; i++)
+    {
+      if (first[i] == (int)i)
+        continue;
+      SubMesh &mesh = scene.meshes[i];
+      stats.dedupBytes += mesh.vertexData.size ()
+                          + mesh.indices.size () * sizeof (unsigned int);
+      mesh.sharedGeometry = first[i];
+      mesh.vertexCount = 0;
+      std::vector<unsigned char> ().swap (mesh.vertexData);
+      std::vector<unsigned int> ().swap (mesh.indices);
+      std::vector<MorphTarget> ().swap (mesh.targets);
+    }
+}
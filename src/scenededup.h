@@ -0,0 +1,23 @@
+#ifndef SCENEDEDUP_H
+#define SCENEDEDUP_H
+
+#include "meshdata.h"
+
+// Loader-side content deduplication.
+//
+// Decoded images, material parameter sets and assembled primitives are
+// hashed in parallel (qHashBits, non-cryptographic) and candidates with the
+// same hash are compared byte for byte. Duplicate textures and materials
+// are dropped and every index is remapped to the first copy; duplicate
+// geometry is released and the SubMesh points at the copy it matches
+// (SubMesh::sharedGeometry), so Model shares one set of buffers. Counts and
+// reclaimed bytes go to `stats`.
+class SceneDedup
+{
+public:
+  // Runs before texture processing and tangent generation, so neither is
+  // spent on copies.
+  static void process (SceneData &scene, LoadStats &stats);
+};
+
+#endif // SCENEDEDUP_H
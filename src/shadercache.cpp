@@ -0,0 +1,199 @@
+#include "shadercache.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+static const char kMagic[4] = { 'M', 'S', 'P', 'B' };
+
+static QByteArray
+readSource (const QString &path)
+{
+  QFile file (path);
+  if (!file.open (QIODevice::ReadOnly))
+    {
+      qDebug () << "ShaderCache: cannot open" << path;
+      return QByteArray ();
+    }
+  return file.readAll ();
+}
+
+// Inserts defines after the #version directive, which must stay first.
+static QByteArray
+injectDefines (const QByteArray &source, const QByteArray &defines)
+{
+  if (defines.isEmpty ())
+    return source;
+
+  qsizetype at = 0;
+  if (source.startsWith ("#version"))
+    {
+      qsizetype eol = source.indexOf ('\n');
+      at = eol < 0 ? source.size () : eol + 1;
+    }
+  return source.left (at) + defines + source.mid (at);
+}
+
+ShaderCache::ShaderCache (const QString &directory) : m_directory (directory)
+{
+  if (m_directory.isEmpty ())
+    m_directory
+        = QStandardPaths::writableLocation (QStandardPaths::CacheLocation)
+          + "/shaders";
+}
+
+void
+ShaderCache::init ()
+{
+  initializeOpenGLFunctions ();
+
+  GLint formats = 0;
+  glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  m_supported = formats > 0;
+  if (!m_supported)
+    qDebug () << "ShaderCache: driver exposes no program binary formats.";
+
+  m_driverKey = QByteArray ((const char *)glGetString (GL_VENDOR)) + '|'
+                + (const char *)glGetString (GL_RENDERER) + '|'
+                + (const char *)glGetString (GL_VERSION);
+
+  QDir ().mkpath (m_directory);
+}
+
+QOpenGLShaderProgram *
+ShaderCache::program (const QString &vertexPath, const QString &fragmentPath,
+                      const QByteArray &defines)
+{
+  QElapsedTimer timer;
+  timer.start ();
+
+  const QByteArray vertexSource
+      = injectDefines (readSource (vertexPath), defines);
+  const QByteArray fragmentSource
+      = injectDefines (readSource (fragmentPath), defines);
+
+  QCryptographicHash hash (QCryptographicHash::Sha1);
+  hash.addData (m_driverKey);
+  hash.addData (vertexSource);
+  hash.addData (fragmentSource);
+  const QString path
+      = m_directory + "/" + QString (hash.result ().toHex ()) + ".bin";
+
+  auto *program = new QOpenGLShaderProgram ();
+  const bool useCache = m_enabled && m_supported;
+
+  if (useCache && QFile::exists (path))
+    {
+      if (loadBinary (program, path))
+        {
+          m_stats.hits++;
+          m_stats.totalMs += timer.nsecsElapsed () / 1.0e6;
+          return program;
+        }
+
+      // Stale or corrupt: recompile into a fresh program object
+      m_stats.rejected++;
+      QFile::remove (path);
+      delete program;
+      program = new QOpenGLShaderProgram ();
+    }
+  else
+    {
+      m_stats.misses++;
+    }
+
+  if (!program->addShaderFromSourceCode (QOpenGLShader::Vertex,
+                                         vertexSource))
+    qDebug () << "Vert Error:" << vertexPath << program->log ();
+  if (!program->addShaderFromSourceCode (QOpenGLShader::Fragment,
+                                         fragmentSource))
+    qDebug () << "Frag Error:" << fragmentPath << program->log ();
+
+  if (useCache)
+    glProgramParameteri (program->programId (),
+                         GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+  if (program->link ())
+    {
+      if (useCache)
+        saveBinary (program, path);
+    }
+  else
+    {
+      qDebug () << "Link Error:" << vertexPath << program->log ();
+    }
+
+  m_stats.totalMs += timer.nsecsElapsed () / 1.0e6;
+  return program;
+}
+
+bool
+ShaderCache::loadBinary (QOpenGLShaderProgram *program, const QString &path)
+{
+  QFile file (path);
+  if (!file.open (QIODevice::ReadOnly))
+    return false;
+  const QByteArray data = file.readAll ();
+  if (data.size () <= 8 || std::memcmp (data.constData (), kMagic, 4) != 0)
+    return false;
+
+  GLenum format;
+  std::memcpy (&format, data.constData () + 4, 4);
+
+  if (!program->create ())
+    return false;
+
+  glProgramBinary (program->programId (), format, data.constData () + 8,
+                   (GLsizei)(data.size () - 8));
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv (program->programId (), GL_LINK_STATUS, &linked);
+  if (!linked)
+    return false;
+
+  // With no shaders attached, link() only picks up the link status set by
+  // glProgramBinary so QOpenGLShaderProgram treats the program as linked.
+  return program->link ();
+}
+
+void
+ShaderCache::saveBinary (QOpenGLShaderProgram *program, const QString &path)
+{
+  const GLuint id = program->programId ();
+  GLint length = 0;
+  glGetProgramiv (id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  QByteArray data (8 + length, Qt::Uninitialized);
+  GLenum format = 0;
+  GLsizei written = 0;
+  glGetProgramBinary (id, length, &written, &format, data.data () + 8);
+  if (written <= 0)
+    return;
+
+  std::memcpy (data.data (), kMagic, 4);
+  std::memcpy (data.data () + 4, &format, 4);
+  data.resize (8 + written);
+
+  // Written atomically so a crash never leaves a truncated entry behind
+  QSaveFile file (path);
+  if (file.open (QIODevice::WriteOnly))
+    {
+      file.write (data);
+      file.commit ();
+    }
+}
+
+void
+ShaderCache::clear ()
+{
+  QDir dir (m_directory);
+  for (const QString &name : dir.entryList ({ "*.bin" }, QDir::Files))
+    dir.remove (name);
+}
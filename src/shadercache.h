@@ -0,0 +1,69 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QString>
+
+struct ShaderCacheStats
+{
+  int hits = 0;
+  int misses = 0;   // Compiled from source (no entry yet)
+  int rejected = 0; // Entry found but refused by the driver
+  double totalMs = 0.0;
+};
+
+// On-disk cache of linked program binaries.
+//
+// Entries are keyed by a hash of the shader sources and the GL vendor,
+// renderer and version strings, so a driver update or shader edit simply
+// misses. Binaries the driver refuses are deleted and the program is
+// compiled from source instead.
+class ShaderCache : protected QOpenGLExtraFunctions
+{
+public:
+  // Empty directory = <cache location>/shaders
+  explicit ShaderCache (const QString &directory = QString ());
+
+  void init ();
+
+  // Returns a linked program (caller owns it) or one with a failed link if
+  // the sources do not compile; errors are logged like the direct path.
+  // `defines` is inserted right after the #version line of both stages.
+  QOpenGLShaderProgram *program (const QString &vertexPath,
+                                 const QString &fragmentPath,
+                                 const QByteArray &defines = QByteArray ());
+
+  void
+  setEnabled (bool enabled)
+  {
+    m_enabled = enabled;
+  }
+
+  // Removes every cached binary (forces a cold start).
+  void clear ();
+
+  QString
+  directory () const
+  {
+    return m_directory;
+  }
+
+  const ShaderCacheStats &
+  stats () const
+  {
+    return m_stats;
+  }
+
+private:
+  bool loadBinary (QOpenGLShaderProgram *program, const QString &path);
+  void saveBinary (QOpenGLShaderProgram *program, const QString &path);
+
+  QString m_directory;
+  QByteArray m_driverKey;
+  bool m_enabled = true;
+  bool m_supported = false;
+  ShaderCacheStats m_stats;
+};
+
+#endif // SHADERCACHE_H
@@ -0,0 +1,295 @@
+#include "skinningpass.h"
+#include "animator.h"
+#include "model.h"
+#include "parallel.h"
+
+#include <QDebug>
+#include <QOpenGLShader>
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+constexpr unsigned int kGroupSize = 64;      // local_size_x
+constexpr unsigned int kMaxGroups = 65535;   // Guaranteed per dimension
+constexpr unsigned int kDeformedFloats = 12; // Per output vertex
+constexpr size_t kVertexGrain = 4096;        // Vertices per pool task
+
+// std430 layout of RestVertex in skinning.comp
+struct RestVertex
+{
+  glm::vec4 position;
+  glm::vec4 normal;
+  glm::vec4 tangent;
+  glm::vec4 texCoords;
+  uint32_t joints[4];
+  glm::vec4 weights;
+};
+static_assert (sizeof (RestVertex) == 96, "RestVertex must match std430");
+} // namespace
+
+SkinningPass::SkinningPass () {}
+
+SkinningPass::~SkinningPass ()
+{
+  clear ();
+  if (m_paletteBuffer)
+    glDeleteBuffers (1, &m_paletteBuffer);
+  if (m_weightBuffer)
+    glDeleteBuffers (1, &m_weightBuffer);
+}
+
+bool
+SkinningPass::init ()
+{
+  initializeOpenGLFunctions ();
+  if (!QOpenGLShader::hasOpenGLShaders (QOpenGLShader::Compute))
+    return false;
+
+  // Compiled directly: ShaderCache only handles vertex/fragment pairs
+  m_program = std::make_unique<QOpenGLShaderProgram> ();
+  if (!m_program->addShaderFromSourceFile (QOpenGLShader::Compute,
+                                           ":/shaders/skinning.comp")
+      || !m_program->link ())
+    {
+      qWarning () << "Skinning shader failed:" << m_program->log ();
+      m_program.reset ();
+      return false;
+    }
+
+  m_firstVertex = m_program->uniformLocation ("firstVertex");
+  m_vertexCount = m_program->uniformLocation ("vertexCount");
+  m_paletteOffset = m_program->uniformLocation ("paletteOffset");
+  m_paletteStride = m_program->uniformLocation ("paletteStride");
+  m_jointCount = m_program->uniformLocation ("jointCount");
+  m_weightOffset = m_program->uniformLocation ("weightOffset");
+  m_weightStride = m_program->uniformLocation ("weightStride");
+  m_targetCount = m_program->uniformLocation ("targetCount");
+  m_skinned = m_program->uniformLocation ("skinned");
+
+  glGenBuffers (1, &m_paletteBuffer);
+  glGenBuffers (1, &m_weightBuffer);
+  return true;
+}
+
+void
+SkinningPass::clear ()
+{
+  for (Target &target : m_targets)
+    {
+      if (target.ownsInput)
+        {
+          glDeleteBuffers (1, &target.input);
+          if (target.morph)
+            glDeleteBuffers (1, &target.morph);
+        }
+      if (target.output)
+        glDeleteBuffers (1, &target.output);
+      if (target.vao)
+        glDeleteVertexArrays (1, &target.vao);
+    }
+  m_targets.clear ();
+  m_instances = 0;
+  m_inputBytes = 0;
+  m_outputBytes = 0;
+}
+
+void
+SkinningPass::setScene (const SceneData &data, const Animator &animator,
+                        Model *model)
+{
+  clear ();
+  if (!m_program)
+    return;
+
+  m_targets.resize (data.meshes.size ());
+  for (size_t m = 0; m < data.meshes.size (); m++)
+    {
+      Target &target = m_targets[m];
+      const SubMesh &geometry = data.geometry (m);
+      target.mesh = (int)m;
+      target.vertexCount = (unsigned int)geometry.vertexCount;
+      if (target.vertexCount == 0)
+        continue;
+
+      // 1. Deduplicated submeshes read their source's rest pose
+      const int shared = data.meshes[m].sharedGeometry;
+      if (shared >= 0 && m_targets[shared].input)
+        {
+          target.input = m_targets[shared].input;
+          target.morph = m_targets[shared].morph;
+          continue;
+        }
+      target.ownsInput = true;
+
+      // 2. Rest vertices in floats, whatever the stored formats
+      const VertexLayout &layout = geometry.layout;
+      std::vector<RestVertex> rest (target.vertexCount);
+      parallelFor (
+          rest.size (),
+          [&] (size_t v) {
+            const unsigned char *src = geometry.vertex (v);
+            RestVertex &dst = rest[v];
+            dst.position = glm::vec4 (geometry.position (v), 1.0f);
+            dst.normal = glm::vec4 (geometry.normal (v), 0.0f);
+            dst.tangent = layout.tangent.components
+                              ? layout.tangent.read (src)
+                              : glm::vec4 (1.0f, 0.0f, 0.0f, 1.0f);
+            dst.texCoords = glm::vec4 (geometry.texCoords (v), 0.0f, 0.0f);
+            const glm::vec4 joints = layout.joints.read (src);
+            for (int j = 0; j < 4; j++)
+              dst.joints[j] = (uint32_t)std::max (joints[j], 0.0f);
+            dst.weights = layout.weights.components
+                              ? layout.weights.read (src)
+                              : glm::vec4 (1.0f, 0.0f, 0.0f, 0.0f);
+          },
+          kVertexGrain);
+
+      glGenBuffers (1, &target.input);
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, target.input);
+      glBufferData (GL_SHADER_STORAGE_BUFFER,
+                    rest.size () * sizeof (RestVertex), rest.data (),
+                    GL_STATIC_DRAW);
+      m_inputBytes += rest.size () * sizeof (RestVertex);
+
+      // 3. Morph deltas, target after target, three vec4 per vertex
+      if (geometry.targets.empty ())
+        continue;
+      const size_t count = target.vertexCount;
+      std::vector<glm::vec4> deltas (geometry.targets.size () * count * 3,
+                                     glm::vec4 (0.0f));
+      for (size_t t = 0; t < geometry.targets.size (); t++)
+        {
+          const MorphTarget &morph = geometry.targets[t];
+          const std::vector<glm::vec3> *streams[]
+              = { &morph.positions, &morph.normals, &morph.tangents };
+          for (int k = 0; k < 3; k++)
+            if (streams[k]->size () >= count)
+              for (size_t v = 0; v < count; v++)
+                deltas[(t * count + v) * 3 + k]
+                    = glm::vec4 ((*streams[k])[v], 0.0f);
+        }
+      glGenBuffers (1, &target.morph);
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, target.morph);
+      glBufferData (GL_SHADER_STORAGE_BUFFER,
+                    deltas.size () * sizeof (glm::vec4), deltas.data (),
+                    GL_STATIC_DRAW);
+      m_inputBytes += deltas.size () * sizeof (glm::vec4);
+    }
+  glBindBuffer (GL_SHADER_STORAGE_BUFFER, 0);
+
+  allocateOutputs (animator.instanceCount (), model);
+}
+
+void
+SkinningPass::allocateOutputs (int instances, Model *model)
+{
+  m_instances = instances;
+  m_outputBytes = 0;
+  const GLsizei stride = kDeformedFloats * sizeof (float);
+  for (Target &target : m_targets)
+    {
+      if (!target.input)
+        continue;
+      if (!target.output)
+        {
+          glGenBuffers (1, &target.output);
+          glGenVertexArrays (1, &target.vao);
+        }
+
+      const size_t bytes = (size_t)target.vertexCount * instances * stride;
+      glBindBuffer (GL_ARRAY_BUFFER, target.output);
+      glBufferData (GL_ARRAY_BUFFER, bytes, nullptr, GL_DYNAMIC_COPY);
+      m_outputBytes += bytes;
+
+      // Position, normal, UV, tangent as the geometry programs expect them,
+      // all from binding 0 so Model moves one offset from copy to copy
+      glBindVertexArray (target.vao);
+      const GLint components[] = { 3, 3, 2, 4 };
+      GLuint offset = 0;
+      for (GLuint a = 0; a < 4; a++)
+        {
+          glEnableVertexAttribArray (a);
+          glVertexAttribFormat (a, components[a], GL_FLOAT, GL_FALSE, offset);
+          glVertexAttribBinding (a, 0);
+          offset += components[a] * sizeof (float);
+        }
+      glBindVertexBuffer (0, target.output, 0, stride);
+      glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, model->indexBuffer (target.mesh));
+      glBindVertexArray (0);
+
+      model->setDeformed (target.mesh, target.vao, target.output, stride,
+                          target.vertexCount, instances);
+    }
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void
+SkinningPass::upload (unsigned int buffer, const void *data, size_t bytes)
+{
+  // Orphaned, so dispatches of frames still in flight keep their copy
+  glBindBuffer (GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData (GL_SHADER_STORAGE_BUFFER, std::max<size_t> (bytes, 16),
+                nullptr, GL_STREAM_DRAW);
+  if (bytes)
+    glBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+  m_frameBytes += std::max<size_t> (bytes, 16);
+}
+
+void
+SkinningPass::dispatch (const Animator &animator, Model *model)
+{
+  if (!m_program || m_targets.empty ())
+    return;
+  if (animator.instanceCount () != m_instances)
+    allocateOutputs (animator.instanceCount (), model);
+
+  // 1. This frame's palettes and morph weights
+  m_frameBytes = 0;
+  upload (m_paletteBuffer, animator.palettes ().data (),
+          animator.palettes ().size () * sizeof (glm::mat4));
+  upload (m_weightBuffer, animator.weights ().data (),
+          animator.weights ().size () * sizeof (float));
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 2, m_paletteBuffer);
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 3, m_weightBuffer);
+
+  // 2. One dispatch per submesh covering every instance, split where the
+  // vertex count exceeds the guaranteed work group count
+  m_program->bind ();
+  glUniform1ui (m_paletteStride, (GLuint)animator.paletteStride ());
+  glUniform1ui (m_weightStride, (GLuint)animator.weightStride ());
+  const std::vector<DeformBinding> &bindings = animator.bindings ();
+  for (const Target &target : m_targets)
+    {
+      if (!target.output || target.mesh >= (int)bindings.size ())
+        continue;
+      const DeformBinding &binding = bindings[target.mesh];
+      glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 0, target.input);
+      glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 1,
+                        target.morph ? target.morph : target.input);
+      glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 4, target.output);
+      glUniform1ui (m_vertexCount, target.vertexCount);
+      glUniform1ui (m_paletteOffset, (GLuint)binding.paletteOffset);
+      glUniform1ui (m_jointCount, (GLuint)binding.jointCount);
+      glUniform1ui (m_weightOffset, (GLuint)binding.weightOffset);
+      glUniform1ui (m_targetCount,
+                    target.morph ? (GLuint)binding.targetCount : 0u);
+      glUniform1i (m_skinned, binding.skinned ? 1 : 0);
+
+      for (unsigned int first = 0; first < target.vertexCount;
+           first += kGroupSize * kMaxGroups)
+        {
+          const unsigned int groups = std::min (
+              (target.vertexCount - first + kGroupSize - 1) / kGroupSize,
+              kMaxGroups);
+          glUniform1ui (m_firstVertex, first);
+          glDispatchCompute (groups, (GLuint)m_instances, 1);
+        }
+    }
+  m_program->release ();
+
+  // 3. The geometry pass fetches the results as vertex attributes
+  glMemoryBarrier (GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  for (GLuint binding = 0; binding <= 4; binding++)
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, binding, 0);
+}
@@ -0,0 +1,88 @@
+#ifndef SKINNINGPASS_H
+#define SKINNINGPASS_H
+
+#include "meshdata.h"
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <memory>
+#include <vector>
+
+class Animator;
+class Model;
+
+// GPU half of animation playback (GL 4.3 compute shaders).
+//
+// At load every submesh of an animated scene gets its rest vertices
+// decoded to floats (position, normal, tangent, UV, joints, weights) and
+// its morph target deltas in storage buffers. Each frame the Animator's
+// palettes and morph weights go into freshly orphaned storage buffers, and
+// one dispatch per submesh blends the targets and skins every vertex for
+// every instance into a float vertex buffer holding one copy per instance.
+// The geometry pass draws the submesh from a VAO over that buffer with its
+// original index buffer (Model::setDeformed).
+class SkinningPass : protected QOpenGLExtraFunctions
+{
+public:
+  SkinningPass ();
+  ~SkinningPass ();
+
+  // False when the context cannot run compute shaders; the pass is
+  // unusable then.
+  bool init ();
+
+  // Decodes and uploads the rest pose of every submesh of `data`, the
+  // scene `model` was just created from. Replaces any previous scene.
+  void setScene (const SceneData &data, const Animator &animator,
+                 Model *model);
+  void clear ();
+
+  // Uploads this frame's palettes and weights and deforms every submesh,
+  // reallocating the outputs when the instance count changed.
+  void dispatch (const Animator &animator, Model *model);
+
+  size_t
+  gpuMemoryBytes () const
+  {
+    return m_inputBytes + m_outputBytes + m_frameBytes;
+  }
+
+private:
+  struct Target
+  {
+    int mesh = -1;
+    unsigned int vertexCount = 0;
+    unsigned int input = 0;  // Rest vertices
+    unsigned int morph = 0;  // Target deltas, 0 = none
+    bool ownsInput = false;  // False when sharing another mesh's geometry
+    unsigned int output = 0; // vertexCount deformed vertices per instance
+    unsigned int vao = 0;
+  };
+
+  void allocateOutputs (int instances, Model *model);
+  void upload (unsigned int buffer, const void *data, size_t bytes);
+
+  std::unique_ptr<QOpenGLShaderProgram> m_program;
+  int m_firstVertex = -1;
+  int m_vertexCount = -1;
+  int m_paletteOffset = -1;
+  int m_paletteStride = -1;
+  int m_jointCount = -1;
+  int m_weightOffset = -1;
+  int m_weightStride = -1;
+  int m_targetCount = -1;
+  int m_skinned = -1;
+
+  std::vector<Target> m_targets;
+  int m_instances = 0;
+
+  // Per-frame inputs
+  unsigned int m_paletteBuffer = 0;
+  unsigned int m_weightBuffer = 0;
+
+  size_t m_inputBytes = 0;
+  size_t m_outputBytes = 0;
+  size_t m_frameBytes = 0;
+};
+
+#endif // SKINNINGPASS_H
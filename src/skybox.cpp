@@ -1,4 +1,6 @@
 #include "skybox.h"
+#include "frameconstants.h"
+#include "shadercache.h"
 #include <QDebug>
 #include <QFile>
 
@@ -23,17 +25,19 @@ Skybox::~Skybox ()
 }
 
 void
-Skybox::init ()
+Skybox::init (ShaderCache *shaderCache)
 {
   initializeOpenGLFunctions ();
 
   // Load Shader
-  m_shader = new QOpenGLShaderProgram ();
-  m_shader->addShaderFromSourceFile (QOpenGLShader::Vertex,
-                                     ":/shaders/skybox.vert");
-  m_shader->addShaderFromSourceFile (QOpenGLShader::Fragment,
-                                     ":/shaders/skybox.frag");
-  m_shader->link ();
+  m_shader = shaderCache->program (":/shaders/skybox.vert",
+                                   ":/shaders/skybox.frag");
+
+  GLuint block
+      = glGetUniformBlockIndex (m_shader->programId (), "FrameConstants");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding (m_shader->programId (), block,
+                           kFrameConstantsBinding);
 
   // Init Cube Geometry
   initCube ();
@@ -72,6 +76,7 @@ Skybox::init ()
 
           // Generate mips for roughness approximation
           glGenerateMipmap (GL_TEXTURE_2D);
+          m_memoryBytes = (size_t)width * height * 8 * 4 / 3; // RGBA16F
 
           stbi_image_free (dataPtr);
           qDebug () << "HDR Skybox loaded successfully.";
@@ -89,7 +94,7 @@ Skybox::init ()
 }
 
 void
-Skybox::render (const QMatrix4x4 &view, const QMatrix4x4 &projection)
+Skybox::render ()
 {
   if (!m_shader || !m_hdrTexture)
     return;
@@ -97,8 +102,6 @@ Skybox::render (const QMatrix4x4 &view, const QMatrix4x4 &projection)
   glDepthFunc (GL_LEQUAL); // Allow skybox to pass at depth 1.0
   m_shader->bind ();
 
-  m_shader->setUniformValue ("view", view);
-  m_shader->setUniformValue ("projection", projection);
   m_shader->setUniformValue ("environmentMap", 0);
 
   glActiveTexture (GL_TEXTURE0);
@@ -4,20 +4,29 @@
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLShaderProgram>
 
+class ShaderCache;
+
 class Skybox : protected QOpenGLExtraFunctions
 {
 public:
   Skybox ();
   ~Skybox ();
 
-  void init ();
-  void render (const QMatrix4x4 &view, const QMatrix4x4 &projection);
+  void init (ShaderCache *shaderCache);
+  // Camera matrices are read from the bound FrameConstants block.
+  void render ();
   unsigned int
   getTextureId () const
   {
     return m_hdrTexture;
   }
 
+  size_t
+  memoryBytes () const
+  {
+    return m_memoryBytes;
+  }
+
 private:
   void loadHDR (const char *path);
   void initCube ();
@@ -26,6 +35,7 @@ private:
   unsigned int m_vao;
   unsigned int m_vbo;
   QOpenGLShaderProgram *m_shader;
+  size_t m_memoryBytes = 0;
 };
 
 #endif // SKYBOX_H
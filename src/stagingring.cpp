@@ -0,0 +1,70 @@
+#include "stagingring.h"
+
+StagingRing::StagingRing () {}
+
+StagingRing::~StagingRing ()
+{
+  if (!m_buffers[0])
+    return;
+
+  for (GLsync &fence : m_fences)
+    {
+      if (fence)
+        glDeleteSync (fence);
+    }
+  glDeleteBuffers (kSlotCount, m_buffers);
+}
+
+void
+StagingRing::init ()
+{
+  initializeOpenGLFunctions ();
+
+  glGenBuffers (kSlotCount, m_buffers);
+  for (unsigned int buffer : m_buffers)
+    {
+      glBindBuffer (GL_COPY_READ_BUFFER, buffer);
+      glBufferData (GL_COPY_READ_BUFFER, kSlotBytes, nullptr,
+                    GL_STREAM_DRAW);
+    }
+  glBindBuffer (GL_COPY_READ_BUFFER, 0);
+}
+
+void *
+StagingRing::map ()
+{
+  GLsync &fence = m_fences[m_slot];
+  if (fence)
+    {
+      GLenum status = glClientWaitSync (fence, 0, 0);
+      if (status == GL_TIMEOUT_EXPIRED)
+        return nullptr;
+      glDeleteSync (fence);
+      fence = nullptr;
+    }
+
+  // The fence guarantees the GPU is done with the slot, so the driver
+  // does not need to synchronize the mapping.
+  glBindBuffer (GL_COPY_READ_BUFFER, m_buffers[m_slot]);
+  void *ptr = glMapBufferRange (GL_COPY_READ_BUFFER, 0, kSlotBytes,
+                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+                                    | GL_MAP_UNSYNCHRONIZED_BIT);
+  glBindBuffer (GL_COPY_READ_BUFFER, 0);
+  return ptr;
+}
+
+unsigned int
+StagingRing::unmap ()
+{
+  glBindBuffer (GL_COPY_READ_BUFFER, m_buffers[m_slot]);
+  glUnmapBuffer (GL_COPY_READ_BUFFER);
+  glBindBuffer (GL_COPY_READ_BUFFER, 0);
+  return m_buffers[m_slot];
+}
+
+void
+StagingRing::fence ()
+{
+  m_fences[m_slot] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_slot = (m_slot + 1) % kSlotCount;
+}
@@ -0,0 +1,41 @@
+#ifndef STAGINGRING_H
+#define STAGINGRING_H
+
+#include <QOpenGLExtraFunctions>
+
+// Small ring of staging buffers for streaming uploads.
+//
+// Data is copied into a mapped slot on the CPU and then transferred with
+// glCopyBufferSubData (buffers) or glTexSubImage2D from a bound
+// GL_PIXEL_UNPACK_BUFFER (textures), so the driver never has to copy or
+// synchronize on client memory. Each slot is fenced after use; map()
+// returns nullptr instead of waiting when every slot is still in flight,
+// which lets the caller simply continue next frame.
+class StagingRing : protected QOpenGLExtraFunctions
+{
+public:
+  static const int kSlotCount = 4;
+  static const size_t kSlotBytes = 4 << 20;
+
+  StagingRing ();
+  ~StagingRing ();
+
+  void init ();
+
+  // Maps the next slot for writing (at most kSlotBytes), or nullptr if it
+  // is still being read by the GPU.
+  void *map ();
+
+  // Unmaps the slot and returns its buffer for the copy commands.
+  unsigned int unmap ();
+
+  // Fences the slot after the copy commands that read it were issued.
+  void fence ();
+
+private:
+  unsigned int m_buffers[kSlotCount] = {};
+  GLsync m_fences[kSlotCount] = {};
+  int m_slot = 0;
+};
+
+#endif // STAGINGRING_H
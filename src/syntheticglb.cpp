@@ -0,0 +1,416 @@
+#include "syntheticglb.h"
+#include "glbwriter.h"
+
+#include <QBuffer>
+#include <QImage>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <draco/compression/encode.h>
+#include <draco/mesh/mesh.h>
+#include <vector>
+
+QString
+SyntheticSceneSpec::name () const
+{
+  QString name = QString ("v%1_p%2_%3_i%4_t%5x%6")
+                     .arg (vertexCount)
+                     .arg (primitiveCount)
+                     .arg (interleaved ? "interleaved" : "packed")
+                     .arg (indexBytes * 8)
+                     .arg (textureCount)
+                     .arg (textureSize);
+  if (quantized)
+    name += "_q";
+  if (compression == MeshoptCompression)
+    name += "_meshopt";
+  else if (compression == DracoCompression)
+    name += "_draco";
+  return name;
+}
+
+// Encodes one grid tile with the quantization glTF tools default to
+// (14-bit positions, 10-bit normals, 12-bit UVs). Fills the attribute ids
+// the extension object refers to.
+static QByteArray
+encodeDraco (const std::vector<float> &positions,
+             const std::vector<float> &normals,
+             const std::vector<float> &texCoords,
+             const std::vector<unsigned int> &indices, int ids[3])
+{
+  const uint32_t count = (uint32_t)(positions.size () / 3);
+  draco::Mesh mesh;
+  mesh.set_num_points (count);
+
+  auto addAttribute = [&] (draco::GeometryAttribute::Type type,
+                           int components, const float *values) {
+    draco::GeometryAttribute attribute;
+    attribute.Init (type, nullptr, (uint8_t)components, draco::DT_FLOAT32,
+                    false, sizeof (float) * components, 0);
+    const int id = mesh.AddAttribute (attribute, true, count);
+    draco::PointAttribute *added = mesh.attribute (id);
+    for (uint32_t i = 0; i < count; i++)
+      added->SetAttributeValue (draco::AttributeValueIndex (i),
+                                values + (size_t)i * components);
+    return (int)added->unique_id ();
+  };
+  ids[0] = addAttribute (draco::GeometryAttribute::POSITION, 3,
+                         positions.data ());
+  ids[1] = addAttribute (draco::GeometryAttribute::NORMAL, 3,
+                         normals.data ());
+  ids[2] = addAttribute (draco::GeometryAttribute::TEX_COORD, 2,
+                         texCoords.data ());
+
+  for (size_t i = 0; i + 2 < indices.size (); i += 3)
+    mesh.AddFace ({ draco::PointIndex (indices[i]),
+                    draco::PointIndex (indices[i + 1]),
+                    draco::PointIndex (indices[i + 2]) });
+
+  draco::Encoder encoder;
+  encoder.SetAttributeQuantization (draco::GeometryAttribute::POSITION, 14);
+  encoder.SetAttributeQuantization (draco::GeometryAttribute::NORMAL, 10);
+  encoder.SetAttributeQuantization (draco::GeometryAttribute::TEX_COORD, 12);
+
+  draco::EncoderBuffer buffer;
+  if (!encoder.EncodeMeshToBuffer (mesh, &buffer).ok ())
+    return QByteArray ();
+  return QByteArray (buffer.data (), (qsizetype)buffer.size ());
+}
+
+static QByteArray
+makeTexturePng (int index, int size)
+{
+  // Checker + gradient with a per-texture tint, so images are distinct and
+  // compress like real content rather than like a flat color.
+  QImage image (size, size, QImage::Format_RGBA8888);
+  const int cell = std::max (1, size / 16);
+  const int tintR = (index * 97) % 256;
+  const int tintG = (index * 57 + 80) % 256;
+  const int tintB = (index * 23 + 160) % 256;
+
+  for (int y = 0; y < size; y++)
+    {
+      uchar *row = image.scanLine (y);
+      for (int x = 0; x < size; x++)
+        {
+          bool checker = ((x / cell) + (y / cell)) % 2 == 0;
+          int shade = checker ? 255 : 96;
+          row[x * 4 + 0] = (uchar)((tintR * shade) / 255);
+          row[x * 4 + 1] = (uchar)((tintG * x) / size);
+          row[x * 4 + 2] = (uchar)((tintB * y) / size);
+          row[x * 4 + 3] = 255;
+        }
+    }
+
+  QByteArray png;
+  QBuffer buffer (&png);
+  buffer.open (QIODevice::WriteOnly);
+  image.save (&buffer, "PNG");
+  return png;
+}
+
+bool
+writeSyntheticGlb (const SyntheticSceneSpec &spec, const QString &path,
+                   SyntheticSceneInfo *info, QString *errorMsg)
+{
+  GlbWriter writer;
+
+  // 1. Grid size per primitive, clamped by the index width
+  size_t perPrimitive
+      = std::max<size_t> (4, spec.vertexCount
+                                 / (size_t)std::max (1, spec.primitiveCount));
+  size_t side = std::max<size_t> (2, (size_t)std::sqrt ((double)perPrimitive));
+  if (spec.indexBytes == 1)
+    side = std::min<size_t> (side, 16);
+  else if (spec.indexBytes == 2)
+    side = std::min<size_t> (side, 256);
+
+  // Keep the requested total by adding primitives when grids were clamped
+  const size_t gridVertices = side * side;
+  int primitiveCount = std::max (
+      spec.primitiveCount,
+      (int)((spec.vertexCount + gridVertices - 1) / gridVertices));
+  int tilesPerRow = (int)std::ceil (std::sqrt ((double)primitiveCount));
+
+  // 2. Textures and materials
+  std::vector<int> materials;
+  for (int t = 0; t < spec.textureCount; t++)
+    {
+      int image = writer.addImage (makeTexturePng (t, spec.textureSize),
+                                   "image/png");
+      int texture = writer.addTexture (image);
+
+      QJsonObject pbr;
+      pbr["baseColorTexture"] = QJsonObject{ { "index", texture } };
+      pbr["metallicFactor"] = 0.0;
+      pbr["roughnessFactor"] = 0.8;
+      materials.push_back (writer.addMaterial (
+          QJsonObject{ { "pbrMetallicRoughness", pbr } }));
+    }
+  if (materials.empty ())
+    {
+      QJsonObject pbr;
+      pbr["baseColorFactor"] = QJsonArray{ 0.8, 0.8, 0.8, 1.0 };
+      pbr["metallicFactor"] = 0.0;
+      pbr["roughnessFactor"] = 0.6;
+      materials.push_back (writer.addMaterial (
+          QJsonObject{ { "pbrMetallicRoughness", pbr } }));
+    }
+
+  // 3. Geometry
+  QJsonArray primitives;
+  const float amplitude = 0.05f;
+  const float twoPi = 6.28318530718f;
+
+  // Float vertices, or KHR_mesh_quantization normals (int8, padded to 4
+  // bytes) and UVs (uint16), both normalized
+  const bool quantized
+      = spec.quantized
+        && spec.compression != SyntheticSceneSpec::DracoCompression;
+  const size_t normalSize = quantized ? 4 : 3 * sizeof (float);
+  const size_t uvSize = quantized ? 4 : 2 * sizeof (float);
+  const size_t vertexSize = 3 * sizeof (float) + normalSize + uvSize;
+  const GlbWriter::ComponentType normalType
+      = quantized ? GlbWriter::Byte : GlbWriter::Float;
+  const GlbWriter::ComponentType uvType
+      = quantized ? GlbWriter::UnsignedShort : GlbWriter::Float;
+  if (quantized)
+    writer.addExtension ("KHR_mesh_quantization", true);
+
+  std::vector<float> positions (gridVertices * 3);
+  std::vector<float> normals (gridVertices * 3);
+  std::vector<float> texCoords (gridVertices * 2);
+  std::vector<unsigned char> normalBytes (gridVertices * normalSize);
+  std::vector<unsigned char> uvBytes (gridVertices * uvSize);
+  std::vector<unsigned char> interleaved (gridVertices * vertexSize);
+
+  // Same triangulation for every tile
+  const size_t triangles = (side - 1) * (side - 1) * 2;
+  std::vector<unsigned int> gridIndices;
+  gridIndices.reserve (triangles * 3);
+  for (size_t j = 0; j + 1 < side; j++)
+    {
+      for (size_t i = 0; i + 1 < side; i++)
+        {
+          unsigned int v0 = (unsigned int)(j * side + i);
+          unsigned int v1 = v0 + 1;
+          unsigned int v2 = v0 + (unsigned int)side;
+          unsigned int v3 = v2 + 1;
+          gridIndices.insert (gridIndices.end (), { v0, v2, v1, v1, v2, v3 });
+        }
+    }
+
+  // Indices in the requested width
+  const bool meshopt
+      = spec.compression == SyntheticSceneSpec::MeshoptCompression;
+  const int indexBytes
+      = meshopt ? std::max (2, spec.indexBytes) : spec.indexBytes;
+  std::vector<unsigned char> indices (gridIndices.size () * indexBytes);
+  for (size_t k = 0; k < gridIndices.size (); k++)
+    {
+      if (indexBytes == 1)
+        indices[k] = (unsigned char)gridIndices[k];
+      else if (indexBytes == 2)
+        {
+          unsigned short v16 = (unsigned short)gridIndices[k];
+          std::memcpy (&indices[k * 2], &v16, 2);
+        }
+      else
+        {
+          std::memcpy (&indices[k * 4], &gridIndices[k], 4);
+        }
+    }
+
+  GlbWriter::ComponentType indexType = GlbWriter::UnsignedInt;
+  if (indexBytes == 1)
+    indexType = GlbWriter::UnsignedByte;
+  else if (indexBytes == 2)
+    indexType = GlbWriter::UnsignedShort;
+
+  // Plain or meshopt-encoded view of `count` elements
+  auto addView = [&] (const void *data, size_t count, int elementSize,
+                      int byteStride, GlbWriter::Target target) {
+    if (!meshopt)
+      return writer.addBufferView (data, count * elementSize, byteStride,
+                                   target);
+    return writer.addMeshoptBufferView (
+        data, count, elementSize,
+        target == GlbWriter::ElementArrayBuffer ? GlbWriter::MeshoptTriangles
+                                                : GlbWriter::MeshoptAttributes,
+        target);
+  };
+
+  for (int p = 0; p < primitiveCount; p++)
+    {
+      float tileX = (float)(p % tilesPerRow);
+      float tileZ = (float)(p / tilesPerRow);
+      float phase = p * 0.37f;
+
+      float minPos[3] = { 1e30f, 1e30f, 1e30f };
+      float maxPos[3] = { -1e30f, -1e30f, -1e30f };
+
+      for (size_t j = 0; j < side; j++)
+        {
+          for (size_t i = 0; i < side; i++)
+            {
+              size_t v = j * side + i;
+              float u = (float)i / (float)(side - 1);
+              float w = (float)j / (float)(side - 1);
+
+              float a = twoPi * 3.0f;
+              float y
+                  = amplitude * std::sin (a * u + phase) * std::cos (a * w);
+              float dydu = amplitude * a * std::cos (a * u + phase)
+                           * std::cos (a * w);
+              float dydw = -amplitude * a * std::sin (a * u + phase)
+                           * std::sin (a * w);
+              float len = std::sqrt (dydu * dydu + 1.0f + dydw * dydw);
+
+              float pos[3] = { tileX + u, y, tileZ + w };
+              float nrm[3] = { -dydu / len, 1.0f / len, -dydw / len };
+              float uv[2] = { u, w };
+
+              for (int c = 0; c < 3; c++)
+                {
+                  minPos[c] = std::min (minPos[c], pos[c]);
+                  maxPos[c] = std::max (maxPos[c], pos[c]);
+                }
+
+              std::memcpy (&positions[v * 3], pos, sizeof (pos));
+              std::memcpy (&normals[v * 3], nrm, sizeof (nrm));
+              std::memcpy (&texCoords[v * 2], uv, sizeof (uv));
+
+              unsigned char *normal = &normalBytes[v * normalSize];
+              unsigned char *texCoord = &uvBytes[v * uvSize];
+              if (quantized)
+                {
+                  for (int c = 0; c < 3; c++)
+                    normal[c] = (unsigned char)(signed char)std::lround (
+                        nrm[c] * 127.0f);
+                  normal[3] = 0;
+                  for (int c = 0; c < 2; c++)
+                    {
+                      unsigned short q
+                          = (unsigned short)std::lround (uv[c] * 65535.0f);
+                      std::memcpy (texCoord + c * 2, &q, 2);
+                    }
+                }
+              else
+                {
+                  std::memcpy (normal, nrm, sizeof (nrm));
+                  std::memcpy (texCoord, uv, sizeof (uv));
+                }
+
+              unsigned char *vertex = &interleaved[v * vertexSize];
+              std::memcpy (vertex, pos, sizeof (pos));
+              std::memcpy (vertex + sizeof (pos), normal, normalSize);
+              std::memcpy (vertex + sizeof (pos) + normalSize, texCoord,
+                           uvSize);
+            }
+        }
+
+      int posAcc, normAcc, uvAcc, indexAcc;
+      std::vector<double> mins (minPos, minPos + 3);
+      std::vector<double> maxs (maxPos, maxPos + 3);
+      QJsonObject primitive;
+
+      if (spec.compression == SyntheticSceneSpec::DracoCompression)
+        {
+          int ids[3];
+          const QByteArray encoded
+              = encodeDraco (positions, normals, texCoords, gridIndices, ids);
+          if (encoded.isEmpty ())
+            {
+              if (errorMsg)
+                *errorMsg = "Draco encoding failed";
+              return false;
+            }
+
+          int view = writer.addBufferView (encoded.constData (),
+                                           (size_t)encoded.size ());
+          posAcc = writer.addAccessor (-1, 0, GlbWriter::Float, gridVertices,
+                                       "VEC3", false, mins, maxs);
+          normAcc = writer.addAccessor (-1, 0, GlbWriter::Float,
+                                        gridVertices, "VEC3");
+          uvAcc = writer.addAccessor (-1, 0, GlbWriter::Float, gridVertices,
+                                      "VEC2");
+          indexAcc = writer.addAccessor (-1, 0, indexType, triangles * 3,
+                                         "SCALAR");
+
+          QJsonObject draco;
+          draco["bufferView"] = view;
+          draco["attributes"] = QJsonObject{ { "POSITION", ids[0] },
+                                             { "NORMAL", ids[1] },
+                                             { "TEXCOORD_0", ids[2] } };
+          primitive["extensions"]
+              = QJsonObject{ { "KHR_draco_mesh_compression", draco } };
+          writer.addExtension ("KHR_draco_mesh_compression", true);
+        }
+      else
+        {
+          if (spec.interleaved)
+            {
+              int view = addView (interleaved.data (), gridVertices,
+                                  vertexSize, vertexSize,
+                                  GlbWriter::ArrayBuffer);
+              posAcc = writer.addAccessor (view, 0, GlbWriter::Float,
+                                           gridVertices, "VEC3", false, mins,
+                                           maxs);
+              normAcc = writer.addAccessor (view, 3 * sizeof (float),
+                                            normalType, gridVertices, "VEC3",
+                                            quantized);
+              uvAcc = writer.addAccessor (view,
+                                          3 * sizeof (float) + normalSize,
+                                          uvType, gridVertices, "VEC2",
+                                          quantized);
+            }
+          else
+            {
+              int posView
+                  = addView (positions.data (), gridVertices,
+                             3 * sizeof (float), 0, GlbWriter::ArrayBuffer);
+              // Padded int8 normals need an explicit stride
+              int normView = addView (normalBytes.data (), gridVertices,
+                                      normalSize, quantized ? 4 : 0,
+                                      GlbWriter::ArrayBuffer);
+              int uvView = addView (uvBytes.data (), gridVertices, uvSize, 0,
+                                    GlbWriter::ArrayBuffer);
+              posAcc = writer.addAccessor (posView, 0, GlbWriter::Float,
+                                           gridVertices, "VEC3", false, mins,
+                                           maxs);
+              normAcc = writer.addAccessor (normView, 0, normalType,
+                                            gridVertices, "VEC3", quantized);
+              uvAcc = writer.addAccessor (uvView, 0, uvType, gridVertices,
+                                          "VEC2", quantized);
+            }
+
+          int indexView = addView (indices.data (), triangles * 3,
+                                   indexBytes, 0,
+                                   GlbWriter::ElementArrayBuffer);
+          indexAcc = writer.addAccessor (indexView, 0, indexType,
+                                         triangles * 3, "SCALAR");
+        }
+
+      QJsonObject attributes;
+      attributes["POSITION"] = posAcc;
+      attributes["NORMAL"] = normAcc;
+      attributes["TEXCOORD_0"] = uvAcc;
+
+      primitive["attributes"] = attributes;
+      primitive["indices"] = indexAcc;
+      primitive["material"] = materials[p % materials.size ()];
+      primitives.append (primitive);
+    }
+
+  int mesh = writer.addMesh (primitives);
+  writer.addNode (QJsonObject{ { "mesh", mesh } });
+
+  if (info)
+    {
+      info->vertexCount = gridVertices * primitiveCount;
+      info->triangleCount = triangles * primitiveCount;
+      info->primitiveCount = primitiveCount;
+    }
+
+  return writer.write (path, errorMsg);
+}
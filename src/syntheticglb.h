@@ -0,0 +1,43 @@
+#ifndef SYNTHETICGLB_H
+#define SYNTHETICGLB_H
+
+#include <QString>
+
+// Procedurally generated glTF scenes for reproducible loader and renderer
+// measurements (production assets cannot be shared).
+struct SyntheticSceneSpec
+{
+  enum Compression
+  {
+    NoCompression,
+    MeshoptCompression, // EXT_meshopt_compression vertex and index views
+    DracoCompression    // KHR_draco_mesh_compression primitives
+  };
+
+  size_t vertexCount = 100000; // Total, split evenly across primitives
+  int primitiveCount = 1;
+  bool interleaved = true;     // One strided view vs. one view per attribute
+  int indexBytes = 4;          // 1, 2 or 4
+  int textureCount = 0;
+  int textureSize = 512;
+  Compression compression = NoCompression;
+  bool quantized = false; // int8 normals, uint16 UVs (not with Draco)
+
+  // Stable identifier, also used as the file name.
+  QString name () const;
+};
+
+struct SyntheticSceneInfo
+{
+  size_t vertexCount = 0; // Actual counts after grid/index-width clamping
+  size_t triangleCount = 0;
+  int primitiveCount = 0;
+};
+
+// Writes a GLB made of wavy grid tiles. Grids are clamped so every
+// primitive stays addressable with the requested index width (meshopt
+// stores 8-bit indices as 16-bit, the narrowest width it encodes).
+bool writeSyntheticGlb (const SyntheticSceneSpec &spec, const QString &path,
+                        SyntheticSceneInfo *info, QString *errorMsg);
+
+#endif // SYNTHETICGLB_H
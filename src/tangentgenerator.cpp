@@ -0,0 +1,170 @@
+#include "tangentgenerator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mikktspace.h>
+
+namespace
+{
+struct Context
+{
+  const SubMesh *mesh;
+  std::vector<glm::vec4> corners; // Tangent + sign per face corner
+};
+
+const SubMesh &
+meshOf (const SMikkTSpaceContext *context)
+{
+  return *static_cast<Context *> (context->m_pUserData)->mesh;
+}
+
+unsigned int
+cornerVertex (const SMikkTSpaceContext *context, int face, int vert)
+{
+  return meshOf (context).indices[(size_t)face * 3 + vert];
+}
+
+int
+getNumFaces (const SMikkTSpaceContext *context)
+{
+  return (int)(meshOf (context).indices.size () / 3);
+}
+
+int
+getNumVerticesOfFace (const SMikkTSpaceContext *, const int)
+{
+  return 3;
+}
+
+void
+getPosition (const SMikkTSpaceContext *context, float out[], const int face,
+             const int vert)
+{
+  const glm::vec3 p
+      = meshOf (context).position (cornerVertex (context, face, vert));
+  out[0] = p.x;
+  out[1] = p.y;
+  out[2] = p.z;
+}
+
+void
+getNormal (const SMikkTSpaceContext *context, float out[], const int face,
+           const int vert)
+{
+  const glm::vec3 n = glm::normalize (
+      meshOf (context).normal (cornerVertex (context, face, vert)));
+  out[0] = n.x;
+  out[1] = n.y;
+  out[2] = n.z;
+}
+
+void
+getTexCoord (const SMikkTSpaceContext *context, float out[], const int face,
+             const int vert)
+{
+  const glm::vec2 uv
+      = meshOf (context).texCoords (cornerVertex (context, face, vert));
+  out[0] = uv.x;
+  out[1] = uv.y;
+}
+
+void
+setTSpaceBasic (const SMikkTSpaceContext *context, const float tangent[],
+                const float sign, const int face, const int vert)
+{
+  static_cast<Context *> (context->m_pUserData)
+      ->corners[(size_t)face * 3 + vert]
+      = glm::vec4 (tangent[0], tangent[1], tangent[2], sign);
+}
+
+using Packed = std::array<int16_t, 4>;
+
+Packed
+pack (const glm::vec4 &tangent)
+{
+  Packed packed;
+  for (int c = 0; c < 3; c++)
+    packed[c] = (int16_t)std::lround (
+        std::clamp (tangent[c], -1.0f, 1.0f) * 32767.0f);
+  packed[3] = tangent.w < 0.0f ? -32767 : 32767;
+  return packed;
+}
+} // namespace
+
+size_t
+TangentGenerator::generate (SubMesh &mesh)
+{
+  const VertexAttribute &slot = mesh.layout.tangent;
+  if (slot.components != 4 || slot.type != ComponentShort
+      || mesh.indices.size () < 3)
+    return 0;
+  for (unsigned int index : mesh.indices)
+    if (index >= mesh.vertexCount)
+      return 0;
+
+  // 1. Tangent per face corner
+  Context data{ &mesh, std::vector<glm::vec4> (mesh.indices.size ()) };
+
+  SMikkTSpaceInterface callbacks = {};
+  callbacks.m_getNumFaces = getNumFaces;
+  callbacks.m_getNumVerticesOfFace = getNumVerticesOfFace;
+  callbacks.m_getPosition = getPosition;
+  callbacks.m_getNormal = getNormal;
+  callbacks.m_getTexCoord = getTexCoord;
+  callbacks.m_setTSpaceBasic = setTSpaceBasic;
+
+  SMikkTSpaceContext context = {};
+  context.m_pInterface = &callbacks;
+  context.m_pUserData = &data;
+  if (!genTangSpaceDefault (&context))
+    return 0;
+
+  // 2. Back to vertices. A corner whose packed tangent differs from every
+  // copy of its vertex so far gets a new copy (chained through `next`).
+  const size_t original = mesh.vertexCount;
+  const unsigned int stride = mesh.layout.stride;
+  std::vector<Packed> assigned (original);
+  std::vector<bool> used (original, false);
+  std::vector<size_t> next (original, SIZE_MAX);
+
+  for (size_t c = 0; c < mesh.indices.size (); c++)
+    {
+      const Packed tangent = pack (data.corners[c]);
+      size_t v = mesh.indices[c];
+      if (!used[v])
+        {
+          used[v] = true;
+          assigned[v] = tangent;
+          std::memcpy (&mesh.vertexData[v * stride + slot.offset],
+                       tangent.data (), sizeof (Packed));
+          continue;
+        }
+
+      while (assigned[v] != tangent && next[v] != SIZE_MAX)
+        v = next[v];
+      if (assigned[v] != tangent)
+        {
+          const size_t copy = mesh.vertexCount++;
+          mesh.vertexData.resize (mesh.vertexCount * stride);
+          std::memcpy (&mesh.vertexData[copy * stride],
+                       &mesh.vertexData[mesh.indices[c] * stride], stride);
+          std::memcpy (&mesh.vertexData[copy * stride + slot.offset],
+                       tangent.data (), sizeof (Packed));
+          for (MorphTarget &target : mesh.targets)
+            for (std::vector<glm::vec3> *deltas :
+                 { &target.positions, &target.normals, &target.tangents })
+              if (!deltas->empty ())
+                deltas->push_back ((*deltas)[mesh.indices[c]]);
+          assigned.push_back (tangent);
+          next.push_back (SIZE_MAX);
+          next[v] = copy;
+          v = copy;
+        }
+      mesh.indices[c] = (unsigned int)v;
+    }
+
+  return mesh.vertexCount - original;
+}
@@ -0,0 +1,19 @@
+#ifndef TANGENTGENERATOR_H
+#define TANGENTGENERATOR_H
+
+#include "meshdata.h"
+
+// Loader-side MikkTSpace tangents.
+//
+// Fills the tangent slot the loader reserved in the vertex layout (int16
+// normalized XYZ + sign) with the reference MikkTSpace implementation, the
+// one baking tools use, so normal maps line up across UV seams. Vertices
+// whose face corners end up with different tangents are split.
+class TangentGenerator
+{
+public:
+  // Returns the number of vertices added by splitting.
+  static size_t generate (SubMesh &mesh);
+};
+
+#endif // TANGENTGENERATOR_H
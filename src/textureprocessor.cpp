@@ -0,0 +1,698 @@
+#include "textureprocessor.h"
+#include "parallel.h"
+
+#include <QOpenGLContext>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// One uncompressed mip level
+struct MipLevel
+{
+  std::vector<unsigned char> texels;
+  int width = 0;
+  int height = 0;
+};
+
+static const std::array<float, 256> &
+srgbToLinear ()
+{
+  static const std::array<float, 256> table = [] () {
+    std::array<float, 256> values;
+    for (int i = 0; i < 256; i++)
+      {
+        const float c = i / 255.0f;
+        values[i] = c <= 0.04045f ? c / 12.92f
+                                  : std::pow ((c + 0.055f) / 1.055f, 2.4f);
+      }
+    return values;
+  }();
+  return table;
+}
+
+static unsigned char
+linearToSrgb (float c)
+{
+  c = std::clamp (c, 0.0f, 1.0f);
+  const float s = c <= 0.0031308f
+                      ? c * 12.92f
+                      : 1.055f * std::pow (c, 1.0f / 2.4f) - 0.055f;
+  return (unsigned char)(s * 255.0f + 0.5f);
+}
+
+static bool
+isAlphaChannel (int channel, int components)
+{
+  return (components == 2 && channel == 1)
+         || (components == 4 && channel == 3);
+}
+
+// 2x2 box filter. Odd dimensions repeat the last row/column.
+static MipLevel
+downsample (const MipLevel &src, int components, int usage)
+{
+  MipLevel dst;
+  dst.width = std::max (1, src.width / 2);
+  dst.height = std::max (1, src.height / 2);
+  dst.texels.resize ((size_t)dst.width * dst.height * components);
+
+  const std::array<float, 256> &lut = srgbToLinear ();
+  const bool normals = usage == UsageNormal && components >= 3;
+
+  parallelFor (
+      (size_t)dst.height,
+      [&] (size_t y) {
+        const int y0 = std::min ((int)y * 2, src.height - 1);
+        const int y1 = std::min ((int)y * 2 + 1, src.height - 1);
+        unsigned char *out
+            = dst.texels.data () + y * (size_t)dst.width * components;
+
+        for (int x = 0; x < dst.width; x++, out += components)
+          {
+            const int x0 = std::min (x * 2, src.width - 1);
+            const int x1 = std::min (x * 2 + 1, src.width - 1);
+            const unsigned char *quad[4] = {
+              &src.texels[((size_t)y0 * src.width + x0) * components],
+              &src.texels[((size_t)y0 * src.width + x1) * components],
+              &src.texels[((size_t)y1 * src.width + x0) * components],
+              &src.texels[((size_t)y1 * src.width + x1) * components],
+            };
+
+            int first = 0;
+            if (normals)
+              {
+                // Average the vectors and put them back on the unit sphere
+                float n[3] = { 0.0f, 0.0f, 0.0f };
+                for (const unsigned char *p : quad)
+                  for (int c = 0; c < 3; c++)
+                    n[c] += p[c] / 127.5f - 1.0f;
+                float len = std::sqrt (n[0] * n[0] + n[1] * n[1]
+                                       + n[2] * n[2]);
+                if (len < 1e-6f)
+                  {
+                    n[0] = n[1] = 0.0f;
+                    n[2] = len = 1.0f;
+                  }
+                for (int c = 0; c < 3; c++)
+                  out[c] = (unsigned char)std::clamp (
+                      (n[c] / len * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f,
+                      255.0f);
+                first = 3;
+              }
+
+            for (int c = first; c < components; c++)
+              {
+                if (usage == UsageColor && !isAlphaChannel (c, components))
+                  {
+                    float sum = 0.0f;
+                    for (const unsigned char *p : quad)
+                      sum += lut[p[c]];
+                    out[c] = linearToSrgb (sum * 0.25f);
+                  }
+                else
+                  {
+                    int sum = 0;
+                    for (const unsigned char *p : quad)
+                      sum += p[c];
+                    out[c] = (unsigned char)((sum + 2) / 4);
+                  }
+              }
+          }
+      },
+      8);
+
+  return dst;
+}
+
+// Gathers a 4x4 block as RGBA. Gray images are replicated to RGB, missing
+// alpha is opaque and texels past the edge repeat the last row/column.
+static void
+fetchBlock (const MipLevel &level, int components, int bx, int by,
+            unsigned char block[16][4])
+{
+  for (int i = 0; i < 16; i++)
+    {
+      const int x = std::min (bx * 4 + i % 4, level.width - 1);
+      const int y = std::min (by * 4 + i / 4, level.height - 1);
+      const unsigned char *p
+          = &level.texels[((size_t)y * level.width + x) * components];
+
+      if (components <= 2)
+        {
+          block[i][0] = block[i][1] = block[i][2] = p[0];
+          block[i][3] = components == 2 ? p[1] : 255;
+        }
+      else
+        {
+          block[i][0] = p[0];
+          block[i][1] = p[1];
+          block[i][2] = p[2];
+          block[i][3] = components == 4 ? p[3] : 255;
+        }
+    }
+}
+
+// Principal axis of the block's colors (first `channels` of RGBA), found by
+// power iteration on the covariance matrix. Channels are kept as structure
+// of arrays so the per-texel loops vectorize. Returns false for a flat
+// block.
+static bool
+principalAxis (const float px[4][16], int channels, float mean[4],
+               float axis[4])
+{
+  for (int c = 0; c < channels; c++)
+    {
+      float sum = 0.0f;
+      for (int i = 0; i < 16; i++)
+        sum += px[c][i];
+      mean[c] = sum / 16.0f;
+    }
+
+  float cov[4][4] = {};
+  for (int a = 0; a < channels; a++)
+    for (int b = a; b < channels; b++)
+      {
+        float sum = 0.0f;
+        for (int i = 0; i < 16; i++)
+          sum += (px[a][i] - mean[a]) * (px[b][i] - mean[b]);
+        cov[a][b] = cov[b][a] = sum;
+      }
+
+  // Start from the row of the most varying channel, which is never
+  // orthogonal to the principal axis.
+  int start = 0;
+  for (int c = 1; c < channels; c++)
+    if (cov[c][c] > cov[start][start])
+      start = c;
+  for (int c = 0; c < channels; c++)
+    axis[c] = cov[start][c];
+
+  for (int iteration = 0; iteration < 8; iteration++)
+    {
+      float next[4] = {};
+      float length = 0.0f;
+      for (int a = 0; a < channels; a++)
+        {
+          for (int b = 0; b < channels; b++)
+            next[a] += cov[a][b] * axis[b];
+          length += next[a] * next[a];
+        }
+      length = std::sqrt (length);
+      if (length < 1e-6f)
+        return false;
+      for (int c = 0; c < channels; c++)
+        axis[c] = next[c] / length;
+    }
+  return true;
+}
+
+// Projects the block on its axis and returns the two extreme points.
+static void
+fitEndpoints (const float px[4][16], int channels, float lo[4], float hi[4])
+{
+  float mean[4];
+  float axis[4];
+  if (!principalAxis (px, channels, mean, axis))
+    {
+      for (int c = 0; c < channels; c++)
+        lo[c] = hi[c] = mean[c];
+      return;
+    }
+
+  float tMin = FLT_MAX;
+  float tMax = -FLT_MAX;
+  for (int i = 0; i < 16; i++)
+    {
+      float t = 0.0f;
+      for (int c = 0; c < channels; c++)
+        t += (px[c][i] - mean[c]) * axis[c];
+      tMin = std::min (tMin, t);
+      tMax = std::max (tMax, t);
+    }
+
+  for (int c = 0; c < channels; c++)
+    {
+      lo[c] = std::clamp (mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+      hi[c] = std::clamp (mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+    }
+}
+
+// Picks the nearest palette entry for every texel.
+template <int PaletteSize>
+static void
+selectIndices (const float px[4][16], int channels,
+               const float palette[PaletteSize][4], int indices[16])
+{
+  float best[16];
+  for (int i = 0; i < 16; i++)
+    {
+      best[i] = FLT_MAX;
+      indices[i] = 0;
+    }
+
+  for (int k = 0; k < PaletteSize; k++)
+    {
+      float error[16] = {};
+      for (int c = 0; c < channels; c++)
+        for (int i = 0; i < 16; i++)
+          {
+            const float d = px[c][i] - palette[k][c];
+            error[i] += d * d;
+          }
+      for (int i = 0; i < 16; i++)
+        {
+          const bool closer = error[i] < best[i];
+          best[i] = closer ? error[i] : best[i];
+          indices[i] = closer ? k : indices[i];
+        }
+    }
+}
+
+static uint16_t
+packRgb565 (const float rgb[3])
+{
+  const int r = (int)std::lround (rgb[0] * 31.0f / 255.0f);
+  const int g = (int)std::lround (rgb[1] * 63.0f / 255.0f);
+  const int b = (int)std::lround (rgb[2] * 31.0f / 255.0f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void
+unpackRgb565 (uint16_t color, float rgb[4])
+{
+  const int r = (color >> 11) & 31;
+  const int g = (color >> 5) & 63;
+  const int b = color & 31;
+  rgb[0] = (float)((r << 3) | (r >> 2));
+  rgb[1] = (float)((g << 2) | (g >> 4));
+  rgb[2] = (float)((b << 3) | (b >> 2));
+  rgb[3] = 255.0f;
+}
+
+// BC1, four color mode (color0 > color1), 8 bytes.
+static void
+encodeBC1 (const unsigned char block[16][4], unsigned char *out)
+{
+  float px[4][16];
+  for (int c = 0; c < 3; c++)
+    for (int i = 0; i < 16; i++)
+      px[c][i] = block[i][c];
+
+  float lo[4];
+  float hi[4];
+  fitEndpoints (px, 3, lo, hi);
+
+  uint16_t color0 = packRgb565 (hi);
+  uint16_t color1 = packRgb565 (lo);
+  if (color0 < color1)
+    std::swap (color0, color1);
+
+  uint32_t bits = 0;
+  if (color0 != color1)
+    {
+      float palette[4][4];
+      unpackRgb565 (color0, palette[0]);
+      unpackRgb565 (color1, palette[1]);
+      for (int c = 0; c < 3; c++)
+        {
+          palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+          palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+
+      int indices[16];
+      selectIndices<4> (px, 3, palette, indices);
+      for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)indices[i] << (2 * i);
+    }
+
+  out[0] = color0 & 0xff;
+  out[1] = color0 >> 8;
+  out[2] = color1 & 0xff;
+  out[3] = color1 >> 8;
+  for (int i = 0; i < 4; i++)
+    out[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// BC4, eight value mode (red0 > red1), 8 bytes.
+static void
+encodeBC4 (const unsigned char values[16], unsigned char *out)
+{
+  int lo = 255;
+  int hi = 0;
+  for (int i = 0; i < 16; i++)
+    {
+      lo = std::min (lo, (int)values[i]);
+      hi = std::max (hi, (int)values[i]);
+    }
+
+  uint64_t bits = 0;
+  if (hi > lo)
+    {
+      float px[4][16];
+      for (int i = 0; i < 16; i++)
+        px[0][i] = values[i];
+
+      float palette[8][4];
+      palette[0][0] = (float)hi;
+      palette[1][0] = (float)lo;
+      for (int k = 2; k < 8; k++)
+        palette[k][0] = ((8 - k) * hi + (k - 1) * lo) / 7.0f;
+
+      int indices[16];
+      selectIndices<8> (px, 1, palette, indices);
+      for (int i = 0; i < 16; i++)
+        bits |= (uint64_t)indices[i] << (3 * i);
+    }
+
+  out[0] = (unsigned char)hi;
+  out[1] = (unsigned char)lo;
+  for (int i = 0; i < 6; i++)
+    out[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// Appends bits LSB first, as BC7 blocks are laid out.
+struct BlockWriter
+{
+  unsigned char *out;
+  int bit = 0;
+
+  void
+  put (unsigned int value, int count)
+  {
+    for (int i = 0; i < count; i++, bit++)
+      if ((value >> i) & 1)
+        out[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+  }
+};
+
+// Splits an 8-bit endpoint into 7-bit values and the shared p-bit.
+static void
+quantizeEndpointBC7 (const float endpoint[4], int quantized[4], int *pBit)
+{
+  float bestError = FLT_MAX;
+  for (int p = 0; p < 2; p++)
+    {
+      int q[4];
+      float error = 0.0f;
+      for (int c = 0; c < 4; c++)
+        {
+          q[c] = std::clamp ((int)std::lround ((endpoint[c] - p) / 2.0f), 0,
+                             127);
+          const float d = (float)((q[c] << 1) | p) - endpoint[c];
+          error += d * d;
+        }
+      if (error < bestError)
+        {
+          bestError = error;
+          *pBit = p;
+          std::memcpy (quantized, q, sizeof (q));
+        }
+    }
+}
+
+// BC7 mode 6: one subset, 7.7.7.7 endpoints with a p-bit each and 4-bit
+// indices. The single mode keeps the encoder fast; it is the one most
+// encoders pick for smooth RGBA content anyway. 16 bytes.
+static void
+encodeBC7 (const unsigned char block[16][4], unsigned char *out)
+{
+  static const int kWeights[16]
+      = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+  float px[4][16];
+  for (int c = 0; c < 4; c++)
+    for (int i = 0; i < 16; i++)
+      px[c][i] = block[i][c];
+
+  float ends[2][4];
+  fitEndpoints (px, 4, ends[0], ends[1]);
+
+  int q[2][4];
+  int p[2];
+  quantizeEndpointBC7 (ends[0], q[0], &p[0]);
+  quantizeEndpointBC7 (ends[1], q[1], &p[1]);
+
+  float palette[16][4];
+  for (int k = 0; k < 16; k++)
+    for (int c = 0; c < 4; c++)
+      {
+        const int e0 = (q[0][c] << 1) | p[0];
+        const int e1 = (q[1][c] << 1) | p[1];
+        palette[k][c]
+            = (float)(((64 - kWeights[k]) * e0 + kWeights[k] * e1 + 32) >> 6);
+      }
+
+  int indices[16];
+  selectIndices<16> (px, 4, palette, indices);
+
+  // The anchor (first) index drops its top bit, so it must be below 8
+  if (indices[0] >= 8)
+    {
+      std::swap (q[0], q[1]);
+      std::swap (p[0], p[1]);
+      for (int i = 0; i < 16; i++)
+        indices[i] = 15 - indices[i];
+    }
+
+  std::memset (out, 0, 16);
+  BlockWriter writer{ out };
+  writer.put (1u << 6, 7); // Mode 6
+  for (int c = 0; c < 4; c++)
+    {
+      writer.put (q[0][c], 7);
+      writer.put (q[1][c], 7);
+    }
+  writer.put (p[0], 1);
+  writer.put (p[1], 1);
+  writer.put (indices[0], 3);
+  for (int i = 1; i < 16; i++)
+    writer.put (indices[i], 4);
+}
+
+static size_t
+blockBytes (unsigned int codec)
+{
+  return codec == CodecBC1 || codec == CodecBC4 ? 8 : 16;
+}
+
+static std::vector<unsigned char>
+encodeLevel (const MipLevel &level, int components, unsigned int codec,
+             int usage)
+{
+  const int blocksX = (level.width + 3) / 4;
+  const int blocksY = (level.height + 3) / 4;
+  const size_t stride = blockBytes (codec);
+  std::vector<unsigned char> blocks ((size_t)blocksX * blocksY * stride);
+
+  // Channels stored by BC5: normal XY, or roughness (G) + metal (B)
+  const int first = usage == UsageMetallicRoughness ? 1 : 0;
+
+  parallelFor ((size_t)blocksY, [&] (size_t by) {
+    unsigned char block[16][4];
+    unsigned char channel[16];
+    for (int bx = 0; bx < blocksX; bx++)
+      {
+        fetchBlock (level, components, bx, (int)by, block);
+        unsigned char *dst
+            = blocks.data () + (by * blocksX + bx) * stride;
+
+        switch (codec)
+          {
+          case CodecBC1:
+            encodeBC1 (block, dst);
+            break;
+          case CodecBC4:
+            for (int i = 0; i < 16; i++)
+              channel[i] = block[i][0];
+            encodeBC4 (channel, dst);
+            break;
+          case CodecBC5:
+            for (int half = 0; half < 2; half++)
+              {
+                for (int i = 0; i < 16; i++)
+                  channel[i] = block[i][first + half];
+                encodeBC4 (channel, dst + 8 * half);
+              }
+            break;
+          case CodecBC7:
+            encodeBC7 (block, dst);
+            break;
+          }
+      }
+  });
+
+  return blocks;
+}
+
+static unsigned int
+chooseCodec (const MipLevel &base, int components, int usage,
+             unsigned int codecs)
+{
+  if (usage == UsageNormal || usage == UsageMetallicRoughness)
+    return components >= 3 ? codecs & CodecBC5 : 0;
+  if (components == 1)
+    return codecs & CodecBC4;
+
+  bool alpha = false;
+  if (components == 2 || components == 4)
+    {
+      for (size_t i = components - 1; i < base.texels.size () && !alpha;
+           i += components)
+        alpha = base.texels[i] != 255;
+    }
+
+  if (!alpha && (codecs & CodecBC1))
+    return CodecBC1;
+  return codecs & CodecBC7;
+}
+
+static void
+processTexture (TextureData &texture, unsigned int codecs)
+{
+  const int components = texture.components;
+  const size_t baseBytes
+      = (size_t)texture.width * texture.height * components;
+  if (components < 1 || components > 4 || texture.width <= 0
+      || texture.height <= 0 || texture.pixels.size () < baseBytes)
+    return;
+
+  // 1. Mip chain down to 1x1
+  std::vector<MipLevel> chain (1);
+  chain[0].texels = std::move (texture.pixels);
+  chain[0].width = texture.width;
+  chain[0].height = texture.height;
+  while (chain.back ().width > 1 || chain.back ().height > 1)
+    chain.push_back (downsample (chain.back (), components, texture.usage));
+
+  // 2. Encode (or keep texels) level by level
+  const unsigned int codec
+      = chooseCodec (chain[0], components, texture.usage, codecs);
+
+  texture.pixels.clear ();
+  texture.levelOffsets.clear ();
+  for (const MipLevel &level : chain)
+    {
+      texture.levelOffsets.push_back (texture.pixels.size ());
+      if (codec)
+        {
+          const std::vector<unsigned char> blocks
+              = encodeLevel (level, components, codec, texture.usage);
+          texture.pixels.insert (texture.pixels.end (), blocks.begin (),
+                                 blocks.end ());
+        }
+      else
+        {
+          texture.pixels.insert (texture.pixels.end (),
+                                 level.texels.begin (), level.texels.end ());
+        }
+    }
+  texture.codec = codec;
+}
+
+void
+TextureProcessor::process (SceneData &scene, unsigned int codecs)
+{
+  // 1. Usage from the materials. A texture sampled in two roles keeps plain
+  // texels, the codecs assume a single channel layout.
+  std::vector<int> usage (scene.textures.size (), -1);
+  std::vector<bool> mixed (scene.textures.size (), false);
+  auto tag = [&] (int index, int role) {
+    if (index < 0 || index >= (int)usage.size ())
+      return;
+    if (usage[index] >= 0 && usage[index] != role)
+      mixed[index] = true;
+    usage[index] = role;
+  };
+  for (const MaterialData &mat : scene.materials)
+    {
+      tag (mat.baseColorIndex, UsageColor);
+      tag (mat.metallicRoughnessIndex, UsageMetallicRoughness);
+      tag (mat.normalIndex, UsageNormal);
+    }
+
+  // 2. Textures one after another, each level spread over the pool
+  for (size_t t = 0; t < scene.textures.size (); t++)
+    {
+      TextureData &texture = scene.textures[t];
+      if (texture.pixels.empty ())
+        continue;
+      texture.usage = mixed[t] ? UsageColor : std::max (usage[t], 0);
+      processTexture (texture, mixed[t] ? 0 : codecs);
+    }
+}
+
+void
+TextureProcessor::process (TextureData &texture, unsigned int codecs)
+{
+  processTexture (texture, codecs);
+}
+
+unsigned int
+TextureProcessor::supportedCodecs (QOpenGLContext *context)
+{
+  if (!context)
+    return 0;
+
+  const bool desktop = !context->isOpenGLES ();
+  const QPair<int, int> version = context->format ().version ();
+  auto has = [context] (const char *extension) {
+    return context->hasExtension (extension);
+  };
+
+  unsigned int codecs = 0;
+  if (has ("GL_EXT_texture_compression_s3tc"))
+    codecs |= CodecBC1;
+  if ((desktop && version >= qMakePair (3, 0))
+      || has ("GL_ARB_texture_compression_rgtc")
+      || has ("GL_EXT_texture_compression_rgtc"))
+    codecs |= CodecBC4 | CodecBC5;
+  if ((desktop && version >= qMakePair (4, 2))
+      || has ("GL_ARB_texture_compression_bptc")
+      || has ("GL_EXT_texture_compression_bptc"))
+    codecs |= CodecBC7;
+  return codecs;
+}
+
+size_t
+TextureProcessor::memoryBytes (const TextureData &texture, int baseLevel)
+{
+  if (texture.pixels.empty ())
+    return 0;
+  if (texture.levelOffsets.empty ())
+    return uncompressedBytes (texture);
+
+  const int levels = (int)texture.levelOffsets.size ();
+  baseLevel = std::clamp (baseLevel, 0, levels - 1);
+
+  // RGB8 is padded to four bytes per texel by common drivers
+  const size_t texelBytes = texture.components >= 3 ? 4 : texture.components;
+  size_t bytes = 0;
+  int width = texture.width;
+  int height = texture.height;
+  for (int level = 0; level < levels; level++)
+    {
+      if (level >= baseLevel && texture.codec)
+        bytes += (size_t)((width + 3) / 4) * ((height + 3) / 4)
+                 * blockBytes (texture.codec);
+      else if (level >= baseLevel)
+        bytes += (size_t)width * height * texelBytes;
+      width = std::max (1, width / 2);
+      height = std::max (1, height / 2);
+    }
+  return bytes;
+}
+
+size_t
+TextureProcessor::uncompressedBytes (const TextureData &texture)
+{
+  if (texture.pixels.empty ())
+    return 0;
+
+  // Unsized RGB formats are stored as 4 bytes per texel by common drivers;
+  // the mip chain adds a third.
+  const size_t texelBytes = texture.components == 1 ? 1 : 4;
+  return (size_t)texture.width * texture.height * texelBytes * 4 / 3;
+}
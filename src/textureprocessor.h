@@ -0,0 +1,39 @@
+#ifndef TEXTUREPROCESSOR_H
+#define TEXTUREPROCESSOR_H
+
+#include "meshdata.h"
+
+class QOpenGLContext;
+
+// Loader-side texture preparation.
+//
+// Builds the whole mip chain on the CPU (sRGB color is averaged in linear
+// space, normals are renormalized) and block-compresses every level the
+// target context can sample: BC1 for opaque color, BC7 for color with
+// alpha, BC5 for normal maps (XY, Z is rebuilt in the shader) and
+// metallic-roughness (G/B packed into RG and swizzled back by Model), BC4
+// for single channel images. Work is spread over idle threads of the global
+// pool, so this belongs on loader threads, never the render thread.
+class TextureProcessor
+{
+public:
+  // Tags each texture with its usage from the materials and processes it.
+  // `codecs` is a set of TextureCodec bits; 0 only builds mips.
+  static void process (SceneData &scene, unsigned int codecs);
+
+  // One texture whose usage is already set, as process() does it.
+  static void process (TextureData &texture, unsigned int codecs);
+
+  // TextureCodec bits the given (current) context can sample.
+  static unsigned int supportedCodecs (QOpenGLContext *context);
+
+  // Estimated VRAM of a texture as Model uploads it, optionally without
+  // the levels finer than baseLevel (streaming). Counts levels dropped from
+  // the pixels (TextureData::firstLevel) too.
+  static size_t memoryBytes (const TextureData &texture, int baseLevel = 0);
+
+  // The same texture as uncompressed 8-bit texels with a mip chain.
+  static size_t uncompressedBytes (const TextureData &texture);
+};
+
+#endif // TEXTUREPROCESSOR_H
@@ -0,0 +1,224 @@
+// Tracing benchmark: what a TRACE_SCOPE costs with the tracer off and on,
+// on one thread and on several at once, and what recording adds to a
+// whole model load.
+//
+//   mesh-spy-tracebench [--iterations N] [--threads N] [--work-dir DIR]
+//                       [--out results.json] [--trace load.json]
+
+#include "gltfloader.h"
+#include "syntheticglb.h"
+#include "tracer.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <algorithm>
+#include <barrier>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Scopes per run: half a thread buffer, so nothing is dropped
+static constexpr size_t kScopes = Tracer::kMaxEvents / 2;
+
+// Written by every loop so the empty one is not optimized away
+static volatile unsigned s_sink = 0;
+
+static void
+emptyLoop (size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    s_sink = s_sink + 1;
+}
+
+static void
+scopeLoop (size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    {
+      TRACE_SCOPE_CAT ("bench", "Scope");
+      s_sink = s_sink + 1;
+    }
+}
+
+static double
+median (std::vector<double> values)
+{
+  if (values.empty ())
+    return 0.0;
+  std::sort (values.begin (), values.end ());
+  return values[values.size () / 2];
+}
+
+// Median nanoseconds per iteration of loop over `threads` threads, each
+// running kScopes iterations. Every run is its own trace session; the
+// threads are kept across runs since their buffers outlive them.
+static double
+measure (void (*loop) (size_t), bool tracing, int threads, int runs)
+{
+  std::barrier sync (threads + 1);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++)
+    workers.emplace_back ([&sync, loop, runs] () {
+      for (int run = 0; run < runs; run++)
+        {
+          sync.arrive_and_wait ();
+          loop (kScopes);
+          sync.arrive_and_wait ();
+        }
+    });
+
+  std::vector<double> samples;
+  for (int run = 0; run < runs; run++)
+    {
+      Tracer::setEnabled (false);
+      Tracer::setEnabled (tracing);
+
+      QElapsedTimer timer;
+      timer.start ();
+      sync.arrive_and_wait ();
+      sync.arrive_and_wait ();
+      samples.push_back ((double)timer.nsecsElapsed () / kScopes);
+    }
+  for (std::thread &worker : workers)
+    worker.join ();
+
+  Tracer::setEnabled (false);
+  return median (samples);
+}
+
+int
+main (int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription ("meshSpy tracing benchmark");
+  parser.addHelpOption ();
+  QCommandLineOption iterOpt ("iterations", "Runs per measurement.", "count",
+                              "9");
+  QCommandLineOption threadsOpt (
+      "threads", "Threads tracing at once.", "count",
+      QString::number (std::max (2, QThread::idealThreadCount ())));
+  QCommandLineOption dirOpt ("work-dir", "Where generated GLBs are cached.",
+                             "dir", QDir::tempPath () + "/mesh-spy-bench");
+  QCommandLineOption outOpt ("out", "Results file.", "file",
+                             "tracebench.json");
+  QCommandLineOption traceOpt ("trace", "Trace of the last traced load.",
+                               "file");
+  parser.addOptions ({ iterOpt, threadsOpt, dirOpt, outOpt, traceOpt });
+  parser.process (app);
+
+  const int runs = std::max (1, parser.value (iterOpt).toInt ());
+  const int threads = std::max (2, parser.value (threadsOpt).toInt ());
+  if (!Tracer::available ())
+    std::fprintf (stderr, "Built without MESHSPY_TRACING: the macros are "
+                          "compiled out, every case measures the loop.\n");
+
+  // 1. One scope in a tight loop, against the same loop without it
+  const double baseline = measure (emptyLoop, false, 1, runs);
+  const double disabled = measure (scopeLoop, false, 1, runs);
+  const double enabled = measure (scopeLoop, true, 1, runs);
+  const size_t dropped = Tracer::droppedCount ();
+  const double contended = measure (scopeLoop, true, threads, runs);
+
+  std::printf ("%-36s %10s %10s\n", "case", "ns/iter", "overhead");
+  auto row = [baseline] (const char *name, double ns) {
+    std::printf ("%-36s %10.2f %10.2f\n", name, ns, ns - baseline);
+  };
+  row ("empty loop", baseline);
+  row ("TRACE_SCOPE, tracer off", disabled);
+  row ("TRACE_SCOPE, tracer on", enabled);
+  const QByteArray threadedName = "TRACE_SCOPE, tracer on, "
+                                  + QByteArray::number (threads)
+                                  + " threads";
+  row (threadedName.constData (), contended);
+
+  // 2. A model load with the tracer off and on, alternating so both see
+  // the same caches
+  SyntheticSceneSpec spec;
+  spec.primitiveCount = 256;
+  spec.textureCount = 4;
+  QDir workDir (parser.value (dirOpt));
+  workDir.mkpath (".");
+  const QString path = workDir.filePath (spec.name () + ".glb");
+  if (!QFileInfo::exists (path))
+    {
+      QString error;
+      if (!writeSyntheticGlb (spec, path, nullptr, &error))
+        {
+          std::fprintf (stderr, "Cannot write %s: %s\n", qPrintable (path),
+                        qPrintable (error));
+          return 1;
+        }
+    }
+
+  std::vector<double> loadOff, loadOn;
+  size_t loadEvents = 0;
+  for (int run = 0; run < runs; run++)
+    {
+      for (bool tracing : { false, true })
+        {
+          Tracer::setEnabled (tracing);
+          QElapsedTimer timer;
+          timer.start ();
+          QString error;
+          std::unique_ptr<SceneData> data (
+              GLTFLoader::load (path, &error, LoaderOptions ()));
+          const double ms = timer.nsecsElapsed () / 1.0e6;
+          Tracer::setEnabled (false);
+          if (!data)
+            {
+              std::fprintf (stderr, "Load failed: %s\n", qPrintable (error));
+              return 1;
+            }
+          (tracing ? loadOn : loadOff).push_back (ms);
+          if (tracing)
+            loadEvents = Tracer::eventCount ();
+        }
+    }
+
+  if (parser.isSet (traceOpt))
+    {
+      QString error;
+      if (!Tracer::write (parser.value (traceOpt), &error))
+        std::fprintf (stderr, "Cannot write trace: %s\n",
+                      qPrintable (error));
+    }
+
+  const double offMs = median (loadOff);
+  const double onMs = median (loadOn);
+  std::printf ("\n%-36s %10.2f ms\n", "load, tracer off", offMs);
+  std::printf ("%-36s %10.2f ms %+7.2f%% (%zu events)\n", "load, tracer on",
+               onMs, (onMs / offMs - 1.0) * 100.0, loadEvents);
+
+  QJsonObject scope{ { "baselineNs", baseline },
+                     { "disabledNs", disabled },
+                     { "enabledNs", enabled },
+                     { "threads", threads },
+                     { "threadedEnabledNs", contended },
+                     { "dropped", (double)dropped } };
+  QJsonObject load{ { "file", spec.name () },
+                    { "offMs", offMs },
+                    { "onMs", onMs },
+                    { "events", (double)loadEvents } };
+  QJsonObject results{ { "tracingCompiledIn", Tracer::available () },
+                       { "scopesPerRun", (double)kScopes },
+                       { "runs", runs },
+                       { "scope", scope },
+                       { "load", load } };
+
+  QFile out (parser.value (outOpt));
+  if (out.open (QIODevice::WriteOnly))
+    out.write (QJsonDocument (results).toJson ());
+  std::printf ("\nResults written to %s\n",
+               qPrintable (parser.value (outOpt)));
+  return 0;
+}
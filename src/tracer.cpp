@@ -0,0 +1,409 @@
+#include "tracer.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QMutex>
+#include <QSaveFile>
+#include <chrono>
+#include <vector>
+
+namespace
+{
+constexpr int kGpuThread = 0; // Track of gpuComplete events
+
+struct TraceEvent
+{
+  const char *category;
+  const char *name;
+  int64_t start; // ns
+  union
+  {
+    int64_t duration; // ns, complete events
+    double value;     // Counters
+  };
+  char phase; // Chrome trace phase: X, B, E, i or C
+  bool gpu;
+};
+
+struct ThreadBuffer
+{
+  // Chunks are allocated and filled by the owning thread only; count
+  // publishes them to write()
+  std::atomic<TraceEvent *> chunks[Tracer::kMaxChunks] = {};
+  std::atomic<size_t> count{ 0 };
+  std::atomic<size_t> dropped{ 0 };
+  std::atomic<unsigned> session{ 0 }; // The one its events belong to
+  int thread = 0;
+  QByteArray name; // Guarded by Registry::mutex
+};
+
+struct Registry
+{
+  QMutex mutex;
+  std::vector<ThreadBuffer *> buffers;
+  std::vector<ThreadBuffer *> retired; // Of threads that have exited
+  int nextThread = kGpuThread + 1;
+};
+
+std::atomic<unsigned> s_session{ 0 };
+std::atomic<int64_t> s_sessionStart{ 0 };
+
+// Never destroyed: threads may still trace while statics are torn down
+Registry &
+registry ()
+{
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+thread_local ThreadBuffer *t_buffer = nullptr;
+
+// Hands the thread's buffer back when the thread exits
+struct ThreadExit
+{
+  void
+  arm ()
+  {
+  }
+
+  ~ThreadExit ()
+  {
+    if (!t_buffer)
+      return;
+    Registry &reg = registry ();
+    QMutexLocker lock (&reg.mutex);
+    reg.retired.push_back (t_buffer);
+    t_buffer = nullptr;
+  }
+};
+
+thread_local ThreadExit t_exit;
+
+// A retired buffer can be taken over once its session is over: until
+// then every write() exports its events again
+bool
+reusable (const ThreadBuffer &buffer)
+{
+  return buffer.session.load (std::memory_order_relaxed)
+         != s_session.load (std::memory_order_relaxed);
+}
+
+ThreadBuffer *
+threadBuffer ()
+{
+  if (t_buffer)
+    return t_buffer;
+
+  // Pool threads come and go; a new one takes over the chunks of one that
+  // has exited instead of growing the registry
+  t_exit.arm ();
+  Registry &reg = registry ();
+  QMutexLocker lock (&reg.mutex);
+  for (size_t i = 0; i < reg.retired.size (); i++)
+    {
+      ThreadBuffer *buffer = reg.retired[i];
+      if (!reusable (*buffer))
+        continue;
+      reg.retired[i] = reg.retired.back ();
+      reg.retired.pop_back ();
+      buffer->count.store (0, std::memory_order_relaxed);
+      buffer->dropped.store (0, std::memory_order_relaxed);
+      buffer->session.store (s_session.load (std::memory_order_relaxed),
+                             std::memory_order_release);
+      buffer->name.clear ();
+      buffer->thread = reg.nextThread++; // A track of its own
+      t_buffer = buffer;
+      return t_buffer;
+    }
+
+  t_buffer = new ThreadBuffer;
+  t_buffer->thread = reg.nextThread++;
+  reg.buffers.push_back (t_buffer);
+  return t_buffer;
+}
+
+void
+append (const TraceEvent &event)
+{
+  ThreadBuffer *buffer = threadBuffer ();
+
+  // The first event of a new session recycles the buffer
+  const unsigned session = s_session.load (std::memory_order_relaxed);
+  if (buffer->session.load (std::memory_order_relaxed) != session)
+    {
+      buffer->count.store (0, std::memory_order_relaxed);
+      buffer->dropped.store (0, std::memory_order_relaxed);
+      buffer->session.store (session, std::memory_order_release);
+    }
+
+  const size_t n = buffer->count.load (std::memory_order_relaxed);
+  const size_t chunk = n / Tracer::kChunkEvents;
+  if (chunk >= Tracer::kMaxChunks)
+    {
+      buffer->dropped.fetch_add (1, std::memory_order_relaxed);
+      return;
+    }
+
+  TraceEvent *events = buffer->chunks[chunk].load (std::memory_order_relaxed);
+  if (!events)
+    {
+      events = new TraceEvent[Tracer::kChunkEvents];
+      buffer->chunks[chunk].store (events, std::memory_order_relaxed);
+    }
+  events[n % Tracer::kChunkEvents] = event;
+  buffer->count.store (n + 1, std::memory_order_release);
+}
+
+bool
+currentSession (const ThreadBuffer &buffer)
+{
+  return buffer.session.load (std::memory_order_acquire)
+         == s_session.load (std::memory_order_relaxed);
+}
+
+TraceEvent
+makeEvent (char phase, const char *category, const char *name, int64_t start)
+{
+  TraceEvent event;
+  event.category = category;
+  event.name = name;
+  event.start = start;
+  event.duration = 0;
+  event.phase = phase;
+  event.gpu = false;
+  return event;
+}
+
+void
+appendString (QByteArray &json, const char *text)
+{
+  json += '"';
+  for (const char *c = text; *c; c++)
+    {
+      if (*c == '"' || *c == '\\')
+        json += '\\';
+      if ((unsigned char)*c >= 0x20)
+        json += *c;
+    }
+  json += '"';
+}
+
+// Microseconds since the session started, as Chrome expects
+void
+appendMicros (QByteArray &json, int64_t ns)
+{
+  json += QByteArray::number (ns / 1000.0, 'f', 3);
+}
+
+void
+appendThreadName (QByteArray &json, int thread, const QByteArray &name,
+                  int sortIndex)
+{
+  json += "{\"ph\":\"M\",\"pid\":1,\"tid\":" + QByteArray::number (thread)
+          + ",\"name\":\"thread_name\",\"args\":{\"name\":";
+  appendString (json, name.constData ());
+  json += "}},\n{\"ph\":\"M\",\"pid\":1,\"tid\":"
+          + QByteArray::number (thread)
+          + ",\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":"
+          + QByteArray::number (sortIndex) + "}},\n";
+}
+
+void
+appendEvent (QByteArray &json, const TraceEvent &event, int thread,
+             int64_t origin)
+{
+  json += "{\"ph\":\"";
+  json += event.phase;
+  json += "\",\"pid\":1,\"tid\":"
+          + QByteArray::number (event.gpu ? kGpuThread : thread)
+          + ",\"ts\":";
+  appendMicros (json, event.start - origin);
+  if (event.phase != 'E')
+    {
+      json += ",\"name\":";
+      appendString (json, event.name);
+    }
+  if (event.category)
+    {
+      json += ",\"cat\":";
+      appendString (json, event.category);
+    }
+
+  switch (event.phase)
+    {
+    case 'X':
+      json += ",\"dur\":";
+      appendMicros (json, event.duration);
+      break;
+    case 'i':
+      json += ",\"s\":\"t\"";
+      break;
+    case 'C':
+      json += ",\"args\":{\"value\":"
+              + QByteArray::number (event.value, 'g', 10) + "}";
+      break;
+    }
+  json += "},\n";
+}
+} // namespace
+
+std::atomic<bool> Tracer::s_enabled{ false };
+
+void
+Tracer::setEnabled (bool enabled)
+{
+  if (enabled && !s_enabled.load (std::memory_order_relaxed))
+    {
+      s_sessionStart.store (now (), std::memory_order_relaxed);
+      s_session.fetch_add (1, std::memory_order_relaxed);
+    }
+  s_enabled.store (enabled, std::memory_order_relaxed);
+}
+
+int64_t
+Tracer::now ()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds> (
+             std::chrono::steady_clock::now ().time_since_epoch ())
+      .count ();
+}
+
+void
+Tracer::complete (const char *category, const char *name, int64_t startNs,
+                  int64_t endNs)
+{
+  TraceEvent event = makeEvent ('X', category, name, startNs);
+  event.duration = endNs - startNs;
+  append (event);
+}
+
+void
+Tracer::begin (const char *category, const char *name)
+{
+  append (makeEvent ('B', category, name, now ()));
+}
+
+void
+Tracer::end ()
+{
+  append (makeEvent ('E', nullptr, nullptr, now ()));
+}
+
+void
+Tracer::instant (const char *category, const char *name)
+{
+  append (makeEvent ('i', category, name, now ()));
+}
+
+void
+Tracer::counter (const char *name, double value)
+{
+  TraceEvent event = makeEvent ('C', nullptr, name, now ());
+  event.value = value;
+  append (event);
+}
+
+void
+Tracer::gpuComplete (const char *name, int64_t startNs, int64_t endNs)
+{
+  TraceEvent event = makeEvent ('X', "gpu", name, startNs);
+  event.duration = endNs - startNs;
+  event.gpu = true;
+  append (event);
+}
+
+void
+Tracer::setThreadName (const char *name)
+{
+  ThreadBuffer *buffer = threadBuffer ();
+  QMutexLocker lock (&registry ().mutex);
+  buffer->name = name;
+}
+
+size_t
+Tracer::eventCount ()
+{
+  Registry &reg = registry ();
+  QMutexLocker lock (&reg.mutex);
+  size_t total = 0;
+  for (const ThreadBuffer *buffer : reg.buffers)
+    if (currentSession (*buffer))
+      total += buffer->count.load (std::memory_order_acquire);
+  return total;
+}
+
+size_t
+Tracer::droppedCount ()
+{
+  Registry &reg = registry ();
+  QMutexLocker lock (&reg.mutex);
+  size_t total = 0;
+  for (const ThreadBuffer *buffer : reg.buffers)
+    if (currentSession (*buffer))
+      total += buffer->dropped.load (std::memory_order_relaxed);
+  return total;
+}
+
+bool
+Tracer::write (const QString &path, QString *errorMsg)
+{
+  const int64_t origin = s_sessionStart.load (std::memory_order_relaxed);
+
+  QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  appendThreadName (json, kGpuThread, "GPU", 1 << 20);
+
+  // 1. Every thread's events of this session, up to the count it has
+  // published; the buffers only grow, so no thread has to stop
+  size_t events = 0;
+  size_t dropped = 0;
+  {
+    Registry &reg = registry ();
+    QMutexLocker lock (&reg.mutex);
+    for (ThreadBuffer *buffer : reg.buffers)
+      {
+        if (!currentSession (*buffer))
+          continue;
+        const size_t count = buffer->count.load (std::memory_order_acquire);
+        dropped += buffer->dropped.load (std::memory_order_relaxed);
+        if (count == 0)
+          continue;
+
+        const QByteArray name
+            = buffer->name.isEmpty ()
+                  ? "Worker " + QByteArray::number (buffer->thread)
+                  : buffer->name;
+        appendThreadName (json, buffer->thread, name, buffer->thread);
+
+        for (size_t i = 0; i < count; i++)
+          {
+            const TraceEvent *chunk
+                = buffer->chunks[i / kChunkEvents].load (
+                    std::memory_order_relaxed);
+            appendEvent (json, chunk[i % kChunkEvents], buffer->thread,
+                         origin);
+            events++;
+          }
+      }
+  }
+
+  // 2. Drop the trailing comma
+  if (json.endsWith (",\n"))
+    json.chop (2);
+  json += "\n]}\n";
+
+  if (dropped)
+    qWarning () << "Tracer:" << dropped
+                << "events dropped, thread buffers were full";
+
+  QSaveFile file (path);
+  if (!file.open (QIODevice::WriteOnly) || file.write (json) != json.size ()
+      || !file.commit ())
+    {
+      if (errorMsg)
+        *errorMsg = file.errorString ();
+      return false;
+    }
+
+  qDebug () << "Tracer:" << events << "events written to" << path;
+  return true;
+}
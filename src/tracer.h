@@ -0,0 +1,159 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Timeline of what every thread (and the GPU) did, written as Chrome trace
+// JSON for chrome://tracing or ui.perfetto.dev.
+//
+// Each thread appends to its own buffer without locking: events go into
+// chunks only that thread writes, and the event count is published with a
+// release store, so write() can export while other threads keep tracing. A
+// thread's buffer holds kMaxEvents per session; past that its events are
+// counted as dropped. Buffers are only created by threads that trace, are
+// recycled by their thread's first event of the next session, and outlive
+// the thread so its events can still be written; once a new session has
+// started, the next new thread takes the buffer over under a new thread
+// id. Do not start a session while write() runs.
+//
+// Names and categories are stored as pointers: pass string literals (or
+// anything else that lives until the trace is written).
+//
+// The TRACE_* macros compile to nothing without MESHSPY_TRACING; with it,
+// a disabled tracer costs one relaxed atomic load per macro.
+class Tracer
+{
+public:
+  static constexpr size_t kChunkEvents = 4096;
+  static constexpr size_t kMaxChunks = 64;
+  static constexpr size_t kMaxEvents = kChunkEvents * kMaxChunks;
+
+#ifdef MESHSPY_TRACING
+  static constexpr bool
+  available ()
+  {
+    return true;
+  }
+
+  static bool
+  enabled ()
+  {
+    return s_enabled.load (std::memory_order_relaxed);
+  }
+#else
+  static constexpr bool
+  available ()
+  {
+    return false;
+  }
+
+  static constexpr bool
+  enabled ()
+  {
+    return false;
+  }
+#endif
+
+  // Turning it on starts a new session, which write() exports
+  static void setEnabled (bool enabled);
+
+  // Steady clock, in nanoseconds
+  static int64_t now ();
+
+  static void complete (const char *category, const char *name,
+                        int64_t startNs, int64_t endNs);
+  static void begin (const char *category, const char *name);
+  static void end ();
+  static void instant (const char *category, const char *name);
+  static void counter (const char *name, double value);
+
+  // A span on the GPU track, already converted to the now() clock
+  static void gpuComplete (const char *name, int64_t startNs, int64_t endNs);
+
+  // Shown for the calling thread; others are listed as "Worker <n>"
+  static void setThreadName (const char *name);
+
+  // Of the current session, over every thread
+  static size_t eventCount ();
+  static size_t droppedCount ();
+
+  static bool write (const QString &path, QString *errorMsg = nullptr);
+
+private:
+  static std::atomic<bool> s_enabled;
+};
+
+// Emits one complete event covering its lifetime, if tracing was on when
+// it started.
+class TraceScope
+{
+public:
+  TraceScope (const char *category, const char *name)
+      : m_category (category), m_name (Tracer::enabled () ? name : nullptr)
+  {
+    if (m_name)
+      m_start = Tracer::now ();
+  }
+
+  ~TraceScope ()
+  {
+    if (m_name)
+      Tracer::complete (m_category, m_name, m_start, Tracer::now ());
+  }
+
+  TraceScope (const TraceScope &) = delete;
+  TraceScope &operator= (const TraceScope &) = delete;
+
+private:
+  const char *m_category;
+  const char *m_name;
+  int64_t m_start = 0;
+};
+
+#ifdef MESHSPY_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_ (a, b)
+#define TRACE_SCOPE_CAT(category, name)                                      \
+  TraceScope TRACE_CONCAT (traceScope_, __LINE__) (category, name)
+#define TRACE_BEGIN(category, name)                                          \
+  do                                                                         \
+    {                                                                        \
+      if (Tracer::enabled ())                                                \
+        Tracer::begin (category, name);                                      \
+    }                                                                        \
+  while (0)
+#define TRACE_END()                                                          \
+  do                                                                         \
+    {                                                                        \
+      if (Tracer::enabled ())                                                \
+        Tracer::end ();                                                      \
+    }                                                                        \
+  while (0)
+#define TRACE_INSTANT(category, name)                                        \
+  do                                                                         \
+    {                                                                        \
+      if (Tracer::enabled ())                                                \
+        Tracer::instant (category, name);                                    \
+    }                                                                        \
+  while (0)
+#define TRACE_COUNTER(name, value)                                           \
+  do                                                                         \
+    {                                                                        \
+      if (Tracer::enabled ())                                                \
+        Tracer::counter (name, value);                                       \
+    }                                                                        \
+  while (0)
+#else
+#define TRACE_SCOPE_CAT(category, name) ((void)0)
+#define TRACE_BEGIN(category, name) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_INSTANT(category, name) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+#endif
+
+#define TRACE_SCOPE(name) TRACE_SCOPE_CAT ("app", name)
+
+#endif // TRACER_H
@@ -0,0 +1,119 @@
+#include "uniformring.h"
+#include "glcore.h"
+
+#include <QDebug>
+#include <algorithm>
+
+UniformRing::UniformRing () {}
+
+UniformRing::~UniformRing ()
+{
+  if (!m_buffer)
+    return;
+
+  for (GLsync &fence : m_fences)
+    {
+      if (fence)
+        glDeleteSync (fence);
+    }
+
+  if (m_mapped)
+    {
+      glBindBuffer (GL_UNIFORM_BUFFER, m_buffer);
+      glUnmapBuffer (GL_UNIFORM_BUFFER);
+      glBindBuffer (GL_UNIFORM_BUFFER, 0);
+    }
+  glDeleteBuffers (1, &m_buffer);
+}
+
+void
+UniformRing::init (size_t blockSize)
+{
+  initializeOpenGLFunctions ();
+
+  GLint alignment = 256;
+  glGetIntegerv (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = std::max (alignment, 1);
+
+  m_blockSize = blockSize;
+  m_slotStride = (blockSize + alignment - 1) / alignment * alignment;
+  const size_t totalSize = m_slotStride * kFrameCount;
+
+  glGenBuffers (1, &m_buffer);
+  glBindBuffer (GL_UNIFORM_BUFFER, m_buffer);
+
+  // glBufferStorage is core since 4.4 and not part of the ES subset.
+  m_gl45 = coreFunctions45 ();
+  if (m_gl45)
+    {
+      const GLbitfield flags
+          = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      m_gl45->glBufferStorage (GL_UNIFORM_BUFFER, (GLsizeiptr)totalSize,
+                               nullptr, flags);
+      m_mapped = static_cast<unsigned char *> (glMapBufferRange (
+          GL_UNIFORM_BUFFER, 0, (GLsizeiptr)totalSize, flags));
+    }
+
+  if (!m_mapped)
+    {
+      qDebug () << "UniformRing: persistent mapping unavailable, using "
+                   "glBufferSubData.";
+      if (m_gl45)
+        {
+          // Immutable storage cannot be respecified, start over.
+          glBindBuffer (GL_UNIFORM_BUFFER, 0);
+          glDeleteBuffers (1, &m_buffer);
+          glGenBuffers (1, &m_buffer);
+          glBindBuffer (GL_UNIFORM_BUFFER, m_buffer);
+        }
+      glBufferData (GL_UNIFORM_BUFFER, (GLsizeiptr)totalSize, nullptr,
+                    GL_DYNAMIC_DRAW);
+      m_staging.resize (m_blockSize);
+    }
+
+  glBindBuffer (GL_UNIFORM_BUFFER, 0);
+}
+
+void *
+UniformRing::beginFrame ()
+{
+  if (!m_mapped)
+    return m_staging.data ();
+
+  // Wait for the GPU to release this slot (kFrameCount frames ago).
+  GLsync &fence = m_fences[m_slot];
+  if (fence)
+    {
+      GLenum result = glClientWaitSync (fence, 0, 0);
+      while (result == GL_TIMEOUT_EXPIRED)
+        result = glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                   1000000); // 1 ms
+      glDeleteSync (fence);
+      fence = nullptr;
+    }
+
+  return m_mapped + m_slot * m_slotStride;
+}
+
+void
+UniformRing::bind (unsigned int bindingPoint)
+{
+  const GLintptr offset = (GLintptr)(m_slot * m_slotStride);
+  if (!m_mapped)
+    {
+      glBindBuffer (GL_UNIFORM_BUFFER, m_buffer);
+      glBufferSubData (GL_UNIFORM_BUFFER, offset, (GLsizeiptr)m_blockSize,
+                       m_staging.data ());
+      glBindBuffer (GL_UNIFORM_BUFFER, 0);
+    }
+  glBindBufferRange (GL_UNIFORM_BUFFER, bindingPoint, m_buffer, offset,
+                     (GLsizeiptr)m_blockSize);
+}
+
+void
+UniformRing::endFrame ()
+{
+  if (m_mapped)
+    m_fences[m_slot] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_slot = (m_slot + 1) % kFrameCount;
+}
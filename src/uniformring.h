@@ -0,0 +1,54 @@
+#ifndef UNIFORMRING_H
+#define UNIFORMRING_H
+
+#include <QOpenGLExtraFunctions>
+#include <vector>
+
+class QOpenGLFunctions_4_5_Core;
+
+// Per-frame uniform data in one buffer split into kFrameCount slots.
+//
+// With GL 4.4+ the buffer is allocated with glBufferStorage and mapped
+// persistently and coherently once, so writing a frame is a plain memcpy.
+// A fence per slot keeps the CPU from overwriting data the GPU is still
+// reading; with three slots the wait only triggers when the CPU runs more
+// than two frames ahead. Older contexts fall back to glBufferSubData.
+class UniformRing : protected QOpenGLExtraFunctions
+{
+public:
+  static const int kFrameCount = 3;
+
+  UniformRing ();
+  ~UniformRing ();
+
+  void init (size_t blockSize);
+
+  // Advances to the next slot and returns its memory for writing.
+  void *beginFrame ();
+
+  // Makes the current slot visible to shaders at the given binding point.
+  void bind (unsigned int bindingPoint);
+
+  // Call after the last draw that reads the current slot.
+  void endFrame ();
+
+  bool
+  isPersistent () const
+  {
+    return m_mapped != nullptr;
+  }
+
+private:
+  QOpenGLFunctions_4_5_Core *m_gl45 = nullptr;
+
+  unsigned int m_buffer = 0;
+  size_t m_blockSize = 0;
+  size_t m_slotStride = 0; // blockSize rounded up to the offset alignment
+  int m_slot = 0;
+
+  unsigned char *m_mapped = nullptr;
+  std::vector<unsigned char> m_staging; // Fallback path only
+  GLsync m_fences[kFrameCount] = {};
+};
+
+#endif // UNIFORMRING_H
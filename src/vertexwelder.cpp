@@ -0,0 +1,287 @@
+#include "vertexwelder.h"
+#include "parallel.h"
+
+#include <QHashFunctions>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+// Larger meshes are cut into chunks of this many vertices, and their keys
+// spread over kShards shards
+constexpr size_t kChunkVertices = 1 << 16;
+constexpr size_t kShards = 64;
+
+using Cell = std::array<int64_t, 3>;
+
+struct Entry
+{
+  uint64_t key;
+  uint32_t vertex;
+
+  bool
+  operator< (const Entry &other) const
+  {
+    return key < other.key || (key == other.key && vertex < other.vertex);
+  }
+};
+
+class Matcher
+{
+public:
+  Matcher (const SubMesh &mesh, float epsilon)
+      : m_mesh (mesh), m_epsilon (epsilon)
+  {
+  }
+
+  // Cells are two tolerances wide, so everything within one tolerance of
+  // a vertex is in its cell or in the neighbor on the nearer side of each
+  // axis (`side`, -1 or +1)
+  Cell
+  cellOf (uint32_t v, Cell *side = nullptr) const
+  {
+    const glm::vec3 p = m_mesh.position (v);
+    Cell cell;
+    for (int a = 0; a < 3; a++)
+      {
+        // Clamped so that huge or non-finite positions still hash
+        const float x = p[a] / (2.0f * m_epsilon);
+        const float c = std::floor (x);
+        cell[a] = std::isfinite (c)
+                      ? (int64_t)std::clamp (c, -1.0e15f, 1.0e15f)
+                      : 0;
+        if (side)
+          (*side)[a] = x - c < 0.5f ? -1 : 1;
+      }
+    return cell;
+  }
+
+  static uint64_t
+  cellKey (const Cell &cell)
+  {
+    return qHashMulti (0, (qint64)cell[0], (qint64)cell[1],
+                       (qint64)cell[2]);
+  }
+
+  // Spatial hash with a tolerance, hash of every byte without
+  uint64_t
+  keyOf (uint32_t v) const
+  {
+    if (m_epsilon > 0.0f)
+      return cellKey (cellOf (v));
+    return qHashBits (m_mesh.vertex (v), m_mesh.layout.stride);
+  }
+
+  bool
+  matches (uint32_t a, uint32_t b) const
+  {
+    const unsigned char *va = m_mesh.vertex (a);
+    const unsigned char *vb = m_mesh.vertex (b);
+    if (m_epsilon <= 0.0f)
+      return std::memcmp (va, vb, m_mesh.layout.stride) == 0;
+
+    const VertexLayout &layout = m_mesh.layout;
+    for (const VertexAttribute *attribute :
+         { &layout.position, &layout.normal, &layout.texCoords,
+           &layout.tangent, &layout.joints, &layout.weights })
+      {
+        const glm::vec4 x = attribute->read (va);
+        const glm::vec4 y = attribute->read (vb);
+        for (int c = 0; c < attribute->components; c++)
+          if (!(std::abs (x[c] - y[c]) <= m_epsilon))
+            return false;
+      }
+    return true;
+  }
+
+private:
+  const SubMesh &m_mesh;
+  float m_epsilon;
+};
+
+// One shard's entries sorted by key, then vertex, with an open addressing
+// table from each key to its first entry
+struct Shard
+{
+  std::vector<Entry> entries;
+  std::vector<uint32_t> slots; // First entry + 1, 0 = empty
+  size_t mask = 0;
+
+  // Keys are already hashes; the low bits picked the shard
+  size_t
+  slotOf (uint64_t key) const
+  {
+    return (size_t)(key >> 6) & mask;
+  }
+
+  void
+  index ()
+  {
+    size_t size = 16;
+    while (size < entries.size () * 2)
+      size *= 2;
+    slots.assign (size, 0);
+    mask = size - 1;
+    for (size_t i = 0; i < entries.size (); i++)
+      {
+        if (i > 0 && entries[i - 1].key == entries[i].key)
+          continue;
+        size_t slot = slotOf (entries[i].key);
+        while (slots[slot])
+          slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)i + 1;
+      }
+  }
+
+  // Lowest-numbered vertex below `best` with this key that matches v
+  void
+  findMatch (uint64_t key, uint32_t v, const Matcher &matcher,
+             uint32_t &best) const
+  {
+    size_t slot = slotOf (key);
+    while (slots[slot] && entries[slots[slot] - 1].key != key)
+      slot = (slot + 1) & mask;
+    if (!slots[slot])
+      return;
+
+    for (size_t i = slots[slot] - 1; i < entries.size ()
+                                     && entries[i].key == key
+                                     && entries[i].vertex < best;
+         i++)
+      if (matcher.matches (entries[i].vertex, v))
+        {
+          best = entries[i].vertex;
+          return;
+        }
+  }
+};
+} // namespace
+
+size_t
+VertexWelder::weld (SubMesh &mesh, float epsilon)
+{
+  const size_t count = mesh.vertexCount;
+  if (count < 2 || mesh.sharedGeometry >= 0)
+    return 0;
+
+  // Morph target deltas would have to match as well; rare enough on
+  // duplicated vertices that such meshes are left alone
+  if (!mesh.targets.empty ())
+    return 0;
+
+  const Matcher matcher (mesh, std::max (epsilon, 0.0f));
+  const bool split = count > kChunkVertices;
+  const size_t chunkSize = split ? kChunkVertices : count;
+  const size_t chunks = (count + chunkSize - 1) / chunkSize;
+  const size_t shards = split ? kShards : 1;
+
+  // 1. Keys, each to its shard
+  std::vector<std::vector<Entry>> lists (chunks * shards);
+  parallelFor (chunks, [&] (size_t chunk) {
+    std::vector<Entry> *chunkLists = &lists[chunk * shards];
+    const size_t end = std::min (count, (chunk + 1) * chunkSize);
+    for (size_t v = chunk * chunkSize; v < end; v++)
+      {
+        const uint64_t key = matcher.keyOf ((uint32_t)v);
+        chunkLists[key % shards].push_back ({ key, (uint32_t)v });
+      }
+  });
+
+  // 2. Each shard sorted and indexed on its own
+  std::vector<Shard> sorted (shards);
+  parallelFor (shards, [&] (size_t s) {
+    std::vector<Entry> &entries = sorted[s].entries;
+    size_t total = 0;
+    for (size_t i = s; i < lists.size (); i += shards)
+      total += lists[i].size ();
+    entries.reserve (total);
+    for (size_t i = s; i < lists.size (); i += shards)
+      {
+        entries.insert (entries.end (), lists[i].begin (), lists[i].end ());
+        std::vector<Entry> ().swap (lists[i]);
+      }
+    std::sort (entries.begin (), entries.end ());
+    sorted[s].index ();
+  });
+
+  // 3. Lowest-numbered match per vertex, from its cell and, with a
+  // tolerance, the seven around the corner it is closest to
+  std::vector<uint32_t> target (count);
+  parallelFor (
+      count,
+      [&] (size_t i) {
+        const uint32_t v = (uint32_t)i;
+        uint32_t best = v;
+        if (epsilon > 0.0f)
+          {
+            Cell side;
+            const Cell cell = matcher.cellOf (v, &side);
+            for (int corner = 0; corner < 8; corner++)
+              {
+                Cell neighbor = cell;
+                for (int a = 0; a < 3; a++)
+                  if (corner & (1 << a))
+                    neighbor[a] += side[a];
+                const uint64_t key = Matcher::cellKey (neighbor);
+                sorted[key % shards].findMatch (key, v, matcher, best);
+              }
+          }
+        else
+          {
+            const uint64_t key = matcher.keyOf (v);
+            sorted[key % shards].findMatch (key, v, matcher, best);
+          }
+        target[v] = best;
+      },
+      kChunkVertices / 16);
+  std::vector<Shard> ().swap (sorted);
+
+  // 4. Chains collapse onto their first vertex (targets are always lower),
+  // survivors are numbered in order
+  std::vector<uint32_t> remap (count);
+  std::vector<uint32_t> survivors;
+  survivors.reserve (count);
+  for (size_t v = 0; v < count; v++)
+    {
+      if (target[v] == v)
+        {
+          remap[v] = (uint32_t)survivors.size ();
+          survivors.push_back ((uint32_t)v);
+        }
+      else
+        {
+          target[v] = target[target[v]];
+          remap[v] = remap[target[v]];
+        }
+    }
+
+  const size_t removed = count - survivors.size ();
+  if (removed == 0)
+    return 0;
+
+  // 5. Compact the vertices and rewrite the indices. Out-of-range indices
+  // stay out of range.
+  const size_t stride = mesh.layout.stride;
+  std::vector<unsigned char> vertexData (survivors.size () * stride);
+  parallelFor (
+      survivors.size (),
+      [&] (size_t i) {
+        std::memcpy (&vertexData[i * stride], mesh.vertex (survivors[i]),
+                     stride);
+      },
+      kChunkVertices);
+  parallelFor (
+      mesh.indices.size (),
+      [&] (size_t i) {
+        unsigned int &index = mesh.indices[i];
+        index = index < count ? remap[index] : index - (unsigned int)removed;
+      },
+      kChunkVertices);
+
+  mesh.vertexData = std::move (vertexData);
+  mesh.vertexCount = survivors.size ();
+  mesh.weldedVertices += removed;
+  return removed;
+}
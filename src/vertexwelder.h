@@ -0,0 +1,26 @@
+#ifndef VERTEXWELDER_H
+#define VERTEXWELDER_H
+
+#include "meshdata.h"
+
+// Loader-side vertex welding (LoaderOptions::weldVertices).
+//
+// Vertices are keyed by a spatial hash of their position, or by a hash of
+// all their bytes for exact matching, and the keys are sharded and sorted
+// on the pool. Every vertex then looks up its own cell and, with a
+// tolerance, the seven sharing its nearest corner, and is welded to the
+// lowest-numbered vertex that matches it on every attribute. Chains of
+// matches collapse onto their first vertex, the survivors are compacted in
+// their original order and the indices rewritten. Unreferenced vertices
+// are kept, and so are meshes with morph targets.
+class VertexWelder
+{
+public:
+  // epsilon 0 welds bit-identical vertices only. Otherwise every decoded
+  // attribute component must be within epsilon (model units for positions,
+  // the attribute's own units for the rest). Returns the number of
+  // vertices removed and records it in mesh.weldedVertices.
+  static size_t weld (SubMesh &mesh, float epsilon);
+};
+
+#endif // VERTEXWELDER_H
@@ -0,0 +1,156 @@
+// VertexWelder correctness check: unindexed grids (six vertices per quad)
+// welded bit-exactly and with a tolerance must come down to one vertex per
+// grid point, plus one per point on a UV seam, and every rewritten index
+// must lead to a vertex equal to the one it replaced.
+//
+//   mesh-spy-weldcheck
+//
+// Exit code: 0 = pass, 1 = mismatch.
+
+#include "vertexwelder.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+constexpr float kEpsilon = 1.0e-3f;
+
+struct GridVertex
+{
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 texCoords;
+};
+
+// n x n quads as separate triangles, indexed 0, 1, 2, ... The UVs jump by
+// one across the column x = n / 2. `jitter` offsets every component of
+// every copy by up to that much, differently per copy.
+SubMesh
+unindexedGrid (int n, float jitter)
+{
+  std::vector<GridVertex> vertices;
+  uint32_t state = 1;
+  auto noise = [&] () {
+    if (jitter == 0.0f)
+      return 0.0f; // Not -0, which would not weld bit-exactly
+    state = state * 1664525u + 1013904223u;
+    return jitter * ((state >> 8) / 16777216.0f * 2.0f - 1.0f);
+  };
+  for (int y = 0; y < n; y++)
+    for (int x = 0; x < n; x++)
+      {
+        const int corners[6][2] = { { 0, 0 }, { 0, 1 }, { 1, 0 },
+                                    { 1, 0 }, { 0, 1 }, { 1, 1 } };
+        for (const int *corner : corners)
+          {
+            const float u = (float)(x + corner[0]), v = (float)(y + corner[1]);
+            GridVertex vertex;
+            vertex.position
+                = glm::vec3 (u + noise (),
+                             std::sin (u * 0.5f) * std::cos (v * 0.5f)
+                                 + noise (),
+                             v + noise ());
+            vertex.normal = glm::vec3 (noise (), 1.0f + noise (), noise ());
+            vertex.texCoords
+                = glm::vec2 (u / n + (x >= n / 2 ? 1.0f : 0.0f) + noise (),
+                             v / n + noise ());
+            vertices.push_back (vertex);
+          }
+      }
+
+  SubMesh mesh;
+  mesh.layout.position = { 3, ComponentFloat, false,
+                           offsetof (GridVertex, position) };
+  mesh.layout.normal = { 3, ComponentFloat, false,
+                         offsetof (GridVertex, normal) };
+  mesh.layout.texCoords = { 2, ComponentFloat, false,
+                            offsetof (GridVertex, texCoords) };
+  mesh.layout.stride = sizeof (GridVertex);
+  mesh.vertexCount = vertices.size ();
+  mesh.vertexData.resize (vertices.size () * sizeof (GridVertex));
+  std::memcpy (mesh.vertexData.data (), vertices.data (),
+               mesh.vertexData.size ());
+  for (size_t i = 0; i < vertices.size (); i++)
+    mesh.indices.push_back ((unsigned int)i);
+  return mesh;
+}
+
+// Every attribute of `a` within epsilon of `b`, bit-identical at 0
+bool
+sameVertex (const SubMesh &original, size_t a, const SubMesh &welded,
+            size_t b, float epsilon)
+{
+  if (epsilon <= 0.0f)
+    return std::memcmp (original.vertex (a), welded.vertex (b),
+                        original.layout.stride)
+           == 0;
+  for (const VertexAttribute VertexLayout::*attribute :
+       { &VertexLayout::position, &VertexLayout::normal,
+         &VertexLayout::texCoords })
+    {
+      const VertexAttribute &x = original.layout.*attribute;
+      const glm::vec4 va = x.read (original.vertex (a));
+      const glm::vec4 vb = (welded.layout.*attribute).read (welded.vertex (b));
+      for (int c = 0; c < x.components; c++)
+        if (!(std::abs (va[c] - vb[c]) <= epsilon))
+          return false;
+    }
+  return true;
+}
+
+bool
+check (int n, float epsilon)
+{
+  // Copies of a grid point lie within epsilon of each other on every
+  // component, grid points a unit apart
+  const SubMesh original = unindexedGrid (n, 0.4f * epsilon);
+  SubMesh mesh = original;
+  const size_t removed = VertexWelder::weld (mesh, epsilon);
+
+  const size_t expected = (size_t)(n + 1) * (n + 1) + (n + 1);
+  bool ok = mesh.vertexCount == expected
+            && mesh.vertexData.size () == expected * mesh.layout.stride
+            && removed == original.vertexCount - expected
+            && mesh.weldedVertices == removed
+            && mesh.indices.size () == original.indices.size ();
+  if (!ok)
+    std::printf ("%zu vertices left of %zu, expected %zu\n",
+                 mesh.vertexCount, original.vertexCount, expected);
+
+  size_t wrong = 0;
+  for (size_t i = 0; ok && i < mesh.indices.size (); i++)
+    wrong += mesh.indices[i] >= mesh.vertexCount
+             || !sameVertex (original, original.indices[i], mesh,
+                             mesh.indices[i], epsilon);
+  if (wrong)
+    std::printf ("%zu of %zu indices lead to a different vertex\n", wrong,
+                 mesh.indices.size ());
+
+  char what[64];
+  std::snprintf (what, sizeof (what), "%dx%d grid, %s", n, n,
+                 epsilon > 0.0f ? "epsilon" : "exact");
+  ok = ok && !wrong;
+  std::printf ("%-28s %s\n", what, ok ? "PASS" : "FAIL");
+  return ok;
+}
+
+} // namespace
+
+int
+main ()
+{
+  // Small grids take the single-shard path, large ones (over 64K
+  // vertices) are chunked and sharded across the pool
+  bool ok = true;
+  for (int n : { 8, 120 })
+    for (float epsilon : { 0.0f, kEpsilon })
+      ok = check (n, epsilon) && ok;
+
+  std::printf ("\n%s\n", ok ? "All checks passed." : "Weld mismatch.");
+  return ok ? 0 : 1;
+}